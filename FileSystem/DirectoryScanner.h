@@ -27,6 +27,24 @@
 #define kDirectoryScannerResultKey_ErrorPaths				@"errorPaths" //NSArray of NSString
 #define kDirectoryScannerResultKey_ExcludedPaths			@"excludedPaths" //NSArray of NSString
 
+#define kDirectoryScannerStatisticsKey_WallTimes			@"wallTimes" //NSDictionary of NSNumber (seconds) keyed by phase
+#define kDirectoryScannerStatisticsKey_CPUTimes				@"cpuTimes" //NSDictionary of NSNumber (seconds) keyed by phase
+#define kDirectoryScannerStatisticsKey_SystemCalls			@"systemCalls" //NSDictionary of NSNumber keyed by function name
+#define kDirectoryScannerStatisticsKey_Directories			@"directories" //NSNumber
+#define kDirectoryScannerStatisticsKey_Entries				@"entries" //NSNumber
+#define kDirectoryScannerStatisticsKey_DirectoriesPerSecond	@"directoriesPerSecond" //NSNumber
+#define kDirectoryScannerStatisticsKey_EntriesPerSecond		@"entriesPerSecond" //NSNumber
+#define kDirectoryScannerStatisticsKey_MetadataBytes		@"metadataBytes" //NSNumber (ACLs and extended attributes)
+#define kDirectoryScannerStatisticsKey_SlowestDirectories	@"slowestDirectories" //NSArray of NSDictionary with "path" and "time" keys (slowest first - time excludes subdirectories)
+
+#define kDirectoryScannerPhase_Total						@"total"
+#define kDirectoryScannerPhase_ReadDirectory				@"readdir"
+#define kDirectoryScannerPhase_Stat							@"lstat"
+#define kDirectoryScannerPhase_Metadata						@"metadata"
+#define kDirectoryScannerPhase_Predicate					@"predicate"
+#define kDirectoryScannerPhase_Compare						@"compare" //Includes "sort"
+#define kDirectoryScannerPhase_Sort							@"sort"
+
 enum {
 	kDirectoryScannerOption_BumpRevision					= (1 << 0), //Only applies to -scanAndCompareRootDirectory:
 	kDirectoryScannerOption_DetectMovedItems				= (1 << 1), //Only applies to -scanAndCompareRootDirectory:
@@ -103,6 +121,9 @@ Metadata is owner & group, permissions, user settable flags, ACLs and extended a
 	NSMutableDictionary*			_info;
 	char*							_xattrBuffer;
 	id<DirectoryScannerDelegate>	_delegate;
+	BOOL							_collectStatistics;
+	void*							_statistics;
+	NSDictionary*					_lastStatistics;
 }
 + (NSPredicate*) exclusionPredicateWithPaths:(NSArray*)paths names:(NSArray*)names;
 + (DirectoryItem*) directoryItemAtPath:(NSString*)path includeMetadata:(BOOL)includeMetadata;
@@ -121,6 +142,9 @@ Metadata is owner & group, permissions, user settable flags, ACLs and extended a
 @property(nonatomic) BOOL excludeDSStoreFiles; //Finder's ".DS_Store" files - NO by default
 @property(nonatomic, copy) NSPredicate* exclusionPredicate; //Substitution variables are $NAME, $PATH, $TYPE (0=directory, 1=file, 2=symlink), $FILE_SIZE, $DATE_CREATED and $DATE_MODIFIED - nil by default
 
+@property(nonatomic) BOOL collectStatistics; //NO by default
+@property(nonatomic, readonly) NSDictionary* lastStatistics; //Statistics from the last scan or compare - nil if "collectStatistics" is NO
+
 - (NSDictionary*) scanRootDirectory; //Reset revision to 1
 - (NSDictionary*) scanAndCompareRootDirectory:(DirectoryScannerOptions)options; //Return changes from current revision
 
@@ -20,6 +20,9 @@
 #import <sys/stat.h>
 #import <sys/attr.h>
 #import <sys/xattr.h>
+#import <mach/mach.h>
+#import <mach/mach_time.h>
+#import <pthread.h>
 
 #import "DirectoryScanner.h"
 #import "NSData+GZip.h"
@@ -34,6 +37,8 @@
 
 #define kExtendedAttributesBufferSize		(128 * (XATTR_MAXNAMELEN + 1))
 
+#define kStatisticsSlowestDirectories		10
+
 enum {
 	kArray_Added = 0,
 	kArray_Removed,
@@ -78,8 +83,59 @@ typedef struct {
 } DirectoryItemData32;
 #pragma pack(pop)
 
+enum {
+	kPhase_Total = 0,
+	kPhase_ReadDirectory,
+	kPhase_Stat,
+	kPhase_Metadata,
+	kPhase_Predicate,
+	kPhase_Compare,
+	kPhase_Sort,
+	kPhaseCount
+};
+
+enum {
+	kCall_OpenDir = 0,
+	kCall_ReadDir,
+	kCall_LStat,
+	kCall_GetAttrList,
+	kCall_GetXAttr,
+	kCall_ListXAttr,
+	kCall_ACLGetFile,
+	kCall_Access,
+	kCall_ReadLink,
+	kCallCount
+};
+
+typedef struct {
+	uint64_t				wallTime; //Mach absolute time units
+	uint64_t				cpuTime; //Nanoseconds
+} StatisticsTimer;
+
+typedef struct {
+	char*					path;
+	uint64_t				wallTime; //Mach absolute time units
+} StatisticsDirectory;
+
+typedef struct {
+	uint64_t				wallTimes[kPhaseCount]; //Mach absolute time units
+	uint64_t				cpuTimes[kPhaseCount]; //Nanoseconds
+	uint64_t				calls[kCallCount];
+	uint64_t				directories;
+	uint64_t				entries;
+	uint64_t				metadataBytes;
+	uint64_t				childrenWallTime; //Accumulated by subdirectories while scanning their parent
+	StatisticsDirectory		slowestDirectories[kStatisticsSlowestDirectories]; //Sorted slowest first
+} ScannerStatistics;
+
 #define IS_DIRECTORY(__DATA__) S_ISDIR((__DATA__)->mode)
 
+#define STATISTICS_COUNT_CALL(__STATISTICS__, __CALL__) \
+{ \
+	if(__STATISTICS__) \
+	(__STATISTICS__)->calls[(__CALL__)] += 1; \
+}
+
 #define ADD_PATH_TO_ARRAY(__ARRAY__, __PATH__) \
 { \
 	CFStringRef string = CFStringCreateWithCString(kCFAllocatorDefault, (__PATH__), kCFStringEncodingUTF8); \
@@ -97,8 +153,116 @@ typedef struct {
 @property(nonatomic, readonly, nonatomic) CFMutableDictionaryRef _directories;
 - (NSInteger) _scanSubdirectory:(const char*)subPath fromRootDirectory:(const char*)rootDirectory directories:(CFMutableDictionaryRef)directories excludedPaths:(NSMutableArray*)excludedPaths errorPaths:(NSMutableArray*)errorPaths;
 - (NSDictionary*) _scanRootDirectory:(BOOL)compare bumpRevision:(BOOL)bumpRevision detectMovedItems:(BOOL)detectMovedItems reportAllRemovedItems:(BOOL)reportAllRemovedItems;
+- (void) _beginStatistics;
+- (void) _endStatistics;
 @end
 
+static NSString* const _PhaseNames[kPhaseCount] = {kDirectoryScannerPhase_Total, kDirectoryScannerPhase_ReadDirectory, kDirectoryScannerPhase_Stat, kDirectoryScannerPhase_Metadata, kDirectoryScannerPhase_Predicate, kDirectoryScannerPhase_Compare, kDirectoryScannerPhase_Sort};
+static NSString* const _CallNames[kCallCount] = {@"opendir", @"readdir", @"lstat", @"getattrlist", @"getxattr", @"listxattr", @"acl_get_file", @"access", @"readlink"};
+
+static uint64_t _GetThreadCPUTime()
+{
+	mach_msg_type_number_t		count = THREAD_BASIC_INFO_COUNT;
+	thread_basic_info_data_t	info;
+	
+	if(thread_info(pthread_mach_thread_np(pthread_self()), THREAD_BASIC_INFO, (thread_info_t)&info, &count) != KERN_SUCCESS)
+	return 0;
+	
+	return ((uint64_t)info.user_time.seconds + (uint64_t)info.system_time.seconds) * 1000000000ULL + ((uint64_t)info.user_time.microseconds + (uint64_t)info.system_time.microseconds) * 1000ULL;
+}
+
+static double _MachTimeToSeconds(uint64_t time)
+{
+	static double				scale = 0.0;
+	mach_timebase_info_data_t	info;
+	
+	if(scale == 0.0) {
+		mach_timebase_info(&info);
+		scale = (double)info.numer / (double)info.denom / 1000000000.0;
+	}
+	
+	return (double)time * scale;
+}
+
+static inline void _StartTimer(StatisticsTimer* timer)
+{
+	timer->wallTime = mach_absolute_time();
+	timer->cpuTime = _GetThreadCPUTime();
+}
+
+static inline uint64_t _StopTimer(StatisticsTimer* timer, ScannerStatistics* statistics, NSUInteger phase)
+{
+	uint64_t					wallTime = mach_absolute_time() - timer->wallTime;
+	
+	statistics->wallTimes[phase] += wallTime;
+	statistics->cpuTimes[phase] += _GetThreadCPUTime() - timer->cpuTime;
+	
+	return wallTime;
+}
+
+static void _RecordDirectoryTime(ScannerStatistics* statistics, const char* path, uint64_t wallTime)
+{
+	NSInteger					i;
+	
+	if(wallTime <= statistics->slowestDirectories[kStatisticsSlowestDirectories - 1].wallTime)
+	return;
+	
+	if(statistics->slowestDirectories[kStatisticsSlowestDirectories - 1].path)
+	free(statistics->slowestDirectories[kStatisticsSlowestDirectories - 1].path);
+	for(i = kStatisticsSlowestDirectories - 1; (i > 0) && (wallTime > statistics->slowestDirectories[i - 1].wallTime); --i)
+	statistics->slowestDirectories[i] = statistics->slowestDirectories[i - 1];
+	statistics->slowestDirectories[i].path = strdup(path);
+	statistics->slowestDirectories[i].wallTime = wallTime;
+}
+
+static NSDictionary* _CreateStatisticsDictionary(ScannerStatistics* statistics)
+{
+	NSMutableDictionary*		dictionary = [NSMutableDictionary new];
+	NSMutableDictionary*		wallTimes = [NSMutableDictionary new];
+	NSMutableDictionary*		cpuTimes = [NSMutableDictionary new];
+	NSMutableDictionary*		calls = [NSMutableDictionary new];
+	NSMutableArray*				directories = [NSMutableArray new];
+	double						totalTime = _MachTimeToSeconds(statistics->wallTimes[kPhase_Total]);
+	NSUInteger					i;
+	
+	for(i = 0; i < kPhaseCount; ++i) {
+		[wallTimes setObject:[NSNumber numberWithDouble:_MachTimeToSeconds(statistics->wallTimes[i])] forKey:_PhaseNames[i]];
+		[cpuTimes setObject:[NSNumber numberWithDouble:((double)statistics->cpuTimes[i] / 1000000000.0)] forKey:_PhaseNames[i]];
+	}
+	for(i = 0; i < kCallCount; ++i)
+	[calls setObject:[NSNumber numberWithUnsignedLongLong:statistics->calls[i]] forKey:_CallNames[i]];
+	for(i = 0; (i < kStatisticsSlowestDirectories) && statistics->slowestDirectories[i].path; ++i)
+	[directories addObject:[NSDictionary dictionaryWithObjectsAndKeys:[NSString stringWithUTF8String:statistics->slowestDirectories[i].path], @"path", [NSNumber numberWithDouble:_MachTimeToSeconds(statistics->slowestDirectories[i].wallTime)], @"time", nil]];
+	
+	[dictionary setObject:wallTimes forKey:kDirectoryScannerStatisticsKey_WallTimes];
+	[dictionary setObject:cpuTimes forKey:kDirectoryScannerStatisticsKey_CPUTimes];
+	[dictionary setObject:calls forKey:kDirectoryScannerStatisticsKey_SystemCalls];
+	[dictionary setObject:[NSNumber numberWithUnsignedLongLong:statistics->directories] forKey:kDirectoryScannerStatisticsKey_Directories];
+	[dictionary setObject:[NSNumber numberWithUnsignedLongLong:statistics->entries] forKey:kDirectoryScannerStatisticsKey_Entries];
+	[dictionary setObject:[NSNumber numberWithDouble:(totalTime > 0.0 ? (double)statistics->directories / totalTime : 0.0)] forKey:kDirectoryScannerStatisticsKey_DirectoriesPerSecond];
+	[dictionary setObject:[NSNumber numberWithDouble:(totalTime > 0.0 ? (double)statistics->entries / totalTime : 0.0)] forKey:kDirectoryScannerStatisticsKey_EntriesPerSecond];
+	[dictionary setObject:[NSNumber numberWithUnsignedLongLong:statistics->metadataBytes] forKey:kDirectoryScannerStatisticsKey_MetadataBytes];
+	[dictionary setObject:directories forKey:kDirectoryScannerStatisticsKey_SlowestDirectories];
+	
+	[directories release];
+	[calls release];
+	[cpuTimes release];
+	[wallTimes release];
+	
+	return dictionary;
+}
+
+static void _FreeStatistics(ScannerStatistics* statistics)
+{
+	NSUInteger					i;
+	
+	for(i = 0; i < kStatisticsSlowestDirectories; ++i) {
+		if(statistics->slowestDirectories[i].path)
+		free(statistics->slowestDirectories[i].path);
+	}
+	free(statistics);
+}
+
 static void _DirectoryItemDataReleaseCallback(CFAllocatorRef allocator, const void* value)
 {
 	DirectoryItemData*		data = (DirectoryItemData*)value;
@@ -171,7 +335,7 @@ static CFHashCode _UTF8StringHashCallBack(const void* value)
 static const CFDictionaryKeyCallBacks _UTF8KeyCallbacks = {0, _UTF8StringRetainCallBack, _FreeReleaseCallBack, _UTF8StringCopyDescriptionCallBack, _UTF8StringCaseSensitiveEqualCallBack, _UTF8StringHashCallBack};
 static const CFDictionaryValueCallBacks	_XATTRValueCallbacks = {0, NULL, _FreeReleaseCallBack, NULL, _XATTREqualCallBack};
 
-static DirectoryItemData* _CreateDirectoryItemData(const char* fullPath, const struct stat* stats, BOOL includeMetadata, NSUInteger revision, char* xattrBuffer)
+static DirectoryItemData* _CreateDirectoryItemData(const char* fullPath, const struct stat* stats, BOOL includeMetadata, NSUInteger revision, char* xattrBuffer, ScannerStatistics* statistics)
 {
 	DirectoryItemData*			data = malloc(sizeof(DirectoryItemData));
 	char						buffer[sizeof(uint32_t) + sizeof(struct timespec)];
@@ -195,6 +359,7 @@ static DirectoryItemData* _CreateDirectoryItemData(const char* fullPath, const s
 	bzero(&list, sizeof(struct attrlist));
 	list.bitmapcount = ATTR_BIT_MAP_COUNT;
 	list.commonattr = ATTR_CMN_CRTIME;
+	STATISTICS_COUNT_CALL(statistics, kCall_GetAttrList);
 	if(getattrlist(fullPath, &list, buffer, sizeof(buffer), FSOPT_NOFOLLOW) == 0)
 	time = (const struct timespec*)&buffer[sizeof(uint32_t)];
 	else {
@@ -204,6 +369,7 @@ static DirectoryItemData* _CreateDirectoryItemData(const char* fullPath, const s
 	data->newDate = (double)time->tv_sec + (double)time->tv_nsec / 1000000000.0;
 	
 	if(S_ISREG(stats->st_mode)) {
+		STATISTICS_COUNT_CALL(statistics, kCall_GetXAttr);
 		resourceSize = getxattr(fullPath, XATTR_RESOURCEFORK_NAME, NULL, 0, 0, XATTR_NOFOLLOW);
 		if(resourceSize >= 0)
 		data->resourceSize = resourceSize;
@@ -221,10 +387,13 @@ static DirectoryItemData* _CreateDirectoryItemData(const char* fullPath, const s
 		data->gid = stats->st_gid;
 		data->flags = stats->st_flags & UF_SETTABLE;
 		
+		STATISTICS_COUNT_CALL(statistics, kCall_ACLGetFile);
 		if((acls = acl_get_file(fullPath, ACL_TYPE_EXTENDED))) {
 			aclString = acl_to_text(acls, NULL);
 			if(aclString) {
 				data->aclString = _CopyCString(aclString);
+				if(statistics)
+				statistics->metadataBytes += strlen(aclString);
 				acl_free(aclString);
 			}
 			else {
@@ -245,19 +414,25 @@ static DirectoryItemData* _CreateDirectoryItemData(const char* fullPath, const s
 		}
 		
 		if(data) {
+			STATISTICS_COUNT_CALL(statistics, kCall_ListXAttr);
 			xattrLength = listxattr(fullPath, xattrBuffer, kExtendedAttributesBufferSize, XATTR_NOFOLLOW);
 			if(xattrLength > 0) {
 				data->extendedAttributes = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &_UTF8KeyCallbacks, &_XATTRValueCallbacks);
 				xattrOffset = 0;
 				while(xattrOffset < xattrLength) {
 					if((strcmp(&xattrBuffer[xattrOffset], XATTR_RESOURCEFORK_NAME) != 0) && (strncmp(&xattrBuffer[xattrOffset], "_kTimeMachine", 13) != 0)) { //HACK: Ignore resource fork and Time Machine attributes
+						STATISTICS_COUNT_CALL(statistics, kCall_GetXAttr);
 						xattrSize = getxattr(fullPath, &xattrBuffer[xattrOffset], NULL, 0, 0, XATTR_NOFOLLOW);
 						if(xattrSize >= 0) {
 							xattrValue = malloc(sizeof(unsigned int) + xattrSize);
 							*((unsigned int*)xattrValue) = xattrSize;
+							STATISTICS_COUNT_CALL(statistics, kCall_GetXAttr);
 							xattrSize = getxattr(fullPath, &xattrBuffer[xattrOffset], (char*)xattrValue + sizeof(unsigned int), xattrSize, 0, XATTR_NOFOLLOW);
-							if(xattrSize == *((unsigned int*)xattrValue))
-							CFDictionarySetValue(data->extendedAttributes, &xattrBuffer[xattrOffset], xattrValue);
+							if(xattrSize == *((unsigned int*)xattrValue)) {
+								CFDictionarySetValue(data->extendedAttributes, &xattrBuffer[xattrOffset], xattrValue);
+								if(statistics)
+								statistics->metadataBytes += xattrSize;
+							}
 							else
 							free(xattrValue);
 						}
@@ -437,7 +612,7 @@ static void _DictionaryApplierFunction_ConvertExtendedAttributes(const void* key
 
 @implementation DirectoryScanner
 
-@synthesize rootDirectory=_rootDirectory, scanningMetadata=_scanMetadata, sortPaths=_sortPaths, reportExcludedHiddenItems=_reportHidden, excludeHiddenItems=_excludeHidden, excludeDSStoreFiles=_excludeDSStore, exclusionPredicate=_exclusionPredicate, revision=_revision, _directories=_directories, delegate=_delegate;
+@synthesize rootDirectory=_rootDirectory, scanningMetadata=_scanMetadata, sortPaths=_sortPaths, reportExcludedHiddenItems=_reportHidden, excludeHiddenItems=_excludeHidden, excludeDSStoreFiles=_excludeDSStore, exclusionPredicate=_exclusionPredicate, revision=_revision, _directories=_directories, delegate=_delegate, collectStatistics=_collectStatistics, lastStatistics=_lastStatistics;
 
 + (NSPredicate*) exclusionPredicateWithPaths:(NSArray*)paths names:(NSArray*)names
 {
@@ -493,7 +668,7 @@ static void _DictionaryApplierFunction_ConvertExtendedAttributes(const void* key
 	}
 	
 	buffer = malloc(kExtendedAttributesBufferSize);
-	data = _CreateDirectoryItemData(fullPath, &stats, includeMetadata, 0, buffer);
+	data = _CreateDirectoryItemData(fullPath, &stats, includeMetadata, 0, buffer, NULL);
 	free(buffer);
 	if(data == NULL)
 	return nil;
@@ -533,6 +708,8 @@ static void _DictionaryApplierFunction_ConvertExtendedAttributes(const void* key
 	CFRelease(_directories);
 	if(_root)
 	_DirectoryItemDataReleaseCallback(NULL, _root);
+	if(_statistics)
+	_FreeStatistics(_statistics);
 }
 
 - (void) finalize
@@ -546,6 +723,7 @@ static void _DictionaryApplierFunction_ConvertExtendedAttributes(const void* key
 {
 	[self _cleanUp_DirectoryScanner];
 	
+	[_lastStatistics release];
 	[_exclusionPredicate release];
 	[_info release];
 	[_rootDirectory release];
@@ -625,10 +803,23 @@ static void _DictionaryApplierFunction_DescriptionTrunk(const void* key, const v
 	CFTypeRef					value;
 	int							type;
 	CFNumberRef					typeNumbers[3];
+	ScannerStatistics*			statistics = _statistics;
+	StatisticsTimer				directoryTimer,
+								timer;
+	uint64_t					childrenWallTime = 0,
+								wallTime;
+	int							error;
+	BOOL						excluded;
 	
 	if(_delegate && [_delegate shouldAbortScanning:self])
 	return -1;
 	
+	if(statistics) {
+		childrenWallTime = statistics->childrenWallTime;
+		statistics->childrenWallTime = 0;
+		directoryTimer.wallTime = mach_absolute_time();
+	}
+	
 	rootLength = strlen(rootDirectory);
 	if(subPath[0] != 0) {
 		fullLength = rootLength + strlen(subPath) + 1;
@@ -643,8 +834,11 @@ static void _DictionaryApplierFunction_DescriptionTrunk(const void* key, const v
 		bcopy(rootDirectory, fullPath, rootLength + 1);
 	}
 	
+	STATISTICS_COUNT_CALL(statistics, kCall_OpenDir);
 	if((dir = opendir(fullPath))) {
 		fullPath[fullLength++] = '/';
+		if(statistics)
+		statistics->directories += 1;
 		
 		if(_exclusionPredicate) {
 			variables = [NSMutableDictionary new];
@@ -658,7 +852,15 @@ static void _DictionaryApplierFunction_DescriptionTrunk(const void* key, const v
 		
 		dictionary = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &_UTF8KeyCallbacks, &itemValueCallbacks);
 		while(1) {
-			if(readdir_r(dir, &storage, &dirent) != 0) {
+			if(statistics) {
+				statistics->calls[kCall_ReadDir] += 1;
+				_StartTimer(&timer);
+				error = readdir_r(dir, &storage, &dirent);
+				_StopTimer(&timer, statistics, kPhase_ReadDirectory);
+			}
+			else
+			error = readdir_r(dir, &storage, &dirent);
+			if(error != 0) {
 				CFRelease(dictionary);
 				dictionary = NULL;
 				break;
@@ -699,7 +901,16 @@ static void _DictionaryApplierFunction_DescriptionTrunk(const void* key, const v
 				}
 			}
 			
-			if(lstat(fullPath, &stats) == 0) {
+			if(statistics) {
+				statistics->entries += 1;
+				statistics->calls[kCall_LStat] += 1;
+				_StartTimer(&timer);
+				error = lstat(fullPath, &stats);
+				_StopTimer(&timer, statistics, kPhase_Stat);
+			}
+			else
+			error = lstat(fullPath, &stats);
+			if(error == 0) {
 				if(!S_ISDIR(stats.st_mode) && !S_ISREG(stats.st_mode) && !S_ISLNK(stats.st_mode)) {
 					ADD_PATH_TO_ARRAY(errorPaths, &fullPath[rootLength + 1]);
 					continue;
@@ -731,7 +942,12 @@ static void _DictionaryApplierFunction_DescriptionTrunk(const void* key, const v
 					value = CFDateCreate(kCFAllocatorDefault, (double)stats.st_mtimespec.tv_sec + (double)stats.st_mtimespec.tv_nsec / 1000000000.0 - kCFAbsoluteTimeIntervalSince1970);
 					[variables setObject:(id)value forKey:@"DATE_CREATED"];
 					CFRelease(value);
-					if([_exclusionPredicate evaluateWithObject:nil substitutionVariables:variables]) {
+					if(statistics)
+					_StartTimer(&timer);
+					excluded = [_exclusionPredicate evaluateWithObject:nil substitutionVariables:variables];
+					if(statistics)
+					_StopTimer(&timer, statistics, kPhase_Predicate);
+					if(excluded) {
 						ADD_PATH_TO_ARRAY(excludedPaths, &fullPath[rootLength + 1]);
 						continue;
 					}
@@ -748,6 +964,7 @@ static void _DictionaryApplierFunction_DescriptionTrunk(const void* key, const v
 					continue;
 				}
 				else if(_scanMetadata) {
+					STATISTICS_COUNT_CALL(statistics, (S_ISLNK(stats.st_mode) ? kCall_ReadLink : kCall_Access));
 					if(!S_ISLNK(stats.st_mode) && (access(fullPath, R_OK) != 0)) {
 						ADD_PATH_TO_ARRAY(errorPaths, &fullPath[rootLength + 1]);
 						continue;
@@ -758,7 +975,13 @@ static void _DictionaryApplierFunction_DescriptionTrunk(const void* key, const v
 					}
 				}
 				
-				data = _CreateDirectoryItemData(fullPath, &stats, _scanMetadata, _revision, _xattrBuffer);
+				if(statistics) {
+					_StartTimer(&timer);
+					data = _CreateDirectoryItemData(fullPath, &stats, _scanMetadata, _revision, _xattrBuffer, statistics);
+					_StopTimer(&timer, statistics, kPhase_Metadata);
+				}
+				else
+				data = _CreateDirectoryItemData(fullPath, &stats, _scanMetadata, _revision, _xattrBuffer, NULL);
 				if(data)
 				CFDictionarySetValue(dictionary, dirent->d_name, data);
 				else
@@ -786,11 +1009,30 @@ static void _DictionaryApplierFunction_DescriptionTrunk(const void* key, const v
 	if(result == 0)
 	ADD_PATH_TO_ARRAY(errorPaths, subPath);
 	
+	if(statistics) {
+		wallTime = mach_absolute_time() - directoryTimer.wallTime;
+		_RecordDirectoryTime(statistics, (subPath[0] ? subPath : "."), wallTime - statistics->childrenWallTime);
+		statistics->childrenWallTime = childrenWallTime + wallTime;
+	}
+	
 	free(fullPath);
 	
 	return result;
 }
 
+static void _SortArray(NSMutableArray* array, NSInteger (*function)(id, id, void*), ScannerStatistics* statistics)
+{
+	StatisticsTimer					timer;
+	
+	if(statistics) {
+		_StartTimer(&timer);
+		[array sortUsingFunction:function context:NULL];
+		_StopTimer(&timer, statistics, kPhase_Sort);
+	}
+	else
+	[array sortUsingFunction:function context:NULL];
+}
+
 static void _DictionaryApplierFunction_Subprune(const void* key, const void* value, void* context)
 {
 	void**							params = (void**)context;
@@ -980,7 +1222,7 @@ static void _DictionaryApplierFunction_Compare(const void* key, const void* valu
 	free(buffer);
 }
 
-static NSMutableDictionary* _CompareDirectories(CFDictionaryRef newDirectories, CFDictionaryRef oldDirectories, BOOL compareMetadata, BOOL detectMovedItems, BOOL reportAllRemovedItems, NSUInteger revision, BOOL sortPaths)
+static NSMutableDictionary* _CompareDirectories(CFDictionaryRef newDirectories, CFDictionaryRef oldDirectories, BOOL compareMetadata, BOOL detectMovedItems, BOOL reportAllRemovedItems, NSUInteger revision, BOOL sortPaths, ScannerStatistics* statistics)
 {
 	CFSetCallBacks					callbacks = {0, NULL, NULL, NULL, _UTF8StringCaseSensitiveEqualCallBack, _UTF8StringHashCallBack};
 	NSMutableDictionary*			dictionary = [NSMutableDictionary dictionary];
@@ -994,6 +1236,10 @@ static NSMutableDictionary* _CompareDirectories(CFDictionaryRef newDirectories,
 									addedCount,
 									addedIndex;
 	CFMutableSetRef					set;
+	StatisticsTimer					timer;
+	
+	if(statistics)
+	_StartTimer(&timer);
 	
 	for(i = 0; i < kArrayCount; ++i)
 	arrays[i] = [NSMutableArray array];
@@ -1048,32 +1294,35 @@ static NSMutableDictionary* _CompareDirectories(CFDictionaryRef newDirectories,
 		
 		if([arrays[kArray_Moved] count]) {
 			if(sortPaths)
-			[arrays[kArray_Moved] sortUsingFunction:_SortFunction_DirectoryItem context:NULL];
+			_SortArray(arrays[kArray_Moved], _SortFunction_DirectoryItem, statistics);
 			[dictionary setObject:arrays[kArray_Moved] forKey:kDirectoryScannerResultKey_MovedItems];
 		}
 	}
 	
 	if([arrays[kArray_Added] count]) {
 		if(sortPaths)
-		[arrays[kArray_Added] sortUsingFunction:_SortFunction_DirectoryItem context:NULL];
+		_SortArray(arrays[kArray_Added], _SortFunction_DirectoryItem, statistics);
 		[dictionary setObject:arrays[kArray_Added] forKey:kDirectoryScannerResultKey_AddedItems];
 	}
 	if([arrays[kArray_Removed] count]) {
 		if(sortPaths)
-		[arrays[kArray_Removed] sortUsingFunction:_SortFunction_DirectoryItem context:NULL];
+		_SortArray(arrays[kArray_Removed], _SortFunction_DirectoryItem, statistics);
 		[dictionary setObject:arrays[kArray_Removed] forKey:kDirectoryScannerResultKey_RemovedItems];
 	}
 	if([arrays[kArray_ModifiedData] count]) {
 		if(sortPaths)
-		[arrays[kArray_ModifiedData] sortUsingFunction:_SortFunction_DirectoryItem context:NULL];
+		_SortArray(arrays[kArray_ModifiedData], _SortFunction_DirectoryItem, statistics);
 		[dictionary setObject:arrays[kArray_ModifiedData] forKey:kDirectoryScannerResultKey_ModifiedItems_Data];
 	}
 	if([arrays[kArray_ModifiedMetadata] count]) {
 		if(sortPaths)
-		[arrays[kArray_ModifiedMetadata] sortUsingFunction:_SortFunction_DirectoryItem context:NULL];
+		_SortArray(arrays[kArray_ModifiedMetadata], _SortFunction_DirectoryItem, statistics);
 		[dictionary setObject:arrays[kArray_ModifiedMetadata] forKey:kDirectoryScannerResultKey_ModifiedItems_Metadata];
 	}
 	
+	if(statistics)
+	_StopTimer(&timer, statistics, kPhase_Compare);
+	
 	return dictionary;
 }
 
@@ -1088,26 +1337,33 @@ static NSMutableDictionary* _CompareDirectories(CFDictionaryRef newDirectories,
 	DirectoryItemData*				newRoot;
 	DirectoryItem*					info;
 	
+	[self _beginStatistics];
+	
 	dirPath = [[[_rootDirectory stringByStandardizingPath] stringByResolvingSymlinksInPath] UTF8String];
-	if((lstat(dirPath, &stats) != 0) || !S_ISDIR(stats.st_mode))
-	return nil;
+	if((lstat(dirPath, &stats) != 0) || !S_ISDIR(stats.st_mode)) {
+		[self _endStatistics];
+		return nil;
+	}
 	
 	if(!compare)
 	_revision = 1;
-	else if(!_revision)
-	return nil;
+	else if(!_revision) {
+		[self _endStatistics];
+		return nil;
+	}
 	
-	newRoot = _CreateDirectoryItemData(dirPath, &stats, _scanMetadata, _revision, _xattrBuffer);
+	newRoot = _CreateDirectoryItemData(dirPath, &stats, _scanMetadata, _revision, _xattrBuffer, _statistics);
 	newDirectories = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &_UTF8KeyCallbacks, &kCFTypeDictionaryValueCallBacks);
 	if([self _scanSubdirectory:"" fromRootDirectory:dirPath directories:newDirectories excludedPaths:excludedPaths errorPaths:errorPaths] <= 0) {
 		CFRelease(newDirectories);
 		if(newRoot)
 		_DirectoryItemDataReleaseCallback(NULL, newRoot);
+		[self _endStatistics];
 		return nil;
 	}
 	
 	if(compare) {
-		dictionary = _CompareDirectories(newDirectories, _directories, _scanMetadata, detectMovedItems, reportAllRemovedItems, (bumpRevision ? _revision + 1 : _revision), _sortPaths);
+		dictionary = _CompareDirectories(newDirectories, _directories, _scanMetadata, detectMovedItems, reportAllRemovedItems, (bumpRevision ? _revision + 1 : _revision), _sortPaths, _statistics);
 		if(_scanMetadata && _root && _ItemMetadataHasChanged(_root, newRoot)) {
 			info = [[DirectoryItem alloc] initWithPath:"" data:_root];
 			if([dictionary objectForKey:kDirectoryScannerResultKey_ModifiedItems_Metadata])
@@ -1130,18 +1386,45 @@ static NSMutableDictionary* _CompareDirectories(CFDictionaryRef newDirectories,
 	
 	if([excludedPaths count]) {
 		if(_sortPaths)
-		[excludedPaths sortUsingFunction:_SortFunction_Paths context:NULL];
+		_SortArray(excludedPaths, _SortFunction_Paths, _statistics);
 		[dictionary setObject:excludedPaths forKey:kDirectoryScannerResultKey_ExcludedPaths];
 	}
 	if([errorPaths count]) {
 		if(_sortPaths)
-		[errorPaths sortUsingFunction:_SortFunction_Paths context:NULL];
+		_SortArray(errorPaths, _SortFunction_Paths, _statistics);
 		[dictionary setObject:errorPaths forKey:kDirectoryScannerResultKey_ErrorPaths];
 	}
 	
+	[self _endStatistics];
+	
 	return dictionary;
 }
 
+- (void) _beginStatistics
+{
+	[_lastStatistics release];
+	_lastStatistics = nil;
+	
+	if(_collectStatistics) {
+		_statistics = calloc(1, sizeof(ScannerStatistics));
+		((ScannerStatistics*)_statistics)->wallTimes[kPhase_Total] = mach_absolute_time();
+		((ScannerStatistics*)_statistics)->cpuTimes[kPhase_Total] = _GetThreadCPUTime();
+	}
+}
+
+- (void) _endStatistics
+{
+	ScannerStatistics*				statistics = _statistics;
+	
+	if(statistics) {
+		statistics->wallTimes[kPhase_Total] = mach_absolute_time() - statistics->wallTimes[kPhase_Total];
+		statistics->cpuTimes[kPhase_Total] = _GetThreadCPUTime() - statistics->cpuTimes[kPhase_Total];
+		_lastStatistics = _CreateStatisticsDictionary(statistics);
+		_FreeStatistics(statistics);
+		_statistics = NULL;
+	}
+}
+
 - (NSDictionary*) scanRootDirectory
 {
 	return [self _scanRootDirectory:NO bumpRevision:NO detectMovedItems:NO reportAllRemovedItems:NO];
@@ -1154,7 +1437,13 @@ static NSMutableDictionary* _CompareDirectories(CFDictionaryRef newDirectories,
 
 - (NSDictionary*) compare:(DirectoryScanner*)scanner options:(DirectoryScannerOptions)options
 {
-	return _CompareDirectories(_directories, [scanner _directories], _scanMetadata && [scanner isScanningMetadata], NO, !(options & kDirectoryScannerOption_OnlyReportTopLevelRemovedItems), 0, _sortPaths);
+	NSDictionary*					dictionary;
+	
+	[self _beginStatistics];
+	dictionary = _CompareDirectories(_directories, [scanner _directories], _scanMetadata && [scanner isScanningMetadata], NO, !(options & kDirectoryScannerOption_OnlyReportTopLevelRemovedItems), 0, _sortPaths, _statistics);
+	[self _endStatistics];
+	
+	return dictionary;
 }
 
 static void _DictionaryApplierFunction_DirectoryContents(const void* key, const void* value, void* context)
@@ -1321,7 +1610,7 @@ static void _DictionaryApplierFunction_DirectorySize(const void* key, const void
 		if(CFDictionaryContainsKey(entry, name)) {
 			fullPath = [[_rootDirectory stringByAppendingPathComponent:path] UTF8String];
 			if(lstat(fullPath, &stats) == 0) {
-				data = _CreateDirectoryItemData(fullPath, &stats, _scanMetadata, _revision, _xattrBuffer);
+				data = _CreateDirectoryItemData(fullPath, &stats, _scanMetadata, _revision, _xattrBuffer, NULL);
 				if(data) {
 					CFDictionarySetValue(entry, name, data);
 					success = YES;
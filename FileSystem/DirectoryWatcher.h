@@ -17,6 +17,13 @@
 */
 
 #import <Foundation/Foundation.h>
+#if defined(__linux__)
+#import <stdint.h>
+
+typedef uint64_t FSEventStreamEventId; //Microseconds since 1970 on Linux
+
+#define kFSEventStreamEventIdSinceNow 0xFFFFFFFFFFFFFFFFULL
+#endif
 
 @class DirectoryWatcher;
 
@@ -28,6 +35,7 @@
 - (void) directoryWatcherDidCompleteHistory:(DirectoryWatcher*)watcher;
 - (void) directoryWatcherWillStart:(DirectoryWatcher*)watcher;
 - (void) directoryWatcherDidStop:(DirectoryWatcher*)watcher;
+- (void) directoryWatcher:(DirectoryWatcher*)watcher didUpdatePaths:(NSDictionary*)paths eventID:(FSEventStreamEventId)eventID; //Only called if "coalescingInterval" is not 0.0 - Keys are paths and values are NSNumber booleans for recursive updates
 @end
 
 @interface DirectoryWatcher : NSObject
@@ -35,14 +43,41 @@
 @private
 	NSString*						_rootDirectory;
 	id<DirectoryWatcherDelegate>	_delegate;
+#if defined(__linux__)
+	int								_notifyFD;
+	int								_mountFD;
+	BOOL							_fanotify,
+									_fanotifyFailed;
+	NSFileHandle*					_fileHandle;
+	NSString*						_resolvedDirectory;
+	NSMutableDictionary*			_watchPaths;
+	NSData*							_rootHandle;
+	NSMutableDictionary*			_handlePaths;
+	FSEventStreamEventId			_sinceEventID,
+									_lastEventID;
+#else
 	FSEventStreamRef				_eventStream;
-	BOOL							_running;
+#endif
+	BOOL							_running,
+									_watchFilesystem;
+	NSTimeInterval					_coalescingInterval;
+	NSMutableDictionary*			_pendingPaths;
+	FSEventStreamEventId			_pendingEventID;
+	NSTimer*						_coalescingTimer;
 }
+/*
+On Linux, recursive inotify watches are used unless "watchesEntireFilesystem" is set and the process is allowed to use fanotify (CAP_SYS_ADMIN)
+Since there is no event history, resuming from a previous event ID reports the root directory as recursively updated, followed by -directoryWatcherDidCompleteHistory:
+Event queue overflows are reported as recursive updates of the root directory and "latency" is ignored
+*/
 - (id) initWithRootDirectory:(NSString*)rootDirectory latency:(NSTimeInterval)latency lastEventID:(FSEventStreamEventId)eventID;
 
 @property(nonatomic, readonly) NSString* rootDirectory;
 @property(nonatomic, assign) id<DirectoryWatcherDelegate> delegate;
 @property(nonatomic, readonly, getter=isWatching) BOOL watching;
+@property(nonatomic, readonly) FSEventStreamEventId lastEventID; //Can be passed to -initWithRootDirectory:latency:lastEventID: to resume watching
+@property(nonatomic) BOOL watchesEntireFilesystem; //Linux only - Uses a single fanotify mark on the filesystem containing the root directory instead of one inotify watch per directory, which only pays off for trees too large for inotify as every change on that filesystem is then resolved and filtered (falls back to inotify if events cannot be resolved) - Must be set before -startWatching - NO by default
+@property(nonatomic) NSTimeInterval coalescingInterval; //Updates are accumulated for that long after the first one, then delivered as a single batch without duplicates or descendants of recursively updated paths - 0.0 (disabled) by default
 
 - (void) startWatching;
 - (void) stopWatching;
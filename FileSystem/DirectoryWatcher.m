@@ -16,8 +16,50 @@
 	along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#if defined(__linux__)
+#ifndef _GNU_SOURCE
+#error _GNU_SOURCE must be defined by the prefix header or the build flags
+#endif
+#import <dirent.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import <sys/stat.h>
+#import <sys/time.h>
+#import <sys/inotify.h>
+#import <sys/fanotify.h>
+#endif
+
 #import "DirectoryWatcher.h"
 
+@interface DirectoryWatcher (Coalescing)
+- (void) _didUpdate:(NSString*)path recursively:(BOOL)recursively eventID:(FSEventStreamEventId)eventID;
+- (void) _flushPendingPaths;
+@end
+
+#if defined(__linux__)
+
+#define kEventBufferSize			(64 * 1024)
+#define kInotifyMask				(IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+#ifdef FAN_REPORT_DFID_NAME
+#define kFanotifyMask				(FAN_CREATE | FAN_DELETE | FAN_MODIFY | FAN_ATTRIB | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_DELETE_SELF | FAN_MOVE_SELF | FAN_ONDIR)
+#endif
+
+@interface DirectoryWatcher ()
+- (BOOL) _startInotify;
+- (void) _readEvents;
+@end
+
+static FSEventStreamEventId _GetCurrentEventID()
+{
+	struct timeval			time;
+	
+	gettimeofday(&time, NULL);
+	
+	return (FSEventStreamEventId)time.tv_sec * 1000000ULL + (FSEventStreamEventId)time.tv_usec;
+}
+
+#else
+
 static void _FSEventCallback(ConstFSEventStreamRef streamRef, void* clientCallBackInfo, size_t numEvents, void* eventPaths, const FSEventStreamEventFlags eventFlags[], const FSEventStreamEventId eventIds[])
 {
 	NSAutoreleasePool*		pool = [NSAutoreleasePool new];
@@ -30,15 +72,18 @@ static void _FSEventCallback(ConstFSEventStreamRef streamRef, void* clientCallBa
 		continue;
 		
 		path = CFArrayGetValueAtIndex((CFArrayRef)eventPaths, i);
-		if(eventFlags[i] & kFSEventStreamEventFlagRootChanged)
-		[[watcher delegate] directoryWatcherRootDidChange:watcher];
+		if(eventFlags[i] & kFSEventStreamEventFlagRootChanged) {
+			[watcher _flushPendingPaths];
+			[[watcher delegate] directoryWatcherRootDidChange:watcher];
+		}
 		else {
 			if(eventFlags[i] & kFSEventStreamEventFlagMustScanSubDirs)
-			[[watcher delegate] directoryWatcher:watcher didUpdate:(NSString*)path recursively:YES eventID:eventIds[i]];
+			[watcher _didUpdate:(NSString*)path recursively:YES eventID:eventIds[i]];
 			else
-			[[watcher delegate] directoryWatcher:watcher didUpdate:(NSString*)path recursively:NO eventID:eventIds[i]];
+			[watcher _didUpdate:(NSString*)path recursively:NO eventID:eventIds[i]];
 			
 			if(eventFlags[i] & kFSEventStreamEventFlagHistoryDone) {
+				[watcher _flushPendingPaths];
 				if([[watcher delegate] respondsToSelector:@selector(directoryWatcherDidCompleteHistory:)])
 				[[watcher delegate] directoryWatcherDidCompleteHistory:watcher];
 			}
@@ -48,9 +93,518 @@ static void _FSEventCallback(ConstFSEventStreamRef streamRef, void* clientCallBa
 	[pool drain];
 }
 
+#endif
+
 @implementation DirectoryWatcher
 
-@synthesize rootDirectory=_rootDirectory, watching=_running, delegate=_delegate;
+@synthesize rootDirectory=_rootDirectory, watching=_running, delegate=_delegate, watchesEntireFilesystem=_watchFilesystem, coalescingInterval=_coalescingInterval;
+
+- (void) _flushPendingPaths
+{
+	NSDictionary*			paths = _pendingPaths;
+	NSString*				path;
+	
+	[_coalescingTimer invalidate];
+	[_coalescingTimer release];
+	_coalescingTimer = nil;
+	
+	if(paths) {
+		_pendingPaths = nil;
+		if([_delegate respondsToSelector:@selector(directoryWatcher:didUpdatePaths:eventID:)])
+		[_delegate directoryWatcher:self didUpdatePaths:paths eventID:_pendingEventID];
+		else {
+			for(path in paths)
+			[_delegate directoryWatcher:self didUpdate:path recursively:[[paths objectForKey:path] boolValue] eventID:_pendingEventID];
+		}
+		[paths release];
+	}
+}
+
+- (void) _coalescingTimer:(NSTimer*)timer
+{
+	[self _flushPendingPaths];
+}
+
+- (void) _didUpdate:(NSString*)path recursively:(BOOL)recursively eventID:(FSEventStreamEventId)eventID
+{
+	NSString*				ancestor;
+	NSString*				parent;
+	NSString*				prefix;
+	NSString*				key;
+	
+	if(_coalescingInterval <= 0.0) {
+		[_delegate directoryWatcher:self didUpdate:path recursively:recursively eventID:eventID];
+		return;
+	}
+	
+	if([path hasSuffix:@"/"] && ([path length] > 1))
+	path = [path substringToIndex:([path length] - 1)];
+	_pendingEventID = MAX(_pendingEventID, eventID);
+	if(_pendingPaths == nil) {
+		_pendingPaths = [NSMutableDictionary new];
+		_coalescingTimer = [[NSTimer alloc] initWithFireDate:[NSDate dateWithTimeIntervalSinceNow:_coalescingInterval] interval:0.0 target:self selector:@selector(_coalescingTimer:) userInfo:nil repeats:NO];
+		[[NSRunLoop currentRunLoop] addTimer:_coalescingTimer forMode:NSRunLoopCommonModes];
+	}
+	
+	if([[_pendingPaths objectForKey:path] boolValue])
+	return;
+	for(ancestor = path, parent = [path stringByDeletingLastPathComponent]; [parent length] && ![parent isEqualToString:ancestor]; ancestor = parent, parent = [parent stringByDeletingLastPathComponent]) {
+		if([[_pendingPaths objectForKey:parent] boolValue])
+		return;
+	}
+	
+	if(recursively) {
+		prefix = ([path isEqualToString:@"/"] ? path : [path stringByAppendingString:@"/"]);
+		for(key in [_pendingPaths allKeys]) {
+			if([key hasPrefix:prefix])
+			[_pendingPaths removeObjectForKey:key];
+		}
+	}
+	[_pendingPaths setObject:[NSNumber numberWithBool:recursively] forKey:path];
+}
+
+#if defined(__linux__)
+
+- (id) initWithRootDirectory:(NSString*)rootDirectory latency:(NSTimeInterval)latency lastEventID:(FSEventStreamEventId)eventID
+{
+	if(rootDirectory == nil) {
+		[self release];
+		return nil;
+	}
+	
+	if((self = [super init])) {
+		_rootDirectory = [[rootDirectory stringByStandardizingPath] copy];
+		_resolvedDirectory = [[_rootDirectory stringByResolvingSymlinksInPath] copy];
+		_notifyFD = -1;
+		_mountFD = -1;
+		_sinceEventID = eventID;
+		_lastEventID = (eventID != kFSEventStreamEventIdSinceNow ? eventID : 0);
+	}
+	
+	return self;
+}
+
+- (void) _cleanUp_DirectoryWatcher
+{
+	[self stopWatching];
+}
+
+- (void) finalize
+{
+	[self _cleanUp_DirectoryWatcher];
+	
+	[super finalize];
+}
+
+- (void) dealloc
+{
+	[self _cleanUp_DirectoryWatcher];
+	
+	[_resolvedDirectory release];
+	[_rootDirectory release];
+	
+	[super dealloc];
+}
+
+- (FSEventStreamEventId) lastEventID
+{
+	return _lastEventID;
+}
+
+- (void) _notifyPath:(NSString*)path recursively:(BOOL)recursively
+{
+	_lastEventID = MAX(_GetCurrentEventID(), _lastEventID + 1);
+	[self _didUpdate:path recursively:recursively eventID:_lastEventID];
+}
+
+- (void) _notifyHistory
+{
+	if(_running) {
+		[self _notifyPath:_rootDirectory recursively:YES];
+		[self _flushPendingPaths];
+		if([_delegate respondsToSelector:@selector(directoryWatcherDidCompleteHistory:)])
+		[_delegate directoryWatcherDidCompleteHistory:self];
+	}
+}
+
+- (void) _addWatchesForDirectory:(NSString*)path
+{
+	NSAutoreleasePool*		localPool = [NSAutoreleasePool new];
+	const char*				fullPath = [path fileSystemRepresentation];
+	struct dirent*			dirent;
+	struct stat				stats;
+	NSString*				subPath;
+	DIR*					dir;
+	int						wd;
+	
+	wd = inotify_add_watch(_notifyFD, fullPath, kInotifyMask);
+	if(wd >= 0) {
+		[_watchPaths setObject:path forKey:[NSNumber numberWithInt:wd]];
+		
+		if((dir = opendir(fullPath))) {
+			while((dirent = readdir(dir))) {
+				if((dirent->d_name[0] == '.') && ((dirent->d_name[1] == 0) || ((dirent->d_name[1] == '.') && (dirent->d_name[2] == 0))))
+				continue;
+				subPath = [path stringByAppendingPathComponent:[[NSFileManager defaultManager] stringWithFileSystemRepresentation:dirent->d_name length:strlen(dirent->d_name)]];
+				if(dirent->d_type == DT_UNKNOWN) {
+					if((lstat([subPath fileSystemRepresentation], &stats) != 0) || !S_ISDIR(stats.st_mode))
+					continue;
+				}
+				else if(dirent->d_type != DT_DIR)
+				continue;
+				[self _addWatchesForDirectory:subPath];
+			}
+			closedir(dir);
+		}
+	}
+	else if(errno != ENOENT) {
+		NSLog(@"%s: inotify_add_watch() on \"%s\" failed with error \"%s\"", __FUNCTION__, fullPath, strerror(errno));
+		if(_running)
+		[self _notifyPath:path recursively:YES];
+	}
+	
+	[localPool drain];
+}
+
+- (void) _removeWatchesForDirectory:(NSString*)path
+{
+	NSString*				prefix = [path stringByAppendingString:@"/"];
+	NSNumber*				key;
+	NSString*				string;
+	
+	for(key in [_watchPaths allKeys]) {
+		string = [_watchPaths objectForKey:key];
+		if([string isEqualToString:path] || [string hasPrefix:prefix]) {
+			inotify_rm_watch(_notifyFD, [key intValue]);
+			[_watchPaths removeObjectForKey:key];
+		}
+	}
+}
+
+- (void) _processInotifyEvent:(const struct inotify_event*)event
+{
+	NSString*				path;
+	NSString*				subPath;
+	
+	if(event->mask & IN_Q_OVERFLOW) {
+		[self _notifyPath:_rootDirectory recursively:YES];
+		return;
+	}
+	
+	path = [_watchPaths objectForKey:[NSNumber numberWithInt:event->wd]];
+	if(path == nil)
+	return;
+	
+	if(event->mask & IN_IGNORED) {
+		[_watchPaths removeObjectForKey:[NSNumber numberWithInt:event->wd]];
+		return;
+	}
+	
+	if(event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+		if([path isEqualToString:_rootDirectory]) {
+			[self _flushPendingPaths];
+			[_delegate directoryWatcherRootDidChange:self];
+		}
+		return;
+	}
+	
+	if(event->len && (event->mask & IN_ISDIR)) {
+		subPath = [path stringByAppendingPathComponent:[[NSFileManager defaultManager] stringWithFileSystemRepresentation:event->name length:strlen(event->name)]];
+		if(event->mask & (IN_CREATE | IN_MOVED_TO)) {
+			[self _addWatchesForDirectory:subPath];
+			[self _notifyPath:subPath recursively:YES]; //NOTE: The directory may have been populated before its watch was added
+		}
+		else if(event->mask & IN_MOVED_FROM)
+		[self _removeWatchesForDirectory:subPath];
+	}
+	
+	[self _notifyPath:path recursively:NO];
+}
+
+#ifdef FAN_REPORT_DFID_NAME
+
+static NSData* _CreateFileHandleData(const struct file_handle* handle)
+{
+	return [[NSData alloc] initWithBytes:handle length:(sizeof(struct file_handle) + handle->handle_bytes)];
+}
+
+- (NSString*) _pathForFileHandle:(struct file_handle*)handle
+{
+	NSData*					data = _CreateFileHandleData(handle);
+	NSString*				path;
+	char					buffer[PATH_MAX];
+	char					procPath[64];
+	ssize_t					length;
+	int						fd;
+	
+	path = [[[_handlePaths objectForKey:data] retain] autorelease];
+	if(path == nil) {
+		fd = open_by_handle_at(_mountFD, handle, O_PATH);
+		if(fd >= 0) {
+			snprintf(procPath, sizeof(procPath), "/proc/self/fd/%i", fd);
+			length = readlink(procPath, buffer, sizeof(buffer));
+			if(length > 0) {
+				path = [[NSFileManager defaultManager] stringWithFileSystemRepresentation:buffer length:length];
+				[_handlePaths setObject:path forKey:data];
+			}
+			close(fd);
+		}
+		else if(errno != ESTALE) { //NOTE: Stale handles are for directories deleted since the event
+			NSLog(@"%s: open_by_handle_at() failed with error \"%s\"", __FUNCTION__, strerror(errno));
+			_fanotifyFailed = YES;
+		}
+	}
+	[data release];
+	
+	return path;
+}
+
+- (void) _processFanotifyEvent:(const struct fanotify_event_metadata*)metadata
+{
+	struct fanotify_event_info_fid*	info = (struct fanotify_event_info_fid*)(metadata + 1);
+	struct file_handle*				handle = (struct file_handle*)info->handle;
+	const char*						name = NULL;
+	NSString*						path;
+	NSString*						subPath;
+	NSData*							data;
+	
+	if(metadata->mask & FAN_Q_OVERFLOW) {
+		[self _notifyPath:_rootDirectory recursively:YES];
+		return;
+	}
+	if(metadata->event_len <= metadata->metadata_len)
+	return;
+	if(info->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME)
+	name = (const char*)handle->f_handle + handle->handle_bytes;
+	
+	if(metadata->mask & (FAN_DELETE_SELF | FAN_MOVE_SELF)) {
+		data = _CreateFileHandleData(handle);
+		if([data isEqualToData:_rootHandle]) {
+			[self _flushPendingPaths];
+			[_delegate directoryWatcherRootDidChange:self];
+		}
+		[data release];
+		[_handlePaths removeAllObjects];
+		return;
+	}
+	
+	path = [self _pathForFileHandle:handle];
+	if(path == nil)
+	return;
+	if([path isEqualToString:_resolvedDirectory])
+	path = _rootDirectory;
+	else if([path hasPrefix:_resolvedDirectory] && ([path characterAtIndex:[_resolvedDirectory length]] == '/'))
+	path = [_rootDirectory stringByAppendingString:[path substringFromIndex:[_resolvedDirectory length]]];
+	else
+	return;
+	
+	if(name && (metadata->mask & FAN_ONDIR)) {
+		if(metadata->mask & (FAN_MOVED_FROM | FAN_DELETE))
+		[_handlePaths removeAllObjects];
+		if(metadata->mask & FAN_MOVED_TO) {
+			subPath = [path stringByAppendingPathComponent:[[NSFileManager defaultManager] stringWithFileSystemRepresentation:name length:strlen(name)]];
+			[self _notifyPath:subPath recursively:YES];
+		}
+	}
+	
+	[self _notifyPath:path recursively:NO];
+}
+
+- (BOOL) _startFanotify
+{
+	char					buffer[sizeof(struct file_handle) + MAX_HANDLE_SZ];
+	struct file_handle*		handle = (struct file_handle*)buffer;
+	int						mountID;
+	
+	_notifyFD = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_CLOEXEC | FAN_NONBLOCK, O_RDONLY);
+	if(_notifyFD < 0)
+	return NO;
+	
+	handle->handle_bytes = MAX_HANDLE_SZ;
+	if(name_to_handle_at(AT_FDCWD, [_resolvedDirectory fileSystemRepresentation], handle, &mountID, 0) != 0) {
+		NSLog(@"%s: name_to_handle_at() on \"%@\" failed with error \"%s\"", __FUNCTION__, _resolvedDirectory, strerror(errno));
+		close(_notifyFD);
+		_notifyFD = -1;
+		return NO;
+	}
+	_mountFD = open([_resolvedDirectory fileSystemRepresentation], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if((_mountFD < 0) || (fanotify_mark(_notifyFD, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, kFanotifyMask, AT_FDCWD, [_resolvedDirectory fileSystemRepresentation]) != 0)) {
+		if(errno != EPERM)
+		NSLog(@"%s: fanotify_mark() on \"%@\" failed with error \"%s\"", __FUNCTION__, _resolvedDirectory, strerror(errno));
+		if(_mountFD >= 0)
+		close(_mountFD);
+		_mountFD = -1;
+		close(_notifyFD);
+		_notifyFD = -1;
+		return NO;
+	}
+	
+	_rootHandle = _CreateFileHandleData(handle);
+	_handlePaths = [NSMutableDictionary new];
+	_fanotify = YES;
+	_fanotifyFailed = NO;
+	
+	return YES;
+}
+
+/* Events that cannot be resolved to paths would be lost, so switch to inotify and report the whole tree as updated */
+- (void) _fallBackToInotify
+{
+	BOOL					running = (_fileHandle != nil);
+	
+	if(running) {
+		[[NSNotificationCenter defaultCenter] removeObserver:self name:NSFileHandleDataAvailableNotification object:_fileHandle];
+		[_fileHandle release];
+		_fileHandle = nil;
+		
+		close(_notifyFD);
+		_notifyFD = -1;
+		close(_mountFD);
+		_mountFD = -1;
+		[_handlePaths release];
+		_handlePaths = nil;
+		[_rootHandle release];
+		_rootHandle = nil;
+		
+		if([self _startInotify]) {
+			_fileHandle = [[NSFileHandle alloc] initWithFileDescriptor:_notifyFD closeOnDealloc:NO];
+			[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(_dataAvailable:) name:NSFileHandleDataAvailableNotification object:_fileHandle];
+		}
+		else
+		NSLog(@"%s: Failed falling back to inotify for \"%@\"", __FUNCTION__, _rootDirectory);
+	}
+	_fanotifyFailed = NO;
+	
+	[self _notifyPath:_rootDirectory recursively:YES];
+}
+
+#endif
+
+- (BOOL) _startInotify
+{
+	_notifyFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(_notifyFD < 0) {
+		NSLog(@"%s: inotify_init1() failed with error \"%s\"", __FUNCTION__, strerror(errno));
+		return NO;
+	}
+	
+	_watchPaths = [NSMutableDictionary new];
+	[self _addWatchesForDirectory:_rootDirectory];
+	if(![_watchPaths count]) {
+		[_watchPaths release];
+		_watchPaths = nil;
+		close(_notifyFD);
+		_notifyFD = -1;
+		return NO;
+	}
+	_fanotify = NO;
+	
+	return YES;
+}
+
+- (void) _readEvents
+{
+	NSAutoreleasePool*		localPool = [NSAutoreleasePool new];
+	char					buffer[kEventBufferSize] __attribute__((aligned(8)));
+	const struct inotify_event*	event;
+#ifdef FAN_REPORT_DFID_NAME
+	const struct fanotify_event_metadata*	metadata;
+#endif
+	ssize_t					length,
+							offset;
+	
+	while((_notifyFD >= 0) && ((length = read(_notifyFD, buffer, sizeof(buffer))) > 0)) {
+#ifdef FAN_REPORT_DFID_NAME
+		if(_fanotify) {
+			for(metadata = (const struct fanotify_event_metadata*)buffer; FAN_EVENT_OK(metadata, length); metadata = FAN_EVENT_NEXT(metadata, length)) {
+				if((metadata->vers == FANOTIFY_METADATA_VERSION) && !_fanotifyFailed)
+				[self _processFanotifyEvent:metadata];
+				if(metadata->fd >= 0)
+				close(metadata->fd);
+			}
+			if(_fanotifyFailed)
+			[self _fallBackToInotify];
+			continue;
+		}
+#endif
+		for(offset = 0; offset < length; offset += sizeof(struct inotify_event) + event->len) {
+			event = (const struct inotify_event*)&buffer[offset];
+			[self _processInotifyEvent:event];
+		}
+	}
+	if((_notifyFD >= 0) && (length < 0) && (errno != EAGAIN))
+	NSLog(@"%s: read() failed with error \"%s\"", __FUNCTION__, strerror(errno));
+	
+	if(_fileHandle)
+	[_fileHandle waitForDataInBackgroundAndNotifyForModes:[NSArray arrayWithObject:NSRunLoopCommonModes]];
+	
+	[localPool drain];
+}
+
+- (void) _dataAvailable:(NSNotification*)notification
+{
+	[self _readEvents];
+}
+
+- (void) startWatching
+{
+	BOOL					success = NO;
+	
+	if(!_running) {
+		if([_delegate respondsToSelector:@selector(directoryWatcherWillStart:)])
+		[_delegate directoryWatcherWillStart:self];
+	
+#ifdef FAN_REPORT_DFID_NAME
+		if(_watchFilesystem)
+		success = [self _startFanotify];
+#endif
+		if(!success)
+		success = [self _startInotify];
+		if(success) {
+			_fileHandle = [[NSFileHandle alloc] initWithFileDescriptor:_notifyFD closeOnDealloc:NO];
+			[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(_dataAvailable:) name:NSFileHandleDataAvailableNotification object:_fileHandle];
+			[_fileHandle waitForDataInBackgroundAndNotifyForModes:[NSArray arrayWithObject:NSRunLoopCommonModes]];
+			_running = YES;
+			
+			if((_sinceEventID != 0) && (_sinceEventID != kFSEventStreamEventIdSinceNow))
+			[self performSelector:@selector(_notifyHistory) withObject:nil afterDelay:0.0];
+			_sinceEventID = kFSEventStreamEventIdSinceNow;
+		}
+	}
+}
+
+- (void) stopWatching
+{
+	NSFileHandle*			fileHandle = _fileHandle;
+	
+	if(_running) {
+		[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(_notifyHistory) object:nil];
+		[[NSNotificationCenter defaultCenter] removeObserver:self name:NSFileHandleDataAvailableNotification object:_fileHandle];
+		_fileHandle = nil;
+		[self _readEvents];
+		[self _flushPendingPaths];
+		[fileHandle release];
+		
+		close(_notifyFD);
+		_notifyFD = -1;
+		if(_mountFD >= 0) {
+			close(_mountFD);
+			_mountFD = -1;
+		}
+		[_watchPaths release];
+		_watchPaths = nil;
+		[_handlePaths release];
+		_handlePaths = nil;
+		[_rootHandle release];
+		_rootHandle = nil;
+		
+		_running = NO;
+		if([_delegate respondsToSelector:@selector(directoryWatcherDidStop:)])
+		[_delegate directoryWatcherDidStop:self];
+	}
+}
+
+#else
 
 - (id) initWithRootDirectory:(NSString*)rootDirectory latency:(NSTimeInterval)latency lastEventID:(FSEventStreamEventId)eventID
 {
@@ -102,6 +656,11 @@ static void _FSEventCallback(ConstFSEventStreamRef streamRef, void* clientCallBa
 	[super dealloc];
 }
 
+- (FSEventStreamEventId) lastEventID
+{
+	return FSEventStreamGetLatestEventId(_eventStream);
+}
+
 - (void) startWatching
 {
 	if(!_running) {
@@ -118,6 +677,7 @@ static void _FSEventCallback(ConstFSEventStreamRef streamRef, void* clientCallBa
 	if(_running) {
 		FSEventStreamFlushSync(_eventStream);
 		FSEventStreamStop(_eventStream);
+		[self _flushPendingPaths];
 		
 		_running = NO;
 		if([_delegate respondsToSelector:@selector(directoryWatcherDidStop:)])
@@ -125,4 +685,6 @@ static void _FSEventCallback(ConstFSEventStreamRef streamRef, void* clientCallBa
 	}
 }
 
+#endif
+
 @end
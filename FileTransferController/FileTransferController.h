@@ -25,11 +25,63 @@
 #define kFileTransferHost_iDisk					@"idisk.mac.com"
 #define kFileTransferHost_AmazonS3				@"s3.amazonaws.com"
 
+#define kHTTPHostLimiterStatisticsKey_Requests			@"requests"
+#define kHTTPHostLimiterStatisticsKey_Waits				@"waits" //Requests that had to wait for another request to the same host to complete
+#define kHTTPHostLimiterStatisticsKey_Timeouts			@"timeouts" //Requests that failed because no request to the same host completed in time
+#define kHTTPHostLimiterStatisticsKey_Failures			@"failures" //Requests that ended with an error (later requests to that host do not attempt a persistent connection until one started after the failure succeeds)
+
+#define kSFTPConnectionPoolStatisticsKey_Idle			@"idle" //Connections currently in the pool
+#define kSFTPConnectionPoolStatisticsKey_Leases			@"leases" //Connections reused by a controller
+#define kSFTPConnectionPoolStatisticsKey_Returns		@"returns" //Connections returned to the pool
+#define kSFTPConnectionPoolStatisticsKey_Expirations	@"expirations" //Connections closed after being idle for too long
+
+#define kFileTransferBandwidthStatisticsKey_Bytes			@"bytes" //NSNumber
+#define kFileTransferBandwidthStatisticsKey_Rate			@"rate" //NSNumber (bytes per second since the previous statistics request for the same direction and class)
+#define kFileTransferBandwidthStatisticsKey_ThrottledTime	@"throttledTime" //NSNumber (seconds spent waiting by all transfers)
+#define kFileTransferBandwidthStatisticsKey_Transfers		@"transfers" //NSNumber (transfers in progress)
+
+#define kFileTransferDigestKey_MD5					@"MD5" //NSData (16 bytes)
+#define kFileTransferDigestKey_SHA256				@"SHA-256" //NSData (32 bytes)
+#define kFileTransferDigestKey_XXH64				@"XXH64" //NSData (8 bytes big-endian)
+
+#define kFileTransferPipelineStatisticsKey_Stage			@"stage" //NSString ("read", "compress", "encrypt" or "send")
+#define kFileTransferPipelineStatisticsKey_BusyTime		@"busyTime" //NSNumber (seconds spent processing)
+#define kFileTransferPipelineStatisticsKey_StarvedTime	@"starvedTime" //NSNumber (seconds spent waiting for the previous stage)
+#define kFileTransferPipelineStatisticsKey_BlockedTime	@"blockedTime" //NSNumber (seconds spent waiting for the next stage)
+#define kFileTransferPipelineStatisticsKey_Occupancy		@"occupancy" //NSNumber (average fill level of the stage output buffers in [0,1] range)
+
 #define kAmazonS3BucketLocation_Europe			@"EU"
 #define kAmazonS3ActivationInfo_UserToken		@"userToken"
 #define kAmazonS3ActivationInfo_AccessKeyID		@"accessKeyID"
 #define kAmazonS3ActivationInfo_SecretAccessKey	@"secretAccessKey"
 
+enum {
+	kFileTransferBandwidthClass_Default = 0,
+	kFileTransferBandwidthClass_Interactive,
+	kFileTransferBandwidthClass_Background
+};
+typedef NSUInteger FileTransferBandwidthClass;
+
+enum {
+	kFileTransferEncryptionFormat_CBC = 0,
+	kFileTransferEncryptionFormat_Chunked
+};
+typedef NSUInteger FileTransferEncryptionFormat;
+
+enum {
+	kFileTransferCompressionFormat_None = 0,
+	kFileTransferCompressionFormat_GZip,
+	kFileTransferCompressionFormat_Fast //Also gzip data but compressed at the fastest level
+};
+typedef NSUInteger FileTransferCompressionFormat;
+
+enum {
+	kFileTransferDigestAlgorithm_MD5 = (1 << 0),
+	kFileTransferDigestAlgorithm_SHA256 = (1 << 1),
+	kFileTransferDigestAlgorithm_XXH64 = (1 << 2)
+};
+typedef NSUInteger FileTransferDigestAlgorithms;
+
 @class FileTransferController;
 
 @protocol FileTransferController
@@ -70,25 +122,56 @@
 	NSUInteger							_totalSize;
 #if !TARGET_OS_IPHONE
 	void*								_digestContext;
-	unsigned char						_digestBuffer[16];
+	FileTransferDigestAlgorithms		_digestAlgorithms;
+	NSDictionary*						_transferDigests;
 	NSString*							_encryptionPassword;
 	void*								_encryptionContext;
 	void*								_encryptionBufferBytes;
 	NSUInteger							_encryptionBufferSize;
+	FileTransferEncryptionFormat		_encryptionFormat;
+	void*								_chunkedEncryption;
+	FileTransferCompressionFormat		_compressionFormat;
+	void*								_compressionContext;
+	NSUInteger							_plainLength;
+	BOOL								_pipelinedUploads;
+	void*								_uploadPipeline;
+	NSArray*							_pipelineStatistics;
 #endif
 	NSTimeInterval						_timeOut;
 	NSUInteger							_maxUploadSpeed,
 										_maxDownloadSpeed;
 	BOOL								_fileTransfer;
 	double								_maxSpeed;
+	volatile int64_t					_speedBucketTime;
+	FileTransferBandwidthClass			_bandwidthClass,
+										_activeBandwidthClass;
+	void*								_bandwidthBuckets;
+	NSString*							_checkpointDirectory;
+	NSString*							_checkpointPath;
+	NSMutableDictionary*				_checkpoint;
+	unsigned long long					_resumeOffset,
+										_checkpointOffset,
+										_checkpointSavedOffset;
+	NSString*							_resumeValidator;
 }
 + (FileTransferController*) fileTransferControllerWithURL:(NSURL*)url;
 + (BOOL) hasAtomicUploads; //Means that a file that failed mid-upload won't appear on the server (e.g. WebDAV)
++ (BOOL) hasResumableDownloads; //Means that -downloadFileFromPath:toPath: can continue a failed download (see "checkpointDirectory")
++ (BOOL) hasResumableUploads; //Means that -uploadFileFromPath:toPath: can continue a failed upload (see "checkpointDirectory")
+#if !TARGET_OS_IPHONE
++ (unsigned long long) encryptedLengthForLength:(unsigned long long)length encryptionFormat:(FileTransferEncryptionFormat)format;
+#endif
 
 + (NSUInteger) globalMaximumDownloadSpeed;
 + (void) setGlobalMaximumDownloadSpeed:(NSUInteger)speed;
 + (NSUInteger) globalMaximumUploadSpeed;
 + (void) setGlobalMaximumUploadSpeed:(NSUInteger)speed;
++ (NSTimeInterval) globalBandwidthBurstInterval;
++ (void) setGlobalBandwidthBurstInterval:(NSTimeInterval)interval; //Amount of traffic at the global maximum speeds that can go through at once after an idle period - 0.25 seconds by default
++ (NSUInteger) weightForBandwidthClass:(FileTransferBandwidthClass)bandwidthClass;
++ (void) setWeight:(NSUInteger)weight forBandwidthClass:(FileTransferBandwidthClass)bandwidthClass; //16 for interactive, 4 for default and 1 for background by default
++ (NSDictionary*) downloadBandwidthStatisticsForClass:(FileTransferBandwidthClass)bandwidthClass; //Returns kFileTransferBandwidthStatisticsKey_XXX keys
++ (NSDictionary*) uploadBandwidthStatisticsForClass:(FileTransferBandwidthClass)bandwidthClass; //Returns kFileTransferBandwidthStatisticsKey_XXX keys
 
 - (id) initWithHost:(NSString*)host port:(UInt16)port username:(NSString*)username password:(NSString*)password basePath:(NSString*)basePath; //Pass nil or 0 when not needed
 - (id) initWithBaseURL:(NSURL*)url;
@@ -100,18 +183,27 @@
 @property(nonatomic, readonly) float transferProgress; //In [0,1] range or NAN if not defined
 
 @property(nonatomic, readonly) NSUInteger lastTransferSize;
+@property(nonatomic, readonly) unsigned long long lastTransferResumeOffset; //Bytes skipped because the last transfer continued a previous one (0 if it started from scratch)
 #if !TARGET_OS_IPHONE
 @property(nonatomic, readonly) NSData* lastTransferDigestData; //MD5 bytes
+@property(nonatomic, readonly) NSDictionary* lastTransferDigests; //Digest for each algorithm in "digestAlgorithms" keyed by kFileTransferDigestKey_XXX
+@property(nonatomic, readonly) NSArray* lastUploadPipelineStatistics; //One NSDictionary with kFileTransferPipelineStatisticsKey_XXX keys per stage in order or nil if the last upload was not pipelined
 #endif
 
 #if !TARGET_OS_IPHONE
-@property(nonatomic) BOOL digestComputation; //Enables on-the-fly MD5 digest computation for file uploads / downloads
+@property(nonatomic) BOOL digestComputation; //Enables on-the-fly digest computation for file uploads / downloads
+@property(nonatomic) FileTransferDigestAlgorithms digestAlgorithms; //Computed in a single pass on separate threads fed with copies of the transfer buffers - kFileTransferDigestAlgorithm_MD5 by default
 @property(nonatomic, copy) NSString* encryptionPassword; //Enables on-the-fly AES-256 encryption / decryption for file uploads / downloads if not nil (use 'openssl aes-256-cbc -d -k PASSWORD -nosalt -in IN_FILE -out OUT_FILE' to decrypt an uploaded file)
+@property(nonatomic) FileTransferCompressionFormat compressionFormat; //Enables on-the-fly gzip compression / decompression for file uploads / downloads (applied before encryption on upload and after decryption on download) - Compressed uploads have no length known in advance, so the server must accept uploads without Content-Length - kFileTransferCompressionFormat_None by default
+@property(nonatomic) BOOL pipelinedUploads; //Reads, digests and encrypts upload data on separate threads ahead of the network (the source stream must not be scheduled on a runloop) - NO by default
+@property(nonatomic) FileTransferEncryptionFormat encryptionFormat; //Chunked format is seekable, authenticated and encrypted / decrypted on multiple threads (see ChunkedCipher.h) but is not compatible with 'openssl' - kFileTransferEncryptionFormat_CBC by default
 #endif
 
 @property(nonatomic) NSTimeInterval timeOut; //In seconds - 0 means default
-@property(nonatomic) NSUInteger maximumDownloadSpeed; //In bytes per second - 0 means unlimited
-@property(nonatomic) NSUInteger maximumUploadSpeed; //In bytes per second - 0 means unlimited
+@property(nonatomic) NSUInteger maximumDownloadSpeed; //In bytes per second (transfers also stay within the global maximum speed) - 0 means unlimited
+@property(nonatomic) NSUInteger maximumUploadSpeed; //In bytes per second (transfers also stay within the global maximum speed) - 0 means unlimited
+@property(nonatomic, copy) NSString* checkpointDirectory; //Enables resumable transfers for -downloadFileFromPath:toPath: and -uploadFileFromPath:toPath: if not nil and supported by the class: a checkpoint recording the offset and remote file version is kept in this directory while a transfer is incomplete, and retrying it with the same paths continues where it stopped (resumed uploads first download the partial remote file to check it still matches the local file) (ignored if encryption or compression is set) - nil by default
+@property(nonatomic) FileTransferBandwidthClass bandwidthClass; //The global maximum speeds are shared between the classes with transfers in progress according to their weights - Applies to the next transfer - kFileTransferBandwidthClass_Default by default
 
 - (NSString*) absolutePathForRemotePath:(NSString*)path;
 - (NSURL*) absoluteURLForRemotePath:(NSString*)path; //Returned URL does not contain user or password
@@ -183,10 +275,25 @@
 	CFHTTPMessageRef					_responseHeaders;
 	BOOL								_disableSSLCertificates,
 										_keepAlive,
-										_hasShouldAbort;
+										_hasShouldAbort,
+										_limitPerHost,
+										_limitedPersistent,
+										_limitedFailed;
+	void*								_limitedHost;
+	NSUInteger							_limitedGeneration,
+										_maxConnections,
+										_segmentSize;
 }
++ (NSUInteger) maximumConcurrentRequestsPerHost;
++ (void) setMaximumConcurrentRequestsPerHost:(NSUInteger)max; //4 by default - Cannot be more than 32
++ (NSDictionary*) hostLimiterStatistics; //Returns kHTTPHostLimiterStatisticsKey_XXX keys
++ (void) resetHostLimiter; //Forgets failed hosts and resets statistics
+
 @property(nonatomic, getter=isSSLCertificateValidationDisabled) BOOL SSLCertificateValidationDisabled;
 @property(nonatomic) BOOL keepConnectionAlive; //NO by default
+@property(nonatomic) BOOL limitsConcurrentRequestsPerHost; //Requests are counted against a process-wide per-host limit shared with the other controllers and wait (up to the timeout or 60 seconds if there is none) while the host is at that limit - Nested requests made while the calling thread already holds a slot to the same host share that slot - This is not a connection pool: CFNetwork owns the sockets and decides by itself whether to reuse a keep-alive connection (implies "keepConnectionAlive") - NO by default
+@property(nonatomic) NSUInteger maximumDownloadConnections; //Only applies to -downloadFileFromPath:toPath: - Files spanning at least 2 segments are fetched as byte ranges over that many parallel connections if the server supports it (ignored if encryption, compression, a checkpoint directory or a maximum download speed is set) - 1 by default
+@property(nonatomic) NSUInteger downloadSegmentSize; //In bytes - 1 MB by default
 - (NSURL*) finalURLForPath:(NSString*)remotePath;
 @end
 
@@ -210,12 +317,15 @@
 
 /* Supports everything except -movePath:toPath: and -deleteDirectoryAtPath: (the first path component is the bucket and can be nil to operate on the bucket list itself and paths with depth > 2 are not supported) */
 /* Contrary to the FileTransferController conventions, deleting non-existent directories returns NO instead of YES and creating an already existing directory returns YES instead of NO (unless the owner differs) */
+/* Uploads fail if compression is set as Amazon S3 rejects PUT requests without Content-Length */
 @interface AmazonS3TransferController : HTTPTransferController
 {
 @private
 	NSString*							_productToken;
 	NSString*							_userToken;
 	NSString*							_newBucketLocation;
+	NSUInteger							_maxUploadConnections,
+										_partSize;
 }
 + (NSDictionary*) activateDesktopProduct:(NSString*)productToken activationKey:(NSString*)activationKey expirationInterval:(NSTimeInterval)expirationInterval error:(NSError**)error; //Returns kAmazonS3ActivationInfo_XXX keys
 + (BOOL) isBucketNameValid:(NSString*)name;
@@ -223,6 +333,8 @@
 @property(nonatomic, copy) NSString* productToken; //Must start with "{ProductToken}"
 @property(nonatomic, copy) NSString* userToken; //Must start with "{UserToken}"
 @property(nonatomic, copy) NSString* newBucketLocation; //One of kAmazonS3BucketLocation_XXX or nil for default
+@property(nonatomic) NSUInteger maximumUploadConnections; //Only applies to -uploadFileFromPath:toPath: - Files spanning at least 2 parts are sent as a multipart upload with parts transferred in parallel over that many connections (ignored if encryption or a maximum upload speed is set) - 1 by default
+@property(nonatomic) NSUInteger multipartUploadPartSize; //In bytes - Cannot be less than 5 MB - 8 MB by default
 - (NSString*) locationForPath:(NSString*)remotePath; //Return nil on error or empty string for default location
 - (NSDictionary*) bucketKeysForPath:(NSString*)remotePath withPrefix:(NSString*)prefix marker:(NSString*)marker delimiter:(NSString*)delimiter maxKeys:(NSUInteger)max isTruncated:(BOOL*)truncated;
 @end
@@ -251,6 +363,13 @@
 @interface FTPSTransferController : FTPTransferController
 @end
 
+enum {
+	kSFTPTransferProtocol_SFTP = 0,
+	kSFTPTransferProtocol_SCP,
+	kSFTPTransferProtocol_Automatic //SCP for files of at least "scpThreshold" bytes
+};
+typedef NSUInteger SFTPTransferProtocol;
+
 /* Supports everything except copy */
 @interface SFTPTransferController : FileTransferController
 {
@@ -258,7 +377,59 @@
 	CFSocketRef							_socket;
 	void*								_session;
 	void*								_sftp;
+	NSUInteger							_maxPipelinedRequests,
+										_maxReceiveWindow,
+										_initialReceiveWindow;
+	NSInteger							_connectionCompressionLevel;
+	NSUInteger							_maxChannels,
+										_numChannels;
+	void**								_channels;
+	BOOL								_reuseConnections;
+	SFTPTransferProtocol				_transferProtocol;
+	unsigned long long					_scpThreshold;
+}
++ (void) closePooledConnections; //Closes all idle SSH connections kept by the process-wide pool
++ (NSDictionary*) connectionPoolStatistics; //Returns kSFTPConnectionPoolStatisticsKey_XXX keys
+@property(nonatomic) NSUInteger maximumPipelinedRequests; //Number of read or write requests kept in flight during file transfers instead of waiting for each reply - Cannot be more than 64 and 1 disables pipelining - 16 by default
+@property(nonatomic) NSUInteger maximumReceiveWindow; //In bytes - The SSH receive window starts like the stock libssh2 one (refilled in steps of about 39 MB) and grows with the measured bandwidth-delay product up to this size which bounds the memory used by incoming data (0 disables autotuning and keeps the stock window) - 128 MB by default
+@property(nonatomic) NSUInteger initialReceiveWindow; //In bytes - Window autotuning starts from (0 means the stock libssh2 window) - 0 by default
+@property(nonatomic, readonly) NSUInteger receiveWindow; //Receive window currently aimed for by autotuning on the main SFTP channel or 0 if disabled or not connected
+@property(nonatomic) NSInteger connectionCompressionLevel; //Compresses the SSH connection with zlib (or its "zlib@openssh.com" variant delayed until authentication which is the only one stock OpenSSH servers offer) at this level in [1,9] range if the server agrees, packets that do not shrink like already compressed data temporarily being sent uncompressed - Applies to new connections only (0 disables compression) - 0 by default
+@property(nonatomic, readonly) float connectionCompressionRatio; //Compressed to uncompressed size of the data sent over the current SSH connection or NAN if it is not compressed
+@property(nonatomic) BOOL reusesConnections; //When the controller is deallocated, its SSH connection goes to a process-wide pool and the next controller for the same host, port, user, password and compression level reuses it instead of connecting and authenticating again - Idle pooled connections are closed after 60 seconds by a background thread - YES by default
+@property(nonatomic) SFTPTransferProtocol transferProtocol; //Protocol used by file transfers, SCP streaming the file over a single channel without the request / response overhead of SFTP - Resumed transfers and uploads of unknown length (compressed data) always use SFTP - SFTP by default
+@property(nonatomic) unsigned long long scpThreshold; //In bytes - 16 MB by default
+@property(nonatomic) NSUInteger maximumChannels; //Number of SFTP channels opened on the SSH connection by batch transfers - Servers may accept fewer (OpenSSH defaults to 10 sessions per connection) - Cannot be more than 16 - 4 by default
+
+- (BOOL) downloadFilesFromPaths:(NSArray*)remotePaths toPaths:(NSArray*)localPaths; //Transfers the files in parallel over up to "maximumChannels" SFTP channels sharing the single SSH connection - Returns NO if any file failed (the delegate gets the first error) or if digests, encryption, compression, a checkpoint directory or a speed limit is set - A local file is only replaced once the remote file has been opened
+- (BOOL) uploadFilesFromPaths:(NSArray*)localPaths toPaths:(NSArray*)remotePaths; //Same as above - Overwrites any pre-existing files
+- (NSDictionary*) attributesOfItemsAtPaths:(NSArray*)remotePaths; //Sends the lstat requests for all paths without waiting for each reply so symbolic links are not followed - NSDictionary of NSDictionary with NSFile type keys (same as -contentsOfDirectoryAtPath:) for the paths that exist - Returns nil on failure
+@end
+
+@class SFTPTransferLoop;
+
+@protocol SFTPTransferLoopDelegate <NSObject>
+@optional
+- (void) transferLoop:(SFTPTransferLoop*)loop didCompleteTransferWithLocalPath:(NSString*)localPath remotePath:(NSString*)remotePath controller:(SFTPTransferController*)controller error:(NSError*)error; //"error" is nil on success
+- (BOOL) transferLoopShouldAbort:(SFTPTransferLoop*)loop;
+@end
+
+/* Runs the transfers of any number of SFTP controllers from the calling thread: libssh2 is used in non-blocking mode and the thread only sleeps in poll() when no transfer can make progress */
+/* Each controller works like for its batch transfers (see -downloadFilesFromPaths:toPaths:) and must not be used elsewhere while the loop runs - Controller delegates only receive progress updates */
+@interface SFTPTransferLoop : NSObject
+{
+@private
+	id<SFTPTransferLoopDelegate>		_delegate;
+	NSMutableArray*						_transfers;
+	NSError*							_error;
+	BOOL								_failed;
 }
+@property(nonatomic, assign) id<SFTPTransferLoopDelegate> delegate;
+@property(nonatomic, readonly) NSError* error; //First error reported by a transfer during the last run or nil
+
+- (BOOL) addDownloadFromPath:(NSString*)remotePath toPath:(NSString*)localPath controller:(SFTPTransferController*)controller;
+- (BOOL) addUploadFromPath:(NSString*)localPath toPath:(NSString*)remotePath controller:(SFTPTransferController*)controller; //Overwrites any pre-existing file - Both methods return NO if the controller cannot transfer in batch (see -downloadFilesFromPaths:toPaths:)
+- (BOOL) run; //Returns once all the transfers added so far have completed - Returns NO if any failed
 @end
 
 #endif
@@ -21,14 +21,23 @@
 #import <unistd.h>
 #else
 #import <openssl/evp.h>
+#import <zlib.h>
 #endif
 #import <libkern/OSAtomic.h>
+#import <pthread.h>
+#import <time.h>
 #import <SystemConfiguration/SystemConfiguration.h>
+#import <CommonCrypto/CommonDigest.h>
 #import <arpa/inet.h>
 
 #import "FileTransferController_Internal.h"
 #import "NSURL+Parameters.h"
 #import "DataStream.h"
+#if !TARGET_OS_IPHONE
+#import "ChunkedCipher.h"
+#import "DigestPipeline.h"
+#import "BlockPipeline.h"
+#endif
 
 #define kFileTransferRunLoopActiveMode	CFSTR("FileTransferActiveMode")
 #define kStreamBufferSize				(256 * 1024)
@@ -36,30 +45,239 @@
 #if !TARGET_OS_IPHONE
 #define kEncryptionCipher				EVP_aes_256_cbc()
 #define kEncryptionCipherBlockSize		16
-#define kDigestType						EVP_md5()
+#define kChunkedEncryptionBatch			16 //chunks
+#define kChunkedEncryptionMaxThreads	8
+#define kUploadPipelineBlockSize		(1024 * 1024)
+#define kUploadPipelineBlockCount		4
+#define kCompressionBufferSize			(256 * 1024)
+#define kCompressionWindowBits			(15 + 16) //Default + gzip header instead of zlib header
+#define kCompressionMemoryLevel			8 //Default
 #endif
+#define kBandwidthClassCount			3
+#define kDefaultBandwidthBurst			250000 //microseconds
+#define kCheckpointSaveInterval			(4 * 1024 * 1024)
+#define kCheckpointKey_URL				@"url"
+#define kCheckpointKey_LocalPath		@"localPath"
+#define kCheckpointKey_Offset			@"offset"
+#define kCheckpointKey_Validator		@"validator"
 
 typedef struct {
 	unsigned char*						buffer;
 	NSUInteger							size;
 } DataInfo;
 
+#if !TARGET_OS_IPHONE
+typedef struct {
+	ChunkedCipher*						cipher;
+	CFDataRef							password;
+	BOOL								headerDone,
+										finished;
+	unsigned long long					index;
+	unsigned char*						input;
+	NSUInteger							inputLength,
+										inputCapacity;
+	unsigned char*						output;
+	NSUInteger							outputOffset,
+										outputLength,
+										outputCapacity;
+} ChunkedEncryption;
+
+typedef struct {
+	z_stream							stream;
+	BOOL								compress,
+										endOfInput,
+										finished;
+	unsigned char*						buffer;
+} CompressionContext;
+
+typedef struct {
+	BlockPipeline*						pipeline;
+	NSInputStream*						stream;
+	FileTransferController*				controller;
+} UploadPipeline;
+#endif
+
+typedef struct {
+	volatile int64_t					time; //Theoretical arrival time of the next byte in microseconds
+	volatile int64_t					bytes;
+	volatile int64_t					waitTime; //In microseconds
+	volatile int32_t					transfers;
+} BandwidthBucket;
+
 static NSUInteger						_maximumDownloadSpeed = 0,
 										_maximumUploadSpeed = 0;
-static OSSpinLock						_downloadLock = 0,
-										_uploadLock = 0;
-static CFTimeInterval					_downloadTime = 0.0,
-										_uploadTime = 0.0;
+static BandwidthBucket					_downloadBuckets[kBandwidthClassCount] = {{0}},
+										_uploadBuckets[kBandwidthClassCount] = {{0}};
+static volatile int32_t					_bandwidthWeights[kBandwidthClassCount] = {4, 16, 1};
+static volatile int64_t					_bandwidthBurst = kDefaultBandwidthBurst;
+static pthread_mutex_t					_statisticsMutex = PTHREAD_MUTEX_INITIALIZER;
+static int64_t							_statisticsBytes[2][kBandwidthClassCount] = {{0}};
+static CFAbsoluteTime					_statisticsTime[2][kBandwidthClassCount] = {{0.0}};
 
 #define MAKE_IPV4(A, B, C, D) ((((UInt32)A) << 24) | (((UInt32)B) << 16) | (((UInt32)C) << 8) | ((UInt32)D))
 
 #define IS_REACHABLE(__FLAGS__) (((__FLAGS__) & kSCNetworkFlagsReachable) && !((__FLAGS__) & kSCNetworkFlagsConnectionRequired))
 
+/* Charges "cost" microseconds to a token bucket and returns the time in microseconds at which the bytes it stands for may go through (GCRA formulation of a token bucket updated with compare-and-swap) */
+static int64_t _ChargeBucket(volatile int64_t* bucketTime, int64_t cost, int64_t now)
+{
+	int64_t						burst = _bandwidthBurst,
+								time,
+								newTime;
+	
+	do {
+		time = *bucketTime;
+		newTime = MAX(time, now - burst) + cost;
+	} while(!OSAtomicCompareAndSwap64Barrier(time, newTime, bucketTime));
+	
+	return newTime;
+}
+
+/* Accounts for "length" bytes and blocks until they fit in both the share of the class if "maxSpeed" is not 0 and the per-controller bucket "controllerTime" if not NULL */
+static void _ThrottleBandwidth(BandwidthBucket* buckets, FileTransferBandwidthClass bandwidthClass, double maxSpeed, volatile int64_t* controllerTime, double controllerSpeed, NSUInteger length)
+{
+	BandwidthBucket*			bucket = &buckets[bandwidthClass];
+	int32_t						weight = _bandwidthWeights[bandwidthClass],
+								totalWeight = 0;
+	int64_t						cost,
+								now,
+								deadline;
+	struct timespec				interval;
+	NSUInteger					i;
+	
+	OSAtomicAdd64Barrier(length, &bucket->bytes);
+	if((maxSpeed <= 0.0) && (controllerTime == NULL))
+	return;
+	
+	now = CFAbsoluteTimeGetCurrent() * 1000000.0;
+	deadline = now;
+	if(maxSpeed > 0.0) {
+		for(i = 0; i < kBandwidthClassCount; ++i) {
+			if(buckets[i].transfers > 0)
+			totalWeight += _bandwidthWeights[i];
+		}
+		if(totalWeight < weight)
+		totalWeight = weight;
+		cost = (double)length * 1000000.0 * (double)totalWeight / ((double)weight * maxSpeed);
+		
+		deadline = _ChargeBucket(&bucket->time, cost, now);
+		if(deadline > now)
+		OSAtomicAdd64Barrier(deadline - now, &bucket->waitTime);
+	}
+	if(controllerTime)
+	deadline = MAX(deadline, _ChargeBucket(controllerTime, (double)length * 1000000.0 / controllerSpeed, now));
+	
+	if(deadline > now) {
+		interval.tv_sec = (deadline - now) / 1000000;
+		interval.tv_nsec = ((deadline - now) % 1000000) * 1000;
+		while((nanosleep(&interval, &interval) == -1) && (errno == EINTR))
+		;
+	}
+}
+
+static NSDictionary* _BandwidthStatistics(NSUInteger direction, BandwidthBucket* buckets, FileTransferBandwidthClass bandwidthClass)
+{
+	BandwidthBucket*			bucket = &buckets[bandwidthClass];
+	int64_t						bytes = bucket->bytes;
+	CFAbsoluteTime				time = CFAbsoluteTimeGetCurrent();
+	double						rate = 0.0;
+	
+	pthread_mutex_lock(&_statisticsMutex);
+	if((_statisticsTime[direction][bandwidthClass] > 0.0) && (time > _statisticsTime[direction][bandwidthClass]))
+	rate = (double)(bytes - _statisticsBytes[direction][bandwidthClass]) / (time - _statisticsTime[direction][bandwidthClass]);
+	_statisticsBytes[direction][bandwidthClass] = bytes;
+	_statisticsTime[direction][bandwidthClass] = time;
+	pthread_mutex_unlock(&_statisticsMutex);
+	
+	return [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithLongLong:bytes], kFileTransferBandwidthStatisticsKey_Bytes,
+		[NSNumber numberWithDouble:rate], kFileTransferBandwidthStatisticsKey_Rate,
+		[NSNumber numberWithDouble:((double)bucket->waitTime / 1000000.0)], kFileTransferBandwidthStatisticsKey_ThrottledTime,
+		[NSNumber numberWithInt:bucket->transfers], kFileTransferBandwidthStatisticsKey_Transfers,
+		nil];
+}
+
+/* Compares the data written to it with the beginning of a local file */
+@interface FileTransferPrefixVerifier : NSObject <DataStreamDestination>
+{
+@private
+	NSInputStream*				_stream;
+	void*						_buffer;
+	NSUInteger					_bufferSize;
+	BOOL						_mismatch;
+}
+- (id) initWithFileAtPath:(NSString*)path;
+@property(nonatomic, readonly, getter=isMismatch) BOOL mismatch;
+@end
+
+@implementation FileTransferPrefixVerifier
+
+@synthesize mismatch=_mismatch;
+
+- (id) initWithFileAtPath:(NSString*)path
+{
+	if((self = [super init])) {
+		_stream = [[NSInputStream alloc] initWithFileAtPath:path];
+		if(_stream == nil) {
+			[self release];
+			return nil;
+		}
+	}
+	
+	return self;
+}
+
+- (void) dealloc
+{
+	[_stream close];
+	[_stream release];
+	free(_buffer);
+	
+	[super dealloc];
+}
+
+- (BOOL) openDataStream:(id)userInfo
+{
+	[_stream open];
+	
+	return ([_stream streamStatus] == NSStreamStatusOpen);
+}
+
+- (NSInteger) writeDataToStream:(id)userInfo buffer:(const void*)buffer maxLength:(NSUInteger)length
+{
+	NSUInteger					offset = 0;
+	NSInteger					result;
+	
+	if(length > _bufferSize) {
+		free(_buffer);
+		_bufferSize = length;
+		_buffer = malloc(_bufferSize);
+	}
+	while(offset < length) {
+		result = [_stream read:((unsigned char*)_buffer + offset) maxLength:(length - offset)];
+		if(result <= 0)
+		break;
+		offset += result;
+	}
+	if((offset < length) || memcmp(_buffer, buffer, length)) {
+		_mismatch = YES;
+		return -1;
+	}
+	
+	return length;
+}
+
+- (void) closeDataStream:(id)userInfo
+{
+	[_stream close];
+}
+
+@end
+
 @implementation FileTransferController
 
-@synthesize baseURL=_baseURL, delegate=_delegate, localHost=_localHost, maxLength=_maxLength, currentLength=_currentLength, timeOut=_timeOut, maximumDownloadSpeed=_maxDownloadSpeed, maximumUploadSpeed=_maxUploadSpeed;
+@synthesize baseURL=_baseURL, delegate=_delegate, localHost=_localHost, maxLength=_maxLength, currentLength=_currentLength, timeOut=_timeOut, maximumDownloadSpeed=_maxDownloadSpeed, maximumUploadSpeed=_maxUploadSpeed, bandwidthClass=_bandwidthClass, checkpointDirectory=_checkpointDirectory, resumeOffset=_resumeOffset, resumeValidator=_resumeValidator;
 #if !TARGET_OS_IPHONE
-@synthesize digestComputation=_digestComputation, encryptionPassword=_encryptionPassword;
+@synthesize digestComputation=_digestComputation, digestAlgorithms=_digestAlgorithms, encryptionPassword=_encryptionPassword, encryptionFormat=_encryptionFormat, compressionFormat=_compressionFormat, pipelinedUploads=_pipelinedUploads, lastUploadPipelineStatistics=_pipelineStatistics;
 #endif
 
 + (id) allocWithZone:(NSZone*)zone
@@ -85,6 +303,28 @@ static CFTimeInterval					_downloadTime = 0.0,
 	return NO;
 }
 
++ (BOOL) hasResumableDownloads
+{
+	return NO;
+}
+
++ (BOOL) hasResumableUploads
+{
+	return NO;
+}
+
+#if !TARGET_OS_IPHONE
+
++ (unsigned long long) encryptedLengthForLength:(unsigned long long)length encryptionFormat:(FileTransferEncryptionFormat)format
+{
+	if(format == kFileTransferEncryptionFormat_Chunked)
+	return ChunkedCipherEncryptedLength(length, kChunkedCipherDefaultChunkSize);
+	
+	return (length / kEncryptionCipherBlockSize + 1) * kEncryptionCipherBlockSize;
+}
+
+#endif
+
 + (NSUInteger) globalMaximumDownloadSpeed
 {
 	return _maximumDownloadSpeed;
@@ -105,6 +345,37 @@ static CFTimeInterval					_downloadTime = 0.0,
 	_maximumUploadSpeed = speed;
 }
 
++ (NSTimeInterval) globalBandwidthBurstInterval
+{
+	return (double)_bandwidthBurst / 1000000.0;
+}
+
++ (void) setGlobalBandwidthBurstInterval:(NSTimeInterval)interval
+{
+	_bandwidthBurst = MAX(interval, 0.0) * 1000000.0;
+}
+
++ (NSUInteger) weightForBandwidthClass:(FileTransferBandwidthClass)bandwidthClass
+{
+	return (bandwidthClass < kBandwidthClassCount ? _bandwidthWeights[bandwidthClass] : 0);
+}
+
++ (void) setWeight:(NSUInteger)weight forBandwidthClass:(FileTransferBandwidthClass)bandwidthClass
+{
+	if(bandwidthClass < kBandwidthClassCount)
+	_bandwidthWeights[bandwidthClass] = MIN(MAX(weight, 1), 1024);
+}
+
++ (NSDictionary*) downloadBandwidthStatisticsForClass:(FileTransferBandwidthClass)bandwidthClass
+{
+	return (bandwidthClass < kBandwidthClassCount ? _BandwidthStatistics(0, _downloadBuckets, bandwidthClass) : nil);
+}
+
++ (NSDictionary*) uploadBandwidthStatisticsForClass:(FileTransferBandwidthClass)bandwidthClass
+{
+	return (bandwidthClass < kBandwidthClassCount ? _BandwidthStatistics(1, _uploadBuckets, bandwidthClass) : nil);
+}
+
 + (FileTransferController*) fileTransferControllerWithURL:(NSURL*)url
 {
 	NSString*					user = [url user];
@@ -177,6 +448,8 @@ static CFTimeInterval					_downloadTime = 0.0,
 	if((self = [super init])) {
 		_baseURL = [url copy];
 #if !TARGET_OS_IPHONE
+		_digestAlgorithms = kFileTransferDigestAlgorithm_MD5;
+		
 		if([[[NSHost currentHost] names] containsObject:host] || [[[NSHost currentHost] addresses] containsObject:host] || [host hasSuffix:@".local"])
 		_localHost = YES;
 		else
@@ -200,8 +473,36 @@ static CFTimeInterval					_downloadTime = 0.0,
 	return [self initWithBaseURL:[NSURL URLWithScheme:[[self class] urlScheme] user:username password:password host:host port:port path:basePath]];
 }
 
+- (void) _endBandwidthAccounting
+{
+	if(_bandwidthBuckets) {
+		OSAtomicDecrement32Barrier(&((BandwidthBucket*)_bandwidthBuckets)[_activeBandwidthClass].transfers);
+		_bandwidthBuckets = NULL;
+	}
+}
+
+- (void) _beginBandwidthAccounting:(BandwidthBucket*)buckets
+{
+	[self _endBandwidthAccounting];
+	
+	if(_fileTransfer && ![self isLocalHost]) {
+		_activeBandwidthClass = (_bandwidthClass < kBandwidthClassCount ? _bandwidthClass : kFileTransferBandwidthClass_Default);
+		_bandwidthBuckets = buckets;
+		OSAtomicIncrement32Barrier(&buckets[_activeBandwidthClass].transfers);
+	}
+}
+
+/* Always charges the global cap of the class and also the per-controller limit if any */
+- (void) _throttleLength:(NSUInteger)length maximumSpeed:(double)maxSpeed
+{
+	if(_bandwidthBuckets)
+	_ThrottleBandwidth(_bandwidthBuckets, _activeBandwidthClass, maxSpeed, (_maxSpeed ? &_speedBucketTime : NULL), _maxSpeed, length);
+}
+
 - (void) _cleanUp_FileTransferController
 {
+	[self _endBandwidthAccounting];
+	
 	if(_reachability)
 	CFRelease(_reachability);
 }
@@ -218,8 +519,14 @@ static CFTimeInterval					_downloadTime = 0.0,
 	[self _cleanUp_FileTransferController];
 	
 #if !TARGET_OS_IPHONE
+	[_pipelineStatistics release];
+	[_transferDigests release];
 	[_encryptionPassword release];
 #endif
+	[_checkpoint release];
+	[_checkpointPath release];
+	[_checkpointDirectory release];
+	[_resumeValidator release];
 	[_baseURL release];
 	
 	[super dealloc];
@@ -247,6 +554,10 @@ static CFTimeInterval					_downloadTime = 0.0,
 
 - (float) transferProgress
 {
+#if !TARGET_OS_IPHONE
+	if(!_maxLength && _plainLength && _compressionContext && ((CompressionContext*)_compressionContext)->compress) //NOTE: Compressed uploads are measured on the source data as their length is not known in advance
+	return MIN((float)((CompressionContext*)_compressionContext)->stream.total_in / (float)_plainLength, 1.0);
+#endif
 	return (_maxLength > 0 ? MIN((float)_currentLength / (float)_maxLength, 1.0) : NAN);
 }
 
@@ -255,17 +566,26 @@ static CFTimeInterval					_downloadTime = 0.0,
 	return _totalSize;
 }
 
+- (void) setLastTransferSize:(NSUInteger)size
+{
+	_totalSize = size;
+}
+
+- (unsigned long long) lastTransferResumeOffset
+{
+	return _resumeOffset;
+}
+
 #if !TARGET_OS_IPHONE
 
 - (NSData*) lastTransferDigestData
 {
-	unsigned int*			ptr = (unsigned int*)_digestBuffer;
-	NSData*					data = nil;
-	
-	if(ptr[0] && ptr[1] && ptr[2] && ptr[3])
-	data = [NSData dataWithBytes:_digestBuffer length:16];
-	
-	return data;
+	return [_transferDigests objectForKey:kFileTransferDigestKey_MD5];
+}
+
+- (NSDictionary*) lastTransferDigests
+{
+	return _transferDigests;
 }
 
 #endif
@@ -326,7 +646,11 @@ static CFTimeInterval					_downloadTime = 0.0,
 
 - (BOOL) downloadFileFromPath:(NSString*)remotePath toStream:(NSOutputStream*)stream
 {
-	BOOL						result = [self _downloadFileFromPath:remotePath toStream:stream];
+	BOOL						result;
+	
+	if(_checkpointPath == nil)
+	_resumeOffset = 0;
+	result = [self _downloadFileFromPath:remotePath toStream:stream];
 	
 	[self setMaxLength:0];
 	
@@ -339,11 +663,24 @@ static CFTimeInterval					_downloadTime = 0.0,
 	return NO;
 }
 
+- (long long) _sizeOfRemoteFileAtPath:(NSString*)remotePath
+{
+	[self doesNotRecognizeSelector:_cmd];
+	return -1;
+}
+
 - (BOOL) uploadFileToPath:(NSString*)remotePath fromStream:(NSInputStream*)stream
 {
-	BOOL						result = [self _uploadFileToPath:remotePath fromStream:stream];
+	BOOL						result;
+	
+	if(_checkpointPath == nil)
+	_resumeOffset = 0;
+	result = [self _uploadFileToPath:remotePath fromStream:stream];
 	
 	[self setMaxLength:0];
+#if !TARGET_OS_IPHONE
+	_plainLength = 0;
+#endif
 	
 	return result;
 }
@@ -352,11 +689,14 @@ static CFTimeInterval					_downloadTime = 0.0,
 
 - (BOOL) _createDigestContext
 {
-	bzero(_digestBuffer, 16);
+	[self _destroyDigestContext];
+	[_transferDigests release];
+	_transferDigests = nil;
 	
-	if(_digestComputation) {
-		_digestContext = malloc(sizeof(EVP_MD_CTX));
-		EVP_DigestInit(_digestContext, kDigestType);
+	if(_digestComputation && _digestAlgorithms) {
+		_digestContext = DigestPipelineCreate(_digestAlgorithms, YES); //NOTE: FileTransferDigestAlgorithms and DigestPipelineAlgorithms use the same values
+		if(_digestContext == NULL)
+		return NO;
 	}
 	
 	return YES;
@@ -365,17 +705,106 @@ static CFTimeInterval					_downloadTime = 0.0,
 - (void) _destroyDigestContext
 {
 	if(_digestContext) {
-		free(_digestContext);
+		DigestPipelineDestroy(_digestContext);
 		_digestContext = NULL;
 	}
 }
 
+- (BOOL) _updateDigestContextWithBytes:(const void*)bytes length:(NSUInteger)length
+{
+	if(_digestContext && length)
+	return DigestPipelineUpdate(_digestContext, bytes, length);
+	
+	return YES;
+}
+
+- (BOOL) _finalizeDigestContext
+{
+	BOOL						success = YES;
+	DigestPipelineAlgorithms	algorithms;
+	DigestPipelineResults		results;
+	NSMutableDictionary*		dictionary;
+	
+	if(_digestContext) {
+		algorithms = DigestPipelineGetAlgorithms(_digestContext);
+		if(DigestPipelineFinalize(_digestContext, &results)) {
+			dictionary = [NSMutableDictionary new];
+			if(algorithms & kDigestPipelineAlgorithm_MD5)
+			[dictionary setObject:[NSData dataWithBytes:results.md5 length:sizeof(results.md5)] forKey:kFileTransferDigestKey_MD5];
+			if(algorithms & kDigestPipelineAlgorithm_SHA256)
+			[dictionary setObject:[NSData dataWithBytes:results.sha256 length:sizeof(results.sha256)] forKey:kFileTransferDigestKey_SHA256];
+			if(algorithms & kDigestPipelineAlgorithm_XXH64)
+			[dictionary setObject:[NSData dataWithBytes:results.xxh64 length:sizeof(results.xxh64)] forKey:kFileTransferDigestKey_XXH64];
+			[_transferDigests release];
+			_transferDigests = dictionary;
+		}
+		else
+		success = NO;
+		
+		[self _destroyDigestContext];
+	}
+	
+	return success;
+}
+
+static NSUInteger _NumberOfCipherThreads()
+{
+	long						count = sysconf(_SC_NPROCESSORS_ONLN);
+	
+	return MIN(MAX(count, 1), kChunkedEncryptionMaxThreads);
+}
+
+- (BOOL) _createChunkedEncryption:(BOOL)decrypt
+{
+	NSData*						passwordData = [_encryptionPassword dataUsingEncoding:NSUTF8StringEncoding];
+	ChunkedEncryption*			encryption;
+	
+	if(![passwordData length])
+	return NO;
+	
+	encryption = calloc(1, sizeof(ChunkedEncryption));
+	encryption->password = CFRetain((CFDataRef)passwordData);
+	if(!decrypt) {
+		encryption->cipher = ChunkedCipherCreateEncryptor(passwordData, kChunkedCipherDefaultChunkSize, _NumberOfCipherThreads());
+		if(encryption->cipher == NULL) {
+			CFRelease(encryption->password);
+			free(encryption);
+			return NO;
+		}
+		encryption->inputCapacity = kChunkedEncryptionBatch * kChunkedCipherDefaultChunkSize;
+		encryption->outputCapacity = kChunkedCipherHeaderSize + encryption->inputCapacity + (kChunkedEncryptionBatch + 1) * kChunkedCipherTagSize;
+		encryption->output = malloc(encryption->outputCapacity);
+	}
+	encryption->input = malloc(encryption->inputCapacity);
+	_chunkedEncryption = encryption;
+	
+	return YES;
+}
+
+- (void) _destroyChunkedEncryption
+{
+	ChunkedEncryption*			encryption = _chunkedEncryption;
+	
+	if(encryption) {
+		if(encryption->cipher)
+		ChunkedCipherDestroy(encryption->cipher);
+		CFRelease(encryption->password);
+		free(encryption->input);
+		free(encryption->output);
+		free(encryption);
+		_chunkedEncryption = NULL;
+	}
+}
+
 - (BOOL) _createCypherContext:(BOOL)decrypt
 {
 	unsigned char				keyBuffer[EVP_MAX_KEY_LENGTH];
 	unsigned char				ivBuffer[EVP_MAX_IV_LENGTH];
 	NSData*						passwordData;
 	
+	if(_encryptionPassword && (_encryptionFormat == kFileTransferEncryptionFormat_Chunked))
+	return [self _createChunkedEncryption:decrypt];
+	
 	if(_encryptionPassword) {
 		passwordData = [_encryptionPassword dataUsingEncoding:NSUTF8StringEncoding];
 		if(![passwordData length])
@@ -402,6 +831,8 @@ static CFTimeInterval					_downloadTime = 0.0,
 
 - (void) _destroyCypherContext
 {
+	[self _destroyChunkedEncryption];
+	
 	if(_encryptionContext) {
 		free(_encryptionBufferBytes);
 		EVP_CIPHER_CTX_cleanup(_encryptionContext);
@@ -410,120 +841,287 @@ static CFTimeInterval					_downloadTime = 0.0,
 	}
 }
 
-#endif
-
-- (BOOL) openOutputStream:(NSOutputStream*)stream isFileTransfer:(BOOL)isFileTransfer
+/* Appends encrypted bytes and decrypts all the complete chunks (or everything left if "final" is YES) into the output buffer */
+- (BOOL) _decryptChunkedBytes:(const void*)bytes length:(NSUInteger)length final:(BOOL)final
 {
-	_totalSize = 0;
-	_fileTransfer = isFileTransfer;
-	if(_fileTransfer) {
-#if !TARGET_OS_IPHONE
-		if(![self _createDigestContext] || ![self _createCypherContext:YES])
+	ChunkedEncryption*			encryption = _chunkedEncryption;
+	NSUInteger					chunkSize,
+								count;
+	long						result;
+	
+	if(encryption->inputLength + length > encryption->inputCapacity) {
+		encryption->inputCapacity = encryption->inputLength + length;
+		encryption->input = realloc(encryption->input, encryption->inputCapacity);
+	}
+	if(length)
+	bcopy(bytes, encryption->input + encryption->inputLength, length);
+	encryption->inputLength += length;
+	encryption->outputLength = 0;
+	
+	if(encryption->cipher == NULL) {
+		if(encryption->inputLength < kChunkedCipherHeaderSize)
+		return !final;
+		encryption->cipher = ChunkedCipherCreateDecryptor((NSData*)encryption->password, encryption->input, _NumberOfCipherThreads());
+		if(encryption->cipher == NULL)
 		return NO;
-#endif
-		_maxSpeed = ([self isLocalHost] ? 0.0 : _maxDownloadSpeed);
+		encryption->inputLength -= kChunkedCipherHeaderSize;
+		memmove(encryption->input, encryption->input + kChunkedCipherHeaderSize, encryption->inputLength);
 	}
-	else
-	_maxSpeed = 0.0;
 	
-	[stream open];
-	if([stream streamStatus] != NSStreamStatusOpen) {
-#if !TARGET_OS_IPHONE
-		[self _destroyCypherContext];
-		[self _destroyDigestContext];
-#endif
+	chunkSize = ChunkedCipherGetChunkSize(encryption->cipher) + kChunkedCipherTagSize;
+	count = (final ? encryption->inputLength : encryption->inputLength / chunkSize * chunkSize);
+	if(!final && (count == 0))
+	return YES;
+	if(count > encryption->outputCapacity) {
+		encryption->outputCapacity = count;
+		free(encryption->output);
+		encryption->output = malloc(encryption->outputCapacity);
+	}
+	
+	result = ChunkedCipherProcess(encryption->cipher, encryption->input, count, encryption->output, encryption->index, final);
+	if(result < 0)
+	return NO;
+	encryption->index += count / chunkSize;
+	encryption->outputLength = result;
+	encryption->inputLength -= count;
+	memmove(encryption->input, encryption->input + count, encryption->inputLength);
+	
+	return YES;
+}
+
+- (BOOL) _createCompressionContext:(BOOL)compress
+{
+	CompressionContext*			compression;
+	int							error;
+	
+	if(_compressionFormat == kFileTransferCompressionFormat_None)
+	return YES;
+	
+	compression = calloc(1, sizeof(CompressionContext));
+	compression->compress = compress;
+	if(compress)
+	error = deflateInit2(&compression->stream, (_compressionFormat == kFileTransferCompressionFormat_Fast ? Z_BEST_SPEED : Z_DEFAULT_COMPRESSION), Z_DEFLATED, kCompressionWindowBits, kCompressionMemoryLevel, Z_DEFAULT_STRATEGY);
+	else
+	error = inflateInit2(&compression->stream, kCompressionWindowBits);
+	if(error != Z_OK) {
+		NSLog(@"%s: %s() failed with error %i", __FUNCTION__, (compress ? "deflateInit2" : "inflateInit2"), error);
+		free(compression);
 		return NO;
 	}
+	compression->buffer = malloc(kCompressionBufferSize);
+	_compressionContext = compression;
 	
 	return YES;
 }
 
-- (BOOL) writeToOutputStream:(NSOutputStream*)stream bytes:(const void*)bytes maxLength:(NSUInteger)length
+- (void) _destroyCompressionContext
 {
-	double						maxSpeed = (_fileTransfer && ![self isLocalHost] ? _maximumDownloadSpeed : 0.0);
-	CFAbsoluteTime				time = 0.0;
-	BOOL						success = YES;
-	int							offset = 0,
-								realLength,
-								numBytes;
-	void*						realBytes;
-	CFTimeInterval				dTime;
+	CompressionContext*			compression = _compressionContext;
 	
-#if !TARGET_OS_IPHONE
-	if(_encryptionContext) {
-		if(length + EVP_MAX_BLOCK_LENGTH != _encryptionBufferSize) {
-			_encryptionBufferSize = length + EVP_MAX_BLOCK_LENGTH;
-			free(_encryptionBufferBytes);
-			_encryptionBufferBytes = malloc(_encryptionBufferSize);
-		}
-		
-		realBytes = _encryptionBufferBytes;
-		if(EVP_DecryptUpdate(_encryptionContext, realBytes, &realLength, bytes, length) != 1)
-		success = NO;
+	if(compression) {
+		if(compression->compress)
+		deflateEnd(&compression->stream);
+		else
+		inflateEnd(&compression->stream);
+		free(compression->buffer);
+		free(compression);
+		_compressionContext = NULL;
 	}
-	else
+}
+
 #endif
-	{
-		realBytes = (void*)bytes;
-		realLength = length;
-	}
+
+- (void) _saveCheckpoint
+{
+	[_checkpoint setValue:_resumeValidator forKey:kCheckpointKey_Validator];
+	[_checkpoint setObject:[NSNumber numberWithUnsignedLongLong:_checkpointOffset] forKey:kCheckpointKey_Offset];
+	if([_checkpoint writeToFile:_checkpointPath atomically:YES])
+	_checkpointSavedOffset = _checkpointOffset;
+	else
+	NSLog(@"%s: Failed writing checkpoint to \"%@\"", __FUNCTION__, _checkpointPath);
+}
+
+/* Reads the bytes preceding the resume offset from a stream and digests them if needed */
+- (BOOL) _readResumedBytesFromStream:(NSInputStream*)stream
+{
+	unsigned long long			offset = 0;
+	unsigned char*				buffer = malloc(kStreamBufferSize);
+	NSInteger					result;
 	
+	while(offset < _resumeOffset) {
+		result = [stream read:buffer maxLength:MIN(_resumeOffset - offset, kStreamBufferSize)];
+		if(result <= 0)
+		break;
 #if !TARGET_OS_IPHONE
-	if(success && _digestContext) {
-		if(EVP_DigestUpdate(_digestContext, realBytes, realLength) != 1)
-		success = NO;
-	}
+		if(![self _updateDigestContextWithBytes:buffer length:result])
+		break;
 #endif
+		offset += result;
+	}
+	free(buffer);
 	
-	if(success && (realLength > 0)) {
-		if(_maxSpeed)
-		time = CFAbsoluteTimeGetCurrent();
-		else if(maxSpeed) {
-			while(1) {
-				time = CFAbsoluteTimeGetCurrent();
-				OSSpinLockLock(&_downloadLock);
-				dTime = _downloadTime - time;
-				OSSpinLockUnlock(&_downloadLock);
-				if(dTime <= 0.0)
-				break;
-				usleep(dTime * 1000000.0);
-			}
+	return (offset == _resumeOffset ? YES : NO);
+}
+
+/* Digests data and writes it to the destination stream */
+- (BOOL) _writeBytes:(const void*)bytes length:(NSUInteger)length toOutputStream:(NSOutputStream*)stream
+{
+	NSUInteger					offset = 0;
+	NSInteger					numBytes;
+	
+#if !TARGET_OS_IPHONE
+	if(![self _updateDigestContextWithBytes:bytes length:length])
+	return NO;
+#endif
+	
+	while(offset < length) {
+		numBytes = [stream write:((const uint8_t*)bytes + offset) maxLength:(length - offset)]; //NOTE: Writing 0 bytes will close the stream
+		if(numBytes == 0) { //NOTE: Writes block until space is available so this means the stream has reached its end or capacity
+			NSLog(@"%s: Output stream is full (status = %i)", __FUNCTION__, [stream streamStatus]);
+			return NO;
 		}
-		
-		if(success) {
-			success = NO;
-			while(1) {
-				numBytes = [stream write:((const uint8_t*)realBytes + offset) maxLength:(realLength - offset)]; //NOTE: Writing 0 bytes will close the stream
-				if(numBytes < 0)
-				break;
-				offset += numBytes;
-				if(offset == realLength) {
-					success = YES;
-					break;
-				}
+		if(numBytes < 0)
+		return NO;
+		offset += numBytes;
 #ifdef __DEBUG__
-				NSLog(@"%s wrote only %i bytes out of %i", __FUNCTION__, numBytes, realLength - offset);
+		if(offset < length)
+		NSLog(@"%s wrote only %i bytes out of %i", __FUNCTION__, numBytes, length - offset);
 #endif
+	}
+	
+	return YES;
+}
+
+/* Decompresses data if needed before writing it to the destination stream */
+- (BOOL) _writeDecryptedBytes:(const void*)bytes length:(NSUInteger)length toOutputStream:(NSOutputStream*)stream
+{
+#if !TARGET_OS_IPHONE
+	CompressionContext*			compression = _compressionContext;
+	NSUInteger					count;
+	int							error;
+	
+	if(compression) {
+		compression->stream.next_in = (Bytef*)bytes;
+		compression->stream.avail_in = length;
+		while(!compression->finished) {
+			compression->stream.next_out = compression->buffer;
+			compression->stream.avail_out = kCompressionBufferSize;
+			error = inflate(&compression->stream, Z_NO_FLUSH);
+			if(error == Z_STREAM_END)
+			compression->finished = YES;
+			else if((error != Z_OK) && (error != Z_BUF_ERROR)) {
+				NSLog(@"%s: inflate() failed with error %i", __FUNCTION__, error);
+				return NO;
 			}
+			count = kCompressionBufferSize - compression->stream.avail_out;
+			if(count && ![self _writeBytes:compression->buffer length:count toOutputStream:stream])
+			return NO;
+			if((compression->stream.avail_in == 0) && (compression->stream.avail_out > 0))
+			break;
 		}
 		
-		if(success) {
-			if(_maxSpeed) {
-				dTime = (double)realLength / _maxSpeed - (CFAbsoluteTimeGetCurrent() - time);
-				if(dTime > 0.0)
-				usleep(dTime * 1000000.0);
-			}
-			else if(maxSpeed) {
-				dTime = (double)realLength / maxSpeed;
-				OSSpinLockLock(&_downloadLock);
-				_downloadTime = MAX(_downloadTime, time) + dTime;
-				OSSpinLockUnlock(&_downloadLock);
-			}
+		return (compression->stream.avail_in == 0 ? YES : NO); //NOTE: Fail on trailing data after the end of the compressed data
+	}
+#endif
+	
+	return [self _writeBytes:bytes length:length toOutputStream:stream];
+}
+
+- (BOOL) openOutputStream:(NSOutputStream*)stream isFileTransfer:(BOOL)isFileTransfer
+{
+#if !TARGET_OS_IPHONE
+	NSInputStream*				input;
+	BOOL						success;
+#endif
+	
+	_totalSize = 0;
+	_fileTransfer = isFileTransfer;
+	if(_fileTransfer) {
+#if !TARGET_OS_IPHONE
+		if(![self _createDigestContext] || ![self _createCypherContext:YES] || ![self _createCompressionContext:NO])
+		return NO;
+#endif
+		_maxSpeed = ([self isLocalHost] ? 0.0 : _maxDownloadSpeed);
+		_speedBucketTime = 0;
+	}
+	else
+	_maxSpeed = 0.0;
+	
+	[stream open];
+	if([stream streamStatus] != NSStreamStatusOpen) {
+#if !TARGET_OS_IPHONE
+		[self _destroyCompressionContext];
+		[self _destroyCypherContext];
+		[self _destroyDigestContext];
+#endif
+		return NO;
+	}
+#if !TARGET_OS_IPHONE
+	if(_fileTransfer && _checkpointPath && _resumeOffset && _digestContext) { //NOTE: The digest must also cover the bytes already in the local file
+		input = [NSInputStream inputStreamWithFileAtPath:[_checkpoint objectForKey:kCheckpointKey_LocalPath]];
+		[input open];
+		success = [self _readResumedBytesFromStream:input];
+		[input close];
+		if(!success) {
+			[self _destroyCompressionContext];
+			[self _destroyCypherContext];
+			[self _destroyDigestContext];
+			[stream close];
+			return NO;
 		}
 	}
+#endif
+	[self _beginBandwidthAccounting:_downloadBuckets];
 	
-	if(success)
-	_totalSize += length;
+	return YES;
+}
+
+- (BOOL) writeToOutputStream:(NSOutputStream*)stream bytes:(const void*)bytes maxLength:(NSUInteger)length
+{
+	double						maxSpeed = (_fileTransfer && ![self isLocalHost] ? _maximumDownloadSpeed : 0.0);
+	BOOL						success = YES;
+	int							realLength;
+	void*						realBytes;
+	
+#if !TARGET_OS_IPHONE
+	if(_chunkedEncryption) {
+		success = [self _decryptChunkedBytes:bytes length:length final:NO];
+		realBytes = ((ChunkedEncryption*)_chunkedEncryption)->output;
+		realLength = ((ChunkedEncryption*)_chunkedEncryption)->outputLength;
+	}
+	else if(_encryptionContext) {
+		if(length + EVP_MAX_BLOCK_LENGTH != _encryptionBufferSize) {
+			_encryptionBufferSize = length + EVP_MAX_BLOCK_LENGTH;
+			free(_encryptionBufferBytes);
+			_encryptionBufferBytes = malloc(_encryptionBufferSize);
+		}
+		
+		realBytes = _encryptionBufferBytes;
+		if(EVP_DecryptUpdate(_encryptionContext, realBytes, &realLength, bytes, length) != 1)
+		success = NO;
+	}
+	else
+#endif
+	{
+		realBytes = (void*)bytes;
+		realLength = length;
+	}
+	
+	if(success && (realLength > 0)) {
+		success = [self _writeDecryptedBytes:realBytes length:realLength toOutputStream:stream];
+		
+		if(success)
+		[self _throttleLength:realLength maximumSpeed:maxSpeed];
+	}
+	
+	if(success) {
+		_totalSize += length;
+		if(_fileTransfer && _checkpointPath) {
+			_checkpointOffset += realLength;
+			if(_resumeValidator && (_checkpointOffset - _checkpointSavedOffset >= kCheckpointSaveInterval))
+			[self _saveCheckpoint];
+		}
+	}
 	
 	return success;
 }
@@ -532,50 +1130,37 @@ static CFTimeInterval					_downloadTime = 0.0,
 {
 	BOOL						success = YES;
 #if !TARGET_OS_IPHONE
-	int							offset = 0,
-								outLength,
-								numBytes;
+	int							outLength;
 	unsigned char				buffer[EVP_MAX_BLOCK_LENGTH];
 #endif
 	
 #if !TARGET_OS_IPHONE
-	if(_encryptionContext) {
+	if(_chunkedEncryption) {
+		success = [self _decryptChunkedBytes:NULL length:0 final:YES];
+		if(success)
+		success = [self _writeDecryptedBytes:((ChunkedEncryption*)_chunkedEncryption)->output length:((ChunkedEncryption*)_chunkedEncryption)->outputLength toOutputStream:stream];
+		
+		[self _destroyCypherContext];
+	}
+	else if(_encryptionContext) {
 		if(EVP_DecryptFinal(_encryptionContext, buffer, &outLength) != 1)
 		success = NO;
 		
 		[self _destroyCypherContext];
 		
-		if(success) {
-			success = NO;
-			while(1) {
-				numBytes = [stream write:((const uint8_t*)buffer + offset) maxLength:(outLength - offset)];
-				if(numBytes < 0)
-				break;
-				offset += numBytes;
-				if(offset == outLength) {
-					success = YES;
-					break;
-				}
-#ifdef __DEBUG__
-				NSLog(@"%s wrote only %i bytes out of %i", __FUNCTION__, numBytes, outLength - offset);
-#endif
-			}
-		}
-		
-		if(success && _digestContext) {
-			if(EVP_DigestUpdate(_digestContext, buffer, outLength) != 1)
-			success = NO;
-		}
+		if(success)
+		success = [self _writeDecryptedBytes:buffer length:outLength toOutputStream:stream];
 	}
 	
-	if(_digestContext) {
-		if(success) {
-			if(EVP_DigestFinal(_digestContext, _digestBuffer, (unsigned int*)&outLength) != 1)
-			success = NO;
-		}
-		
-		[self _destroyDigestContext];
+	if(success && _compressionContext && !((CompressionContext*)_compressionContext)->finished) {
+		NSLog(@"%s: Compressed data is truncated", __FUNCTION__);
+		success = NO;
 	}
+	
+	if(success)
+	success = [self _finalizeDigestContext];
+	else
+	[self _destroyDigestContext];
 #endif
 	
 	return success;
@@ -584,23 +1169,281 @@ static CFTimeInterval					_downloadTime = 0.0,
 - (void) closeOutputStream:(NSOutputStream*)stream
 {
 #if !TARGET_OS_IPHONE
+	[self _destroyCompressionContext];
 	[self _destroyCypherContext];
 	[self _destroyDigestContext];
 #endif
+	[self _endBandwidthAccounting];
 	
 	[stream close];
 }
 
+#if !TARGET_OS_IPHONE
+
+/* Reads data from the source stream and digests it */
+- (NSInteger) _readPlainFromInputStream:(NSInputStream*)stream bytes:(void*)bytes maxLength:(NSUInteger)length
+{
+	NSInteger					result = [stream read:bytes maxLength:length];
+	
+	if(result > 0) {
+		if(![self _updateDigestContextWithBytes:bytes length:result])
+		result = -1;
+	}
+	else if(result == 0) {
+		if(![self _finalizeDigestContext])
+		result = -1;
+	}
+	
+	return result;
+}
+
+/* Same as above but compresses the data if needed */
+- (NSInteger) _readSourceFromInputStream:(NSInputStream*)stream bytes:(void*)bytes maxLength:(NSUInteger)length
+{
+	CompressionContext*			compression = _compressionContext;
+	NSInteger					result;
+	int							error;
+	
+	if(compression == NULL)
+	return [self _readPlainFromInputStream:stream bytes:bytes maxLength:length];
+	
+	compression->stream.next_out = bytes;
+	compression->stream.avail_out = length;
+	while(!compression->finished && (compression->stream.avail_out == length)) {
+		if(!compression->endOfInput && (compression->stream.avail_in == 0)) {
+			result = [self _readPlainFromInputStream:stream bytes:compression->buffer maxLength:kCompressionBufferSize];
+			if(result < 0)
+			return -1;
+			if(result == 0)
+			compression->endOfInput = YES;
+			compression->stream.next_in = compression->buffer;
+			compression->stream.avail_in = result;
+		}
+		error = deflate(&compression->stream, (compression->endOfInput ? Z_FINISH : Z_NO_FLUSH));
+		if(error == Z_STREAM_END)
+		compression->finished = YES;
+		else if((error != Z_OK) && (error != Z_BUF_ERROR)) {
+			NSLog(@"%s: deflate() failed with error %i", __FUNCTION__, error);
+			return -1;
+		}
+	}
+	
+	return length - compression->stream.avail_out;
+}
+
+/* Called on the "compress" stage thread - The output block is large enough to hold the compressed input in one call */
+- (BOOL) _compressUploadPipelineBlock:(const BlockPipelineBlock*)input toBlock:(BlockPipelineBlock*)output
+{
+	CompressionContext*			compression = _compressionContext;
+	int							error;
+	
+	compression->stream.next_in = input->bytes;
+	compression->stream.avail_in = input->length;
+	compression->stream.next_out = output->bytes;
+	compression->stream.avail_out = output->capacity;
+	error = deflate(&compression->stream, (input->final ? Z_FINISH : Z_NO_FLUSH));
+	if(error != (input->final ? Z_STREAM_END : Z_OK)) { //NOTE: Only the final block can be empty
+		NSLog(@"%s: deflate() failed with error %i", __FUNCTION__, error);
+		return NO;
+	}
+	output->length = output->capacity - compression->stream.avail_out;
+	
+	return (compression->stream.avail_in == 0 ? YES : NO);
+}
+
+/* Called on the "encrypt" stage thread - Partial chunks are kept in the chunked encryption input buffer until the next block */
+- (BOOL) _encryptUploadPipelineBlock:(const BlockPipelineBlock*)input toBlock:(BlockPipelineBlock*)output
+{
+	ChunkedEncryption*			encryption = _chunkedEncryption;
+	const unsigned char*		bytes = input->bytes;
+	NSUInteger					chunkSize,
+								count;
+	int							length;
+	long						outLength;
+	
+	if(encryption) {
+		if(!encryption->headerDone) {
+			bcopy(ChunkedCipherGetHeader(encryption->cipher), output->bytes, kChunkedCipherHeaderSize);
+			output->length = kChunkedCipherHeaderSize;
+			encryption->headerDone = YES;
+		}
+		chunkSize = ChunkedCipherGetChunkSize(encryption->cipher);
+		count = input->length;
+		if(encryption->inputLength || (!input->final && (count % chunkSize))) {
+			bcopy(input->bytes, encryption->input + encryption->inputLength, input->length); //NOTE: The capacity was adjusted when creating the pipeline
+			encryption->inputLength += input->length;
+			bytes = encryption->input;
+			count = encryption->inputLength;
+		}
+		if(!input->final)
+		count = count / chunkSize * chunkSize;
+		outLength = ChunkedCipherProcess(encryption->cipher, bytes, count, output->bytes + output->length, encryption->index, input->final);
+		if(outLength < 0)
+		return NO;
+		encryption->index += count / chunkSize;
+		output->length += outLength;
+		if(bytes == encryption->input) {
+			encryption->inputLength -= count;
+			memmove(encryption->input, encryption->input + count, encryption->inputLength);
+		}
+	}
+	else {
+		if(EVP_EncryptUpdate(_encryptionContext, output->bytes, &length, input->bytes, input->length) != 1)
+		return NO;
+		output->length = length;
+		if(input->final) {
+			if(EVP_EncryptFinal(_encryptionContext, output->bytes + output->length, &length) != 1)
+			return NO;
+			output->length += length;
+		}
+	}
+	
+	return YES;
+}
+
+static NSInteger _UploadPipelineSourceCallback(void* info, void* bytes, NSUInteger maxLength)
+{
+	UploadPipeline*				upload = (UploadPipeline*)info;
+	NSAutoreleasePool*			pool = [NSAutoreleasePool new];
+	NSInteger					result;
+	
+	result = [upload->controller _readPlainFromInputStream:upload->stream bytes:bytes maxLength:maxLength];
+	
+	[pool release];
+	return result;
+}
+
+static BOOL _UploadPipelineCompressCallback(void* info, const BlockPipelineBlock* input, BlockPipelineBlock* output)
+{
+	UploadPipeline*				upload = (UploadPipeline*)info;
+	
+	return [upload->controller _compressUploadPipelineBlock:input toBlock:output];
+}
+
+static BOOL _UploadPipelineEncryptCallback(void* info, const BlockPipelineBlock* input, BlockPipelineBlock* output)
+{
+	UploadPipeline*				upload = (UploadPipeline*)info;
+	
+	return [upload->controller _encryptUploadPipelineBlock:input toBlock:output];
+}
+
+- (void) _destroyUploadPipeline
+{
+	UploadPipeline*				upload = _uploadPipeline;
+	BlockPipelineStageStatistics	statistics[kBlockPipelineMaxStages];
+	NSMutableArray*				array;
+	NSUInteger					count,
+								i;
+	
+	if(upload) {
+		count = BlockPipelineGetStatistics(upload->pipeline, statistics, kBlockPipelineMaxStages);
+		array = [NSMutableArray new];
+		for(i = 0; i < count; ++i)
+		[array addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+			[NSString stringWithUTF8String:statistics[i].name], kFileTransferPipelineStatisticsKey_Stage,
+			[NSNumber numberWithDouble:statistics[i].busyTime], kFileTransferPipelineStatisticsKey_BusyTime,
+			[NSNumber numberWithDouble:statistics[i].starvedTime], kFileTransferPipelineStatisticsKey_StarvedTime,
+			[NSNumber numberWithDouble:statistics[i].blockedTime], kFileTransferPipelineStatisticsKey_BlockedTime,
+			[NSNumber numberWithDouble:statistics[i].occupancy], kFileTransferPipelineStatisticsKey_Occupancy,
+			nil]];
+		[_pipelineStatistics release];
+		_pipelineStatistics = array;
+		
+		BlockPipelineDestroy(upload->pipeline);
+		free(upload);
+		_uploadPipeline = NULL;
+	}
+}
+
+- (BOOL) _createUploadPipeline:(NSInputStream*)stream
+{
+	ChunkedEncryption*			encryption = _chunkedEncryption;
+	NSUInteger					blockSize = kUploadPipelineBlockSize,
+								compressCapacity = 0,
+								encryptCapacity = 0,
+								inputCapacity,
+								chunkSize;
+	UploadPipeline*				upload;
+	
+	if(encryption) {
+		chunkSize = ChunkedCipherGetChunkSize(encryption->cipher);
+		blockSize = MAX(blockSize / chunkSize, 1) * chunkSize;
+	}
+	if(_compressionContext)
+	compressCapacity = deflateBound(&((CompressionContext*)_compressionContext)->stream, blockSize) + kCompressionBufferSize; //NOTE: Leave room for data held back by previous blocks
+	inputCapacity = (compressCapacity ? compressCapacity : blockSize);
+	if(encryption) {
+		if(compressCapacity) {
+			inputCapacity += chunkSize;
+			if(encryption->inputCapacity < inputCapacity) {
+				encryption->inputCapacity = inputCapacity;
+				encryption->input = realloc(encryption->input, encryption->inputCapacity);
+			}
+		}
+		encryptCapacity = kChunkedCipherHeaderSize + inputCapacity + (inputCapacity / chunkSize + 1) * kChunkedCipherTagSize;
+	}
+	else if(_encryptionContext)
+	encryptCapacity = inputCapacity + 2 * EVP_MAX_BLOCK_LENGTH;
+	
+	upload = calloc(1, sizeof(UploadPipeline));
+	upload->stream = stream;
+	upload->controller = self;
+	upload->pipeline = BlockPipelineCreate("read", _UploadPipelineSourceCallback, upload, blockSize, kUploadPipelineBlockCount, "send");
+	if(upload->pipeline == NULL) {
+		free(upload);
+		return NO;
+	}
+	_uploadPipeline = upload;
+	
+	if(compressCapacity && !BlockPipelineAddStage(upload->pipeline, "compress", _UploadPipelineCompressCallback, upload, compressCapacity)) {
+		[self _destroyUploadPipeline];
+		return NO;
+	}
+	if(encryptCapacity && !BlockPipelineAddStage(upload->pipeline, "encrypt", _UploadPipelineEncryptCallback, upload, encryptCapacity)) {
+		[self _destroyUploadPipeline];
+		return NO;
+	}
+	if(!BlockPipelineStart(upload->pipeline)) {
+		[self _destroyUploadPipeline];
+		return NO;
+	}
+	
+	return YES;
+}
+
+- (NSInteger) _readFromUploadPipeline:(void*)bytes maxLength:(NSUInteger)length maximumSpeed:(double)maxSpeed
+{
+	NSInteger					result;
+	
+	result = BlockPipelineRead(((UploadPipeline*)_uploadPipeline)->pipeline, bytes, length);
+	if((result < 0) && BlockPipelineGetError(((UploadPipeline*)_uploadPipeline)->pipeline))
+	NSLog(@"%s: Upload pipeline failed with error \"%@\"", __FUNCTION__, [BlockPipelineGetError(((UploadPipeline*)_uploadPipeline)->pipeline) localizedDescription]);
+	
+	if(result > 0)
+	[self _throttleLength:result maximumSpeed:maxSpeed];
+	
+	return result;
+}
+
+#endif
+
 - (BOOL) openInputStream:(NSInputStream*)stream isFileTransfer:(BOOL)isFileTransfer
 {
+	BOOL						success = YES;
+	
 	_totalSize = 0;
 	_fileTransfer = isFileTransfer;
+#if !TARGET_OS_IPHONE
+	[_pipelineStatistics release];
+	_pipelineStatistics = nil;
+#endif
 	if(_fileTransfer) {
 #if !TARGET_OS_IPHONE
-		if(![self _createDigestContext] || ![self _createCypherContext:NO])
+		if(![self _createDigestContext] || ![self _createCypherContext:NO] || ![self _createCompressionContext:YES])
 		return NO;
 #endif
 		_maxSpeed = ([self isLocalHost] ? 0.0 : _maxUploadSpeed);
+		_speedBucketTime = 0;
 	}
 	else
 	_maxSpeed = 0.0;
@@ -608,28 +1451,113 @@ static CFTimeInterval					_downloadTime = 0.0,
 	[stream open];
 	if([stream streamStatus] != NSStreamStatusOpen) {
 #if !TARGET_OS_IPHONE
+		[self _destroyCompressionContext];
 		[self _destroyCypherContext];
 		[self _destroyDigestContext];
 #endif
 		return NO;
 	}
+	if(_fileTransfer && _checkpointPath && _resumeOffset) { //NOTE: Skip the bytes already uploaded but still digest them
+#if !TARGET_OS_IPHONE
+		if(_digestContext)
+		success = [self _readResumedBytesFromStream:stream];
+		else
+#endif
+		success = ([stream setProperty:[NSNumber numberWithUnsignedLongLong:_resumeOffset] forKey:NSStreamFileCurrentOffsetKey] || [self _readResumedBytesFromStream:stream]);
+	}
+#if !TARGET_OS_IPHONE
+	if(success && _fileTransfer && _pipelinedUploads && ![self _createUploadPipeline:stream])
+	success = NO;
+#endif
+	if(!success) {
+#if !TARGET_OS_IPHONE
+		[self _destroyCompressionContext];
+		[self _destroyCypherContext];
+		[self _destroyDigestContext];
+#endif
+		[stream close];
+		return NO;
+	}
+	[self _beginBandwidthAccounting:_uploadBuckets];
 	
 	return YES;
 }
 
+#if !TARGET_OS_IPHONE
+
+/* Reads plain data in batches of chunks, encrypts them in parallel and returns the encrypted data (starting with the header) in pieces of at most "length" bytes */
+- (NSInteger) _readChunkedFromInputStream:(NSInputStream*)stream bytes:(void*)bytes maxLength:(NSUInteger)length maximumSpeed:(double)maxSpeed
+{
+	ChunkedEncryption*			encryption = _chunkedEncryption;
+	NSUInteger					chunkSize = ChunkedCipherGetChunkSize(encryption->cipher),
+								count;
+	NSInteger					result;
+	long						outLength;
+	
+	while(encryption->outputOffset == encryption->outputLength) {
+		if(encryption->finished)
+		return 0;
+		encryption->outputOffset = 0;
+		encryption->outputLength = 0;
+		
+		if(!encryption->headerDone) {
+			bcopy(ChunkedCipherGetHeader(encryption->cipher), encryption->output, kChunkedCipherHeaderSize);
+			encryption->outputLength = kChunkedCipherHeaderSize;
+			encryption->headerDone = YES;
+			break;
+		}
+		
+		result = [self _readSourceFromInputStream:stream bytes:(encryption->input + encryption->inputLength) maxLength:(encryption->inputCapacity - encryption->inputLength)];
+		if(result < 0)
+		return -1;
+		
+		if(result > 0) {
+			[self _throttleLength:result maximumSpeed:maxSpeed];
+			
+			encryption->inputLength += result;
+			
+			count = encryption->inputLength / chunkSize * chunkSize;
+			if(count == 0)
+			continue;
+			outLength = ChunkedCipherProcess(encryption->cipher, encryption->input, count, encryption->output, encryption->index, NO);
+			encryption->index += count / chunkSize;
+			encryption->inputLength -= count;
+			memmove(encryption->input, encryption->input + count, encryption->inputLength);
+		}
+		else {
+			outLength = ChunkedCipherProcess(encryption->cipher, encryption->input, encryption->inputLength, encryption->output, encryption->index, YES);
+			encryption->inputLength = 0;
+			encryption->finished = YES;
+		}
+		if(outLength < 0)
+		return -1;
+		encryption->outputLength = outLength;
+	}
+	
+	result = MIN(length, encryption->outputLength - encryption->outputOffset);
+	bcopy(encryption->output + encryption->outputOffset, bytes, result);
+	encryption->outputOffset += result;
+	
+	return result;
+}
+
+#endif
+
 - (NSInteger) readFromInputStream:(NSInputStream*)stream bytes:(void*)bytes maxLength:(NSUInteger)length
 {
 	double						maxSpeed = (_fileTransfer && ![self isLocalHost] ? _maximumUploadSpeed : 0.0);
-	CFAbsoluteTime				time = 0.0;
 	NSInteger					result;
-	CFTimeInterval				dTime;
 #if !TARGET_OS_IPHONE
 	void*						newBytes;
 	int							newLength;
 #endif
 	
 #if !TARGET_OS_IPHONE
-	if(_encryptionContext) {
+	if(_uploadPipeline)
+	result = [self _readFromUploadPipeline:bytes maxLength:length maximumSpeed:maxSpeed];
+	else if(_chunkedEncryption)
+	result = [self _readChunkedFromInputStream:stream bytes:bytes maxLength:length maximumSpeed:maxSpeed];
+	else if(_encryptionContext) {
 		if(length <= EVP_MAX_BLOCK_LENGTH)
 		return -1;
 		
@@ -639,62 +1567,23 @@ static CFTimeInterval					_downloadTime = 0.0,
 			_encryptionBufferBytes = malloc(_encryptionBufferSize);
 		}
 		
-		if(_maxSpeed)
-		time = CFAbsoluteTimeGetCurrent();
-		else if(maxSpeed) {
-			while(1) {
-				time = CFAbsoluteTimeGetCurrent();
-				OSSpinLockLock(&_uploadLock);
-				dTime = _uploadTime - time;
-				OSSpinLockUnlock(&_uploadLock);
-				if(dTime <= 0.0)
-				break;
-				usleep(dTime * 1000000.0);
-			}
-		}
-		
 		newBytes = _encryptionBufferBytes;
-		result = [stream read:newBytes maxLength:(length - EVP_MAX_BLOCK_LENGTH)];
+		result = [self _readSourceFromInputStream:stream bytes:newBytes maxLength:(length - EVP_MAX_BLOCK_LENGTH)];
 		
-		if(result > 0) {
-			if(_maxSpeed) {
-				dTime = (double)result / _maxSpeed - (CFAbsoluteTimeGetCurrent() - time);
-				if(dTime > 0.0)
-				usleep(dTime * 1000000.0);
-			}
-			else if(maxSpeed) {
-				dTime = (double)result / maxSpeed;
-				OSSpinLockLock(&_uploadLock);
-				_uploadTime = MAX(_uploadTime, time) + dTime;
-				OSSpinLockUnlock(&_uploadLock);
-			}
-		}
+		if(result > 0)
+		[self _throttleLength:result maximumSpeed:maxSpeed];
 		
 		if(result > 0) {
-			if(_digestContext) {
-				if(EVP_DigestUpdate(_digestContext, newBytes, result) != 1)
-				result = -1;
-			}
-			
-			if(result > 0) {
-				if(EVP_EncryptUpdate(_encryptionContext, bytes, &newLength, newBytes, result) == 1) //FIXME: We should encrypt directly into "bytes" if there's enough room
-				result = newLength;
-				else
-				result = -1;
-			}
+			if(EVP_EncryptUpdate(_encryptionContext, bytes, &newLength, newBytes, result) == 1) //FIXME: We should encrypt directly into "bytes" if there's enough room
+			result = newLength;
+			else
+			result = -1;
 		}
 		if(result == 0) { //HACK: CFReadStreamCreateForStreamedHTTPRequest() will stop reading when reaching Content-Length, so NSInputStream may never have an opportunity to return 0
-			if(_digestContext) {
-				if(EVP_DigestFinal(_digestContext, _digestBuffer, (unsigned int*)&newLength) != 1)
-				result = -1;
-			}
-			
-			if(result == 0) {
-				if(EVP_EncryptFinal(_encryptionContext, bytes, &newLength) == 1)
-				result = newLength;
-				else
-				result = -1;
-			}
+			if(EVP_EncryptFinal(_encryptionContext, bytes, &newLength) == 1)
+			result = newLength;
+			else
+			result = -1;
 			
 			[self _destroyCypherContext];
 			[self _destroyDigestContext];
@@ -703,48 +1592,19 @@ static CFTimeInterval					_downloadTime = 0.0,
 	else
 #endif
 	{
-		if(_maxSpeed)
-		time = CFAbsoluteTimeGetCurrent();
-		else if(maxSpeed) {
-			while(1) {
-				time = CFAbsoluteTimeGetCurrent();
-				OSSpinLockLock(&_uploadLock);
-				dTime = _uploadTime - time;
-				OSSpinLockUnlock(&_uploadLock);
-				if(dTime <= 0.0)
-				break;
-				usleep(dTime * 1000000.0);
-			}
-		}
-		
+#if !TARGET_OS_IPHONE
+		result = [self _readSourceFromInputStream:stream bytes:bytes maxLength:length];
+#else
 		result = [stream read:bytes maxLength:length];
+#endif
 		
-		if(result > 0) {
-			if(_maxSpeed) {
-				dTime = (double)result / _maxSpeed - (CFAbsoluteTimeGetCurrent() - time);
-				if(dTime > 0.0)
-				usleep(dTime * 1000000.0);
-			}
-			else if(maxSpeed) {
-				dTime = (double)result / maxSpeed;
-				OSSpinLockLock(&_uploadLock);
-				_uploadTime = MAX(_uploadTime, time) + dTime;
-				OSSpinLockUnlock(&_uploadLock);
-			}
-		}
+		if(result > 0)
+		[self _throttleLength:result maximumSpeed:maxSpeed];
 		
 #if !TARGET_OS_IPHONE
-		if(_digestContext) {
-			if(result > 0) {
-				if(EVP_DigestUpdate(_digestContext, bytes, result) != 1)
-				result = -1;
-			}
-			if((result == 0) || (_currentLength + result == _maxLength)) { //HACK: CFReadStreamCreateForStreamedHTTPRequest() will stop reading when reaching Content-Length, so NSInputStream may never have an opportunity to return 0
-				if(EVP_DigestFinal(_digestContext, _digestBuffer, (unsigned int*)&newLength) != 1)
-				result = -1;
-				
-				[self _destroyDigestContext];
-			}
+		if(_digestContext && (result > 0) && (_currentLength + result == _maxLength)) { //HACK: CFReadStreamCreateForStreamedHTTPRequest() will stop reading when reaching Content-Length, so NSInputStream may never have an opportunity to return 0
+			if(![self _finalizeDigestContext])
+			result = -1;
 		}
 #endif
 	}
@@ -758,9 +1618,12 @@ static CFTimeInterval					_downloadTime = 0.0,
 - (void) closeInputStream:(NSInputStream*)stream
 {
 #if !TARGET_OS_IPHONE
+	[self _destroyUploadPipeline];
+	[self _destroyCompressionContext];
 	[self _destroyCypherContext];
 	[self _destroyDigestContext];
 #endif
+	[self _endBandwidthAccounting];
 	
 	[stream close];
 }
@@ -769,15 +1632,83 @@ static CFTimeInterval					_downloadTime = 0.0,
 
 @implementation FileTransferController (Extensions)
 
-- (BOOL) uploadFileToPath:(NSString*)remotePath fromStream:(NSInputStream*)stream length:(NSUInteger)length
+/* Sets the length of the data actually transferred for "length" bytes of source data */
+- (void) _setMaxLengthForSourceLength:(NSUInteger)length
 {
-	BOOL					success;
-	
 #if !TARGET_OS_IPHONE
-	if([self encryptionPassword])
-	length = (length / kEncryptionCipherBlockSize + 1) * kEncryptionCipherBlockSize;
+	_plainLength = length;
+	if(_compressionFormat != kFileTransferCompressionFormat_None)
+	length = 0; //NOTE: The compressed length is not known in advance
+	else if(_encryptionPassword)
+	length = [FileTransferController encryptedLengthForLength:length encryptionFormat:_encryptionFormat];
 #endif
 	[self setMaxLength:length];
+}
+
+- (BOOL) _canResumeTransfer:(BOOL)upload
+{
+	if(_checkpointDirectory == nil)
+	return NO;
+#if !TARGET_OS_IPHONE
+	if(_encryptionPassword || (_compressionFormat != kFileTransferCompressionFormat_None))
+	return NO;
+#endif
+	
+	return (upload ? [[self class] hasResumableUploads] : [[self class] hasResumableDownloads]);
+}
+
+/* Starts recording a checkpoint for the transfer and returns the previous one if any */
+- (NSDictionary*) _beginCheckpointForLocalPath:(NSString*)localPath remotePath:(NSString*)remotePath upload:(BOOL)upload
+{
+	NSString*				url = [[self absoluteURLForRemotePath:remotePath] absoluteString];
+	NSMutableString*		name = [NSMutableString string];
+	unsigned char			md5[CC_MD5_DIGEST_LENGTH];
+	NSDictionary*			checkpoint;
+	NSData*					data;
+	NSUInteger				i;
+	
+	data = [[NSString stringWithFormat:@"%@\n%@\n%@", (upload ? @"upload" : @"download"), url, localPath] dataUsingEncoding:NSUTF8StringEncoding];
+	CC_MD5([data bytes], [data length], md5);
+	for(i = 0; i < CC_MD5_DIGEST_LENGTH; ++i)
+	[name appendFormat:@"%02x", md5[i]];
+	[_checkpointPath release];
+	_checkpointPath = [[_checkpointDirectory stringByAppendingPathComponent:[name stringByAppendingPathExtension:@"checkpoint"]] copy];
+	
+	checkpoint = [NSDictionary dictionaryWithContentsOfFile:_checkpointPath];
+	if(![[checkpoint objectForKey:kCheckpointKey_URL] isEqual:url] || ![[checkpoint objectForKey:kCheckpointKey_LocalPath] isEqual:localPath])
+	checkpoint = nil;
+	
+	[_checkpoint release];
+	_checkpoint = [[NSMutableDictionary alloc] initWithObjectsAndKeys:url, kCheckpointKey_URL, localPath, kCheckpointKey_LocalPath, nil];
+	
+	return checkpoint;
+}
+
+/* Saves the checkpoint if "keep" is YES or deletes it - Returns YES if the checkpoint was saved */
+- (BOOL) _endCheckpoint:(BOOL)keep
+{
+	BOOL					saved = NO;
+	
+	if(keep) {
+		[self _saveCheckpoint];
+		saved = (_checkpointSavedOffset == _checkpointOffset);
+	}
+	if(!saved)
+	unlink([_checkpointPath fileSystemRepresentation]);
+	
+	[_checkpoint release];
+	_checkpoint = nil;
+	[_checkpointPath release];
+	_checkpointPath = nil;
+	
+	return saved;
+}
+
+- (BOOL) uploadFileToPath:(NSString*)remotePath fromStream:(NSInputStream*)stream length:(NSUInteger)length
+{
+	BOOL					success;
+	
+	[self _setMaxLengthForSourceLength:length];
 	
 	success = [self uploadFileToPath:remotePath fromStream:stream];
 	
@@ -794,13 +1725,45 @@ static CFTimeInterval					_downloadTime = 0.0,
 	NSOutputStream*			stream;
 	BOOL					success;
 	NSError*				error;
+	NSDictionary*			checkpoint;
+	NSDictionary*			info;
+	unsigned long long		offset = 0;
 	
 	localPath = [localPath stringByStandardizingPath];
-	stream = [NSOutputStream outputStreamToFileAtPath:localPath append:NO];
-	if(stream == nil)
-	return NO;
-	
-	success = [self downloadFileFromPath:remotePath toStream:stream];
+	if([self _canResumeTransfer:NO]) {
+		checkpoint = [self _beginCheckpointForLocalPath:localPath remotePath:remotePath upload:NO];
+		if([checkpoint objectForKey:kCheckpointKey_Validator]) {
+			info = [[NSFileManager defaultManager] attributesOfItemAtPath:localPath error:NULL];
+			offset = [[checkpoint objectForKey:kCheckpointKey_Offset] unsignedLongLongValue];
+			if(([[info objectForKey:NSFileSize] unsignedLongLongValue] < offset) || (truncate([localPath fileSystemRepresentation], offset) != 0)) //NOTE: Discard anything written after the checkpoint was saved
+			offset = 0;
+		}
+		
+		while(1) {
+			_resumeOffset = offset;
+			_checkpointOffset = offset;
+			_checkpointSavedOffset = offset;
+			[self setResumeValidator:(offset ? [checkpoint objectForKey:kCheckpointKey_Validator] : nil)];
+			
+			stream = [NSOutputStream outputStreamToFileAtPath:localPath append:(offset > 0)];
+			success = (stream ? [self downloadFileFromPath:remotePath toStream:stream] : NO);
+			if(!success && offset && !_resumeOffset) { //NOTE: The remote file changed since the checkpoint so start over
+				offset = 0;
+				continue;
+			}
+			break;
+		}
+		
+		if([self _endCheckpoint:(!success && _resumeValidator && _checkpointOffset)])
+		return NO;
+	}
+	else {
+		stream = [NSOutputStream outputStreamToFileAtPath:localPath append:NO];
+		if(stream == nil)
+		return NO;
+		
+		success = [self downloadFileFromPath:remotePath toStream:stream];
+	}
 	
 	if(!success && ([stream streamStatus] > NSStreamStatusNotOpen)) {
 		if(![[NSFileManager defaultManager] removeItemAtPath:localPath error:&error])
@@ -810,11 +1773,41 @@ static CFTimeInterval					_downloadTime = 0.0,
 	return success;
 }
 
+/* Downloads the remote file to check it matches the beginning of the local file before an upload is resumed */
+- (BOOL) _remoteFileAtPath:(NSString*)remotePath isPrefixOfLocalFile:(NSString*)localPath
+{
+	id						delegate = [self delegate];
+	NSString*				checkpointPath = _checkpointPath;
+	FileTransferPrefixVerifier*	verifier;
+	DataWriteStream*		stream;
+	BOOL					success = NO;
+	
+	verifier = [[FileTransferPrefixVerifier alloc] initWithFileAtPath:localPath];
+	if(verifier) {
+		stream = [[DataWriteStream alloc] initWithDataDestination:verifier userInfo:nil];
+		_checkpointPath = nil; //NOTE: Keep the download away from the upload checkpoint
+		_resumeOffset = 0;
+		[self setResumeValidator:nil];
+		[self setDelegate:nil];
+		success = ([self downloadFileFromPath:remotePath toStream:stream] && ![verifier isMismatch]);
+		[self setDelegate:delegate];
+		_checkpointPath = checkpointPath;
+		[stream release];
+		[verifier release];
+	}
+	
+	return success;
+}
+
 - (BOOL) uploadFileFromPath:(NSString*)localPath toPath:(NSString*)remotePath
 {
+	unsigned long long		offset = 0;
 	NSDictionary*			info;
 	BOOL					success;
-	NSUInteger				maxLength;
+	unsigned long long		length;
+	NSDictionary*			checkpoint;
+	NSString*				validator;
+	long long				remoteSize;
 	
 	localPath = [localPath stringByStandardizingPath];
 	while(1) {
@@ -827,15 +1820,28 @@ static CFTimeInterval					_downloadTime = 0.0,
 		break;
 	}
 	
-	maxLength = [[info objectForKey:NSFileSize] unsignedIntegerValue];
-#if !TARGET_OS_IPHONE
-	if([self encryptionPassword])
-	maxLength = (maxLength / kEncryptionCipherBlockSize + 1) * kEncryptionCipherBlockSize;
-#endif
-	[self setMaxLength:maxLength];
+	length = [[info objectForKey:NSFileSize] unsignedLongLongValue];
+	if([self _canResumeTransfer:YES]) {
+		checkpoint = [self _beginCheckpointForLocalPath:localPath remotePath:remotePath upload:YES];
+		validator = [NSString stringWithFormat:@"%llu-%.0f", length, [[info objectForKey:NSFileModificationDate] timeIntervalSinceReferenceDate]];
+		if([[checkpoint objectForKey:kCheckpointKey_Validator] isEqualToString:validator]) { //NOTE: The remote file should hold the bytes uploaded so far but it may have been replaced since
+			remoteSize = [self _sizeOfRemoteFileAtPath:remotePath];
+			if((remoteSize > 0) && (remoteSize <= length) && [self _remoteFileAtPath:remotePath isPrefixOfLocalFile:localPath])
+			offset = remoteSize;
+		}
+		[self setResumeValidator:validator];
+		_checkpointOffset = offset;
+		[self _saveCheckpoint]; //NOTE: Save the checkpoint before starting so the upload can be resumed even if the process dies
+		_resumeOffset = offset;
+	}
+	
+	[self _setMaxLengthForSourceLength:(length - offset)];
 	
 	success = [self uploadFileToPath:remotePath fromStream:[NSInputStream inputStreamWithFileAtPath:localPath]];
 	
+	if(_checkpointPath)
+	[self _endCheckpoint:!success];
+	
 	return success;
 }
 
@@ -853,17 +1859,11 @@ static CFTimeInterval					_downloadTime = 0.0,
 - (BOOL) uploadFileFromData:(NSData*)data toPath:(NSString*)remotePath
 {
 	BOOL					success;
-	NSUInteger				maxLength;
 	
 	if(data == nil)
 	return NO;
 	
-	maxLength = [data length];
-#if !TARGET_OS_IPHONE
-	if([self encryptionPassword])
-	maxLength = (maxLength / kEncryptionCipherBlockSize + 1) * kEncryptionCipherBlockSize;
-#endif
-	[self setMaxLength:maxLength];
+	[self _setMaxLengthForSourceLength:[data length]];
 	
 	success = [self uploadFileToPath:remotePath fromStream:[NSInputStream inputStreamWithData:data]];
 	
@@ -925,19 +1925,13 @@ static CFTimeInterval					_downloadTime = 0.0,
 - (BOOL) uploadFileFromBytes:(const void*)bytes length:(NSUInteger)length toPath:(NSString*)remotePath
 {
 	BOOL					success;
-	NSUInteger				maxLength;
 	DataReadStream*			readStream;
 	DataInfo				info;
 	
 	if(bytes == NULL)
 	return NO;
 	
-	maxLength = length;
-#if !TARGET_OS_IPHONE
-	if([self encryptionPassword])
-	maxLength = (maxLength / kEncryptionCipherBlockSize + 1) * kEncryptionCipherBlockSize;
-#endif
-	[self setMaxLength:maxLength];
+	[self _setMaxLengthForSourceLength:length];
 	
 	info.buffer = (void*)bytes;
 	info.size = length;
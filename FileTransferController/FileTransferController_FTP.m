@@ -50,6 +50,16 @@ static inline NSError* _MakeCURLError(CURLcode code, const char* message, id tra
 	return @"ftp";
 }
 
++ (BOOL) hasResumableDownloads
+{
+	return YES;
+}
+
++ (BOOL) hasResumableUploads
+{
+	return YES;
+}
+
 - (id) initWithBaseURL:(NSURL*)url
 {
 	if((self = [super initWithBaseURL:url])) {
@@ -171,12 +181,38 @@ static int _WriteProgressCallback(void* clientp, double dltotal, double dlnow, d
 	return (params[2] ? [[self delegate] fileTransferControllerShouldAbort:self] : 0);
 }
 
+/* Called before writing the first downloaded bytes - Returns NO if the remote file changed since the interrupted transfer being resumed */
+- (BOOL) _updateResumeValidator
+{
+	double					length = -1.0;
+	long					time = -1;
+	NSString*				validator = nil;
+	
+	curl_easy_getinfo(_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &length); //NOTE: This excludes the skipped bytes
+	curl_easy_getinfo(_handle, CURLINFO_FILETIME, &time);
+	if(length >= 0.0)
+	validator = [NSString stringWithFormat:@"%.0f-%li", (double)[self resumeOffset] + length, time];
+	if([self resumeOffset] && ![validator isEqualToString:[self resumeValidator]]) {
+		[self setResumeOffset:0];
+		return NO;
+	}
+	[self setResumeValidator:validator];
+	
+	return YES;
+}
+
 static size_t _WriteCallback(void* buffer, size_t size, size_t nmemb, void* userp)
 {
 	void**					params = (void*)userp;
 	FTPTransferController*	self = (FTPTransferController*)params[0];
 	NSOutputStream*			stream = (NSOutputStream*)params[1];
 	
+	if(params[3] == NULL) {
+		if(![self _updateResumeValidator])
+		return -1;
+		params[3] = self;
+	}
+	
 	return ([self writeToOutputStream:stream bytes:buffer maxLength:(size * nmemb)] ? size * nmemb : -1);
 }
 
@@ -184,7 +220,7 @@ static size_t _WriteCallback(void* buffer, size_t size, size_t nmemb, void* user
 {
 	NSURL*					url = [self fullAbsoluteURLForRemotePath:remotePath];
 	BOOL					success = NO;
-	void*					params[3];
+	void*					params[4];
 	CURLcode				result;
 	char					buffer[CURL_ERROR_SIZE];
 	NSError*				error;
@@ -195,6 +231,7 @@ static size_t _WriteCallback(void* buffer, size_t size, size_t nmemb, void* user
 	params[0] = self;
 	params[1] = stream;
 	params[2] = ([[self delegate] respondsToSelector:@selector(fileTransferControllerShouldAbort:)] ? self : NULL);
+	params[3] = NULL;
 	
 	[self _reset];
 	curl_easy_setopt(_handle, CURLOPT_URL, [self _convertURL:url]);
@@ -204,12 +241,22 @@ static size_t _WriteCallback(void* buffer, size_t size, size_t nmemb, void* user
 	curl_easy_setopt(_handle, CURLOPT_NOPROGRESS, (long)0);
 	curl_easy_setopt(_handle, CURLOPT_PROGRESSFUNCTION, _WriteProgressCallback);
 	curl_easy_setopt(_handle, CURLOPT_PROGRESSDATA, params);
+	if([self checkpointDirectory])
+	curl_easy_setopt(_handle, CURLOPT_FILETIME, (long)1);
+	if([self resumeOffset])
+	curl_easy_setopt(_handle, CURLOPT_RESUME_FROM_LARGE, (curl_off_t)[self resumeOffset]);
 	
 	if([self openOutputStream:stream isFileTransfer:YES]) {
 		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
 		[[self delegate] fileTransferControllerDidStart:self];
 		
 		result = curl_easy_perform(_handle);
+		if((result == CURLE_OK) && (params[3] == NULL) && ![self _updateResumeValidator]) { //NOTE: No data was received so the remote file has not been checked yet
+			strlcpy(buffer, "Remote file was modified since the transfer was interrupted", CURL_ERROR_SIZE);
+			result = CURLE_BAD_DOWNLOAD_RESUME;
+		}
+		else if(result == CURLE_BAD_DOWNLOAD_RESUME) //NOTE: The remote file is now shorter than the resume offset
+		[self setResumeOffset:0];
 		if(result == CURLE_OK) {
 			if([self flushOutputStream:stream]) {
 				if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
@@ -275,7 +322,9 @@ static size_t _ReadCallback(char* bufptr, size_t size, size_t nitems, void* user
 	curl_easy_setopt(_handle, CURLOPT_PROGRESSFUNCTION, _ReadProgressCallback);
 	curl_easy_setopt(_handle, CURLOPT_PROGRESSDATA, params);
 	curl_easy_setopt(_handle, CURLOPT_UPLOAD, (long)1);
-	curl_easy_setopt(_handle, CURLOPT_INFILESIZE, (long)[self maxLength]);
+	curl_easy_setopt(_handle, CURLOPT_INFILESIZE, ([self maxLength] ? (long)[self maxLength] : (long)-1)); //NOTE: The length of compressed uploads is not known in advance
+	if([self resumeOffset]) //NOTE: The input stream has already been positioned at the resume offset
+	curl_easy_setopt(_handle, CURLOPT_FTPAPPEND, (long)1);
 	
 	if([self openInputStream:stream isFileTransfer:YES]) {
 		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
@@ -298,6 +347,20 @@ static size_t _ReadCallback(char* bufptr, size_t size, size_t nitems, void* user
 	return success;
 }
 
+- (long long) _sizeOfRemoteFileAtPath:(NSString*)remotePath
+{
+	NSURL*					url = [self fullAbsoluteURLForRemotePath:remotePath];
+	double					length = -1.0;
+	
+	[self _reset];
+	curl_easy_setopt(_handle, CURLOPT_URL, [self _convertURL:url]);
+	curl_easy_setopt(_handle, CURLOPT_NOBODY, (long)1);
+	if((curl_easy_perform(_handle) != CURLE_OK) || (curl_easy_getinfo(_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &length) != CURLE_OK))
+	return -1;
+	
+	return (length >= 0.0 ? (long long)length : -1);
+}
+
 - (NSDictionary*) _ParseFTPDirectoryListing:(NSData*)data
 {
 	NSMutableDictionary*	result = [NSMutableDictionary dictionary];
@@ -23,7 +23,13 @@ HTTP Status Codes: http://www.w3.org/Protocols/rfc2616/rfc2616-sec10.html
 */
 
 #import <CommonCrypto/CommonHMAC.h>
+#import <CommonCrypto/CommonDigest.h>
 #import <SystemConfiguration/SystemConfiguration.h>
+#import <fcntl.h>
+#import <sys/stat.h>
+#import <sys/time.h>
+#import <pthread.h>
+#import <unistd.h>
 #if TARGET_OS_IPHONE
 #import <MobileCoreServices/MobileCoreServices.h>
 #endif
@@ -40,14 +46,82 @@ HTTP Status Codes: http://www.w3.org/Protocols/rfc2616/rfc2616-sec10.html
 
 #define kUpdateInterval					0.5
 #define kFileBufferSize					(256 * 1024)
+#define kDefaultSegmentSize				(1024 * 1024)
+#define kSegmentedRunLoopMode			CFSTR("HTTPSegmentedDownloadMode")
+#define kMultipartRunLoopMode			CFSTR("AmazonS3MultipartUploadMode")
+#define kDefaultPartSize				(8 * 1024 * 1024)
+#define kMinimumPartSize				(5 * 1024 * 1024) //Imposed by Amazon S3
+#define kMaximumPartCount				10000 //Imposed by Amazon S3
+#define kMaximumPartRetries				3
+#define kLimiterDefaultRequestsPerHost	4
+#define kLimiterMaximumRequestsPerHost	32
+#define kLimiterMaximumWait				60.0
 #define kDefaultHTTPError				@"Unsupported HTTP response"
 #define	kAmazonAWSSuffix				@".amazonaws.com"
 
 #define MAKE_HTTP_ERROR(__STATUS__, ...) MAKE_ERROR(@"http", __STATUS__, __VA_ARGS__)
 
+typedef struct _SegmentedDownload SegmentedDownload;
+
+typedef struct {
+	SegmentedDownload*			download;
+	CFReadStreamRef				stream;
+	off_t						offset, //Next byte to be written
+								end; //Exclusive
+	BOOL						validated;
+} SegmentConnection;
+
+struct _SegmentedDownload {
+	HTTPTransferController*		controller;
+	NSString*					path;
+	int							fd;
+	off_t						length,
+								nextOffset, //First byte not yet assigned to a connection
+								digestOffset; //First byte not yet digested
+	unsigned char*				buffer;
+	NSUInteger					count;
+	SegmentConnection*			connections;
+	BOOL						done,
+								success;
+};
+
+typedef struct _MultipartUpload MultipartUpload;
+
+typedef struct {
+	MultipartUpload*			upload;
+	CFReadStreamRef				stream;
+	NSUInteger					partNumber; //1-based or 0 if idle
+	NSUInteger					retries;
+	NSData*						data;
+	NSString*					md5;
+	CFIndex						bytesWritten;
+} PartConnection;
+
+struct _MultipartUpload {
+	AmazonS3TransferController*	controller;
+	NSString*					path;
+	NSString*					uploadID;
+	int							fd;
+	off_t						length;
+	NSUInteger					partSize,
+								partCount,
+								nextPart; //1-based
+	NSMutableArray*				etags;
+	NSUInteger					completedLength;
+	NSUInteger					count;
+	PartConnection*				connections;
+	BOOL						done,
+								success;
+};
+
 @interface HTTPTransferController () <DataStreamSource>
 + (BOOL) hasUploadDataStream;
 @property(nonatomic, readonly) CFHTTPMessageRef responseHeaders;
+- (void) _segmentConnection:(SegmentConnection*)connection handleEvent:(CFStreamEventType)type;
+@end
+
+@interface AmazonS3TransferController ()
+- (void) _partConnection:(PartConnection*)connection handleEvent:(CFStreamEventType)type;
 @end
 
 /* Required for the compiler not to complain */
@@ -59,9 +133,137 @@ HTTP Status Codes: http://www.w3.org/Protocols/rfc2616/rfc2616-sec10.html
 
 static char* NewBase64Encode(const void *buffer, size_t length, bool separateLines, size_t *outputLength);
 
+/* This is a concurrency limiter and not a connection pool: CFNetwork owns the actual sockets and decides by itself whether a request goes over an existing keep-alive connection, so this only limits how many requests run concurrently against each host */
+typedef struct {
+	NSUInteger					active,
+								failures; //Incremented on each failure so requests started before it cannot clear it
+	BOOL						unhealthy;
+} LimitedHost;
+
+/* Slots held by a thread - Nested requests to the same host run sequentially on that thread so they share its slot */
+typedef struct _HeldSlot {
+	LimitedHost*				host;
+	NSUInteger					depth;
+	struct _HeldSlot*			next;
+} HeldSlot;
+
+enum {
+	kLimiterStatistic_Requests = 0,
+	kLimiterStatistic_Waits,
+	kLimiterStatistic_Timeouts,
+	kLimiterStatistic_Failures,
+	kLimiterStatisticCount
+};
+
+static pthread_mutex_t			_limiterMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t			_limiterCondition = PTHREAD_COND_INITIALIZER;
+static pthread_once_t			_limiterOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t			_limiterThreadKey;
+static CFMutableDictionaryRef	_limiterHosts = NULL;
+static NSUInteger				_limiterMaxRequests = kLimiterDefaultRequestsPerHost;
+static NSUInteger				_limiterStatistics[kLimiterStatisticCount] = {0};
+
+static void _InitializeLimiter()
+{
+	pthread_key_create(&_limiterThreadKey, NULL);
+}
+
+static NSString* _LimiterKeyForURL(NSURL* url)
+{
+	return [NSString stringWithFormat:@"%@://%@:%i", [url scheme], [[url host] lowercaseString], [[url port] intValue]];
+}
+
+/* Returns NULL on timeout - Sets "persistent" to NO if a request to the host failed and no request started since has succeeded */
+static LimitedHost* _AcquireHostSlot(NSString* key, NSTimeInterval timeout, BOOL* persistent, NSUInteger* generation)
+{
+	struct timespec				deadline;
+	struct timeval				time;
+	LimitedHost*				host;
+	HeldSlot*					slot;
+	
+	pthread_once(&_limiterOnce, _InitializeLimiter);
+	if(timeout <= 0.0)
+	timeout = kLimiterMaximumWait;
+	
+	pthread_mutex_lock(&_limiterMutex);
+	if(_limiterHosts == NULL)
+	_limiterHosts = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, NULL);
+	host = (LimitedHost*)CFDictionaryGetValue(_limiterHosts, key);
+	if(host == NULL) {
+		host = calloc(1, sizeof(LimitedHost));
+		CFDictionarySetValue(_limiterHosts, key, host);
+	}
+	
+	for(slot = pthread_getspecific(_limiterThreadKey); slot; slot = slot->next) {
+		if(slot->host == host)
+		break;
+	}
+	if(slot)
+	slot->depth += 1;
+	else {
+		if(host->active >= _limiterMaxRequests) {
+			_limiterStatistics[kLimiterStatistic_Waits] += 1;
+			gettimeofday(&time, NULL);
+			deadline.tv_sec = time.tv_sec + (time_t)timeout;
+			deadline.tv_nsec = time.tv_usec * 1000 + (long)((timeout - floor(timeout)) * 1000000000.0);
+			if(deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec += 1;
+				deadline.tv_nsec -= 1000000000;
+			}
+			while(host->active >= _limiterMaxRequests) {
+				if(pthread_cond_timedwait(&_limiterCondition, &_limiterMutex, &deadline) == ETIMEDOUT) {
+					_limiterStatistics[kLimiterStatistic_Timeouts] += 1;
+					pthread_mutex_unlock(&_limiterMutex);
+					return NULL;
+				}
+			}
+		}
+		host->active += 1;
+		
+		slot = malloc(sizeof(HeldSlot));
+		slot->host = host;
+		slot->depth = 1;
+		slot->next = pthread_getspecific(_limiterThreadKey);
+		pthread_setspecific(_limiterThreadKey, slot);
+	}
+	_limiterStatistics[kLimiterStatistic_Requests] += 1;
+	*persistent = !host->unhealthy;
+	*generation = host->failures;
+	pthread_mutex_unlock(&_limiterMutex);
+	
+	return host;
+}
+
+static void _ReleaseHostSlot(LimitedHost* host, BOOL failed, NSUInteger generation)
+{
+	HeldSlot*					previous = NULL;
+	HeldSlot*					slot;
+	
+	pthread_mutex_lock(&_limiterMutex);
+	for(slot = pthread_getspecific(_limiterThreadKey); slot && (slot->host != host); slot = slot->next)
+	previous = slot;
+	if(slot && (--slot->depth == 0)) {
+		if(previous)
+		previous->next = slot->next;
+		else
+		pthread_setspecific(_limiterThreadKey, slot->next);
+		free(slot);
+		host->active -= 1;
+	}
+	if(failed) {
+		host->failures += 1;
+		host->unhealthy = YES;
+		_limiterStatistics[kLimiterStatistic_Failures] += 1;
+	}
+	else if(host->failures == generation)
+	host->unhealthy = NO;
+	pthread_cond_broadcast(&_limiterCondition);
+	pthread_mutex_unlock(&_limiterMutex);
+}
+
 @implementation HTTPTransferController
 
-@synthesize SSLCertificateValidationDisabled=_disableSSLCertificates, keepConnectionAlive=_keepAlive, responseHeaders=_responseHeaders;
+@synthesize SSLCertificateValidationDisabled=_disableSSLCertificates, keepConnectionAlive=_keepAlive, limitsConcurrentRequestsPerHost=_limitPerHost, responseHeaders=_responseHeaders, maximumDownloadConnections=_maxConnections, downloadSegmentSize=_segmentSize;
 
 + (NSString*) urlScheme;
 {
@@ -73,13 +275,75 @@ static char* NewBase64Encode(const void *buffer, size_t length, bool separateLin
 	return YES;
 }
 
++ (BOOL) hasResumableDownloads
+{
+	return YES;
+}
+
 + (BOOL) hasUploadDataStream
 {
 	return NO;
 }
 
++ (NSUInteger) maximumConcurrentRequestsPerHost
+{
+	return _limiterMaxRequests;
+}
+
++ (void) setMaximumConcurrentRequestsPerHost:(NSUInteger)max
+{
+	pthread_mutex_lock(&_limiterMutex);
+	_limiterMaxRequests = MIN(MAX(max, 1), kLimiterMaximumRequestsPerHost);
+	pthread_cond_broadcast(&_limiterCondition);
+	pthread_mutex_unlock(&_limiterMutex);
+}
+
++ (NSDictionary*) hostLimiterStatistics
+{
+	NSUInteger				statistics[kLimiterStatisticCount];
+	
+	pthread_mutex_lock(&_limiterMutex);
+	bcopy(_limiterStatistics, statistics, sizeof(_limiterStatistics));
+	pthread_mutex_unlock(&_limiterMutex);
+	
+	return [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithUnsignedInteger:statistics[kLimiterStatistic_Requests]], kHTTPHostLimiterStatisticsKey_Requests,
+		[NSNumber numberWithUnsignedInteger:statistics[kLimiterStatistic_Waits]], kHTTPHostLimiterStatisticsKey_Waits,
+		[NSNumber numberWithUnsignedInteger:statistics[kLimiterStatistic_Timeouts]], kHTTPHostLimiterStatisticsKey_Timeouts,
+		[NSNumber numberWithUnsignedInteger:statistics[kLimiterStatistic_Failures]], kHTTPHostLimiterStatisticsKey_Failures,
+	nil];
+}
+
+static void _ResetLimitedHost(const void* key, const void* value, void* context)
+{
+	((LimitedHost*)value)->unhealthy = NO;
+}
+
++ (void) resetHostLimiter
+{
+	pthread_mutex_lock(&_limiterMutex);
+	if(_limiterHosts)
+	CFDictionaryApplyFunction(_limiterHosts, _ResetLimitedHost, NULL);
+	bzero(_limiterStatistics, sizeof(_limiterStatistics));
+	pthread_mutex_unlock(&_limiterMutex);
+}
+
+- (id) initWithBaseURL:(NSURL*)url
+{
+	if((self = [super initWithBaseURL:url])) {
+		_maxConnections = 1;
+		_segmentSize = kDefaultSegmentSize;
+	}
+	
+	return self;
+}
+
 - (void) invalidate
 {
+	CFReadStreamRef			stream = (CFReadStreamRef)[self activeStream];
+	
+	if(_limitedHost && stream && (CFReadStreamGetStatus(stream) == kCFStreamStatusError))
+	_limitedFailed = YES;
+	
 	if(_responseHeaders) {
 		CFRelease(_responseHeaders);
 		_responseHeaders = NULL;
@@ -88,6 +352,31 @@ static char* NewBase64Encode(const void *buffer, size_t length, bool separateLin
 	[super invalidate];
 }
 
+- (id) runReadStream:(CFReadStreamRef)readStream dataStream:(NSOutputStream*)dataStream userInfo:(id)info isFileTransfer:(BOOL)allowEncryption
+{
+	id						result;
+	
+	if(!_limitPerHost)
+	return [super runReadStream:readStream dataStream:dataStream userInfo:info isFileTransfer:allowEncryption];
+	
+	_limitedHost = _AcquireHostSlot(_LimiterKeyForURL([self baseURL]), [self timeOut], &_limitedPersistent, &_limitedGeneration);
+	if(_limitedHost == NULL) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Timeout while waiting for a request slot to the host")];
+		CFRelease(readStream);
+		return nil;
+	}
+	CFReadStreamSetProperty(readStream, kCFStreamPropertyHTTPAttemptPersistentConnection, (_limitedPersistent ? kCFBooleanTrue : kCFBooleanFalse));
+	_limitedFailed = NO;
+	
+	result = [super runReadStream:readStream dataStream:dataStream userInfo:info isFileTransfer:allowEncryption];
+	
+	_ReleaseHostSlot(_limitedHost, _limitedFailed, _limitedGeneration);
+	_limitedHost = NULL;
+	
+	return result;
+}
+
 - (CFHTTPMessageRef) _newHTTPRequestWithMethod:(NSString*)method url:(NSURL*)url
 {
 	NSString*				user = [[self baseURL] user];
@@ -132,7 +421,7 @@ static char* NewBase64Encode(const void *buffer, size_t length, bool separateLin
 		CFReadStreamSetProperty(readStream, kCFStreamPropertyHTTPShouldAutoredirect, kCFBooleanTrue);
 	}
 	
-	CFReadStreamSetProperty(readStream, kCFStreamPropertyHTTPAttemptPersistentConnection, (_keepAlive ? kCFBooleanTrue : kCFBooleanFalse));
+	CFReadStreamSetProperty(readStream, kCFStreamPropertyHTTPAttemptPersistentConnection, (_keepAlive || _limitPerHost ? kCFBooleanTrue : kCFBooleanFalse));
 	
 	if([[[self class] urlScheme] isEqualToString:@"https"] && _disableSSLCertificates) {
 		sslSettings = CFDictionaryCreateMutable(kCFAllocatorDefault, 1, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
@@ -154,9 +443,26 @@ static char* NewBase64Encode(const void *buffer, size_t length, bool separateLin
 	return readStream;
 }
 
+/* Returns the entity tag or modification date of the response if it can be used with "If-Range" */
+static NSString* _ResumeValidatorFromHTTPHeaders(CFHTTPMessageRef headers)
+{
+	NSString*					value;
+	
+	if([[NSMakeCollectable(CFHTTPMessageCopyHeaderFieldValue(headers, CFSTR("Content-Encoding"))) autorelease] length]) //NOTE: Ranges would apply to the encoded data
+	return nil;
+	
+	value = [NSMakeCollectable(CFHTTPMessageCopyHeaderFieldValue(headers, CFSTR("ETag"))) autorelease];
+	if([value length] && ![value hasPrefix:@"W/"]) //NOTE: Weak entity tags are not allowed in "If-Range"
+	return value;
+	
+	return [NSMakeCollectable(CFHTTPMessageCopyHeaderFieldValue(headers, CFSTR("Last-Modified"))) autorelease];
+}
+
 - (void) readStreamClientCallBack:(CFReadStreamRef)stream type:(CFStreamEventType)type
 {
 	CFStringRef					value;
+	NSInteger					status;
+	NSString*					range;
 	
 	switch(type) {
 		
@@ -167,6 +473,21 @@ static char* NewBase64Encode(const void *buffer, size_t length, bool separateLin
 				[self setMaxLength:[(NSString*)value integerValue]];
 				CFRelease(value);
 			}
+			
+			status = CFHTTPMessageGetResponseStatusCode(_responseHeaders);
+			if([self resumeOffset]) { //NOTE: Only a partial response starting at the resume offset can be appended to the local file
+				range = [NSMakeCollectable(CFHTTPMessageCopyHeaderFieldValue(_responseHeaders, CFSTR("Content-Range"))) autorelease];
+				if((status != 206) || ![range hasPrefix:[NSString stringWithFormat:@"bytes %llu-", [self resumeOffset]]]) {
+					if((status == 200) || (status == 416)) //NOTE: "If-Range" did not match or the file is now shorter
+					[self setResumeOffset:0];
+					if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+					[[self delegate] fileTransferControllerDidFail:self withError:MAKE_HTTP_ERROR(status, @"Unable to resume transfer")];
+					[self _doneWithResult:nil];
+					return;
+				}
+			}
+			if((status == 200) || (status == 206))
+			[self setResumeValidator:_ResumeValidatorFromHTTPHeaders(_responseHeaders)];
 		}
 		break;
 		
@@ -186,6 +507,7 @@ static char* NewBase64Encode(const void *buffer, size_t length, bool separateLin
 	NSString*				method = info;
 	id						result = nil;
 	NSString*				location;
+	NSString*				header;
 	
 	if(error)
 	*error = nil;
@@ -203,8 +525,15 @@ static char* NewBase64Encode(const void *buffer, size_t length, bool separateLin
 			result = [NSURL URLWithString:location];
 		}
 	}
+	else if([method isEqualToString:@"HEAD+"]) {
+		if(status == 200) {
+			result = [NSMutableDictionary dictionary];
+			for(header in [NSArray arrayWithObjects:@"Content-Length", @"Content-Encoding", @"Accept-Ranges", nil])
+			[result setValue:[NSMakeCollectable(CFHTTPMessageCopyHeaderFieldValue(_responseHeaders, (CFStringRef)header)) autorelease] forKey:header];
+		}
+	}
 	else if([method isEqualToString:@"GET"]) {
-		if(status == 200)
+		if((status == 200) || ((status == 206) && [self resumeOffset]))
 		result = [NSNumber numberWithBool:YES];
 	}
 	else if([method isEqualToString:@"PUT"]) {
@@ -229,6 +558,10 @@ static char* NewBase64Encode(const void *buffer, size_t length, bool separateLin
 	request = [self _newHTTPRequestWithMethod:@"GET" path:remotePath];
 	if(request == NULL)
 	return NO;
+	if([self resumeOffset]) {
+		CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Range"), (CFStringRef)[NSString stringWithFormat:@"bytes=%llu-", [self resumeOffset]]);
+		CFHTTPMessageSetHeaderFieldValue(request, CFSTR("If-Range"), (CFStringRef)[self resumeValidator]);
+	}
 	
 	readStream = [self _newReadStreamWithHTTPRequest:request bodyStream:nil];
 	CFRelease(request);
@@ -326,6 +659,320 @@ static char* NewBase64Encode(const void *buffer, size_t length, bool separateLin
 	return [self runReadStream:stream dataStream:([[self class] hasUploadDataStream] ? [NSOutputStream outputStreamToMemory] : nil) userInfo:@"HEAD" isFileTransfer:NO];
 }
 
+static void _SegmentReadStreamClientCallBack(CFReadStreamRef stream, CFStreamEventType type, void* clientCallBackInfo)
+{
+	NSAutoreleasePool*		pool = [NSAutoreleasePool new];
+	SegmentConnection*		connection = (SegmentConnection*)clientCallBackInfo;
+	
+	[connection->download->controller _segmentConnection:connection handleEvent:type];
+	
+	[pool drain];
+}
+
+- (BOOL) _openSegmentConnection:(SegmentConnection*)connection
+{
+	SegmentedDownload*		download = connection->download;
+	CFStreamClientContext	context = {0, connection, NULL, NULL, NULL};
+	CFHTTPMessageRef		request;
+	
+	request = [self _newHTTPRequestWithMethod:@"GET" path:download->path];
+	if(request == NULL)
+	return NO;
+	
+	connection->offset = download->nextOffset;
+	connection->end = MIN(connection->offset + (off_t)_segmentSize, download->length);
+	connection->validated = NO;
+	download->nextOffset = connection->end;
+	CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Range"), (CFStringRef)[NSString stringWithFormat:@"bytes=%qi-%qi", (long long)connection->offset, (long long)connection->end - 1]);
+	
+	connection->stream = [self _newReadStreamWithHTTPRequest:request bodyStream:nil];
+	CFRelease(request);
+	if(connection->stream == NULL)
+	return NO;
+	
+	//NOTE: Successive ranges fetched by the same connection should reuse the same socket
+	CFReadStreamSetProperty(connection->stream, kCFStreamPropertyHTTPAttemptPersistentConnection, kCFBooleanTrue);
+	CFReadStreamSetClient(connection->stream, kCFStreamEventOpenCompleted | kCFStreamEventHasBytesAvailable | kCFStreamEventErrorOccurred | kCFStreamEventEndEncountered, _SegmentReadStreamClientCallBack, &context);
+	CFReadStreamScheduleWithRunLoop(connection->stream, CFRunLoopGetCurrent(), kSegmentedRunLoopMode);
+	
+	return (CFReadStreamOpen(connection->stream) ? YES : NO);
+}
+
+- (void) _closeSegmentConnection:(SegmentConnection*)connection
+{
+	if(connection->stream) {
+		CFReadStreamUnscheduleFromRunLoop(connection->stream, CFRunLoopGetCurrent(), kSegmentedRunLoopMode);
+		CFReadStreamSetClient(connection->stream, kCFStreamEventNone, NULL, NULL);
+		CFReadStreamClose(connection->stream);
+		CFRelease(connection->stream);
+		connection->stream = NULL;
+	}
+}
+
+- (void) _segmentedDownload:(SegmentedDownload*)download didFailWithError:(NSError*)error
+{
+	if(!download->done) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:error];
+		download->done = YES;
+		CFRunLoopStop(CFRunLoopGetCurrent());
+	}
+}
+
+- (BOOL) _validateSegmentConnection:(SegmentConnection*)connection
+{
+	CFHTTPMessageRef		headers;
+	NSInteger				status;
+	NSString*				range;
+	
+	if(!connection->validated) {
+		headers = (CFHTTPMessageRef)CFReadStreamCopyProperty(connection->stream, kCFStreamPropertyHTTPResponseHeader);
+		status = (headers ? CFHTTPMessageGetResponseStatusCode(headers) : -1);
+		range = (headers ? [NSMakeCollectable(CFHTTPMessageCopyHeaderFieldValue(headers, CFSTR("Content-Range"))) autorelease] : nil);
+		if(headers)
+		CFRelease(headers);
+		
+		//NOTE: A server ignoring the range would return 200 and the entire file
+		if((status != 206) || ![range hasPrefix:[NSString stringWithFormat:@"bytes %qi-%qi/", (long long)connection->offset, (long long)connection->end - 1]]) {
+			[self _segmentedDownload:connection->download didFailWithError:MAKE_HTTP_ERROR(status, @"Unexpected response to range request (%@)", range)];
+			return NO;
+		}
+		connection->validated = YES;
+	}
+	
+	return YES;
+}
+
+/* Digest the part of the file that has been entirely written so far */
+- (BOOL) _updateSegmentedDownloadDigest:(SegmentedDownload*)download
+{
+#if !TARGET_OS_IPHONE
+	off_t					frontier = download->nextOffset;
+	NSUInteger				i;
+	ssize_t					count;
+	
+	if(![self digestComputation])
+	return YES;
+	
+	for(i = 0; i < download->count; ++i) {
+		if(download->connections[i].stream)
+		frontier = MIN(frontier, download->connections[i].offset);
+	}
+	
+	while(download->digestOffset < frontier) {
+		count = pread(download->fd, download->buffer, MIN(frontier - download->digestOffset, kFileBufferSize), download->digestOffset);
+		if(count <= 0)
+		return NO;
+		if(![self _updateDigestContextWithBytes:download->buffer length:count])
+		return NO;
+		download->digestOffset += count;
+	}
+#endif
+	
+	return YES;
+}
+
+- (void) _segmentConnection:(SegmentConnection*)connection handleEvent:(CFStreamEventType)type
+{
+	SegmentedDownload*		download = connection->download;
+	NSUInteger				i;
+	CFIndex					count;
+	
+	if(download->done)
+	return;
+	
+	switch(type) {
+		
+		case kCFStreamEventOpenCompleted:
+		break;
+		
+		case kCFStreamEventHasBytesAvailable:
+		if(![self _validateSegmentConnection:connection])
+		return;
+		count = CFReadStreamRead(connection->stream, download->buffer, kFileBufferSize);
+		if(count > 0) {
+			if(connection->offset + count > connection->end) {
+				[self _segmentedDownload:download didFailWithError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Server returned more data than requested")];
+				return;
+			}
+			if(pwrite(download->fd, download->buffer, count, connection->offset) != count) {
+				[self _segmentedDownload:download didFailWithError:MAKE_ERROR(NSPOSIXErrorDomain, errno, @"Failed writing to file (%s)", strerror(errno))];
+				return;
+			}
+			connection->offset += count;
+			[self setCurrentLength:([self currentLength] + count)];
+		}
+		break;
+		
+		case kCFStreamEventErrorOccurred:
+		[self _segmentedDownload:download didFailWithError:[NSMakeCollectable(CFReadStreamCopyError(connection->stream)) autorelease]];
+		return;
+		
+		case kCFStreamEventEndEncountered:
+		if(![self _validateSegmentConnection:connection])
+		return;
+		if(connection->offset != connection->end) {
+			[self _segmentedDownload:download didFailWithError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Connection closed before end of range")];
+			return;
+		}
+		[self _closeSegmentConnection:connection];
+		if(download->nextOffset < download->length) {
+			if(![self _openSegmentConnection:connection]) {
+				[self _segmentedDownload:download didFailWithError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed opening connection")];
+				return;
+			}
+		}
+		break;
+		
+	}
+	
+	if(![self _updateSegmentedDownloadDigest:download]) {
+		[self _segmentedDownload:download didFailWithError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed computing digest")];
+		return;
+	}
+	
+	if(download->nextOffset == download->length) {
+		for(i = 0; i < download->count; ++i) {
+			if(download->connections[i].stream)
+			break;
+		}
+		if(i == download->count) {
+			download->success = YES;
+			download->done = YES;
+			CFRunLoopStop(CFRunLoopGetCurrent());
+		}
+	}
+}
+
+- (BOOL) _runSegmentedDownload:(SegmentedDownload*)download
+{
+	BOOL					delegateHasShouldAbort = [[self delegate] respondsToSelector:@selector(fileTransferControllerShouldAbort:)];
+	CFAbsoluteTime			timeout = [self timeOut],
+							lastTime = CFAbsoluteTimeGetCurrent(),
+							time;
+	NSUInteger				i;
+	SInt32					value;
+	
+#if !TARGET_OS_IPHONE
+	if(![self _createDigestContext])
+	return NO;
+#endif
+	
+	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
+	[[self delegate] fileTransferControllerDidStart:self];
+	
+	for(i = 0; i < download->count; ++i) {
+		download->connections[i].download = download;
+		if(![self _openSegmentConnection:&download->connections[i]]) {
+			[self _segmentedDownload:download didFailWithError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed opening connection")];
+			break;
+		}
+	}
+	
+	while(!download->done) {
+		value = CFRunLoopRunInMode(kSegmentedRunLoopMode, kUpdateInterval, true);
+		time = CFAbsoluteTimeGetCurrent();
+		if(value != kCFRunLoopRunTimedOut)
+		lastTime = time;
+		else if((timeout > 0.0) && (time - lastTime >= timeout)) {
+			[self _segmentedDownload:download didFailWithError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Timeout while reading from stream")];
+			break;
+		}
+		if(delegateHasShouldAbort && [[self delegate] fileTransferControllerShouldAbort:self])
+		break;
+	}
+	
+	for(i = 0; i < download->count; ++i)
+	[self _closeSegmentConnection:&download->connections[i]];
+	
+#if !TARGET_OS_IPHONE
+	if(download->success) {
+		if(![self _updateSegmentedDownloadDigest:download] || ![self _finalizeDigestContext]) {
+			if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+			[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed computing digest")];
+			download->success = NO;
+		}
+	}
+	[self _destroyDigestContext];
+#endif
+	
+	if(download->success) {
+		[self setLastTransferSize:download->length];
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
+		[[self delegate] fileTransferControllerDidSucceed:self];
+	}
+	
+	return download->success;
+}
+
+/* Override completely */
+- (BOOL) downloadFileFromPath:(NSString*)remotePath toPath:(NSString*)localPath
+{
+	id						delegate = [self delegate];
+	SegmentedDownload		download;
+	CFHTTPMessageRef		request;
+	CFReadStreamRef			stream;
+	NSDictionary*			headers;
+	long long				length;
+	BOOL					success;
+	
+	if((_maxConnections <= 1) || (_segmentSize == 0))
+	return [super downloadFileFromPath:remotePath toPath:localPath];
+#if !TARGET_OS_IPHONE
+	if([self encryptionPassword] || [self compressionFormat])
+	return [super downloadFileFromPath:remotePath toPath:localPath];
+#endif
+	if([self checkpointDirectory]) //NOTE: Only regular downloads can be resumed
+	return [super downloadFileFromPath:remotePath toPath:localPath];
+	if(![self isLocalHost] && ([self maximumDownloadSpeed] || [FileTransferController globalMaximumDownloadSpeed]))
+	return [super downloadFileFromPath:remotePath toPath:localPath];
+	
+	//NOTE: Any failure here is reported by the regular download instead
+	request = [self _newHTTPRequestWithMethod:@"HEAD" path:remotePath];
+	if(request == NULL)
+	return [super downloadFileFromPath:remotePath toPath:localPath];
+	stream = [self _newReadStreamWithHTTPRequest:request bodyStream:nil];
+	CFRelease(request);
+	[self setDelegate:nil];
+	headers = [self runReadStream:stream dataStream:([[self class] hasUploadDataStream] ? [NSOutputStream outputStreamToMemory] : nil) userInfo:@"HEAD+" isFileTransfer:NO];
+	[self setDelegate:delegate];
+	length = [[headers objectForKey:@"Content-Length"] longLongValue];
+	if(([[headers objectForKey:@"Accept-Ranges"] rangeOfString:@"bytes"].location == NSNotFound) || [[headers objectForKey:@"Content-Encoding"] length] || (length < 2 * (long long)_segmentSize))
+	return [super downloadFileFromPath:remotePath toPath:localPath];
+	
+	bzero(&download, sizeof(SegmentedDownload));
+	download.controller = self;
+	download.path = remotePath;
+	download.length = length;
+	download.fd = open([[localPath stringByStandardizingPath] fileSystemRepresentation], O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+	if(download.fd < 0)
+	return NO;
+	if(ftruncate(download.fd, length) == 0) {
+		download.count = MIN(_maxConnections, (length + _segmentSize - 1) / _segmentSize);
+		if(_limitPerHost)
+		download.count = MIN(download.count, _limiterMaxRequests);
+		download.connections = calloc(download.count, sizeof(SegmentConnection));
+		download.buffer = malloc(kFileBufferSize);
+		
+		[self setMaxLength:length];
+		success = [self _runSegmentedDownload:&download];
+		[self setMaxLength:0];
+		
+		free(download.buffer);
+		free(download.connections);
+	}
+	else {
+		NSLog(@"%s: ftruncate() failed with error \"%s\"", __FUNCTION__, strerror(errno));
+		success = NO;
+	}
+	close(download.fd);
+	
+	if(!success)
+	unlink([[localPath stringByStandardizingPath] fileSystemRepresentation]);
+	
+	return success;
+}
+
 @end
 
 @implementation SecureHTTPTransferController
@@ -623,7 +1270,7 @@ static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
 
 @implementation AmazonS3TransferController
 
-@synthesize productToken=_productToken, userToken=_userToken, newBucketLocation=_newBucketLocation;
+@synthesize productToken=_productToken, userToken=_userToken, newBucketLocation=_newBucketLocation, maximumUploadConnections=_maxUploadConnections, multipartUploadPartSize=_partSize;
 
 + (NSDictionary*) activateDesktopProduct:(NSString*)productToken activationKey:(NSString*)activationKey expirationInterval:(NSTimeInterval)expirationInterval error:(NSError**)error
 {
@@ -719,7 +1366,12 @@ static NSDictionary* _DictionaryFromDAVProperties(MiniXMLNode* node)
 		return nil;
 	}
 	
-	return [super initWithBaseURL:url];
+	if((self = [super initWithBaseURL:url])) {
+		_maxUploadConnections = 1;
+		_partSize = kDefaultPartSize;
+	}
+	
+	return self;
 }
 
 - (id) initWithAccessKeyID:(NSString*)accessKeyID secretAccessKey:(NSString*)secretAccessKey bucket:(NSString*)bucket
@@ -801,6 +1453,40 @@ static NSString* _EncodeBase64(NSData* data)
 	return string;
 }
 
+static NSString* _CanonicalizedSubresources(NSString* query)
+{
+	static NSSet*			subresources = nil;
+	NSMutableArray*			array = [NSMutableArray array];
+	NSString*				parameter;
+	NSRange					range;
+	
+	if(subresources == nil)
+	subresources = [[NSSet alloc] initWithObjects:@"location", @"logging", @"torrent", @"uploads", @"uploadId", @"partNumber", nil];
+	
+	for(parameter in [query componentsSeparatedByString:@"&"]) {
+		range = [parameter rangeOfString:@"="];
+		if([subresources containsObject:(range.location != NSNotFound ? [parameter substringToIndex:range.location] : parameter)])
+		[array addObject:parameter];
+	}
+	[array sortUsingSelector:@selector(compare:)];
+	
+	return ([array count] ? [@"?" stringByAppendingString:[array componentsJoinedByString:@"&"]] : @"");
+}
+
+- (BOOL) _uploadFileToPath:(NSString*)remotePath fromStream:(NSInputStream*)stream
+{
+#if !TARGET_OS_IPHONE
+	//NOTE: The compressed length is not known in advance and Amazon S3 rejects PUT requests without Content-Length
+	if([self compressionFormat]) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Compressed uploads are not supported by Amazon S3")];
+		return NO;
+	}
+#endif
+	
+	return [super _uploadFileToPath:remotePath fromStream:stream];
+}
+
 /* See http://docs.amazonwebservices.com/AmazonS3/2006-03-01/index.html?RESTAuthentication.html */
 - (CFReadStreamRef) _newReadStreamWithHTTPRequest:(CFHTTPMessageRef)request bodyStream:(id)stream
 {
@@ -851,8 +1537,7 @@ static NSString* _EncodeBase64(NSData* data)
 		else
 		[buffer appendFormat:@"/%@/", [host substringToIndex:range.location]];
 	}
-	if([query isEqualToString:@"location"] || [query isEqualToString:@"logging"] || [query isEqualToString:@"torrent"])
-	[buffer appendFormat:@"?%@", query];
+	[buffer appendString:_CanonicalizedSubresources(query)];
 	authorization = _EncodeBase64(_ComputeSHA1HMAC([buffer dataUsingEncoding:NSUTF8StringEncoding], [[self baseURL] passwordByReplacingPercentEscapes]));
 	[buffer release];
 	
@@ -1018,6 +1703,14 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 		if((status == 200) && [body isKindOfClass:[MiniXMLParser class]] && [[[(MiniXMLParser*)body rootNode] name] isEqualToString:@"CopyObjectResult"])
 		result = [NSNumber numberWithBool:YES];
 	}
+	else if([method isEqualToString:@"INITIATE"]) {
+		if((status == 200) && [body isKindOfClass:[MiniXMLParser class]])
+		result = [(MiniXMLParser*)body firstValueAtPath:@"InitiateMultipartUploadResult:UploadId"];
+	}
+	else if([method isEqualToString:@"COMPLETE"]) { //NOTE: Amazon S3 can return an error with a 200 status
+		if((status == 200) && [body isKindOfClass:[MiniXMLParser class]] && [[[(MiniXMLParser*)body rootNode] name] isEqualToString:@"CompleteMultipartUploadResult"])
+		result = [NSNumber numberWithBool:YES];
+	}
 	else
 	result = [super processReadResultStream:stream userInfo:info error:error];
 	
@@ -1222,6 +1915,407 @@ static NSDictionary* _DictionaryFromS3Objects(MiniXMLNode* node, NSString* baseP
 	return [self runReadStream:stream dataStream:[NSOutputStream outputStreamToMemory] userInfo:@"GET?" isFileTransfer:NO];
 }
 
+static void _PartReadStreamClientCallBack(CFReadStreamRef stream, CFStreamEventType type, void* clientCallBackInfo)
+{
+	NSAutoreleasePool*		pool = [NSAutoreleasePool new];
+	PartConnection*			connection = (PartConnection*)clientCallBackInfo;
+	
+	[connection->upload->controller _partConnection:connection handleEvent:type];
+	
+	[pool drain];
+}
+
+/* The delegate is detached as this is only a control request of the upload */
+- (NSString*) _initiateMultipartUploadToPath:(NSString*)remotePath
+{
+	id						delegate = [self delegate];
+	CFHTTPMessageRef		request;
+	CFReadStreamRef			stream;
+	NSString*				uploadID;
+	
+	request = [self _newHTTPRequestWithMethod:@"POST" path:[remotePath stringByAppendingString:@"?uploads"]];
+	if(request == NULL)
+	return nil;
+	
+	stream = [self _newReadStreamWithHTTPRequest:request bodyStream:nil];
+	CFRelease(request);
+	
+	[self setDelegate:nil];
+	uploadID = [self runReadStream:stream dataStream:[NSOutputStream outputStreamToMemory] userInfo:@"INITIATE" isFileTransfer:NO];
+	[self setDelegate:delegate];
+	
+	return uploadID;
+}
+
+/* The delegate is detached as this is only a control request of the upload */
+- (BOOL) _completeMultipartUpload:(MultipartUpload*)upload
+{
+	id						delegate = [self delegate];
+	NSMutableString*		xmlString = [NSMutableString stringWithString:@"<CompleteMultipartUpload>"];
+	CFHTTPMessageRef		request;
+	CFReadStreamRef			stream;
+	NSData*					xmlData;
+	NSUInteger				i;
+	BOOL					success;
+	
+	for(i = 0; i < upload->partCount; ++i)
+	[xmlString appendFormat:@"<Part><PartNumber>%i</PartNumber><ETag>%@</ETag></Part>", i + 1, [upload->etags objectAtIndex:i]];
+	[xmlString appendString:@"</CompleteMultipartUpload>"];
+	
+	request = [self _newHTTPRequestWithMethod:@"POST" path:[NSString stringWithFormat:@"%@?uploadId=%@", upload->path, upload->uploadID]];
+	if(request == NULL)
+	return NO;
+	
+	xmlData = [xmlString dataUsingEncoding:NSUTF8StringEncoding];
+	CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Content-Type"), CFSTR("application/xml"));
+	CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Content-Length"), (CFStringRef)[NSString stringWithFormat:@"%i", [xmlData length]]);
+	CFHTTPMessageSetBody(request, (CFDataRef)xmlData);
+	
+	stream = [self _newReadStreamWithHTTPRequest:request bodyStream:nil];
+	CFRelease(request);
+	
+	[self setDelegate:nil];
+	success = [[self runReadStream:stream dataStream:[NSOutputStream outputStreamToMemory] userInfo:@"COMPLETE" isFileTransfer:NO] boolValue];
+	[self setDelegate:delegate];
+	
+	return success;
+}
+
+- (void) _abortMultipartUpload:(MultipartUpload*)upload
+{
+	id						delegate = [self delegate];
+	
+	//NOTE: The upload has already failed at this point so there is no need to report errors
+	[self setDelegate:nil];
+	if(![self _deletePath:[NSString stringWithFormat:@"%@?uploadId=%@", upload->path, upload->uploadID]])
+	NSLog(@"%s: Failed aborting multipart upload \"%@\"", __FUNCTION__, upload->uploadID);
+	[self setDelegate:delegate];
+}
+
+/* Parts are always read from disk in order, so the file digest can be computed as we go */
+- (BOOL) _readPart:(PartConnection*)connection
+{
+	MultipartUpload*		upload = connection->upload;
+	off_t					offset = (off_t)(connection->partNumber - 1) * upload->partSize;
+	NSUInteger				length = MIN(upload->length - offset, upload->partSize);
+	NSMutableData*			data;
+	unsigned char			md5[CC_MD5_DIGEST_LENGTH];
+	
+	data = [[NSMutableData alloc] initWithLength:length];
+	if(pread(upload->fd, [data mutableBytes], length, offset) != (ssize_t)length) {
+		NSLog(@"%s: pread() failed with error \"%s\"", __FUNCTION__, strerror(errno));
+		[data release];
+		return NO;
+	}
+#if !TARGET_OS_IPHONE
+	if(![self _updateDigestContextWithBytes:[data bytes] length:length]) {
+		[data release];
+		return NO;
+	}
+#endif
+	CC_MD5([data bytes], length, md5);
+	
+	[connection->data release];
+	connection->data = data;
+	[connection->md5 release];
+	connection->md5 = [_EncodeBase64([NSData dataWithBytes:md5 length:CC_MD5_DIGEST_LENGTH]) copy];
+	
+	return YES;
+}
+
+- (BOOL) _openPartConnection:(PartConnection*)connection
+{
+	MultipartUpload*		upload = connection->upload;
+	CFStreamClientContext	context = {0, connection, NULL, NULL, NULL};
+	CFHTTPMessageRef		request;
+	
+	request = [self _newHTTPRequestWithMethod:@"PUT" path:[NSString stringWithFormat:@"%@?partNumber=%i&uploadId=%@", upload->path, connection->partNumber, upload->uploadID]];
+	if(request == NULL)
+	return NO;
+	
+	CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Content-MD5"), (CFStringRef)connection->md5);
+	CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Content-Length"), (CFStringRef)[NSString stringWithFormat:@"%i", [connection->data length]]);
+	CFHTTPMessageSetBody(request, (CFDataRef)connection->data);
+	connection->bytesWritten = 0;
+	
+	connection->stream = [self _newReadStreamWithHTTPRequest:request bodyStream:nil];
+	CFRelease(request);
+	if(connection->stream == NULL)
+	return NO;
+	
+	CFReadStreamSetProperty(connection->stream, kCFStreamPropertyHTTPAttemptPersistentConnection, kCFBooleanTrue);
+	CFReadStreamSetClient(connection->stream, kCFStreamEventOpenCompleted | kCFStreamEventHasBytesAvailable | kCFStreamEventErrorOccurred | kCFStreamEventEndEncountered, _PartReadStreamClientCallBack, &context);
+	CFReadStreamScheduleWithRunLoop(connection->stream, CFRunLoopGetCurrent(), kMultipartRunLoopMode);
+	
+	return (CFReadStreamOpen(connection->stream) ? YES : NO);
+}
+
+- (void) _closePartConnection:(PartConnection*)connection
+{
+	if(connection->stream) {
+		CFReadStreamUnscheduleFromRunLoop(connection->stream, CFRunLoopGetCurrent(), kMultipartRunLoopMode);
+		CFReadStreamSetClient(connection->stream, kCFStreamEventNone, NULL, NULL);
+		CFReadStreamClose(connection->stream);
+		CFRelease(connection->stream);
+		connection->stream = NULL;
+	}
+}
+
+- (BOOL) _startNextPart:(PartConnection*)connection
+{
+	MultipartUpload*		upload = connection->upload;
+	
+	[connection->data release];
+	connection->data = nil;
+	[connection->md5 release];
+	connection->md5 = nil;
+	connection->partNumber = 0;
+	connection->retries = 0;
+	
+	if(upload->nextPart <= upload->partCount) {
+		connection->partNumber = upload->nextPart++;
+		if(![self _readPart:connection] || ![self _openPartConnection:connection])
+		return NO;
+	}
+	
+	return YES;
+}
+
+- (void) _multipartUpload:(MultipartUpload*)upload didFailWithError:(NSError*)error
+{
+	if(!upload->done) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:error];
+		upload->done = YES;
+		CFRunLoopStop(CFRunLoopGetCurrent());
+	}
+}
+
+- (void) _updateMultipartUploadProgress:(MultipartUpload*)upload
+{
+	NSUInteger				length = upload->completedLength;
+	CFNumberRef				number;
+	NSUInteger				i;
+	
+	for(i = 0; i < upload->count; ++i) {
+		if(upload->connections[i].stream && (number = CFReadStreamCopyProperty(upload->connections[i].stream, kCFStreamPropertyHTTPRequestBytesWrittenCount))) {
+			CFNumberGetValue(number, kCFNumberCFIndexType, &upload->connections[i].bytesWritten);
+			CFRelease(number);
+		}
+		length += upload->connections[i].bytesWritten;
+	}
+	
+	[self setCurrentLength:length];
+}
+
+- (void) _partConnection:(PartConnection*)connection handleEvent:(CFStreamEventType)type
+{
+	MultipartUpload*		upload = connection->upload;
+	unsigned char			buffer[1024];
+	CFHTTPMessageRef		headers;
+	NSInteger				status;
+	NSString*				etag = nil;
+	NSError*				error;
+	BOOL					transient;
+	NSUInteger				i;
+	
+	if(upload->done)
+	return;
+	
+	switch(type) {
+		
+		case kCFStreamEventOpenCompleted:
+		return;
+		
+		case kCFStreamEventHasBytesAvailable:
+		CFReadStreamRead(connection->stream, buffer, sizeof(buffer)); //NOTE: Response body is ignored
+		return;
+		
+		case kCFStreamEventErrorOccurred:
+		error = [NSMakeCollectable(CFReadStreamCopyError(connection->stream)) autorelease];
+		transient = YES;
+		break;
+		
+		case kCFStreamEventEndEncountered:
+		headers = (CFHTTPMessageRef)CFReadStreamCopyProperty(connection->stream, kCFStreamPropertyHTTPResponseHeader);
+		status = (headers ? CFHTTPMessageGetResponseStatusCode(headers) : -1);
+		if(status == 200)
+		etag = [NSMakeCollectable(CFHTTPMessageCopyHeaderFieldValue(headers, CFSTR("ETag"))) autorelease];
+		if(headers)
+		CFRelease(headers);
+		error = (etag ? nil : MAKE_HTTP_ERROR(status, @"Amazon S3 Error: Failed uploading part %i", connection->partNumber));
+		transient = ((status < 0) || (status >= 500)); //NOTE: Client errors like 400 or 403 would fail again
+		break;
+		
+		default:
+		return;
+		
+	}
+	
+	[self _closePartConnection:connection];
+	if(error) {
+		if(transient && (connection->retries < kMaximumPartRetries)) {
+			connection->retries += 1;
+			if(![self _openPartConnection:connection])
+			[self _multipartUpload:upload didFailWithError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed opening connection")];
+		}
+		else
+		[self _multipartUpload:upload didFailWithError:error];
+		return;
+	}
+	
+	[upload->etags replaceObjectAtIndex:(connection->partNumber - 1) withObject:etag];
+	upload->completedLength += [connection->data length];
+	connection->bytesWritten = 0;
+	[self _updateMultipartUploadProgress:upload];
+	if(![self _startNextPart:connection]) {
+		[self _multipartUpload:upload didFailWithError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed reading part from file")];
+		return;
+	}
+	
+	for(i = 0; i < upload->count; ++i) {
+		if(upload->connections[i].partNumber)
+		break;
+	}
+	if(i == upload->count) {
+		upload->success = YES;
+		upload->done = YES;
+		CFRunLoopStop(CFRunLoopGetCurrent());
+	}
+}
+
+- (BOOL) _runMultipartUpload:(MultipartUpload*)upload
+{
+	BOOL					delegateHasShouldAbort = [[self delegate] respondsToSelector:@selector(fileTransferControllerShouldAbort:)];
+	CFAbsoluteTime			timeout = [self timeOut],
+							lastTime = CFAbsoluteTimeGetCurrent(),
+							time;
+	NSUInteger				i;
+	SInt32					value;
+	
+	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
+	[[self delegate] fileTransferControllerDidStart:self];
+	
+	for(i = 0; i < upload->count; ++i) {
+		upload->connections[i].upload = upload;
+		if(![self _startNextPart:&upload->connections[i]]) {
+			[self _multipartUpload:upload didFailWithError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed starting part upload")];
+			break;
+		}
+	}
+	
+	while(!upload->done) {
+		value = CFRunLoopRunInMode(kMultipartRunLoopMode, kUpdateInterval, true);
+		time = CFAbsoluteTimeGetCurrent();
+		if(value != kCFRunLoopRunTimedOut)
+		lastTime = time;
+		else if((timeout > 0.0) && (time - lastTime >= timeout)) {
+			[self _multipartUpload:upload didFailWithError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Timeout while writing to stream")];
+			break;
+		}
+		if(delegateHasShouldAbort && [[self delegate] fileTransferControllerShouldAbort:self])
+		break;
+		[self _updateMultipartUploadProgress:upload];
+	}
+	
+	for(i = 0; i < upload->count; ++i) {
+		[self _closePartConnection:&upload->connections[i]];
+		[upload->connections[i].data release];
+		[upload->connections[i].md5 release];
+	}
+	
+	return upload->success;
+}
+
+/* Override completely */
+- (BOOL) uploadFileFromPath:(NSString*)localPath toPath:(NSString*)remotePath
+{
+	MultipartUpload			upload;
+	struct stat				info;
+	NSUInteger				i;
+	BOOL					success;
+	
+	if(_maxUploadConnections <= 1)
+	return [super uploadFileFromPath:localPath toPath:remotePath];
+#if !TARGET_OS_IPHONE
+	if([self encryptionPassword] || [self compressionFormat])
+	return [super uploadFileFromPath:localPath toPath:remotePath];
+#endif
+	if(![self isLocalHost] && ([self maximumUploadSpeed] || [FileTransferController globalMaximumUploadSpeed]))
+	return [super uploadFileFromPath:localPath toPath:remotePath];
+	
+	bzero(&upload, sizeof(MultipartUpload));
+	upload.fd = open([[localPath stringByStandardizingPath] fileSystemRepresentation], O_RDONLY);
+	if(upload.fd < 0)
+	return NO;
+	if((fstat(upload.fd, &info) != 0) || (info.st_size < 2 * (off_t)MAX(_partSize, kMinimumPartSize))) {
+		close(upload.fd);
+		return [super uploadFileFromPath:localPath toPath:remotePath];
+	}
+	
+	upload.controller = self;
+	upload.path = remotePath;
+	upload.length = info.st_size;
+	upload.partSize = MAX(MAX(_partSize, kMinimumPartSize), (upload.length + kMaximumPartCount - 1) / kMaximumPartCount);
+	upload.partCount = (upload.length + upload.partSize - 1) / upload.partSize;
+	upload.nextPart = 1;
+	upload.count = MIN(_maxUploadConnections, upload.partCount);
+	if([self limitsConcurrentRequestsPerHost])
+	upload.count = MIN(upload.count, [HTTPTransferController maximumConcurrentRequestsPerHost]);
+	
+	upload.uploadID = [self _initiateMultipartUploadToPath:remotePath];
+	if(upload.uploadID == nil) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Amazon S3 Error: Failed initiating multipart upload")];
+		close(upload.fd);
+		return NO;
+	}
+	
+	upload.etags = [NSMutableArray new];
+	for(i = 0; i < upload.partCount; ++i)
+	[upload.etags addObject:[NSNull null]];
+	upload.connections = calloc(upload.count, sizeof(PartConnection));
+	
+#if !TARGET_OS_IPHONE
+	success = [self _createDigestContext];
+	if(!success && [[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+	[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed creating digest")];
+#else
+	success = YES;
+#endif
+	if(success) {
+		[self setMaxLength:upload.length];
+		success = [self _runMultipartUpload:&upload];
+		[self setMaxLength:0];
+	}
+#if !TARGET_OS_IPHONE
+	if(success && ![self _finalizeDigestContext]) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed computing digest")];
+		success = NO;
+	}
+	[self _destroyDigestContext];
+#endif
+	if(success && ![self _completeMultipartUpload:&upload]) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Amazon S3 Error: Failed completing multipart upload")];
+		success = NO;
+	}
+	if(success) {
+		[self setLastTransferSize:upload.length];
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
+		[[self delegate] fileTransferControllerDidSucceed:self];
+	}
+	else
+	[self _abortMultipartUpload:&upload];
+	
+	free(upload.connections);
+	[upload.etags release];
+	close(upload.fd);
+	
+	return success;
+}
+
 @end
 
 @implementation SecureAmazonS3TransferController
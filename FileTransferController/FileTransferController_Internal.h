@@ -28,9 +28,13 @@
 @interface FileTransferController ()
 @property(nonatomic) NSUInteger currentLength;
 @property(nonatomic) NSUInteger maxLength;
+@property(nonatomic) NSUInteger lastTransferSize;
+@property(nonatomic) unsigned long long resumeOffset; //Set before calling -_downloadFileFromPath:toStream: or -_uploadFileToPath:fromStream: if the transfer must start at this offset (only for classes with resumable transfers)
+@property(nonatomic, copy) NSString* resumeValidator; //Identifies the version of the remote file the resumed bytes come from or nil - Downloads must set it before writing any data and reset "resumeOffset" to 0 before failing if it changed
 
 - (BOOL) _downloadFileFromPath:(NSString*)remotePath toStream:(NSOutputStream*)stream; //To be implemented by subclasses
 - (BOOL) _uploadFileToPath:(NSString*)remotePath fromStream:(NSInputStream*)stream; //To be implemented by subclasses
+- (long long) _sizeOfRemoteFileAtPath:(NSString*)remotePath; //To be implemented by subclasses with resumable uploads - Returns -1 if the file does not exist or on error
 
 + (BOOL) useAsyncStreams;
 + (NSString*) urlScheme;
@@ -43,6 +47,13 @@
 - (BOOL) writeToOutputStream:(NSOutputStream*)stream bytes:(const void*)bytes maxLength:(NSUInteger)length;
 - (BOOL) flushOutputStream:(NSOutputStream*)stream;
 - (void) closeOutputStream:(NSOutputStream*)stream;
+
+#if !TARGET_OS_IPHONE
+- (BOOL) _createDigestContext; //Does nothing if "digestComputation" is NO
+- (BOOL) _updateDigestContextWithBytes:(const void*)bytes length:(NSUInteger)length;
+- (BOOL) _finalizeDigestContext; //Also destroys the digest context
+- (void) _destroyDigestContext;
+#endif
 @end
 
 @interface StreamTransferController ()
@@ -55,4 +66,5 @@
 
 - (id) processReadResultStream:(NSOutputStream*)stream userInfo:(id)info error:(NSError**)error;
 - (void) invalidate;
+- (void) _doneWithResult:(id)result; //Ends the stream loop and reports success to the delegate if "result" is not nil
 @end
@@ -17,16 +17,97 @@
 */
 
 #import <sys/mount.h>
+#import <sys/mman.h>
+#import <sys/stat.h>
+#import <sys/ioctl.h>
+#import <fcntl.h>
+#import <unistd.h>
 #import <pthread.h>
+#if defined(__linux__)
+#import <sys/sendfile.h>
+#import <sys/xattr.h>
+#import <linux/fs.h>
+#else
+#import <copyfile.h>
+#endif
 
 #import "FileTransferController_Internal.h"
 #import "NSURL+Parameters.h"
 
+#define kCopyChunkSize			(8 * 1024 * 1024)
+#define kMappedWindowSize		(16 * 1024 * 1024)
+
 #if !TARGET_OS_IPHONE
 static CFMutableBagRef		_mountedList = NULL;
 static pthread_mutex_t		_mountedMutex = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
+@interface LocalTransferController ()
+- (BOOL) _didCopyBytes:(off_t)offset;
+@end
+
+static BOOL _IsRegularFile(NSString* path)
+{
+	struct stat				info;
+	
+	return (path && (stat([path fileSystemRepresentation], &info) == 0) && S_ISREG(info.st_mode));
+}
+
+/* Copies the permissions, extended attributes and ACLs like -[NSFileManager copyItemAtPath:toPath:error:] */
+static BOOL _CopyFileMetadata(int inFD, int outFD, mode_t mode)
+{
+#if defined(__linux__)
+	char*					names;
+	char*					name;
+	ssize_t					namesLength,
+							valueLength;
+	void*					value;
+	BOOL					success = YES;
+	
+	if(fchmod(outFD, mode & 07777) != 0)
+	return NO;
+	
+	//NOTE: POSIX ACLs are stored as "system.posix_acl_XXX" extended attributes
+	namesLength = flistxattr(inFD, NULL, 0);
+	if(namesLength <= 0)
+	return ((namesLength == 0) || (errno == ENOTSUP));
+	names = malloc(namesLength);
+	namesLength = flistxattr(inFD, names, namesLength);
+	for(name = names; success && (namesLength > 0) && (name < names + namesLength); name += strlen(name) + 1) {
+		valueLength = fgetxattr(inFD, name, NULL, 0);
+		if(valueLength < 0)
+		continue;
+		value = malloc(MAX(valueLength, 1));
+		valueLength = fgetxattr(inFD, name, value, valueLength);
+		if((valueLength >= 0) && (fsetxattr(outFD, name, value, valueLength, 0) != 0) && (errno != EPERM) && (errno != ENOTSUP)) //NOTE: Unprivileged processes cannot set "trusted" or "security" attributes
+		success = NO;
+		free(value);
+	}
+	free(names);
+	
+	return success;
+#else
+	return (fcopyfile(inFD, outFD, NULL, COPYFILE_SECURITY | COPYFILE_XATTR) == 0);
+#endif
+}
+
+#if !defined(__linux__)
+
+static int _CopyFileCallback(int what, int stage, copyfile_state_t state, const char* src, const char* dst, void* context)
+{
+	LocalTransferController*	controller = (LocalTransferController*)context;
+	off_t						copied;
+	
+	if((what == COPYFILE_COPY_DATA) && (stage == COPYFILE_PROGRESS)) {
+		if(copyfile_state_get(state, COPYFILE_STATE_COPIED, &copied) == 0)
+		return ([controller _didCopyBytes:copied] ? COPYFILE_CONTINUE : COPYFILE_QUIT);
+	}
+	
+	return COPYFILE_CONTINUE;
+}
+
+#endif
+
 @implementation LocalTransferController
 
 + (BOOL) useAsyncStreams
@@ -39,6 +120,16 @@ static pthread_mutex_t		_mountedMutex = PTHREAD_MUTEX_INITIALIZER;
 	return @"file";
 }
 
++ (BOOL) hasResumableDownloads
+{
+	return YES;
+}
+
++ (BOOL) hasResumableUploads
+{
+	return YES;
+}
+
 - (id) processReadResultStream:(NSOutputStream*)stream userInfo:(id)info error:(NSError**)error
 {
 	return [NSNumber numberWithBool:YES];
@@ -129,6 +220,7 @@ static pthread_mutex_t		_mountedMutex = PTHREAD_MUTEX_INITIALIZER;
 	NSDictionary*			info;
 	NSError*				error;
 	CFReadStreamRef			readStream;
+	NSString*				validator;
 	
 	if(!stream || ([stream streamStatus] != NSStreamStatusNotOpen))
 	return NO;
@@ -144,11 +236,23 @@ static pthread_mutex_t		_mountedMutex = PTHREAD_MUTEX_INITIALIZER;
 	info = [[NSFileManager defaultManager] attributesOfItemAtPath:[url path] error:&error];
 	if(info == nil)
 	return NO;
-	[self setMaxLength:[[info objectForKey:NSFileSize] unsignedIntegerValue]];
+	validator = [NSString stringWithFormat:@"%@-%.0f", [info objectForKey:NSFileSize], [[info objectForKey:NSFileModificationDate] timeIntervalSinceReferenceDate]];
+	if([self resumeOffset] && ![validator isEqualToString:[self resumeValidator]]) {
+		[self setResumeOffset:0];
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
+		[[self delegate] fileTransferControllerDidStart:self];
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"\"%@\" was modified since the transfer was interrupted", remotePath)];
+		return NO;
+	}
+	[self setResumeValidator:validator];
+	[self setMaxLength:([[info objectForKey:NSFileSize] unsignedLongLongValue] - [self resumeOffset])];
 	
 	readStream = CFReadStreamCreateWithFile(kCFAllocatorDefault, (CFURLRef)url);
 	if(readStream == NULL)
 	return NO;
+	if([self resumeOffset])
+	CFReadStreamSetProperty(readStream, kCFStreamPropertyFileCurrentOffset, (CFNumberRef)[NSNumber numberWithUnsignedLongLong:[self resumeOffset]]);
 	
 	return [[self runReadStream:readStream dataStream:stream userInfo:nil isFileTransfer:YES] boolValue];
 }
@@ -172,10 +276,243 @@ static pthread_mutex_t		_mountedMutex = PTHREAD_MUTEX_INITIALIZER;
 	writeStream = CFWriteStreamCreateWithFile(kCFAllocatorDefault, (CFURLRef)url);
 	if(writeStream == NULL)
 	return NO;
+	if([self resumeOffset])
+	CFWriteStreamSetProperty(writeStream, kCFStreamPropertyAppendToFile, kCFBooleanTrue);
 	
 	return [[self runWriteStream:writeStream dataStream:stream userInfo:nil isFileTransfer:YES] boolValue];
 }
 
+- (long long) _sizeOfRemoteFileAtPath:(NSString*)remotePath
+{
+	NSURL*					url = [self absoluteURLForRemotePath:remotePath];
+	struct stat				info;
+	
+	return (url && (stat([[url path] fileSystemRepresentation], &info) == 0) && S_ISREG(info.st_mode) ? info.st_size : -1);
+}
+
+/* Returns NO if the copy must be aborted */
+- (BOOL) _didCopyBytes:(off_t)offset
+{
+	[self setCurrentLength:offset];
+	
+	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidUpdateProgress:)])
+	[[self delegate] fileTransferControllerDidUpdateProgress:self];
+	
+	return !([[self delegate] respondsToSelector:@selector(fileTransferControllerShouldAbort:)] && [[self delegate] fileTransferControllerShouldAbort:self]);
+}
+
+- (BOOL) _canCopyFileWithKernel:(BOOL)upload
+{
+#if !TARGET_OS_IPHONE
+	if([self encryptionPassword] || [self compressionFormat])
+	return NO;
+#endif
+	if([self checkpointDirectory]) //NOTE: Copies through the stream loop can be resumed
+	return NO;
+	if(![self isLocalHost]) {
+		if(upload && ([self maximumUploadSpeed] || [FileTransferController globalMaximumUploadSpeed]))
+		return NO;
+		if(!upload && ([self maximumDownloadSpeed] || [FileTransferController globalMaximumDownloadSpeed]))
+		return NO;
+	}
+	
+	return YES;
+}
+
+/* Copies a regular file without going through the stream loop: cloned or copied by the kernel if possible, or through mmap() if the digest must be computed - The permissions, extended attributes and ACLs are copied as well if "metadata" is YES */
+- (BOOL) _copyFileAtPath:(NSString*)fromPath toPath:(NSString*)toPath digest:(BOOL)digest metadata:(BOOL)metadata error:(NSError**)error
+{
+	const char*				toFSPath = [toPath fileSystemRepresentation];
+	BOOL					success = NO;
+	int						inFD,
+							outFD = -1;
+	struct stat				info;
+	off_t					offset = 0;
+	size_t					length;
+	ssize_t					result;
+	size_t					position;
+	void*					bytes;
+#if defined(__linux__)
+	BOOL					useCopyRange = YES;
+#else
+	copyfile_state_t		state;
+#endif
+	
+	*error = nil;
+	inFD = open([fromPath fileSystemRepresentation], O_RDONLY);
+	if(inFD < 0)
+	goto Exit;
+	if(fstat(inFD, &info) != 0)
+	goto Exit;
+	[self setMaxLength:info.st_size];
+	[self setCurrentLength:0];
+	
+#if !TARGET_OS_IPHONE
+	if(digest) {
+		if(![self _createDigestContext])
+		goto Exit;
+		outFD = open(toFSPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if(outFD < 0)
+		goto Exit;
+		while(offset < info.st_size) {
+			length = MIN(info.st_size - offset, kMappedWindowSize);
+			bytes = mmap(NULL, length, PROT_READ, MAP_SHARED, inFD, offset);
+			if(bytes == MAP_FAILED)
+			goto Exit;
+			madvise(bytes, length, MADV_SEQUENTIAL);
+			success = [self _updateDigestContextWithBytes:bytes length:length];
+			for(position = 0; success && (position < length);) {
+				result = write(outFD, (char*)bytes + position, length - position);
+				if(result < 0) {
+					if(errno != EINTR)
+					success = NO;
+				}
+				else
+				position += result;
+			}
+			munmap(bytes, length);
+			if(!success)
+			goto Exit;
+			offset += length;
+			success = NO;
+			if(![self _didCopyBytes:offset]) {
+				*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Transfer aborted");
+				goto Exit;
+			}
+		}
+		if(![self _finalizeDigestContext])
+		goto Exit;
+		success = YES;
+		goto Exit;
+	}
+#endif
+	
+#if defined(__linux__)
+	outFD = open(toFSPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(outFD < 0)
+	goto Exit;
+	if(ioctl(outFD, FICLONE, inFD) == 0) {
+		offset = info.st_size;
+		[self _didCopyBytes:offset];
+	}
+	while(offset < info.st_size) {
+		length = MIN(info.st_size - offset, kCopyChunkSize);
+		if(useCopyRange) {
+			result = copy_file_range(inFD, NULL, outFD, NULL, length, 0);
+			if((result < 0) && ((errno == ENOSYS) || (errno == EXDEV) || (errno == EINVAL) || (errno == EOPNOTSUPP))) {
+				useCopyRange = NO;
+				continue;
+			}
+		}
+		else
+		result = sendfile(outFD, inFD, NULL, length);
+		if(result < 0) {
+			if(errno == EINTR)
+			continue;
+			goto Exit;
+		}
+		if(result == 0) {
+			*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"\"%@\" was truncated during the copy", fromPath);
+			goto Exit;
+		}
+		offset += result;
+		if(![self _didCopyBytes:offset]) {
+			*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Transfer aborted");
+			goto Exit;
+		}
+	}
+	success = YES;
+#else
+	//NOTE: Cloning requires the destination not to exist and is only supported on some volumes (e.g. APFS)
+	if((unlink(toFSPath) == 0) || (errno == ENOENT)) {
+		if(fclonefileat(inFD, AT_FDCWD, toFSPath, 0) == 0) {
+			[self _didCopyBytes:info.st_size];
+			success = YES;
+			goto Exit;
+		}
+	}
+	outFD = open(toFSPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(outFD < 0)
+	goto Exit;
+	state = copyfile_state_alloc();
+	copyfile_state_set(state, COPYFILE_STATE_STATUS_CB, &_CopyFileCallback);
+	copyfile_state_set(state, COPYFILE_STATE_STATUS_CTX, self);
+	success = (fcopyfile(inFD, outFD, state, COPYFILE_DATA) == 0);
+	copyfile_state_free(state);
+	if(!success && (errno == ECANCELED))
+	*error = MAKE_FILETRANSFERCONTROLLER_ERROR(@"Transfer aborted");
+#endif
+	
+Exit:
+	if(success && metadata && (outFD >= 0)) //NOTE: Clones already carry the metadata
+	success = _CopyFileMetadata(inFD, outFD, info.st_mode);
+	if(!success && (*error == nil))
+	*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+#if !TARGET_OS_IPHONE
+	[self _destroyDigestContext];
+#endif
+	if(outFD >= 0)
+	close(outFD);
+	if(inFD >= 0)
+	close(inFD);
+	if(success)
+	[self setLastTransferSize:info.st_size];
+	else if(outFD >= 0)
+	unlink(toFSPath);
+	
+	return success;
+}
+
+- (BOOL) _transferFileAtPath:(NSString*)fromPath toPath:(NSString*)toPath
+{
+	BOOL					digest = NO;
+	NSError*				error;
+	
+#if !TARGET_OS_IPHONE
+	digest = [self digestComputation];
+#endif
+	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
+	[[self delegate] fileTransferControllerDidStart:self];
+	
+	if(![self _copyFileAtPath:fromPath toPath:toPath digest:digest metadata:NO error:&error]) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:error];
+		return NO;
+	}
+	
+	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
+	[[self delegate] fileTransferControllerDidSucceed:self];
+	
+	return YES;
+}
+
+- (BOOL) downloadFileFromPath:(NSString*)remotePath toPath:(NSString*)localPath
+{
+	NSURL*					url;
+	
+	if([self _canCopyFileWithKernel:NO]) {
+		url = [self absoluteURLForRemotePath:remotePath];
+		if(url && _IsRegularFile([url path]))
+		return [self _transferFileAtPath:[url path] toPath:[localPath stringByStandardizingPath]];
+	}
+	
+	return [super downloadFileFromPath:remotePath toPath:localPath];
+}
+
+- (BOOL) uploadFileFromPath:(NSString*)localPath toPath:(NSString*)remotePath
+{
+	NSURL*					url;
+	
+	localPath = [localPath stringByStandardizingPath];
+	if([self _canCopyFileWithKernel:YES] && _IsRegularFile(localPath)) {
+		url = [self absoluteURLForRemotePath:remotePath];
+		if(url)
+		return [self _transferFileAtPath:localPath toPath:[url path]];
+	}
+	
+	return [super uploadFileFromPath:localPath toPath:remotePath];
+}
+
 - (BOOL) movePath:(NSString*)fromRemotePath toPath:(NSString*)toRemotePath
 {
 	NSURL*					fromURL = [self absoluteURLForRemotePath:fromRemotePath];
@@ -227,8 +564,8 @@ static pthread_mutex_t		_mountedMutex = PTHREAD_MUTEX_INITIALIZER;
 			[[self delegate] fileTransferControllerDidFail:self withError:error];
 			return NO;
 		}
-
-		if(![manager copyItemAtPath:[fromURL path] toPath:[toURL path] error:&error]) {
+		
+		if(_IsRegularFile([fromURL path]) ? ![self _copyFileAtPath:[fromURL path] toPath:[toURL path] digest:NO metadata:YES error:&error] : ![manager copyItemAtPath:[fromURL path] toPath:[toURL path] error:&error]) {
 			if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
 			[[self delegate] fileTransferControllerDidFail:self withError:error];
 			return NO;
@@ -17,6 +17,12 @@
 */
 
 #import <netinet/in.h>
+#import <sys/select.h>
+#import <poll.h>
+#import <pthread.h>
+#import <sys/time.h>
+#import <openssl/sha.h>
+#import <openssl/rand.h>
 #import "libssh2.h"
 #import "libssh2_sftp.h"
 
@@ -27,6 +33,96 @@
 #define kDefaultMode					0755
 #define kNameBufferSize					1024
 #define kTransferBufferSize				(32 * 1024)
+#define kDefaultPipelinedRequests		16
+#define kDefaultMaxReceiveWindow		(128 * 1024 * 1024)
+#define kDefaultMaxChannels				4
+#define kMaxChannels					16
+#define kDefaultSCPThreshold			(16 * 1024 * 1024)
+#define kPollInterval					1.0
+#define kMaxPooledConnections			32
+#define kMaxPooledConnectionsPerServer	4
+#define kPooledConnectionIdleTimeOut	60.0
+
+enum {
+	kBatchChannelState_Idle = 0,
+	kBatchChannelState_Opening,
+	kBatchChannelState_Transferring,
+	kBatchChannelState_Flushing,
+	kBatchChannelState_Closing
+};
+
+enum {
+	kBatchResult_Error = -1,
+	kBatchResult_WouldBlock = 0,
+	kBatchResult_Progress,
+	kBatchResult_Done
+};
+
+#define kTransferKey_LocalPath			@"localPath"
+#define kTransferKey_RemotePath			@"remotePath"
+#define kTransferKey_Controller			@"controller"
+#define kTransferKey_Upload				@"upload"
+
+typedef struct {
+	LIBSSH2_SFTP*			sftp;
+	LIBSSH2_SFTP_HANDLE*	handle;
+	NSUInteger				state;
+	NSDictionary*			transfer;
+	BOOL					upload,
+							failed;
+	NSError*				error;
+	int						fd;
+	ssize_t					length,
+							offset;
+	unsigned char			buffer[kTransferBufferSize];
+} BatchChannel;
+
+typedef struct {
+	SFTPTransferController*	controller;
+	NSMutableArray*			pending;
+	BatchChannel*			channels;
+	BatchChannel*			sending; //Channel which left a packet partially sent
+	NSUInteger				numChannels,
+							length;
+	CFAbsoluteTime			lastTime;
+	BOOL					done;
+} BatchSession;
+
+@interface SFTPTransferLoop ()
+- (void) _completeTransfer:(NSDictionary*)transfer error:(NSError*)error;
+@end
+
+@interface SFTPTransferController () <SFTPTransferLoopDelegate>
+- (BOOL) _canTransferInBatch;
+- (BOOL) _beginBatchSession:(BatchSession*)session;
+- (NSInteger) _runBatchSession:(BatchSession*)session loop:(SFTPTransferLoop*)loop;
+- (BOOL) _getPollDescriptor:(struct pollfd*)descriptor forBatchSession:(BatchSession*)session;
+- (void) _endBatchSession:(BatchSession*)session loop:(SFTPTransferLoop*)loop error:(NSError*)error;
+@end
+
+typedef struct {
+	CFStringRef				key;
+	CFSocketRef				socket;
+	LIBSSH2_SESSION*		session;
+	LIBSSH2_SFTP*			sftp;
+	CFAbsoluteTime			time;
+} PooledConnection;
+
+enum {
+	kPoolStatistic_Leases = 0,
+	kPoolStatistic_Returns,
+	kPoolStatistic_Expirations,
+	kPoolStatisticCount
+};
+
+static pthread_mutex_t		_poolMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		_poolCondition = PTHREAD_COND_INITIALIZER;
+static PooledConnection		_pool[kMaxPooledConnections]; //Ordered from least to most recently returned
+static NSUInteger			_poolSize = 0;
+static NSUInteger			_poolStatistics[kPoolStatisticCount] = {0};
+static BOOL					_poolReaper = NO;
+static pthread_once_t		_poolSaltOnce = PTHREAD_ONCE_INIT;
+static unsigned char		_poolSalt[16];
 
 static inline NSError* _MakeLibSSH2Error(LIBSSH2_SESSION* session, LIBSSH2_SFTP* sftp)
 {
@@ -38,6 +134,22 @@ static inline NSError* _MakeLibSSH2Error(LIBSSH2_SESSION* session, LIBSSH2_SFTP*
 	return [NSError errorWithDomain:@"libssh2" code:error userInfo:[NSDictionary dictionaryWithObjectsAndKeys:[NSString stringWithUTF8String:message], NSLocalizedDescriptionKey, (libssh2_sftp_last_error(sftp) ? [NSNumber numberWithUnsignedLong:libssh2_sftp_last_error(sftp)] : nil), @"SFTPLastError", nil]];
 }
 
+static NSDictionary* _DictionaryFromAttributes(const LIBSSH2_SFTP_ATTRIBUTES* attributes)
+{
+	NSMutableDictionary*		dictionary = [NSMutableDictionary dictionary];
+	
+	if(S_ISLNK(attributes->permissions))
+	[dictionary setObject:NSFileTypeSymbolicLink forKey:NSFileType];
+	else
+	[dictionary setObject:(S_ISDIR(attributes->permissions) ? NSFileTypeDirectory : NSFileTypeRegular) forKey:NSFileType];
+	if(attributes->flags & LIBSSH2_SFTP_ATTR_ACMODTIME)
+	[dictionary setObject:[NSDate dateWithTimeIntervalSince1970:attributes->mtime] forKey:NSFileModificationDate];
+	if(S_ISREG(attributes->permissions) && (attributes->flags & LIBSSH2_SFTP_ATTR_SIZE))
+	[dictionary setObject:[NSNumber numberWithUnsignedLongLong:attributes->filesize] forKey:NSFileSize];
+	
+	return dictionary;
+}
+
 static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFOptionFlags callBackTypes, CFSocketCallBack callback, const CFSocketContext* context, CFTimeInterval timeOut)
 {
 	int							on = 1;
@@ -88,13 +200,197 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 	return socket;
 }
 
+static BOOL _WaitForSocket(int fd, int directions, NSTimeInterval timeOut)
+{
+	struct timeval				tv = {(__darwin_time_t)timeOut, (__darwin_suseconds_t)(fmod(timeOut, 1.0) * 1000000.0)};
+	fd_set						readSet,
+								writeSet;
+	
+	FD_ZERO(&readSet);
+	FD_ZERO(&writeSet);
+	if(directions & LIBSSH2_SESSION_BLOCK_OUTBOUND)
+	FD_SET(fd, &writeSet);
+	if((directions & LIBSSH2_SESSION_BLOCK_INBOUND) || !(directions & LIBSSH2_SESSION_BLOCK_OUTBOUND))
+	FD_SET(fd, &readSet);
+	
+	return (select(fd + 1, &readSet, &writeSet, NULL, &tv) > 0);
+}
+
+static void _FreePooledConnection(PooledConnection* connection)
+{
+	struct timeval				tv = {1, 0};
+	
+	setsockopt(CFSocketGetNative(connection->socket), SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	setsockopt(CFSocketGetNative(connection->socket), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	libssh2_sftp_shutdown(connection->sftp);
+	libssh2_session_free(connection->session);
+	CFSocketInvalidate(connection->socket);
+	CFRelease(connection->socket);
+	CFRelease(connection->key);
+}
+
+/* Must be called with the pool mutex locked */
+static void _RemovePooledConnection(NSUInteger index, PooledConnection* connection)
+{
+	*connection = _pool[index];
+	_poolSize -= 1;
+	memmove(&_pool[index], &_pool[index + 1], (_poolSize - index) * sizeof(PooledConnection));
+}
+
+/* Must be called with the pool mutex locked */
+static NSUInteger _RemoveExpiredPooledConnections(PooledConnection* connections)
+{
+	CFAbsoluteTime				time = CFAbsoluteTimeGetCurrent();
+	NSUInteger					count = 0;
+	
+	while(_poolSize && (time - _pool[0].time >= kPooledConnectionIdleTimeOut))
+	_RemovePooledConnection(0, &connections[count++]);
+	_poolStatistics[kPoolStatistic_Expirations] += count;
+	
+	return count;
+}
+
+/* Closes idle connections as they expire even if the pool is not used anymore */
+static void* _PoolReaperThread(void* unused)
+{
+	PooledConnection			expired[kMaxPooledConnections];
+	struct timespec				deadline;
+	struct timeval				now;
+	NSTimeInterval				delay;
+	NSUInteger					count,
+								i;
+	
+	pthread_mutex_lock(&_poolMutex);
+	while(1) {
+		if(_poolSize == 0)
+		pthread_cond_wait(&_poolCondition, &_poolMutex);
+		else {
+			delay = _pool[0].time + kPooledConnectionIdleTimeOut - CFAbsoluteTimeGetCurrent();
+			if(delay > 0.0) {
+				gettimeofday(&now, NULL);
+				deadline.tv_sec = now.tv_sec + (time_t)delay;
+				deadline.tv_nsec = now.tv_usec * 1000 + (long)((delay - floor(delay)) * 1000000000.0);
+				if(deadline.tv_nsec >= 1000000000) {
+					deadline.tv_sec += 1;
+					deadline.tv_nsec -= 1000000000;
+				}
+				pthread_cond_timedwait(&_poolCondition, &_poolMutex, &deadline);
+			}
+		}
+		
+		count = _RemoveExpiredPooledConnections(expired);
+		if(count) {
+			pthread_mutex_unlock(&_poolMutex);
+			for(i = 0; i < count; ++i)
+			_FreePooledConnection(&expired[i]);
+			pthread_mutex_lock(&_poolMutex);
+		}
+	}
+	
+	return NULL;
+}
+
+static void _InitializePoolSalt()
+{
+	if(RAND_bytes(_poolSalt, sizeof(_poolSalt)) != 1)
+	NSLog(@"%s: RAND_bytes() failed", __FUNCTION__);
+}
+
+static BOOL _LeasePooledConnection(CFStringRef key, PooledConnection* connection)
+{
+	PooledConnection			expired[kMaxPooledConnections];
+	NSUInteger					count,
+								i;
+	BOOL						found;
+	
+	while(1) {
+		found = NO;
+		pthread_mutex_lock(&_poolMutex);
+		count = _RemoveExpiredPooledConnections(expired);
+		for(i = _poolSize; i > 0; --i) {
+			if(CFEqual(_pool[i - 1].key, key)) {
+				_RemovePooledConnection(i - 1, connection);
+				found = YES;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&_poolMutex);
+		
+		for(i = 0; i < count; ++i)
+		_FreePooledConnection(&expired[i]);
+		if(!found)
+		return NO;
+		
+		//NOTE: An idle connection has nothing to read unless the server sent a disconnect message or closed it
+		if(!_WaitForSocket(CFSocketGetNative(connection->socket), LIBSSH2_SESSION_BLOCK_INBOUND, 0.0)) {
+			pthread_mutex_lock(&_poolMutex);
+			_poolStatistics[kPoolStatistic_Leases] += 1;
+			pthread_mutex_unlock(&_poolMutex);
+			return YES;
+		}
+		_FreePooledConnection(connection);
+	}
+}
+
+static void _ReturnPooledConnection(PooledConnection* connection)
+{
+	PooledConnection			expired[kMaxPooledConnections + 1];
+	NSUInteger					count,
+								oldest = NSNotFound,
+								matches = 0,
+								i;
+	pthread_t					thread;
+	
+	pthread_mutex_lock(&_poolMutex);
+	if(!_poolReaper) {
+		if(pthread_create(&thread, NULL, _PoolReaperThread, NULL) == 0) {
+			pthread_detach(thread);
+			_poolReaper = YES;
+		}
+		else
+		NSLog(@"%s: pthread_create() failed", __FUNCTION__);
+	}
+	count = _RemoveExpiredPooledConnections(expired);
+	for(i = 0; i < _poolSize; ++i) {
+		if(CFEqual(_pool[i].key, connection->key)) {
+			if(oldest == NSNotFound)
+			oldest = i;
+			matches += 1;
+		}
+	}
+	if(matches >= kMaxPooledConnectionsPerServer)
+	_RemovePooledConnection(oldest, &expired[count++]);
+	else if(_poolSize == kMaxPooledConnections)
+	_RemovePooledConnection(0, &expired[count++]);
+	_pool[_poolSize++] = *connection;
+	_poolStatistics[kPoolStatistic_Returns] += 1;
+	pthread_cond_signal(&_poolCondition);
+	pthread_mutex_unlock(&_poolMutex);
+	
+	for(i = 0; i < count; ++i)
+	_FreePooledConnection(&expired[i]);
+}
+
 @implementation SFTPTransferController
 
+@synthesize maximumPipelinedRequests=_maxPipelinedRequests, maximumReceiveWindow=_maxReceiveWindow, initialReceiveWindow=_initialReceiveWindow, connectionCompressionLevel=_connectionCompressionLevel, maximumChannels=_maxChannels, reusesConnections=_reuseConnections,
+	transferProtocol=_transferProtocol, scpThreshold=_scpThreshold;
+
 + (NSString*) urlScheme;
 {
 	return @"ssh";
 }
 
++ (BOOL) hasResumableDownloads
+{
+	return YES;
+}
+
++ (BOOL) hasResumableUploads
+{
+	return YES;
+}
+
 - (id) initWithBaseURL:(NSURL*)url
 {
 	if(![url user] || ![url password]) {
@@ -102,11 +398,64 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 		return nil;
 	}
 	
-	return [super initWithBaseURL:url];
+	if((self = [super initWithBaseURL:url])) {
+		_maxPipelinedRequests = kDefaultPipelinedRequests;
+		_maxReceiveWindow = kDefaultMaxReceiveWindow;
+		_maxChannels = kDefaultMaxChannels;
+		_reuseConnections = YES;
+		_scpThreshold = kDefaultSCPThreshold;
+	}
+	
+	return self;
+}
+
++ (void) closePooledConnections
+{
+	PooledConnection			connections[kMaxPooledConnections];
+	NSUInteger					count,
+								i;
+	
+	pthread_mutex_lock(&_poolMutex);
+	count = _poolSize;
+	bcopy(_pool, connections, count * sizeof(PooledConnection));
+	_poolSize = 0;
+	pthread_mutex_unlock(&_poolMutex);
+	
+	for(i = 0; i < count; ++i)
+	_FreePooledConnection(&connections[i]);
+}
+
++ (NSDictionary*) connectionPoolStatistics
+{
+	NSUInteger				statistics[kPoolStatisticCount],
+							count;
+	
+	pthread_mutex_lock(&_poolMutex);
+	bcopy(_poolStatistics, statistics, sizeof(_poolStatistics));
+	count = _poolSize;
+	pthread_mutex_unlock(&_poolMutex);
+	
+	return [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithUnsignedInteger:count], kSFTPConnectionPoolStatisticsKey_Idle,
+		[NSNumber numberWithUnsignedInteger:statistics[kPoolStatistic_Leases]], kSFTPConnectionPoolStatisticsKey_Leases,
+		[NSNumber numberWithUnsignedInteger:statistics[kPoolStatistic_Returns]], kSFTPConnectionPoolStatisticsKey_Returns,
+		[NSNumber numberWithUnsignedInteger:statistics[kPoolStatistic_Expirations]], kSFTPConnectionPoolStatisticsKey_Expirations,
+	nil];
+}
+
+- (void) _closeAdditionalChannels
+{
+	while(_numChannels)
+	libssh2_sftp_shutdown(_channels[--_numChannels]);
+	if(_channels) {
+		free(_channels);
+		_channels = NULL;
+	}
 }
 
 - (void) _disconnect
 {
+	[self _closeAdditionalChannels];
+	
 	if(_sftp) {
 		libssh2_sftp_shutdown(_sftp);
 		_sftp = NULL;
@@ -124,16 +473,67 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 	}
 }
 
-- (void) finalize
+/* The credentials only appear as a salted digest so the process-wide pool does not keep the password around */
+- (NSString*) _poolKey
+{
+	NSURL*					url = [self baseURL];
+	NSData*					user = [[url user] dataUsingEncoding:NSUTF8StringEncoding];
+	NSData*					password = [[url passwordByReplacingPercentEscapes] dataUsingEncoding:NSUTF8StringEncoding];
+	unsigned char			digest[SHA256_DIGEST_LENGTH];
+	NSMutableString*		string;
+	SHA256_CTX				context;
+	NSUInteger				i;
+	
+	pthread_once(&_poolSaltOnce, _InitializePoolSalt);
+	SHA256_Init(&context);
+	SHA256_Update(&context, _poolSalt, sizeof(_poolSalt));
+	SHA256_Update(&context, [user bytes], [user length]);
+	SHA256_Update(&context, "", 1);
+	SHA256_Update(&context, [password bytes], [password length]);
+	SHA256_Final(digest, &context);
+	
+	string = [NSMutableString stringWithFormat:@"%@:%i:%i:", [[url host] lowercaseString], ([url port] ? [[url port] unsignedShortValue] : kDefaultSSHPort), (int)_connectionCompressionLevel];
+	for(i = 0; i < SHA256_DIGEST_LENGTH; ++i)
+	[string appendFormat:@"%02x", digest[i]];
+	
+	return string;
+}
+
+/* Returns the connection to the pool if it is still usable and disconnects otherwise */
+- (void) _releaseConnection
 {
+	PooledConnection		connection;
+	int						error;
+	
+	if(_reuseConnections && _sftp) {
+		error = libssh2_session_last_errno(_session);
+		if(((error == LIBSSH2_ERROR_NONE) || (error == LIBSSH2_ERROR_SFTP_PROTOCOL) || (error == LIBSSH2_ERROR_EAGAIN)) && !_WaitForSocket(CFSocketGetNative(_socket), LIBSSH2_SESSION_BLOCK_INBOUND, 0.0)) {
+			[self _closeAdditionalChannels];
+			connection.key = CFRetain([self _poolKey]);
+			connection.socket = _socket;
+			connection.session = _session;
+			connection.sftp = _sftp;
+			connection.time = CFAbsoluteTimeGetCurrent();
+			_ReturnPooledConnection(&connection);
+			_socket = NULL;
+			_session = NULL;
+			_sftp = NULL;
+		}
+	}
+	
 	[self _disconnect];
+}
+
+- (void) finalize
+{
+	[self _releaseConnection];
 	
 	[super finalize];
 }
 
 - (void) dealloc
 {
-	[self _disconnect];
+	[self _releaseConnection];
 	
 	[super dealloc];
 }
@@ -151,6 +551,7 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 - (BOOL) _reconnect:(NSTimeInterval)timeOut
 {
 	NSURL*					url = [self baseURL];
+	PooledConnection		connection;
 	char*					message;
 	int						error;
 	
@@ -160,11 +561,23 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 		[self _disconnect];
 	}
 	
+	if((_socket == NULL) && _reuseConnections && _LeasePooledConnection((CFStringRef)[self _poolKey], &connection)) {
+		_socket = connection.socket;
+		_session = connection.session;
+		_sftp = connection.sftp;
+		CFRelease(connection.key);
+	}
+	
 	if(_socket == NULL) {
 		_socket = _CreateSocketConnectedToHost([url host], ([url port] ? [[url port] unsignedShortValue] : kDefaultSSHPort), kCFSocketNoCallBack, NULL, NULL, timeOut);
 		if(_socket) {
 			_session = libssh2_session_init();
 			if(_session) {
+				if(_connectionCompressionLevel) {
+					libssh2_session_compression(_session, _connectionCompressionLevel, 0, LIBSSH2_COMPRESSION_ADAPTIVE);
+					libssh2_session_method_pref(_session, LIBSSH2_METHOD_COMP_CS, "zlib@openssh.com,zlib,none");
+					libssh2_session_method_pref(_session, LIBSSH2_METHOD_COMP_SC, "zlib@openssh.com,zlib,none");
+				}
 				if(libssh2_session_startup(_session, CFSocketGetNative(_socket)) == 0) {
 					if(libssh2_userauth_password(_session, [[url user] UTF8String], [[url passwordByReplacingPercentEscapes] UTF8String]) == 0) {
 						_sftp = libssh2_sftp_init(_session);
@@ -193,10 +606,232 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 	}
 	
 	[self _setTimeOut:timeOut];
+	libssh2_channel_window_autotune(libssh2_sftp_get_channel(_sftp), _initialReceiveWindow, _maxReceiveWindow);
+	
+	return YES;
+}
+
+- (NSUInteger) _openAdditionalChannels:(NSUInteger)count
+{
+	LIBSSH2_SFTP*			sftp;
+	char*					message;
+	int						error;
+	
+	if(_channels == NULL)
+	_channels = calloc(kMaxChannels - 1, sizeof(LIBSSH2_SFTP*));
+	
+	while(_numChannels < MIN(count, kMaxChannels - 1)) {
+		sftp = libssh2_sftp_init(_session);
+		if(sftp == NULL) { //NOTE: The server may limit the number of sessions per connection so go on with the channels already open
+			error = libssh2_session_last_error(_session, &message, NULL, 0);
+			NSLog(@"%s: libssh2_sftp_init() failed (error %i): %s", __FUNCTION__, error, message);
+			break;
+		}
+		libssh2_channel_window_autotune(libssh2_sftp_get_channel(sftp), _initialReceiveWindow, _maxReceiveWindow);
+		_channels[_numChannels++] = sftp;
+	}
+	
+	return _numChannels;
+}
+
+- (NSUInteger) receiveWindow
+{
+	return (_sftp ? libssh2_channel_window_target(libssh2_sftp_get_channel(_sftp)) : 0);
+}
+
+- (float) connectionCompressionRatio
+{
+	libssh2_uint64_t		raw,
+							compressed;
+	
+	if(!_session || libssh2_session_compression_stats(_session, &raw, &compressed) || !raw)
+	return NAN;
+	
+	return (float)compressed / (float)raw;
+}
+
+- (BOOL) _shouldTransferOverSCP:(const char*)serverPath upload:(BOOL)upload
+{
+	LIBSSH2_SFTP_ATTRIBUTES	attributes;
+	
+	if((_transferProtocol == kSFTPTransferProtocol_SFTP) || [self resumeOffset])
+	return NO;
+	
+	if(upload) {
+		if([self maxLength] == 0) //NOTE: SCP must send the file length before the data
+		return NO;
+		return ((_transferProtocol == kSFTPTransferProtocol_SCP) || ([self maxLength] >= _scpThreshold));
+	}
+	
+	if(_transferProtocol == kSFTPTransferProtocol_SCP)
+	return YES;
+	return ((libssh2_sftp_stat(_sftp, serverPath, &attributes) == 0) && (attributes.flags & LIBSSH2_SFTP_ATTR_SIZE) && (attributes.filesize >= _scpThreshold));
+}
+
+/* Returns the number of bytes read or -1 on error or time-out */
+- (ssize_t) _readFromSCPChannel:(LIBSSH2_CHANNEL*)channel bytes:(unsigned char*)buffer maxLength:(size_t)length
+{
+	NSTimeInterval			timeOut = [self timeOut];
+	CFTimeInterval			startTime = CFAbsoluteTimeGetCurrent();
+	ssize_t					numBytes;
+	
+	while((numBytes = libssh2_channel_read(channel, (char*)buffer, length)) == LIBSSH2_ERROR_EAGAIN) {
+		if((timeOut > 0.0) && (CFAbsoluteTimeGetCurrent() - startTime >= timeOut))
+		return -1;
+		_WaitForSocket(CFSocketGetNative(_socket), libssh2_session_block_directions(_session), kPollInterval);
+	}
+	
+	return numBytes;
+}
+
+/* Returns NO on error or time-out */
+- (BOOL) _writeToSCPChannel:(LIBSSH2_CHANNEL*)channel bytes:(const unsigned char*)buffer length:(size_t)length
+{
+	NSTimeInterval			timeOut = [self timeOut];
+	CFTimeInterval			lastTime = CFAbsoluteTimeGetCurrent(),
+							time;
+	ssize_t					result;
+	
+	while(length) {
+		result = libssh2_channel_write(channel, (const char*)buffer, length);
+		time = CFAbsoluteTimeGetCurrent();
+		if((result == LIBSSH2_ERROR_EAGAIN) || (result == 0)) {
+			if((timeOut > 0.0) && (time - lastTime >= timeOut))
+			return NO;
+			_WaitForSocket(CFSocketGetNative(_socket), libssh2_session_block_directions(_session), kPollInterval);
+			continue;
+		}
+		if(result < 0)
+		return NO;
+		buffer += result;
+		length -= result;
+		lastTime = time;
+	}
 	
 	return YES;
 }
 
+- (BOOL) _downloadFileFromSCPPath:(const char*)serverPath toStream:(NSOutputStream*)stream
+{
+	BOOL					delegateHasShouldAbort = [[self delegate] respondsToSelector:@selector(fileTransferControllerShouldAbort:)];
+	BOOL					success = NO;
+	NSUInteger				length = 0;
+	unsigned char			buffer[kTransferBufferSize];
+	unsigned long long		remaining;
+	ssize_t					numBytes;
+	LIBSSH2_CHANNEL*		channel;
+	struct stat				info;
+	NSError*				error;
+	
+	channel = libssh2_scp_recv(_session, serverPath, &info);
+	if(channel == NULL) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:_MakeLibSSH2Error(_session, _sftp)];
+		return NO;
+	}
+	libssh2_channel_window_autotune(channel, _initialReceiveWindow, _maxReceiveWindow);
+	[self setResumeValidator:[NSString stringWithFormat:@"%llu-%lu", (unsigned long long)info.st_size, (unsigned long)info.st_mtime]];
+	[self setMaxLength:info.st_size];
+	
+	remaining = info.st_size;
+	while(1) {
+		if(remaining == 0) {
+			if([self flushOutputStream:stream]) {
+				if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
+				[[self delegate] fileTransferControllerDidSucceed:self];
+				success = YES;
+			}
+			else if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)]) {
+				error = [stream streamError];
+				[[self delegate] fileTransferControllerDidFail:self withError:([error code] ? error : MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed flushing output stream (status = %i)", [stream streamStatus]))];
+			}
+			break;
+		}
+		
+		numBytes = [self _readFromSCPChannel:channel bytes:buffer maxLength:MIN(remaining, kTransferBufferSize)];
+		if(numBytes <= 0) {
+			if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+			[[self delegate] fileTransferControllerDidFail:self withError:(numBytes < 0 ? _MakeLibSSH2Error(_session, _sftp) : MAKE_FILETRANSFERCONTROLLER_ERROR(@"SCP channel was closed prematurely"))];
+			break;
+		}
+		if(![self writeToOutputStream:stream bytes:buffer maxLength:numBytes]) {
+			if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)]) {
+				error = [stream streamError];
+				[[self delegate] fileTransferControllerDidFail:self withError:([error code] ? error : MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed writing to output stream (status = %i)", [stream streamStatus]))];
+			}
+			break;
+		}
+		remaining -= numBytes;
+		length += numBytes;
+		[self setCurrentLength:length];
+		
+		if(delegateHasShouldAbort && [[self delegate] fileTransferControllerShouldAbort:self])
+		break;
+	}
+	
+	libssh2_channel_free(channel);
+	
+	return success;
+}
+
+- (BOOL) _uploadFileToSCPPath:(const char*)serverPath fromStream:(NSInputStream*)stream
+{
+	BOOL					delegateHasShouldAbort = [[self delegate] respondsToSelector:@selector(fileTransferControllerShouldAbort:)];
+	NSUInteger				maxLength = [self maxLength],
+							length = 0;
+	BOOL					success = NO;
+	unsigned char			buffer[kTransferBufferSize];
+	LIBSSH2_CHANNEL*		channel;
+	NSInteger				numBytes;
+	
+	channel = libssh2_scp_send(_session, serverPath, kDefaultMode, maxLength);
+	if(channel == NULL) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:_MakeLibSSH2Error(_session, _sftp)];
+		return NO;
+	}
+	
+	do {
+		numBytes = [self readFromInputStream:stream bytes:buffer maxLength:kTransferBufferSize];
+		if(numBytes < 0) {
+			if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+			[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed reading from input stream")];
+			break;
+		}
+		if((numBytes == 0) || (length + numBytes > maxLength)) {
+			if(length + numBytes != maxLength) { //NOTE: The server would otherwise wait for more data or truncate the file
+				if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+				[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Input stream length does not match the announced length (%i bytes)", maxLength)];
+				break;
+			}
+		}
+		if(numBytes > 0) {
+			if(![self _writeToSCPChannel:channel bytes:buffer length:numBytes]) {
+				if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+				[[self delegate] fileTransferControllerDidFail:self withError:_MakeLibSSH2Error(_session, _sftp)];
+				break;
+			}
+			length += numBytes;
+			[self setCurrentLength:length];
+			continue;
+		}
+		
+		//NOTE: Wait for the server to confirm the file was written
+		if((libssh2_channel_send_eof(channel) == 0) && (libssh2_channel_wait_eof(channel) == 0) && (libssh2_channel_wait_closed(channel) == 0) && (libssh2_channel_get_exit_status(channel) == 0)) {
+			if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
+			[[self delegate] fileTransferControllerDidSucceed:self];
+			success = YES;
+		}
+		else if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"SCP transfer to \"%s\" failed", serverPath)];
+		break;
+	} while(!delegateHasShouldAbort || ![[self delegate] fileTransferControllerShouldAbort:self]);
+	
+	libssh2_channel_free(channel);
+	
+	return success;
+}
+
 - (BOOL) _downloadFileFromPath:(NSString*)remotePath toStream:(NSOutputStream*)stream
 {
 	BOOL					delegateHasShouldAbort = [[self delegate] respondsToSelector:@selector(fileTransferControllerShouldAbort:)];
@@ -211,6 +846,7 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 	LIBSSH2_SFTP_HANDLE*	handle;
 	LIBSSH2_SFTP_ATTRIBUTES	attributes;
 	NSError*				error;
+	NSString*				validator;
 	
 	if(!stream || ([stream streamStatus] != NSStreamStatusNotOpen))
 	return NO;
@@ -222,10 +858,24 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 	[[self delegate] fileTransferControllerDidStart:self];
 	
 	if([self _reconnect:timeOut]) {
-		handle = libssh2_sftp_open(_sftp, serverPath, LIBSSH2_FXF_READ, 0);
-		if(handle) {
-			if((libssh2_sftp_fstat(handle, &attributes) == 0) && (attributes.flags & LIBSSH2_SFTP_ATTR_SIZE)) {
-				[self setMaxLength:attributes.filesize];
+		if([self _shouldTransferOverSCP:serverPath upload:NO])
+		success = [self _downloadFileFromSCPPath:serverPath toStream:stream];
+		else if((handle = libssh2_sftp_open(_sftp, serverPath, LIBSSH2_FXF_READ, 0))) {
+			libssh2_sftp_pipeline(handle, _maxPipelinedRequests);
+			if((libssh2_sftp_fstat(handle, &attributes) == 0) && (attributes.flags & LIBSSH2_SFTP_ATTR_SIZE))
+			validator = [NSString stringWithFormat:@"%llu-%lu", attributes.filesize, (attributes.flags & LIBSSH2_SFTP_ATTR_ACMODTIME ? attributes.mtime : 0)];
+			else
+			validator = nil;
+			if(validator && [self resumeOffset] && ![validator isEqualToString:[self resumeValidator]]) {
+				[self setResumeOffset:0];
+				if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+				[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"\"%@\" was modified since the transfer was interrupted", remotePath)];
+			}
+			else if(validator) {
+				[self setResumeValidator:validator];
+				[self setMaxLength:(attributes.filesize - [self resumeOffset])];
+				if([self resumeOffset])
+				libssh2_sftp_seek64(handle, [self resumeOffset]);
 			
 				[self _setTimeOut:1.0];
 				do {
@@ -234,8 +884,10 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 					if(numBytes == LIBSSH2SFTP_EAGAIN) {
 						if((timeOut > 0.0) && (time - lastTime >= timeOut))
 						numBytes = -1;
-						else
-						continue;
+						else {
+							_WaitForSocket(CFSocketGetNative(_socket), libssh2_session_block_directions(_session), kPollInterval);
+							continue;
+						}
 					}
 					else
 					lastTime = time;
@@ -314,8 +966,12 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 	[[self delegate] fileTransferControllerDidStart:self];
 	
 	if([self _reconnect:timeOut]) {
-		handle = libssh2_sftp_open(_sftp, serverPath, LIBSSH2_FXF_CREAT | LIBSSH2_FXF_TRUNC | LIBSSH2_FXF_WRITE, kDefaultMode);
-		if(handle) {
+		if([self _shouldTransferOverSCP:serverPath upload:YES])
+		success = [self _uploadFileToSCPPath:serverPath fromStream:stream];
+		else if((handle = libssh2_sftp_open(_sftp, serverPath, ([self resumeOffset] ? LIBSSH2_FXF_WRITE : LIBSSH2_FXF_CREAT | LIBSSH2_FXF_TRUNC | LIBSSH2_FXF_WRITE), kDefaultMode))) {
+			libssh2_sftp_pipeline(handle, _maxPipelinedRequests);
+			if([self resumeOffset]) //NOTE: The input stream has already been positioned at the resume offset
+			libssh2_sftp_seek64(handle, [self resumeOffset]);
 			[self _setTimeOut:1.0];
 			do {
 				numBytes = [self readFromInputStream:stream bytes:buffer maxLength:kTransferBufferSize];
@@ -330,6 +986,7 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 								break;
 							}
 							if(!delegateHasShouldAbort || ![[self delegate] fileTransferControllerShouldAbort:self]) {
+								_WaitForSocket(CFSocketGetNative(_socket), libssh2_session_block_directions(_session), kPollInterval);
 								result = 0;
 								continue;
 							}
@@ -349,9 +1006,26 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 				}
 				else {
 					if(numBytes == 0) {
-						if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
-						[[self delegate] fileTransferControllerDidSucceed:self];
-						success = YES;
+						do { //NOTE: Wait for the server to acknowledge the pipelined writes
+							result = libssh2_sftp_flush(handle);
+							time = CFAbsoluteTimeGetCurrent();
+							if(result == LIBSSH2SFTP_EAGAIN) {
+								if(((timeOut > 0.0) && (time - lastTime >= timeOut)) || (delegateHasShouldAbort && [[self delegate] fileTransferControllerShouldAbort:self])) {
+									result = -1;
+									break;
+								}
+								_WaitForSocket(CFSocketGetNative(_socket), libssh2_session_block_directions(_session), kPollInterval);
+							}
+							else
+							lastTime = time;
+						} while(result == LIBSSH2SFTP_EAGAIN);
+						if(result == 0) {
+							if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
+							[[self delegate] fileTransferControllerDidSucceed:self];
+							success = YES;
+						}
+						else if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+						[[self delegate] fileTransferControllerDidFail:self withError:_MakeLibSSH2Error(_session, _sftp)];
 					}
 					else {
 						if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
@@ -377,6 +1051,18 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 	return success;
 }
 
+- (long long) _sizeOfRemoteFileAtPath:(NSString*)remotePath
+{
+	LIBSSH2_SFTP_ATTRIBUTES	attributes;
+	
+	if(![self _reconnect:[self timeOut]])
+	return -1;
+	if((libssh2_sftp_stat(_sftp, [[self absolutePathForRemotePath:remotePath] UTF8String], &attributes) != 0) || !(attributes.flags & LIBSSH2_SFTP_ATTR_SIZE))
+	return -1;
+	
+	return attributes.filesize;
+}
+
 - (NSDictionary*) contentsOfDirectoryAtPath:(NSString*)remotePath
 {
 	const char*				serverPath = [[self absolutePathForRemotePath:remotePath] UTF8String];
@@ -384,7 +1070,6 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 	char					buffer[kNameBufferSize];
 	LIBSSH2_SFTP_HANDLE*	handle;
 	LIBSSH2_SFTP_ATTRIBUTES	attributes;
-	NSMutableDictionary*	dictionary;
 	int						result;
 	
 	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
@@ -402,6 +1087,7 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 		[[self delegate] fileTransferControllerDidFail:self withError:_MakeLibSSH2Error(_session, _sftp)];
 		return nil;
 	}
+	libssh2_sftp_pipeline(handle, _maxPipelinedRequests);
 	
 	while((result = libssh2_sftp_readdir(handle, buffer, kNameBufferSize, &attributes)) > 0) {
 		if((buffer[0] == '.') && ((buffer[1] == 0) || (buffer[1] == '.')))
@@ -411,14 +1097,7 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 		if(S_ISLNK(attributes.permissions))
 		continue; //FIXME: We ignore symlinks
 		
-		dictionary = [NSMutableDictionary new];
-		[dictionary setObject:(S_ISDIR(attributes.permissions) ? NSFileTypeDirectory : NSFileTypeRegular) forKey:NSFileType];
-		if(attributes.flags & LIBSSH2_SFTP_ATTR_ACMODTIME)
-		[dictionary setObject:[NSDate dateWithTimeIntervalSince1970:attributes.mtime] forKey:NSFileModificationDate];
-		if(S_ISREG(attributes.permissions) && (attributes.flags & LIBSSH2_SFTP_ATTR_SIZE))
-		[dictionary setObject:[NSNumber numberWithUnsignedLongLong:attributes.filesize] forKey:NSFileSize];
-		[listing setObject:dictionary forKey:[NSString stringWithUTF8String:buffer]];
-		[dictionary release];
+		[listing setObject:_DictionaryFromAttributes(&attributes) forKey:[NSString stringWithUTF8String:buffer]];
 	}
 	
 	if(result < 0) {
@@ -435,6 +1114,56 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 	return listing;
 }
 
+- (NSDictionary*) attributesOfItemsAtPaths:(NSArray*)remotePaths
+{
+	NSUInteger				count = [remotePaths count];
+	NSMutableDictionary*	dictionary = nil;
+	const char**			paths;
+	LIBSSH2_SFTP_ATTRIBUTES*	attributes;
+	unsigned long*			statuses;
+	NSUInteger				i;
+	
+	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
+	[[self delegate] fileTransferControllerDidStart:self];
+	
+	if(![self _reconnect:[self timeOut]]) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"\"%@\" is not reachable", [[self baseURL] URLByDeletingUserAndPassword])];
+		return nil;
+	}
+	
+	paths = malloc(count * sizeof(const char*));
+	attributes = malloc(count * sizeof(LIBSSH2_SFTP_ATTRIBUTES));
+	statuses = malloc(count * sizeof(unsigned long));
+	for(i = 0; i < count; ++i)
+	paths[i] = [[self absolutePathForRemotePath:[remotePaths objectAtIndex:i]] UTF8String];
+	
+	if(libssh2_sftp_stat_batch(_sftp, paths, count, LIBSSH2_SFTP_LSTAT, attributes, statuses) == 0) {
+		dictionary = [NSMutableDictionary dictionaryWithCapacity:count];
+		for(i = 0; i < count; ++i) {
+			if((statuses[i] == LIBSSH2_FX_OK) && (attributes[i].flags & LIBSSH2_SFTP_ATTR_PERMISSIONS))
+			[dictionary setObject:_DictionaryFromAttributes(&attributes[i]) forKey:[remotePaths objectAtIndex:i]];
+			else if((statuses[i] != LIBSSH2_FX_NO_SUCH_FILE) && (statuses[i] != LIBSSH2_FX_OK))
+			NSLog(@"%s: Failed retrieving attributes of \"%@\" (status %lu)", __FUNCTION__, [remotePaths objectAtIndex:i], statuses[i]);
+		}
+	}
+	
+	free(statuses);
+	free(attributes);
+	free(paths);
+	
+	if(dictionary) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
+		[[self delegate] fileTransferControllerDidSucceed:self];
+	}
+	else {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:_MakeLibSSH2Error(_session, _sftp)];
+	}
+	
+	return dictionary;
+}
+
 - (BOOL) createDirectoryAtPath:(NSString*)remotePath
 {
 	const char*				serverPath = [[self absolutePathForRemotePath:remotePath] UTF8String];
@@ -538,4 +1267,482 @@ static CFSocketRef _CreateSocketConnectedToHost(NSString* name, UInt16 port, CFO
 	return YES;
 }
 
+- (NSInteger) _runBatchChannel:(BatchChannel*)channel transferredLength:(NSUInteger*)length
+{
+	ssize_t					result;
+	
+	switch(channel->state) {
+		
+		case kBatchChannelState_Opening:
+		channel->handle = libssh2_sftp_open(channel->sftp, [[self absolutePathForRemotePath:[channel->transfer objectForKey:kTransferKey_RemotePath]] UTF8String], (channel->upload ? LIBSSH2_FXF_CREAT | LIBSSH2_FXF_TRUNC | LIBSSH2_FXF_WRITE : LIBSSH2_FXF_READ), kDefaultMode);
+		if(channel->handle == NULL)
+		return (libssh2_session_last_errno(_session) == LIBSSH2_ERROR_EAGAIN ? kBatchResult_WouldBlock : kBatchResult_Error);
+		if(!channel->upload) { //NOTE: Only replace the local file once the remote one is known to exist
+			channel->fd = open([[[channel->transfer objectForKey:kTransferKey_LocalPath] stringByStandardizingPath] fileSystemRepresentation], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if(channel->fd < 0) {
+				channel->error = [MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed opening \"%@\" (%s)", [channel->transfer objectForKey:kTransferKey_LocalPath], strerror(errno)) retain];
+				return kBatchResult_Error;
+			}
+		}
+		libssh2_sftp_pipeline(channel->handle, _maxPipelinedRequests);
+		channel->state = kBatchChannelState_Transferring;
+		return kBatchResult_Progress;
+		
+		case kBatchChannelState_Transferring:
+		if(channel->upload) {
+			if(channel->offset == channel->length) {
+				channel->length = read(channel->fd, channel->buffer, kTransferBufferSize);
+				channel->offset = 0;
+				if(channel->length < 0) {
+					channel->error = [MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed reading from \"%@\" (%s)", [channel->transfer objectForKey:kTransferKey_LocalPath], strerror(errno)) retain];
+					return kBatchResult_Error;
+				}
+				if(channel->length == 0) {
+					channel->state = kBatchChannelState_Flushing;
+					return kBatchResult_Progress;
+				}
+			}
+			result = libssh2_sftp_write(channel->handle, (char*)channel->buffer + channel->offset, channel->length - channel->offset);
+			if(result == LIBSSH2SFTP_EAGAIN)
+			return kBatchResult_WouldBlock;
+			if(result < 0)
+			return kBatchResult_Error;
+			channel->offset += result;
+		}
+		else {
+			result = libssh2_sftp_read(channel->handle, (char*)channel->buffer, kTransferBufferSize);
+			if(result == LIBSSH2SFTP_EAGAIN)
+			return kBatchResult_WouldBlock;
+			if(result < 0)
+			return kBatchResult_Error;
+			if(result == 0) {
+				channel->state = kBatchChannelState_Closing;
+				return kBatchResult_Progress;
+			}
+			if(write(channel->fd, channel->buffer, result) != result) {
+				channel->error = [MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed writing to \"%@\" (%s)", [channel->transfer objectForKey:kTransferKey_LocalPath], strerror(errno)) retain];
+				return kBatchResult_Error;
+			}
+		}
+		*length += result;
+		return kBatchResult_Progress;
+		
+		case kBatchChannelState_Flushing: //NOTE: Wait for the server to acknowledge the pipelined writes
+		result = libssh2_sftp_flush(channel->handle);
+		if(result == LIBSSH2SFTP_EAGAIN)
+		return kBatchResult_WouldBlock;
+		if(result < 0)
+		return kBatchResult_Error;
+		channel->state = kBatchChannelState_Closing;
+		return kBatchResult_Progress;
+		
+		case kBatchChannelState_Closing:
+		result = libssh2_sftp_close(channel->handle);
+		if(result == LIBSSH2SFTP_EAGAIN)
+		return kBatchResult_WouldBlock;
+		channel->handle = NULL;
+		if(channel->fd >= 0)
+		close(channel->fd);
+		channel->fd = -1;
+		channel->state = kBatchChannelState_Idle;
+		return (result || channel->failed ? kBatchResult_Error : kBatchResult_Done);
+		
+	}
+	
+	return kBatchResult_Error;
+}
+
+- (void) _completeBatchChannel:(BatchChannel*)channel loop:(SFTPTransferLoop*)loop error:(NSError*)error
+{
+	if(channel->fd >= 0)
+	close(channel->fd);
+	channel->fd = -1;
+	channel->handle = NULL;
+	channel->state = kBatchChannelState_Idle;
+	
+	[loop _completeTransfer:channel->transfer error:(channel->error ? channel->error : error)];
+	[channel->transfer release];
+	channel->transfer = nil;
+	[channel->error release];
+	channel->error = nil;
+}
+
+- (BOOL) _beginBatchSession:(BatchSession*)session
+{
+	NSUInteger				i;
+	
+	if(![self _reconnect:[self timeOut]])
+	return NO;
+	
+	session->numChannels = 1 + ((_maxChannels > 1) && ([session->pending count] > 1) ? [self _openAdditionalChannels:(MIN(_maxChannels, [session->pending count]) - 1)] : 0);
+	session->channels = calloc(session->numChannels, sizeof(BatchChannel));
+	for(i = 0; i < session->numChannels; ++i) {
+		session->channels[i].sftp = (i ? _channels[i - 1] : _sftp);
+		session->channels[i].fd = -1;
+	}
+	session->lastTime = CFAbsoluteTimeGetCurrent();
+	libssh2_session_set_blocking(_session, 0);
+	
+	return YES;
+}
+
+/* Runs every channel of the session once, starting pending transfers on idle channels */
+- (NSInteger) _runBatchSession:(BatchSession*)session loop:(SFTPTransferLoop*)loop
+{
+	NSUInteger				first = (session->sending ? session->sending - session->channels : 0);
+	BOOL					progress = NO;
+	NSUInteger				numActive = 0,
+							i;
+	BatchChannel*			channel;
+	NSDictionary*			transfer;
+	NSString*				localPath;
+	NSInteger				result;
+	int						fd;
+	
+	for(i = 0; i < session->numChannels; ++i) {
+		channel = &session->channels[(first + i) % session->numChannels];
+		if(channel->state == kBatchChannelState_Idle) {
+			if(![session->pending count])
+			continue;
+			transfer = [session->pending objectAtIndex:0];
+			channel->transfer = [transfer retain];
+			channel->upload = [[transfer objectForKey:kTransferKey_Upload] boolValue];
+			[session->pending removeObjectAtIndex:0];
+			progress = YES;
+			
+			if(channel->upload) { //NOTE: Downloads open the local file once the remote one is open
+				localPath = [[transfer objectForKey:kTransferKey_LocalPath] stringByStandardizingPath];
+				fd = open([localPath fileSystemRepresentation], O_RDONLY);
+				if(fd < 0) {
+					[self _completeBatchChannel:channel loop:loop error:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Failed opening \"%@\" (%s)", localPath, strerror(errno))];
+					continue;
+				}
+				channel->fd = fd;
+			}
+			channel->failed = NO;
+			channel->length = 0;
+			channel->offset = 0;
+			channel->state = kBatchChannelState_Opening;
+		}
+		
+		result = [self _runBatchChannel:channel transferredLength:&session->length];
+		session->sending = (((result == kBatchResult_WouldBlock) && (libssh2_session_block_directions(_session) & LIBSSH2_SESSION_BLOCK_OUTBOUND)) ? channel : NULL);
+		
+		if(result == kBatchResult_Error) {
+			if(channel->handle) {
+				if(channel->error == nil)
+				channel->error = [_MakeLibSSH2Error(_session, channel->sftp) retain];
+				channel->failed = YES;
+				channel->state = kBatchChannelState_Closing;
+			}
+			else
+			[self _completeBatchChannel:channel loop:loop error:_MakeLibSSH2Error(_session, channel->sftp)];
+			progress = YES;
+		}
+		else if(result == kBatchResult_Done) {
+			[self _completeBatchChannel:channel loop:loop error:nil];
+			progress = YES;
+		}
+		else if(result == kBatchResult_Progress)
+		progress = YES;
+		
+		if(channel->state != kBatchChannelState_Idle)
+		numActive += 1;
+		if(session->sending) //NOTE: A packet partially sent by this channel must be completed before any other channel can send so resume it first once the socket is writable
+		break;
+	}
+	[self setCurrentLength:session->length];
+	
+	if(!numActive && ![session->pending count])
+	return kBatchResult_Done;
+	
+	return (progress ? kBatchResult_Progress : kBatchResult_WouldBlock);
+}
+
+/* Returns NO if a channel already has received data to process */
+- (BOOL) _getPollDescriptor:(struct pollfd*)descriptor forBatchSession:(BatchSession*)session
+{
+	int						directions = libssh2_session_block_directions(_session);
+	NSUInteger				i;
+	
+	for(i = 0; !session->sending && (i < session->numChannels); ++i) { //NOTE: Data for a channel may have been received while reading for another one (but nothing can run before the partially sent packet is completed)
+		if((session->channels[i].state != kBatchChannelState_Idle) && libssh2_poll_channel_read(libssh2_sftp_get_channel(session->channels[i].sftp), 0))
+		return NO;
+	}
+	
+	descriptor->fd = CFSocketGetNative(_socket);
+	descriptor->events = ((directions & LIBSSH2_SESSION_BLOCK_OUTBOUND) ? POLLOUT : 0) | (((directions & LIBSSH2_SESSION_BLOCK_INBOUND) || !(directions & LIBSSH2_SESSION_BLOCK_OUTBOUND)) ? POLLIN : 0);
+	descriptor->revents = 0;
+	
+	return YES;
+}
+
+/* Fails all the remaining transfers of the session if "error" is not nil */
+- (void) _endBatchSession:(BatchSession*)session loop:(SFTPTransferLoop*)loop error:(NSError*)error
+{
+	NSUInteger				i;
+	
+	if(error) {
+		for(i = 0; i < session->numChannels; ++i) {
+			if(session->channels[i].state != kBatchChannelState_Idle)
+			[self _completeBatchChannel:&session->channels[i] loop:loop error:error];
+		}
+		while([session->pending count]) {
+			[loop _completeTransfer:[session->pending objectAtIndex:0] error:error];
+			[session->pending removeObjectAtIndex:0];
+		}
+		
+		//NOTE: Channels may have been left in the middle of an operation so start over with a new connection
+		[self _disconnect];
+	}
+	else
+	libssh2_session_set_blocking(_session, 1);
+	
+	if(session->channels) {
+		free(session->channels);
+		session->channels = NULL;
+	}
+	session->sending = NULL;
+}
+
+/* Batch transfers copy the raw file data so they cannot honor the stream based features */
+- (BOOL) _canTransferInBatch
+{
+	return (![self digestComputation] && ![self encryptionPassword] && ([self compressionFormat] == kFileTransferCompressionFormat_None) && ![self checkpointDirectory] && ![self maximumDownloadSpeed] && ![self maximumUploadSpeed]);
+}
+
+- (BOOL) transferLoopShouldAbort:(SFTPTransferLoop*)loop
+{
+	return ([[self delegate] respondsToSelector:@selector(fileTransferControllerShouldAbort:)] && [[self delegate] fileTransferControllerShouldAbort:self]);
+}
+
+- (BOOL) _transferFilesAtRemotePaths:(NSArray*)remotePaths localPaths:(NSArray*)localPaths upload:(BOOL)upload
+{
+	NSUInteger				count = [remotePaths count],
+							maxLength = 0,
+							i;
+	SFTPTransferLoop*		loop;
+	NSString*				localPath;
+	BOOL					success;
+	
+	if([localPaths count] != count)
+	return NO;
+	if(![self _canTransferInBatch]) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Batch transfers do not support digests, encryption, compression, checkpoints or speed limits")];
+		return NO;
+	}
+	if(count == 0)
+	return YES;
+	
+	if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidStart:)])
+	[[self delegate] fileTransferControllerDidStart:self];
+	
+	if(upload) {
+		for(localPath in localPaths)
+		maxLength += [[[[NSFileManager defaultManager] attributesOfItemAtPath:localPath error:NULL] objectForKey:NSFileSize] unsignedIntegerValue];
+	}
+	[self setMaxLength:maxLength];
+	
+	loop = [SFTPTransferLoop new];
+	[loop setDelegate:self];
+	for(i = 0; i < count; ++i) {
+		if(upload)
+		[loop addUploadFromPath:[localPaths objectAtIndex:i] toPath:[remotePaths objectAtIndex:i] controller:self];
+		else
+		[loop addDownloadFromPath:[remotePaths objectAtIndex:i] toPath:[localPaths objectAtIndex:i] controller:self];
+	}
+	success = [loop run];
+	
+	if(success) {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidSucceed:)])
+		[[self delegate] fileTransferControllerDidSucceed:self];
+	}
+	else {
+		if([[self delegate] respondsToSelector:@selector(fileTransferControllerDidFail:withError:)])
+		[[self delegate] fileTransferControllerDidFail:self withError:[loop error]];
+	}
+	[loop release];
+	
+	return success;
+}
+
+- (BOOL) downloadFilesFromPaths:(NSArray*)remotePaths toPaths:(NSArray*)localPaths
+{
+	return [self _transferFilesAtRemotePaths:remotePaths localPaths:localPaths upload:NO];
+}
+
+- (BOOL) uploadFilesFromPaths:(NSArray*)localPaths toPaths:(NSArray*)remotePaths
+{
+	return [self _transferFilesAtRemotePaths:remotePaths localPaths:localPaths upload:YES];
+}
+
+@end
+
+@implementation SFTPTransferLoop
+
+@synthesize delegate=_delegate, error=_error;
+
+- (id) init
+{
+	if((self = [super init]))
+	_transfers = [NSMutableArray new];
+	
+	return self;
+}
+
+- (void) dealloc
+{
+	[_transfers release];
+	[_error release];
+	
+	[super dealloc];
+}
+
+- (BOOL) _addTransferWithLocalPath:(NSString*)localPath remotePath:(NSString*)remotePath controller:(SFTPTransferController*)controller upload:(BOOL)upload
+{
+	if(![localPath length] || ![remotePath length] || ![controller isKindOfClass:[SFTPTransferController class]] || ![controller _canTransferInBatch])
+	return NO;
+	
+	[_transfers addObject:[NSDictionary dictionaryWithObjectsAndKeys:localPath, kTransferKey_LocalPath, remotePath, kTransferKey_RemotePath, controller, kTransferKey_Controller, [NSNumber numberWithBool:upload], kTransferKey_Upload, nil]];
+	
+	return YES;
+}
+
+- (BOOL) addDownloadFromPath:(NSString*)remotePath toPath:(NSString*)localPath controller:(SFTPTransferController*)controller
+{
+	return [self _addTransferWithLocalPath:localPath remotePath:remotePath controller:controller upload:NO];
+}
+
+- (BOOL) addUploadFromPath:(NSString*)localPath toPath:(NSString*)remotePath controller:(SFTPTransferController*)controller
+{
+	return [self _addTransferWithLocalPath:localPath remotePath:remotePath controller:controller upload:YES];
+}
+
+- (void) _completeTransfer:(NSDictionary*)transfer error:(NSError*)error
+{
+	if(error) {
+		if(_error == nil)
+		_error = [error retain];
+		_failed = YES;
+	}
+	
+	if([_delegate respondsToSelector:@selector(transferLoop:didCompleteTransferWithLocalPath:remotePath:controller:error:)])
+	[_delegate transferLoop:self didCompleteTransferWithLocalPath:[transfer objectForKey:kTransferKey_LocalPath] remotePath:[transfer objectForKey:kTransferKey_RemotePath] controller:[transfer objectForKey:kTransferKey_Controller] error:error];
+}
+
+- (BOOL) run
+{
+	BOOL					delegateHasShouldAbort = [_delegate respondsToSelector:@selector(transferLoopShouldAbort:)];
+	NSMutableArray*			controllers = [NSMutableArray array];
+	NSUInteger				numSessions,
+							numRunning,
+							numDescriptors,
+							i;
+	BatchSession*			sessions;
+	struct pollfd*			descriptors;
+	SFTPTransferController*	controller;
+	NSDictionary*			transfer;
+	NSAutoreleasePool*		localPool;
+	NSTimeInterval			timeOut;
+	CFAbsoluteTime			time;
+	NSInteger				result;
+	BOOL					progress,
+							pending;
+	
+	[_error release];
+	_error = nil;
+	_failed = NO;
+	if([_transfers count] == 0)
+	return YES;
+	
+	for(transfer in _transfers) {
+		if([controllers indexOfObjectIdenticalTo:[transfer objectForKey:kTransferKey_Controller]] == NSNotFound)
+		[controllers addObject:[transfer objectForKey:kTransferKey_Controller]];
+	}
+	numSessions = [controllers count];
+	sessions = calloc(numSessions, sizeof(BatchSession));
+	descriptors = malloc(numSessions * sizeof(struct pollfd));
+	for(i = 0; i < numSessions; ++i) {
+		sessions[i].controller = [controllers objectAtIndex:i];
+		sessions[i].pending = [NSMutableArray new];
+	}
+	for(transfer in _transfers)
+	[sessions[[controllers indexOfObjectIdenticalTo:[transfer objectForKey:kTransferKey_Controller]]].pending addObject:transfer];
+	[_transfers removeAllObjects];
+	
+	//NOTE: Connecting is blocking but reused pooled connections make it immediate
+	for(i = 0; i < numSessions; ++i) {
+		controller = sessions[i].controller;
+		if(![controller _beginBatchSession:&sessions[i]]) {
+			[controller _endBatchSession:&sessions[i] loop:self error:MAKE_FILETRANSFERCONTROLLER_ERROR(@"\"%@\" is not reachable", [[controller baseURL] URLByDeletingUserAndPassword])];
+			sessions[i].done = YES;
+		}
+	}
+	
+	while(1) {
+		localPool = [NSAutoreleasePool new];
+		progress = NO;
+		numRunning = 0;
+		for(i = 0; i < numSessions; ++i) {
+			if(sessions[i].done)
+			continue;
+			controller = sessions[i].controller;
+			timeOut = [controller timeOut];
+			time = CFAbsoluteTimeGetCurrent();
+			result = [controller _runBatchSession:&sessions[i] loop:self];
+			if(result == kBatchResult_Progress) {
+				sessions[i].lastTime = time;
+				progress = YES;
+			}
+			else if((result == kBatchResult_WouldBlock) && (timeOut > 0.0) && (time - sessions[i].lastTime >= timeOut))
+			result = kBatchResult_Error;
+			
+			if(result == kBatchResult_Done)
+			[controller _endBatchSession:&sessions[i] loop:self error:nil];
+			else if(result == kBatchResult_Error)
+			[controller _endBatchSession:&sessions[i] loop:self error:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Connection to \"%@\" timed out", [[controller baseURL] URLByDeletingUserAndPassword])];
+			else
+			numRunning += 1;
+			sessions[i].done = ((result == kBatchResult_Done) || (result == kBatchResult_Error));
+		}
+		
+		if(numRunning && delegateHasShouldAbort && [_delegate transferLoopShouldAbort:self]) {
+			for(i = 0; i < numSessions; ++i) {
+				if(!sessions[i].done)
+				[sessions[i].controller _endBatchSession:&sessions[i] loop:self error:MAKE_FILETRANSFERCONTROLLER_ERROR(@"Transfer was aborted")];
+				sessions[i].done = YES;
+			}
+			numRunning = 0;
+		}
+		
+		//NOTE: Only sleep when no session can make progress until one of their sockets becomes ready
+		if(numRunning && !progress) {
+			pending = NO;
+			numDescriptors = 0;
+			for(i = 0; i < numSessions; ++i) {
+				if(sessions[i].done)
+				continue;
+				if(![sessions[i].controller _getPollDescriptor:&descriptors[numDescriptors] forBatchSession:&sessions[i]]) {
+					pending = YES;
+					break;
+				}
+				numDescriptors += 1;
+			}
+			if(!pending && (poll(descriptors, numDescriptors, kPollInterval * 1000) < 0) && (errno != EINTR))
+			NSLog(@"%s: poll() failed with error \"%s\"", __FUNCTION__, strerror(errno));
+		}
+		[localPool drain];
+		if(!numRunning)
+		break;
+	}
+	
+	for(i = 0; i < numSessions; ++i)
+	[sessions[i].pending release];
+	free(descriptors);
+	free(sessions);
+	
+	return !_failed;
+}
+
 @end
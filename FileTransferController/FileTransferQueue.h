@@ -0,0 +1,123 @@
+/*
+	This file is part of the PolKit library.
+	Copyright (C) 2008-2009 Pierre-Olivier Latour <info@pol-online.net>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#import <Foundation/Foundation.h>
+#import <pthread.h>
+
+enum {
+	kFileTransferItemType_Upload = 0,
+	kFileTransferItemType_Download,
+	kFileTransferItemType_Delete,
+	kFileTransferItemType_CreateDirectory
+};
+typedef NSUInteger FileTransferItemType;
+
+enum {
+	kFileTransferItemState_Pending = 0,
+	kFileTransferItemState_Running,
+	kFileTransferItemState_Succeeded,
+	kFileTransferItemState_Failed,
+	kFileTransferItemState_Cancelled
+};
+typedef NSUInteger FileTransferItemState;
+
+@class FileTransferQueue, FileTransferItem, FileTransferController;
+
+@protocol FileTransferQueueDelegate <NSObject>
+@optional
+- (void) fileTransferQueue:(FileTransferQueue*)queue willUseController:(FileTransferController*)controller; //Called on a worker thread - Use it to configure the controller (time-out, digest computation...) but do not change its delegate
+- (void) fileTransferQueue:(FileTransferQueue*)queue didCompleteItem:(FileTransferItem*)item; //Check the item state to know if it succeeded
+- (void) fileTransferQueueDidUpdateProgress:(FileTransferQueue*)queue;
+- (void) fileTransferQueueDidFinish:(FileTransferQueue*)queue;
+@end
+
+@interface FileTransferItem : NSObject
+{
+@private
+	FileTransferItemType		_type;
+	NSURL*						_baseURL;
+	NSString*					_localPath;
+	NSString*					_remotePath;
+	NSMutableArray*				_dependencies;
+	FileTransferItemState		_state;
+	NSUInteger					_attempts;
+	NSError*					_error;
+	unsigned long long			_size,
+								_transferredSize;
+	id							_userInfo;
+}
+@property(nonatomic, readonly) FileTransferItemType type;
+@property(nonatomic, readonly) NSURL* baseURL;
+@property(nonatomic, readonly) NSString* localPath; //nil for deletions and directory creations
+@property(nonatomic, readonly) NSString* remotePath;
+@property(nonatomic, readonly) NSArray* dependencies;
+@property(nonatomic, readonly) FileTransferItemState state;
+@property(nonatomic, readonly) NSUInteger attempts;
+@property(nonatomic, readonly) NSError* error; //Last error reported by the controller
+@property(nonatomic, readonly) unsigned long long size; //0 if not known yet
+@property(nonatomic, retain) id userInfo;
+
+- (void) addDependency:(FileTransferItem*)item; //The item will not start before "item" has succeeded and fails if "item" fails or is never added to the queue
+@end
+
+/* Delegate methods (except -fileTransferQueue:willUseController:) are called on the thread that called -start and require its runloop to be running */
+@interface FileTransferQueue : NSObject
+{
+@private
+	id<FileTransferQueueDelegate>	_delegate;
+	NSUInteger						_maxConcurrent,
+									_maxPerHost,
+									_maxRetries;
+	NSTimeInterval					_retryDelay;
+	pthread_mutex_t					_mutex;
+	pthread_cond_t					_condition;
+	NSMutableArray*					_items;
+	NSMutableDictionary*			_hostCounts;
+	NSMutableArray*					_workers;
+	NSThread*						_delegateThread;
+	NSUInteger						_runningItems,
+									_runningWorkers,
+									_completedCount,
+									_failedCount;
+	BOOL							_running,
+									_cancelled;
+	CFAbsoluteTime					_progressTime;
+}
+- (id) initWithMaximumConcurrentTransfers:(NSUInteger)max;
+@property(nonatomic, assign) id<FileTransferQueueDelegate> delegate;
+
+@property(nonatomic, readonly) NSUInteger maximumConcurrentTransfers;
+@property(nonatomic) NSUInteger maximumConcurrentTransfersPerHost; //2 by default
+@property(nonatomic) NSUInteger maximumRetries; //Per item - Only transient failures (network errors, time-outs, server errors...) are retried - 2 by default
+@property(nonatomic) NSTimeInterval retryDelay; //In seconds - Doubled after each failed attempt of an item - Other items to the same host can run during the delay - 1.0 by default
+
+- (FileTransferItem*) addUploadFromPath:(NSString*)localPath toPath:(NSString*)remotePath baseURL:(NSURL*)url;
+- (FileTransferItem*) addDownloadFromPath:(NSString*)remotePath toPath:(NSString*)localPath baseURL:(NSURL*)url;
+- (FileTransferItem*) addDeletionOfFileAtPath:(NSString*)remotePath baseURL:(NSURL*)url;
+- (FileTransferItem*) addCreationOfDirectoryAtPath:(NSString*)remotePath baseURL:(NSURL*)url; //Items added afterwards inside this directory automatically depend on it - Succeeds if the directory already exists
+@property(nonatomic, readonly) NSArray* items;
+
+- (void) start; //Resets the numbers of completed and failed items - Items added while the queue is running are processed as well
+- (void) cancel; //Aborts running transfers and cancels pending items
+- (BOOL) waitUntilDone; //Runs the current runloop until all items are processed - Returns NO if any item failed or was cancelled
+@property(nonatomic, readonly, getter=isRunning) BOOL running;
+
+@property(nonatomic, readonly) NSUInteger numberOfCompletedItems;
+@property(nonatomic, readonly) NSUInteger numberOfFailedItems;
+@property(nonatomic, readonly) float progress; //In [0,1] range based on the sizes known so far or NAN if not defined
+@end
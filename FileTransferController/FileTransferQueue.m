@@ -0,0 +1,661 @@
+/*
+	This file is part of the PolKit library.
+	Copyright (C) 2008-2009 Pierre-Olivier Latour <info@pol-online.net>
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#import <sys/time.h>
+
+#import "FileTransferQueue.h"
+#import "FileTransferController.h"
+#import "WorkerThread.h"
+
+#define kDefaultMaxPerHost				2
+#define kDefaultMaxRetries				2
+#define kDefaultRetryDelay				1.0 //seconds
+#define kMaxRetryDelay					60.0 //seconds
+#define kProgressInterval				0.5 //seconds
+#define kRunLoopInterval				0.1 //seconds
+#define kThreadDictionaryKey			@"FileTransferQueue.item"
+
+#define kQueueErrorDomain				@"FileTransferQueue"
+
+#define MAKE_QUEUE_ERROR(...) [NSError errorWithDomain:kQueueErrorDomain code:-1 userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:__VA_ARGS__] forKey:NSLocalizedDescriptionKey]]
+
+@interface FileTransferItem ()
+@property(nonatomic) FileTransferItemState state;
+@property(nonatomic) NSUInteger attempts;
+@property(nonatomic, retain) NSError* error;
+@property(nonatomic) unsigned long long size;
+@property(nonatomic) unsigned long long transferredSize;
+- (id) initWithType:(FileTransferItemType)type baseURL:(NSURL*)url localPath:(NSString*)localPath remotePath:(NSString*)remotePath;
+- (NSString*) _hostKey;
+@end
+
+@interface FileTransferQueue ()
+- (FileTransferItem*) _addItem:(FileTransferItem*)item;
+- (FileTransferItem*) _nextItem;
+- (BOOL) _performItem:(FileTransferItem*)item withController:(FileTransferController*)controller;
+- (void) _finishItem:(FileTransferItem*)item;
+- (void) _releaseHostOfItem:(FileTransferItem*)item;
+- (void) _waitBeforeRetryingItem:(FileTransferItem*)item;
+- (void) _startWorker;
+@end
+
+/* Returns NO for errors that would happen again if the item was retried (missing files, denied access, client errors...) */
+static BOOL _IsTransientError(NSError* error)
+{
+	NSString*				domain = [error domain];
+	NSInteger				code = [error code];
+	
+	if(error == nil) //NOTE: Controllers do not always report an error
+	return YES;
+	if([domain isEqualToString:kQueueErrorDomain])
+	return NO;
+	if([domain isEqualToString:@"http"])
+	return ((code < 0) || (code == 408) || (code == 429) || (code >= 500));
+	if([domain isEqualToString:@"curl"]) //CURLE_COULDNT_RESOLVE_HOST, CURLE_COULDNT_CONNECT, CURLE_PARTIAL_FILE, CURLE_OPERATION_TIMEDOUT, CURLE_SSL_CONNECT_ERROR, CURLE_GOT_NOTHING, CURLE_SEND_ERROR and CURLE_RECV_ERROR
+	return ((code == 6) || (code == 7) || (code == 18) || (code == 28) || (code == 35) || (code == 52) || (code == 55) || (code == 56));
+	if([domain isEqualToString:@"libssh2"]) //LIBSSH2_ERROR_AUTHENTICATION_FAILED, LIBSSH2_ERROR_PUBLICKEY_UNVERIFIED and LIBSSH2_ERROR_SFTP_PROTOCOL (the server status like no such file or permission denied)
+	return ((code != -18) && (code != -19) && (code != -31));
+	if([domain isEqualToString:NSPOSIXErrorDomain])
+	return ((code != ENOENT) && (code != EACCES) && (code != EPERM) && (code != ENOTDIR) && (code != EISDIR) && (code != ENOSPC) && (code != EROFS) && (code != EDQUOT));
+	
+	return YES;
+}
+
+@implementation FileTransferItem
+
+@synthesize type=_type, baseURL=_baseURL, localPath=_localPath, remotePath=_remotePath, dependencies=_dependencies, state=_state,
+	attempts=_attempts, error=_error, size=_size, transferredSize=_transferredSize, userInfo=_userInfo;
+
+- (id) initWithType:(FileTransferItemType)type baseURL:(NSURL*)url localPath:(NSString*)localPath remotePath:(NSString*)remotePath
+{
+	if(![url isKindOfClass:[NSURL class]] || ![remotePath length] || (((type == kFileTransferItemType_Upload) || (type == kFileTransferItemType_Download)) && ![localPath length])) {
+		[self release];
+		return nil;
+	}
+	
+	if((self = [super init])) {
+		_type = type;
+		_baseURL = [url copy];
+		_localPath = [localPath copy];
+		_remotePath = [remotePath copy];
+		_dependencies = [NSMutableArray new];
+		if(_type == kFileTransferItemType_Upload)
+		_size = [[[[NSFileManager defaultManager] attributesOfItemAtPath:_localPath error:NULL] objectForKey:NSFileSize] unsignedLongLongValue];
+	}
+	
+	return self;
+}
+
+- (void) dealloc
+{
+	[_baseURL release];
+	[_localPath release];
+	[_remotePath release];
+	[_dependencies release];
+	[_error release];
+	[_userInfo release];
+	
+	[super dealloc];
+}
+
+- (void) addDependency:(FileTransferItem*)item
+{
+	if(item && (item != self) && ![_dependencies containsObject:item])
+	[_dependencies addObject:item];
+}
+
+- (NSString*) _hostKey
+{
+	return [NSString stringWithFormat:@"%@://%@:%@", [[_baseURL scheme] lowercaseString], [[_baseURL host] lowercaseString], [_baseURL port]];
+}
+
+- (NSString*) description
+{
+	static NSString* types[] = {@"Upload", @"Download", @"Delete", @"CreateDirectory"};
+	
+	return [NSString stringWithFormat:@"<%@ = 0x%08X | %@ \"%@\" on %@ | state = %i | attempts = %i>", [self class], (long)self, types[_type], _remotePath, [_baseURL host], _state, _attempts];
+}
+
+@end
+
+@implementation FileTransferQueue
+
+@synthesize delegate=_delegate, maximumConcurrentTransfers=_maxConcurrent, maximumConcurrentTransfersPerHost=_maxPerHost, maximumRetries=_maxRetries,
+	retryDelay=_retryDelay, running=_running;
+
+- (id) init
+{
+	return [self initWithMaximumConcurrentTransfers:4];
+}
+
+- (id) initWithMaximumConcurrentTransfers:(NSUInteger)max
+{
+	if(max == 0) {
+		[self release];
+		return nil;
+	}
+	
+	if((self = [super init])) {
+		_maxConcurrent = max;
+		_maxPerHost = kDefaultMaxPerHost;
+		_maxRetries = kDefaultMaxRetries;
+		_retryDelay = kDefaultRetryDelay;
+		pthread_mutex_init(&_mutex, NULL);
+		pthread_cond_init(&_condition, NULL);
+		_items = [NSMutableArray new];
+		_hostCounts = [NSMutableDictionary new];
+		_workers = [NSMutableArray new];
+	}
+	
+	return self;
+}
+
+- (void) _cleanUp_FileTransferQueue
+{
+	pthread_cond_destroy(&_condition);
+	pthread_mutex_destroy(&_mutex);
+}
+
+- (void) finalize
+{
+	[self _cleanUp_FileTransferQueue];
+	
+	[super finalize];
+}
+
+- (void) dealloc
+{
+	[self _cleanUp_FileTransferQueue];
+	
+	[_workers release];
+	[_hostCounts release];
+	[_items release];
+	[_delegateThread release];
+	
+	[super dealloc];
+}
+
+- (void) setMaximumConcurrentTransfersPerHost:(NSUInteger)max
+{
+	pthread_mutex_lock(&_mutex);
+	_maxPerHost = MAX(max, 1);
+	pthread_cond_broadcast(&_condition);
+	pthread_mutex_unlock(&_mutex);
+}
+
+- (NSArray*) items
+{
+	NSArray*				items;
+	
+	pthread_mutex_lock(&_mutex);
+	items = [NSArray arrayWithArray:_items];
+	pthread_mutex_unlock(&_mutex);
+	
+	return items;
+}
+
+- (NSUInteger) numberOfCompletedItems
+{
+	return _completedCount;
+}
+
+- (NSUInteger) numberOfFailedItems
+{
+	return _failedCount;
+}
+
+- (float) progress
+{
+	unsigned long long		totalSize = 0,
+							transferredSize = 0;
+	FileTransferItem*		item;
+	
+	pthread_mutex_lock(&_mutex);
+	for(item in _items) {
+		if((item.type != kFileTransferItemType_Upload) && (item.type != kFileTransferItemType_Download))
+		continue;
+		totalSize += item.size;
+		if(item.state == kFileTransferItemState_Running)
+		transferredSize += item.transferredSize;
+		else if(item.state != kFileTransferItemState_Pending)
+		transferredSize += item.size;
+	}
+	pthread_mutex_unlock(&_mutex);
+	
+	return (totalSize > 0 ? MIN((double)transferredSize / (double)totalSize, 1.0) : NAN);
+}
+
+- (FileTransferItem*) _addItem:(FileTransferItem*)item
+{
+	NSString*				path;
+	FileTransferItem*		otherItem;
+	
+	if(item == nil)
+	return nil;
+	
+	pthread_mutex_lock(&_mutex);
+	//NOTE: Uploads and directory creations inside a directory that is created by the queue must wait for it
+	if((item.type == kFileTransferItemType_Upload) || (item.type == kFileTransferItemType_CreateDirectory)) {
+		for(otherItem in _items) {
+			if((otherItem.type != kFileTransferItemType_CreateDirectory) || ![otherItem.baseURL isEqual:item.baseURL])
+			continue;
+			path = otherItem.remotePath;
+			if(![path hasSuffix:@"/"])
+			path = [path stringByAppendingString:@"/"];
+			if([item.remotePath hasPrefix:path])
+			[item addDependency:otherItem];
+		}
+	}
+	[_items addObject:item];
+	//NOTE: Workers exit when there is nothing left to do, so start one again if the queue is still running
+	if(_running && !_cancelled && (_runningWorkers < _maxConcurrent))
+	[self _startWorker];
+	pthread_cond_broadcast(&_condition);
+	pthread_mutex_unlock(&_mutex);
+	
+	return item;
+}
+
+- (FileTransferItem*) addUploadFromPath:(NSString*)localPath toPath:(NSString*)remotePath baseURL:(NSURL*)url
+{
+	return [self _addItem:[[[FileTransferItem alloc] initWithType:kFileTransferItemType_Upload baseURL:url localPath:localPath remotePath:remotePath] autorelease]];
+}
+
+- (FileTransferItem*) addDownloadFromPath:(NSString*)remotePath toPath:(NSString*)localPath baseURL:(NSURL*)url
+{
+	return [self _addItem:[[[FileTransferItem alloc] initWithType:kFileTransferItemType_Download baseURL:url localPath:localPath remotePath:remotePath] autorelease]];
+}
+
+- (FileTransferItem*) addDeletionOfFileAtPath:(NSString*)remotePath baseURL:(NSURL*)url
+{
+	return [self _addItem:[[[FileTransferItem alloc] initWithType:kFileTransferItemType_Delete baseURL:url localPath:nil remotePath:remotePath] autorelease]];
+}
+
+- (FileTransferItem*) addCreationOfDirectoryAtPath:(NSString*)remotePath baseURL:(NSURL*)url
+{
+	return [self _addItem:[[[FileTransferItem alloc] initWithType:kFileTransferItemType_CreateDirectory baseURL:url localPath:nil remotePath:remotePath] autorelease]];
+}
+
+- (void) _notifyCompletedItem:(FileTransferItem*)item
+{
+	if([_delegate respondsToSelector:@selector(fileTransferQueue:didCompleteItem:)])
+	[_delegate fileTransferQueue:self didCompleteItem:item];
+}
+
+- (void) _notifyProgress:(id)argument
+{
+	if([_delegate respondsToSelector:@selector(fileTransferQueueDidUpdateProgress:)])
+	[_delegate fileTransferQueueDidUpdateProgress:self];
+}
+
+- (void) _notifyFinished:(id)argument
+{
+	NSArray*				workers;
+	WorkerThread*			worker;
+	
+	pthread_mutex_lock(&_mutex);
+	if(_runningWorkers > 0) { //NOTE: Workers were started again for items added in the meantime
+		pthread_mutex_unlock(&_mutex);
+		return;
+	}
+	workers = [NSArray arrayWithArray:_workers];
+	[_workers removeAllObjects];
+	_running = NO;
+	pthread_mutex_unlock(&_mutex);
+	
+	for(worker in workers)
+	[worker waitUntilDone];
+	[_delegateThread release];
+	_delegateThread = nil;
+	
+	if([_delegate respondsToSelector:@selector(fileTransferQueueDidFinish:)])
+	[_delegate fileTransferQueueDidFinish:self];
+}
+
+/* Must be called with the mutex locked */
+- (void) _completeItem:(FileTransferItem*)item withState:(FileTransferItemState)state
+{
+	item.state = state;
+	_completedCount += 1;
+	if(state != kFileTransferItemState_Succeeded)
+	_failedCount += 1;
+	
+	[self performSelector:@selector(_notifyCompletedItem:) onThread:_delegateThread withObject:item waitUntilDone:NO];
+}
+
+/* Blocks until an item can be started or returns nil when there is nothing left to do and the calling worker must exit */
+- (FileTransferItem*) _nextItem
+{
+	FileTransferItem*		result = nil;
+	BOOL					pending,
+							blocked,
+							missing;
+	FileTransferItem*		item;
+	FileTransferItem*		dependency;
+	NSString*				host;
+	NSUInteger				count;
+	
+	pthread_mutex_lock(&_mutex);
+	while(1) {
+		pending = NO;
+		for(item in _items) {
+			if(item.state != kFileTransferItemState_Pending)
+			continue;
+			if(_cancelled) {
+				[self _completeItem:item withState:kFileTransferItemState_Cancelled];
+				continue;
+			}
+			pending = YES;
+			
+			blocked = NO;
+			for(dependency in item.dependencies) {
+				if((dependency.state == kFileTransferItemState_Failed) || (dependency.state == kFileTransferItemState_Cancelled)) {
+					item.error = MAKE_QUEUE_ERROR(@"Dependency \"%@\" did not succeed", dependency.remotePath);
+					[self _completeItem:item withState:kFileTransferItemState_Failed];
+					pthread_cond_broadcast(&_condition);
+					blocked = YES;
+					break;
+				}
+				if(dependency.state != kFileTransferItemState_Succeeded)
+				blocked = YES;
+			}
+			if(blocked)
+			continue;
+			
+			host = [item _hostKey];
+			count = [[_hostCounts objectForKey:host] unsignedIntegerValue];
+			if(count >= _maxPerHost)
+			continue;
+			[_hostCounts setObject:[NSNumber numberWithUnsignedInteger:(count + 1)] forKey:host];
+			
+			item.state = kFileTransferItemState_Running;
+			_runningItems += 1;
+			result = item;
+			break;
+		}
+		if(result || !pending)
+		break;
+		
+		//NOTE: If nothing is running, the remaining items can only be blocked by dependencies that were never added to the queue or by a dependency cycle
+		if(_runningItems == 0) {
+			missing = NO;
+			for(item in _items) {
+				if(item.state != kFileTransferItemState_Pending)
+				continue;
+				for(dependency in item.dependencies) {
+					if([_items indexOfObjectIdenticalTo:dependency] == NSNotFound) {
+						item.error = MAKE_QUEUE_ERROR(@"Dependency \"%@\" is not in the queue", dependency.remotePath);
+						[self _completeItem:item withState:kFileTransferItemState_Failed];
+						missing = YES;
+						break;
+					}
+				}
+			}
+			if(missing) //NOTE: Items depending on the ones that just failed now fail as well on the next pass
+			continue;
+			
+			for(item in _items) {
+				if(item.state != kFileTransferItemState_Pending)
+				continue;
+				item.error = MAKE_QUEUE_ERROR(@"Circular dependency");
+				[self _completeItem:item withState:kFileTransferItemState_Failed];
+			}
+			break;
+		}
+		
+		pthread_cond_wait(&_condition, &_mutex);
+	}
+	//NOTE: The worker exits so it must stop counting as running while the mutex is still locked or items added in the meantime would never be processed
+	if(result == nil) {
+		_runningWorkers -= 1;
+		if(_runningWorkers == 0)
+		[self performSelector:@selector(_notifyFinished:) onThread:_delegateThread withObject:nil waitUntilDone:NO];
+	}
+	pthread_mutex_unlock(&_mutex);
+	
+	return result;
+}
+
+- (void) _finishItem:(FileTransferItem*)item
+{
+	pthread_mutex_lock(&_mutex);
+	[self _releaseHostOfItem:item];
+	_runningItems -= 1;
+	[self _completeItem:item withState:item.state];
+	pthread_mutex_unlock(&_mutex);
+}
+
+/* Must be called with the mutex locked */
+- (void) _releaseHostOfItem:(FileTransferItem*)item
+{
+	NSString*				host = [item _hostKey];
+	
+	[_hostCounts setObject:[NSNumber numberWithUnsignedInteger:([[_hostCounts objectForKey:host] unsignedIntegerValue] - 1)] forKey:host];
+	pthread_cond_broadcast(&_condition);
+}
+
+/* Releases the host slot of the item while waiting so that other items to the same host can run - Returns early if the queue is cancelled */
+- (void) _waitBeforeRetryingItem:(FileTransferItem*)item
+{
+	NSTimeInterval			delay = MIN(_retryDelay * (double)(1 << MIN(item.attempts - 1, 16)), kMaxRetryDelay);
+	struct timespec			deadline;
+	struct timeval			time;
+	NSString*				host;
+	
+	if(delay <= 0.0)
+	return;
+	
+	gettimeofday(&time, NULL);
+	deadline.tv_sec = time.tv_sec + (time_t)delay;
+	deadline.tv_nsec = time.tv_usec * 1000 + (long)((delay - floor(delay)) * 1000000000.0);
+	if(deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec += 1;
+		deadline.tv_nsec -= 1000000000;
+	}
+	
+	pthread_mutex_lock(&_mutex);
+	[self _releaseHostOfItem:item];
+	while(!_cancelled && (pthread_cond_timedwait(&_condition, &_mutex, &deadline) != ETIMEDOUT))
+	;
+	host = [item _hostKey];
+	while(!_cancelled && ([[_hostCounts objectForKey:host] unsignedIntegerValue] >= _maxPerHost))
+	pthread_cond_wait(&_condition, &_mutex);
+	[_hostCounts setObject:[NSNumber numberWithUnsignedInteger:([[_hostCounts objectForKey:host] unsignedIntegerValue] + 1)] forKey:host];
+	pthread_mutex_unlock(&_mutex);
+}
+
+- (BOOL) _performItem:(FileTransferItem*)item withController:(FileTransferController*)controller
+{
+	BOOL					success = NO;
+	
+	switch(item.type) {
+		
+		case kFileTransferItemType_Upload:
+		success = [controller uploadFileFromPath:item.localPath toPath:item.remotePath];
+		break;
+		
+		case kFileTransferItemType_Download:
+		success = [controller downloadFileFromPath:item.remotePath toPath:item.localPath];
+		break;
+		
+		case kFileTransferItemType_Delete:
+		if([controller respondsToSelector:@selector(deleteFileAtPath:)])
+		success = [(id)controller deleteFileAtPath:item.remotePath];
+		else
+		item.error = MAKE_QUEUE_ERROR(@"Deletion is not supported by %@", [controller class]);
+		break;
+		
+		case kFileTransferItemType_CreateDirectory:
+		if([controller respondsToSelector:@selector(createDirectoryAtPath:)]) {
+			success = [(id)controller createDirectoryAtPath:item.remotePath];
+			//NOTE: Creating a directory that already exists is not an error for the queue
+			if(!success && [controller respondsToSelector:@selector(contentsOfDirectoryAtPath:)] && [(id)controller contentsOfDirectoryAtPath:item.remotePath])
+			success = YES;
+		}
+		else
+		item.error = MAKE_QUEUE_ERROR(@"Directory creation is not supported by %@", [controller class]);
+		break;
+	
+	}
+	
+	return success;
+}
+
+- (void) _workerThread:(id)argument
+{
+	NSMutableDictionary*	controllers = [NSMutableDictionary new];
+	NSMutableDictionary*	threadDictionary = [[NSThread currentThread] threadDictionary];
+	NSAutoreleasePool*		localPool;
+	FileTransferItem*		item;
+	FileTransferController*	controller;
+	NSString*				key;
+	BOOL					success;
+	
+	while((item = [self _nextItem])) {
+		localPool = [NSAutoreleasePool new];
+		
+		key = [item.baseURL absoluteString];
+		controller = [controllers objectForKey:key];
+		if(controller == nil) {
+			controller = [FileTransferController fileTransferControllerWithURL:item.baseURL];
+			if(controller) {
+				[controller setDelegate:(id<FileTransferControllerDelegate>)self];
+				if([_delegate respondsToSelector:@selector(fileTransferQueue:willUseController:)])
+				[_delegate fileTransferQueue:self willUseController:controller];
+				[controllers setObject:controller forKey:key];
+			}
+		}
+		
+		success = NO;
+		if(controller) {
+			[threadDictionary setObject:item forKey:kThreadDictionaryKey];
+			while(1) {
+				item.attempts += 1;
+				item.transferredSize = 0;
+				item.error = nil;
+				success = [self _performItem:item withController:controller];
+				if(success || _cancelled || (item.attempts > _maxRetries) || !_IsTransientError(item.error))
+				break;
+				[self _waitBeforeRetryingItem:item];
+				if(_cancelled)
+				break;
+			}
+			[threadDictionary removeObjectForKey:kThreadDictionaryKey];
+		}
+		else
+		item.error = MAKE_QUEUE_ERROR(@"Unsupported URL \"%@\"", item.baseURL);
+		
+		if(success) {
+			item.error = nil;
+			item.state = kFileTransferItemState_Succeeded;
+		}
+		else
+		item.state = (_cancelled ? kFileTransferItemState_Cancelled : kFileTransferItemState_Failed);
+		[self _finishItem:item];
+		
+		[localPool drain];
+	}
+	
+	for(controller in [controllers objectEnumerator])
+	[controller setDelegate:nil];
+	[controllers release];
+}
+
+/* Must be called with the mutex locked */
+- (void) _startWorker
+{
+	WorkerThread*			worker;
+	
+	_runningWorkers += 1;
+	worker = [WorkerThread new];
+	[worker startWithTarget:self selector:@selector(_workerThread:) argument:nil];
+	[_workers addObject:worker];
+	[worker release];
+}
+
+- (void) start
+{
+	NSUInteger				i;
+	
+	if(_running)
+	return;
+	
+	pthread_mutex_lock(&_mutex);
+	_running = YES;
+	_cancelled = NO;
+	_completedCount = 0;
+	_failedCount = 0;
+	[_delegateThread release];
+	_delegateThread = [[NSThread currentThread] retain];
+	_progressTime = 0.0;
+	for(i = 0; i < _maxConcurrent; ++i)
+	[self _startWorker];
+	pthread_mutex_unlock(&_mutex);
+}
+
+- (void) cancel
+{
+	pthread_mutex_lock(&_mutex);
+	_cancelled = YES;
+	pthread_cond_broadcast(&_condition);
+	pthread_mutex_unlock(&_mutex);
+}
+
+- (BOOL) waitUntilDone
+{
+	while(_running)
+	[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:kRunLoopInterval]];
+	
+	return (_failedCount == 0);
+}
+
+@end
+
+@implementation FileTransferQueue (FileTransferControllerDelegate)
+
+- (void) fileTransferControllerDidUpdateProgress:(FileTransferController*)controller
+{
+	FileTransferItem*		item = [[[NSThread currentThread] threadDictionary] objectForKey:kThreadDictionaryKey];
+	float					progress = [controller transferProgress];
+	CFAbsoluteTime			time = CFAbsoluteTimeGetCurrent();
+	
+	pthread_mutex_lock(&_mutex);
+	if(item.size == 0)
+	item.size = [controller transferSize];
+	if(!isnan(progress))
+	item.transferredSize = (double)item.size * (double)progress;
+	if(time >= _progressTime + kProgressInterval) {
+		_progressTime = time;
+		[self performSelector:@selector(_notifyProgress:) onThread:_delegateThread withObject:nil waitUntilDone:NO];
+	}
+	pthread_mutex_unlock(&_mutex);
+}
+
+- (void) fileTransferControllerDidFail:(FileTransferController*)controller withError:(NSError*)error
+{
+	FileTransferItem*		item = [[[NSThread currentThread] threadDictionary] objectForKey:kThreadDictionaryKey];
+	
+	item.error = error;
+}
+
+- (BOOL) fileTransferControllerShouldAbort:(FileTransferController*)controller
+{
+	return _cancelled;
+}
+
+@end
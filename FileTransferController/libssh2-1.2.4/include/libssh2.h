@@ -148,8 +148,9 @@ typedef long long libssh2_int64_t;
 #define LIBSSH2_SOCKET_POLL_MAXLOOPS    120
 
 /* Maximum size to allow a payload to compress to, plays it safe by falling
-   short of spec limits */
-#define LIBSSH2_PACKET_MAXCOMP      32000
+   short of spec limits while leaving room for incompressible 32 KB channel
+   data packets */
+#define LIBSSH2_PACKET_MAXCOMP      34000
 
 /* Maximum size to allow a payload to deccompress to, plays it safe by
    allowing more than spec requires */
@@ -243,6 +244,10 @@ typedef struct _LIBSSH2_USERAUTH_KBDINT_RESPONSE
 /* session.flags bits */
 #define LIBSSH2_FLAG_SIGPIPE        0x00000001
 
+/* libssh2_session_compression() constants */
+#define LIBSSH2_COMPRESSION_DEFAULT_LEVEL   -1
+#define LIBSSH2_COMPRESSION_ADAPTIVE        0x00000001
+
 typedef struct _LIBSSH2_SESSION                     LIBSSH2_SESSION;
 typedef struct _LIBSSH2_CHANNEL                     LIBSSH2_CHANNEL;
 typedef struct _LIBSSH2_LISTENER                    LIBSSH2_LISTENER;
@@ -413,6 +418,13 @@ LIBSSH2_API int libssh2_session_block_directions(LIBSSH2_SESSION *session);
 LIBSSH2_API int libssh2_session_flag(LIBSSH2_SESSION *session, int flag,
                                      int value);
 
+LIBSSH2_API int libssh2_session_compression(LIBSSH2_SESSION *session,
+                                            int level, int strategy,
+                                            int flags);
+LIBSSH2_API int libssh2_session_compression_stats(LIBSSH2_SESSION *session,
+                                                  libssh2_uint64_t *raw,
+                                                  libssh2_uint64_t *compressed);
+
 /* Userauth API */
 LIBSSH2_API char *libssh2_userauth_list(LIBSSH2_SESSION *session,
                                         const char *username,
@@ -606,6 +618,19 @@ libssh2_channel_window_read_ex(LIBSSH2_CHANNEL *channel,
 #define libssh2_channel_window_read(channel) \
   libssh2_channel_window_read_ex((channel), NULL, NULL)
 
+/* Receive window autotuning: instead of refilling the receive window by a
+ * fixed amount, grow it to twice the bandwidth-delay product measured on the
+ * channel, starting from "min_window" bytes (0 for the stock refill of about
+ * 39 MB) but never above "max_window" bytes which bounds the memory used by
+ * incoming data. A "max_window" of 0 disables it.
+ * libssh2_channel_window_target() returns the window currently aimed for or
+ * 0 if autotuning is disabled.
+ */
+LIBSSH2_API void libssh2_channel_window_autotune(LIBSSH2_CHANNEL *channel,
+                                                 unsigned long min_window,
+                                                 unsigned long max_window);
+LIBSSH2_API unsigned long libssh2_channel_window_target(LIBSSH2_CHANNEL *channel);
+
 /* libssh2_channel_receive_window_adjust is DEPRECATED, do not use! */
 LIBSSH2_API unsigned long
 libssh2_channel_receive_window_adjust(LIBSSH2_CHANNEL *channel,
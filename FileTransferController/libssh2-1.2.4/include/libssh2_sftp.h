@@ -184,6 +184,7 @@ struct _LIBSSH2_SFTP_ATTRIBUTES {
 LIBSSH2_API LIBSSH2_SFTP *libssh2_sftp_init(LIBSSH2_SESSION *session);
 LIBSSH2_API int libssh2_sftp_shutdown(LIBSSH2_SFTP *sftp);
 LIBSSH2_API unsigned long libssh2_sftp_last_error(LIBSSH2_SFTP *sftp);
+LIBSSH2_API LIBSSH2_CHANNEL *libssh2_sftp_get_channel(LIBSSH2_SFTP *sftp);
 
 /* File / Directory Ops */
 LIBSSH2_API LIBSSH2_SFTP_HANDLE *libssh2_sftp_open_ex(LIBSSH2_SFTP *sftp,
@@ -225,6 +226,18 @@ LIBSSH2_API void libssh2_sftp_seek64(LIBSSH2_SFTP_HANDLE *handle,
 LIBSSH2_API size_t libssh2_sftp_tell(LIBSSH2_SFTP_HANDLE *handle);
 LIBSSH2_API libssh2_uint64_t libssh2_sftp_tell64(LIBSSH2_SFTP_HANDLE *handle);
 
+/* Pipelining: keep up to "depth" FXP_READ / FXP_WRITE requests in flight on a
+ * file handle instead of waiting for each response before sending the next
+ * one (a depth of 0 or 1 disables it). Set it right after opening the file.
+ * On a directory handle, FXP_READDIR requests are pipelined the same way.
+ * Pipelined writes return as soon as they are sent so a failure may only be
+ * reported by a later call: use libssh2_sftp_flush() to wait for all of them.
+ */
+#define LIBSSH2_SFTP_PIPELINE_MAX 64
+LIBSSH2_API void libssh2_sftp_pipeline(LIBSSH2_SFTP_HANDLE *handle,
+                                       unsigned int depth);
+LIBSSH2_API int libssh2_sftp_flush(LIBSSH2_SFTP_HANDLE *handle);
+
 LIBSSH2_API int libssh2_sftp_fstat_ex(LIBSSH2_SFTP_HANDLE *handle,
                                       LIBSSH2_SFTP_ATTRIBUTES *attrs,
                                       int setstat);
@@ -280,6 +293,18 @@ LIBSSH2_API int libssh2_sftp_stat_ex(LIBSSH2_SFTP *sftp,
     libssh2_sftp_stat_ex((sftp), (path), strlen(path), LIBSSH2_SFTP_SETSTAT, \
                          (attrs))
 
+/* Stat or lstat "count" paths with up to LIBSSH2_SFTP_STAT_BATCH_MAX requests
+ * in flight. For each path, "statuses" receives LIBSSH2_FX_OK and "attrs" its
+ * attributes or the SFTP status code of the failure (e.g.
+ * LIBSSH2_FX_NO_SUCH_FILE). Returns 0 unless the whole batch failed.
+ */
+#define LIBSSH2_SFTP_STAT_BATCH_MAX 64
+LIBSSH2_API int libssh2_sftp_stat_batch(LIBSSH2_SFTP *sftp,
+                                        const char * const *paths,
+                                        unsigned int count, int stat_type,
+                                        LIBSSH2_SFTP_ATTRIBUTES *attrs,
+                                        unsigned long *statuses);
+
 LIBSSH2_API int libssh2_sftp_symlink_ex(LIBSSH2_SFTP *sftp,
                                         const char *path,
                                         unsigned int path_len,
@@ -42,6 +42,9 @@
 #include <unistd.h>
 #endif
 #include <fcntl.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
 #ifdef HAVE_INTTYPES_H
 #include <inttypes.h>
 #endif
@@ -50,6 +53,43 @@
 #include "channel.h"
 #include "transport.h"
 
+/* Receive window autotuning limits: the window is advertised as a 32 bits
+   value and the throughput is measured over at least 10 ms - Autotuning
+   starts from the refill of channels without it */
+#define CHANNEL_WINDOW_MAX (1024*1024*1024)
+#define CHANNEL_WINDOW_INTERVAL 0.01
+#define CHANNEL_WINDOW_STOCK (LIBSSH2_CHANNEL_WINDOW_DEFAULT*600)
+
+/*
+ * channel_seconds_between
+ *
+ * Returns the number of seconds between two times
+ */
+static double
+channel_seconds_between(const struct timeval *start,
+                        const struct timeval *end)
+{
+    return (double) (end->tv_sec - start->tv_sec) +
+        (double) (end->tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/*
+ * channel_discard_data
+ *
+ * Free the data packets queued on a channel
+ */
+static void
+channel_discard_data(LIBSSH2_CHANNEL *channel)
+{
+    LIBSSH2_PACKET *packet;
+
+    while ((packet = _libssh2_list_first(&channel->data_packets))) {
+        _libssh2_list_remove(&packet->node);
+        LIBSSH2_FREE(channel->session, packet->data);
+        LIBSSH2_FREE(channel->session, packet);
+    }
+}
+
 /*
  *  _libssh2_channel_nextid
  *
@@ -228,6 +268,9 @@ _libssh2_channel_open(LIBSSH2_SESSION * session, const char *channel_type,
             goto channel_error;
         }
 
+        /* The confirmation gives a first round-trip time sample for
+           receive window autotuning */
+        gettimeofday(&session->open_channel->window_reopen, NULL);
         session->open_state = libssh2_NB_state_sent;
     }
 
@@ -246,6 +289,13 @@ _libssh2_channel_open(LIBSSH2_SESSION * session, const char *channel_type,
         }
 
         if (session->open_data[0] == SSH_MSG_CHANNEL_OPEN_CONFIRMATION) {
+            struct timeval now;
+
+            gettimeofday(&now, NULL);
+            session->open_channel->window_rtt =
+                channel_seconds_between(&session->open_channel->window_reopen,
+                                        &now);
+            session->open_channel->window_reopen.tv_sec = 0;
             session->open_channel->remote.id =
                 _libssh2_ntohu32(session->open_data + 5);
             session->open_channel->local.window_size =
@@ -289,25 +339,12 @@ _libssh2_channel_open(LIBSSH2_SESSION * session, const char *channel_type,
         session->open_packet = NULL;
     }
     if (session->open_channel) {
-        unsigned char channel_id[4];
         LIBSSH2_FREE(session, session->open_channel->channel_type);
 
         _libssh2_list_remove(&session->open_channel->node);
 
         /* Clear out packets meant for this channel */
-        _libssh2_htonu32(channel_id, session->open_channel->local.id);
-        while ((_libssh2_packet_ask(session, SSH_MSG_CHANNEL_DATA,
-                                    &session->open_data,
-                                    &session->open_data_len, 1,
-                                    channel_id, 4) >= 0)
-               ||
-               (_libssh2_packet_ask(session, SSH_MSG_CHANNEL_EXTENDED_DATA,
-                                    &session->open_data,
-                                    &session->open_data_len, 1,
-                                    channel_id, 4) >= 0)) {
-            LIBSSH2_FREE(session, session->open_data);
-            session->open_data = NULL;
-        }
+        channel_discard_data(session->open_channel);
 
         /* Free any state variables still holding data */
         if (session->open_channel->write_packet) {
@@ -1426,7 +1463,7 @@ _libssh2_channel_flush(LIBSSH2_CHANNEL *channel, int streamid)
 {
     if (channel->flush_state == libssh2_NB_state_idle) {
         LIBSSH2_PACKET *packet =
-            _libssh2_list_first(&channel->session->packets);
+            _libssh2_list_first(&channel->data_packets);
         channel->flush_refund_bytes = 0;
         channel->flush_flush_bytes = 0;
 
@@ -1576,6 +1613,12 @@ _libssh2_channel_receive_window_adjust(LIBSSH2_CHANNEL * channel,
         return rc;
     }
     else {
+        /* A server stalled by the exhausted window resumes sending when it
+           gets this adjustment: time it to measure the round-trip time */
+        if (channel->window_max
+            && (channel->remote.window_size < channel->remote.packet_size))
+            gettimeofday(&channel->window_reopen, NULL);
+
         channel->remote.window_size += adjustment;
     }
 
@@ -1639,6 +1682,98 @@ libssh2_channel_receive_window_adjust2(LIBSSH2_CHANNEL *channel,
     return rc;
 }
 
+/*
+ * libssh2_channel_window_autotune
+ *
+ * Enable or disable receive window autotuning for a channel
+ */
+LIBSSH2_API void
+libssh2_channel_window_autotune(LIBSSH2_CHANNEL *channel,
+                                unsigned long min_window,
+                                unsigned long max_window)
+{
+    if (max_window > CHANNEL_WINDOW_MAX)
+        max_window = CHANNEL_WINDOW_MAX;
+    if (!min_window)
+        min_window = CHANNEL_WINDOW_STOCK;
+    if (min_window < channel->remote.window_size_initial)
+        min_window = channel->remote.window_size_initial;
+    if (min_window > max_window)
+        min_window = max_window;
+
+    channel->window_max = max_window;
+    if (!max_window) {
+        channel->window_target = 0;
+        return;
+    }
+    /* Keep what was learned so far if it still fits */
+    if ((channel->window_target < min_window)
+        || (channel->window_target > max_window))
+        channel->window_target = min_window;
+}
+
+/*
+ * libssh2_channel_window_target
+ *
+ * Return the receive window autotuning currently aims for
+ */
+LIBSSH2_API unsigned long
+libssh2_channel_window_target(LIBSSH2_CHANNEL *channel)
+{
+    return channel->window_max ? channel->window_target : 0;
+}
+
+/*
+ * _libssh2_channel_window_received
+ *
+ * Account for data received on a channel to autotune its receive window: the
+ * round-trip time is measured when the channel is opened and whenever a
+ * stalled server resumes sending, the throughput over intervals of at least
+ * one round-trip time, then the window target grows to twice their product.
+ * While the window limits the throughput this doubles the target every
+ * round-trip.
+ */
+void
+_libssh2_channel_window_received(LIBSSH2_CHANNEL *channel,
+                                 unsigned long length)
+{
+    struct timeval now;
+    double elapsed, bdp;
+
+    if (!channel->window_max)
+        return;
+
+    gettimeofday(&now, NULL);
+
+    if (channel->window_reopen.tv_sec) {
+        elapsed = channel_seconds_between(&channel->window_reopen, &now);
+        channel->window_rtt = channel->window_rtt ?
+            (7.0 * channel->window_rtt + elapsed) / 8.0 : elapsed;
+        channel->window_reopen.tv_sec = 0;
+    }
+
+    if (!channel->window_bytes)
+        channel->window_start = now;
+    channel->window_bytes += length;
+    if (!channel->window_rtt)
+        return;
+
+    elapsed = channel_seconds_between(&channel->window_start, &now);
+    if (elapsed >= ((channel->window_rtt > CHANNEL_WINDOW_INTERVAL) ?
+                    channel->window_rtt : CHANNEL_WINDOW_INTERVAL)) {
+        bdp = (double) channel->window_bytes * channel->window_rtt / elapsed;
+        if (2.0 * bdp > (double) channel->window_target) {
+            channel->window_target = (2.0 * bdp < (double) channel->window_max) ?
+                (unsigned long) (2.0 * bdp) : channel->window_max;
+            _libssh2_debug(channel->session, LIBSSH2_TRACE_CONN,
+                           "Receive window target of channel %lu/%lu grown "
+                           "to %lu bytes", channel->local.id,
+                           channel->remote.id, channel->window_target);
+        }
+        channel->window_bytes = 0;
+    }
+}
+
 int
 _libssh2_channel_extended_data(LIBSSH2_CHANNEL *channel, int ignore_mode)
 {
@@ -1749,7 +1884,7 @@ ssize_t _libssh2_channel_read(LIBSSH2_CHANNEL *channel, int stream_id,
         goto channel_read_ex_point1;
     }
 
-    read_packet = _libssh2_list_first(&session->packets);
+    read_packet = _libssh2_list_first(&channel->data_packets);
     while (read_packet && (bytes_read < (int) buflen)) {
         /* previously this loop condition also checked for
            !channel->remote.close but we cannot let it do this:
@@ -1844,15 +1979,26 @@ ssize_t _libssh2_channel_read(LIBSSH2_CHANNEL *channel, int stream_id,
            more off the network again */
         channel->read_state = libssh2_NB_state_created;
 
-    if(channel->remote.window_size < (LIBSSH2_CHANNEL_WINDOW_DEFAULT*300)) {
-        /* the window is getting too narrow, expand it! */
+    if(channel->window_max ?
+       (channel->remote.window_size < channel->window_target / 2) :
+       (channel->remote.window_size < (LIBSSH2_CHANNEL_WINDOW_DEFAULT*300))) {
+        /* the window is getting too narrow, expand it! - autotuning refills
+           like the stock window but by its target and without going over
+           its maximum */
+        channel->read_adjustment = channel->window_max ?
+            ((channel->remote.window_size + channel->window_target >
+              channel->window_max) ?
+             (channel->window_max - channel->remote.window_size) :
+             channel->window_target) :
+            (LIBSSH2_CHANNEL_WINDOW_DEFAULT*600);
 
       channel_read_ex_point1:
         channel->read_state = libssh2_NB_state_jump1;
         /* the actual window adjusting may not finish so we need to deal with
            this special state here */
         rc = _libssh2_channel_receive_window_adjust(channel,
-                                                    (LIBSSH2_CHANNEL_WINDOW_DEFAULT*600), 0, NULL);
+                                                    channel->read_adjustment,
+                                                    0, NULL);
         if (rc == PACKET_EAGAIN)
             return rc;
 
@@ -1896,11 +2042,10 @@ libssh2_channel_read_ex(LIBSSH2_CHANNEL *channel, int stream_id, char *buf,
 unsigned long
 _libssh2_channel_packet_data_len(LIBSSH2_CHANNEL * channel, int stream_id)
 {
-    LIBSSH2_SESSION *session = channel->session;
     LIBSSH2_PACKET *read_packet;
     uint32_t read_local_id;
 
-    read_packet = _libssh2_list_first(&session->packets);
+    read_packet = _libssh2_list_first(&channel->data_packets);
     if (read_packet == NULL)
         return 0;
 
@@ -2161,8 +2306,7 @@ libssh2_channel_send_eof(LIBSSH2_CHANNEL *channel)
 LIBSSH2_API int
 libssh2_channel_eof(LIBSSH2_CHANNEL * channel)
 {
-    LIBSSH2_SESSION *session = channel->session;
-    LIBSSH2_PACKET *packet = _libssh2_list_first(&session->packets);
+    LIBSSH2_PACKET *packet = _libssh2_list_first(&channel->data_packets);
 
     while (packet) {
         if (((packet->data[0] == SSH_MSG_CHANNEL_DATA)
@@ -2378,9 +2522,6 @@ libssh2_channel_wait_closed(LIBSSH2_CHANNEL *channel)
 int _libssh2_channel_free(LIBSSH2_CHANNEL *channel)
 {
     LIBSSH2_SESSION *session = channel->session;
-    unsigned char channel_id[4];
-    unsigned char *data;
-    unsigned long data_len;
     int rc;
 
     assert(session);
@@ -2415,14 +2556,7 @@ int _libssh2_channel_free(LIBSSH2_CHANNEL *channel)
      */
 
     /* Clear out packets meant for this channel */
-    _libssh2_htonu32(channel_id, channel->local.id);
-    while ((_libssh2_packet_ask(session, SSH_MSG_CHANNEL_DATA, &data,
-                                &data_len, 1, channel_id, 4) >= 0)
-           ||
-           (_libssh2_packet_ask(session, SSH_MSG_CHANNEL_EXTENDED_DATA, &data,
-                                &data_len, 1, channel_id, 4) >= 0)) {
-        LIBSSH2_FREE(session, data);
-    }
+    channel_discard_data(channel);
 
     /* free "channel_type" */
     if (channel->channel_type) {
@@ -2492,7 +2626,7 @@ libssh2_channel_window_read_ex(LIBSSH2_CHANNEL * channel,
     if (read_avail) {
         unsigned long bytes_queued = 0;
         LIBSSH2_PACKET *packet =
-            _libssh2_list_first(&channel->session->packets);
+            _libssh2_list_first(&channel->data_packets);
 
         while (packet) {
             unsigned char packet_type = packet->data[0];
@@ -52,6 +52,14 @@ int _libssh2_channel_receive_window_adjust(LIBSSH2_CHANNEL * channel,
                                            unsigned char force,
                                            unsigned int *store);
 
+/*
+ * _libssh2_channel_window_received
+ *
+ * Account for data received on a channel to autotune its receive window
+ */
+void _libssh2_channel_window_received(LIBSSH2_CHANNEL *channel,
+                                      unsigned long length);
+
 /*
  * _libssh2_channel_flush
  *
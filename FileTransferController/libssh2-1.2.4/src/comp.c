@@ -77,6 +77,7 @@ comp_method_none_comp(LIBSSH2_SESSION * session,
 
 static const LIBSSH2_COMP_METHOD comp_method_none = {
     "none",
+    1,
     NULL,
     comp_method_none_comp,
     NULL
@@ -110,6 +111,55 @@ comp_method_zlib_free(voidpf opaque, voidpf address)
 
 
 
+/* Number of packets sent without compression in adaptive mode after one
+   did not shrink, before trying to compress again */
+#define COMP_ADAPTIVE_BACKOFF 64
+
+/* Initial size of the pooled buffer, grown as needed */
+#define COMP_BUFFER_SIZE 16384
+
+struct comp_zlib_ctx
+{
+    z_stream strm;
+
+    /* output buffer kept for the whole life of the stream */
+    unsigned char *buf;
+    unsigned long buf_size;
+
+    /* compression only */
+    int level;
+    int strategy;
+    int adaptive;
+    int current_level;
+    int backoff;                /* packets left to send at level 0 */
+};
+
+/* comp_method_zlib_grow
+ * Make sure the pooled buffer can hold at least 'size' bytes
+ */
+static int
+comp_method_zlib_grow(LIBSSH2_SESSION * session, struct comp_zlib_ctx *ctx,
+                      unsigned long size)
+{
+    unsigned char *buf;
+
+    if (size <= ctx->buf_size)
+        return 0;
+
+    buf = LIBSSH2_REALLOC(session, ctx->buf, size);
+    if (!buf) {
+        libssh2_error(session, LIBSSH2_ERROR_ALLOC,
+                      "Unable to expand compress/decompression buffer", 0);
+        return -1;
+    }
+    ctx->buf = buf;
+    ctx->buf_size = size;
+
+    return 0;
+}
+
+
+
 /* libssh2_comp_method_zlib_init
  * All your bandwidth are belong to us (so save some)
  */
@@ -117,34 +167,49 @@ static int
 comp_method_zlib_init(LIBSSH2_SESSION * session, int compress,
                       void **abstract)
 {
-    z_stream *strm;
+    struct comp_zlib_ctx *ctx;
     int status;
 
-    strm = LIBSSH2_ALLOC(session, sizeof(z_stream));
-    if (!strm) {
+    ctx = LIBSSH2_ALLOC(session, sizeof(struct comp_zlib_ctx));
+    if (!ctx) {
         libssh2_error(session, LIBSSH2_ERROR_ALLOC,
                       "Unable to allocate memory for zlib compression/decompression",
                       0);
         return -1;
     }
-    memset(strm, 0, sizeof(z_stream));
+    memset(ctx, 0, sizeof(struct comp_zlib_ctx));
 
-    strm->opaque = (voidpf) session;
-    strm->zalloc = (alloc_func) comp_method_zlib_alloc;
-    strm->zfree = (free_func) comp_method_zlib_free;
+    ctx->strm.opaque = (voidpf) session;
+    ctx->strm.zalloc = (alloc_func) comp_method_zlib_alloc;
+    ctx->strm.zfree = (free_func) comp_method_zlib_free;
     if (compress) {
         /* deflate */
-        status = deflateInit(strm, Z_DEFAULT_COMPRESSION);
+        ctx->level = session->comp_level;
+        ctx->strategy = session->comp_strategy;
+        ctx->adaptive = session->comp_flags & LIBSSH2_COMPRESSION_ADAPTIVE;
+        ctx->current_level = ctx->level;
+        status = deflateInit2(&ctx->strm, ctx->level, Z_DEFLATED,
+                              MAX_WBITS, 8 /* default memory level */,
+                              ctx->strategy);
     } else {
         /* inflate */
-        status = inflateInit(strm);
+        status = inflateInit(&ctx->strm);
     }
 
     if (status != Z_OK) {
-        LIBSSH2_FREE(session, strm);
+        LIBSSH2_FREE(session, ctx);
+        return -1;
+    }
+
+    if (comp_method_zlib_grow(session, ctx, COMP_BUFFER_SIZE)) {
+        if (compress)
+            deflateEnd(&ctx->strm);
+        else
+            inflateEnd(&ctx->strm);
+        LIBSSH2_FREE(session, ctx);
         return -1;
     }
-    *abstract = strm;
+    *abstract = ctx;
 
     return 0;
 }
@@ -153,6 +218,11 @@ comp_method_zlib_init(LIBSSH2_SESSION * session, int compress,
 
 /* libssh2_comp_method_zlib_comp
  * zlib, a compression standard for all occasions
+ *
+ * Data goes through a buffer pooled in the stream context: compressed
+ * packets are returned from it directly as the transport copies them right
+ * away, while decompressed ones are copied out of it to a buffer of the
+ * exact size since they end up in the packet queues.
  */
 static int
 comp_method_zlib_comp(LIBSSH2_SESSION * session,
@@ -164,34 +234,39 @@ comp_method_zlib_comp(LIBSSH2_SESSION * session,
                       const unsigned char *src,
                       unsigned long src_len, void **abstract)
 {
-    z_stream *strm = *abstract;
-    /* A short-term alloc of a full data chunk is better than a series of
-       reallocs */
-    char *out;
-    int out_maxlen = compress ? (src_len + 4) : (2 * src_len);
-    int limiter = 0;
-
-    /* In practice they never come smaller than this */
-    if (out_maxlen < 25) {
-        out_maxlen = 25;
-    }
+    struct comp_zlib_ctx *ctx = *abstract;
+    z_stream *strm = &ctx->strm;
+    unsigned long out_len;
+    unsigned char *out;
+
+    /* Deflate hardly ever grows the data by more than a few bytes but
+       inflate commonly does */
+    if (comp_method_zlib_grow(session, ctx,
+                              compress ? (src_len + src_len / 1000 + 64) :
+                              (4 * src_len + 64)))
+        return -1;
 
-    if (out_maxlen > (int) payload_limit) {
-        out_maxlen = payload_limit;
+    strm->next_out = ctx->buf;
+    strm->avail_out = ctx->buf_size;
+
+    if (compress && ctx->adaptive) {
+        /* Packets are sent at level 0 while backing off, which still
+           produces a valid deflate stream made of stored blocks */
+        int level = ctx->backoff ? 0 : ctx->level;
+
+        if (level != ctx->current_level) {
+            if (deflateParams(strm, level, ctx->strategy) != Z_OK) {
+                libssh2_error(session, LIBSSH2_ERROR_ZLIB,
+                              "compress/decompression failure", 0);
+                return -1;
+            }
+            ctx->current_level = level;
+        }
     }
 
     strm->next_in = (unsigned char *) src;
     strm->avail_in = src_len;
-    strm->next_out = (unsigned char *) LIBSSH2_ALLOC(session, out_maxlen);
-    out = (char *) strm->next_out;
-    strm->avail_out = out_maxlen;
-    if (!strm->next_out) {
-        libssh2_error(session, LIBSSH2_ERROR_ALLOC,
-                      "Unable to allocate compression/decompression buffer",
-                      0);
-        return -1;
-    }
-    while (strm->avail_in) {
+    while (1) {
         int status;
 
         if (compress) {
@@ -199,91 +274,74 @@ comp_method_zlib_comp(LIBSSH2_SESSION * session,
         } else {
             status = inflate(strm, Z_PARTIAL_FLUSH);
         }
-        if (status != Z_OK) {
+        if ((status != Z_OK) &&
+            !((status == Z_BUF_ERROR) && !strm->avail_in)) {
             libssh2_error(session, LIBSSH2_ERROR_ZLIB,
                           "compress/decompression failure", 0);
-            LIBSSH2_FREE(session, out);
             return -1;
         }
-        if (strm->avail_in) {
-            unsigned long out_ofs = out_maxlen - strm->avail_out;
-            char *newout;
 
-            out_maxlen +=
-                compress ? (strm->avail_in + 4) : (2 * strm->avail_in);
+        /* Done once all the input is consumed and the output is flushed,
+           which leaves room in the output buffer */
+        if (!strm->avail_in && strm->avail_out)
+            break;
 
-            if ((out_maxlen > (int) payload_limit) && !compress && limiter++) {
-                libssh2_error(session, LIBSSH2_ERROR_ZLIB,
-                              "Excessive growth in decompression phase", 0);
-                LIBSSH2_FREE(session, out);
-                return -1;
-            }
+        out_len = ctx->buf_size - strm->avail_out;
+        if (!compress && (out_len >= payload_limit)) {
+            libssh2_error(session, LIBSSH2_ERROR_ZLIB,
+                          "Excessive growth in decompression phase", 0);
+            return -1;
+        }
+        if (comp_method_zlib_grow(session, ctx, 2 * ctx->buf_size))
+            return -1;
+        strm->next_out = ctx->buf + out_len;
+        strm->avail_out = ctx->buf_size - out_len;
+    }
+    out_len = ctx->buf_size - strm->avail_out;
 
-            newout = LIBSSH2_REALLOC(session, out, out_maxlen);
-            if (!newout) {
-                libssh2_error(session, LIBSSH2_ERROR_ALLOC,
-                              "Unable to expand compress/decompression buffer",
-                              0);
-                LIBSSH2_FREE(session, out);
-                return -1;
-            }
-            out = newout;
-            strm->next_out = (unsigned char *) out + out_ofs;
-            strm->avail_out +=
-                compress ? (strm->avail_in + 4) : (2 * strm->avail_in);
-        } else
-            while (!strm->avail_out) {
-                /* Done with input, might be a byte or two in internal buffer
-                 * during compress.  Or potentially many bytes if it's a
-                 * decompress
-                 */
-                int grow_size = compress ? 8 : 1024;
-                char *newout;
-
-                if (out_maxlen >= (int) payload_limit) {
-                    libssh2_error(session, LIBSSH2_ERROR_ZLIB,
-                                  "Excessive growth in decompression phase",
-                                  0);
-                    LIBSSH2_FREE(session, out);
-                    return -1;
-                }
-
-                if (grow_size > (int) (payload_limit - out_maxlen)) {
-                    grow_size = payload_limit - out_maxlen;
-                }
-
-                out_maxlen += grow_size;
-                strm->avail_out = grow_size;
-
-                newout = LIBSSH2_REALLOC(session, out, out_maxlen);
-                if (!newout) {
-                    libssh2_error(session, LIBSSH2_ERROR_ALLOC,
-                                  "Unable to expand final compress/decompress buffer",
-                                  0);
-                    LIBSSH2_FREE(session, out);
-                    return -1;
-                }
-                out = newout;
-                strm->next_out = (unsigned char *) out + out_maxlen -
-                    grow_size;
-
-                if (compress) {
-                    status = deflate(strm, Z_PARTIAL_FLUSH);
-                } else {
-                    status = inflate(strm, Z_PARTIAL_FLUSH);
-                }
-                if (status != Z_OK) {
-                    libssh2_error(session, LIBSSH2_ERROR_ZLIB,
-                                  "compress/decompression failure", 0);
-                    LIBSSH2_FREE(session, out);
-                    return -1;
-                }
-            }
+    /* The pooled buffer may already have been large enough for the whole
+       output so the check in the loop above is not sufficient */
+    if (!compress && (out_len > payload_limit)) {
+        libssh2_error(session, LIBSSH2_ERROR_ZLIB,
+                      "Excessive growth in decompression phase", 0);
+        return -1;
     }
 
-    *dest = (unsigned char *) out;
-    *dest_len = out_maxlen - strm->avail_out;
-    *free_dest = 1;
+    if (compress) {
+        if (out_len > payload_limit) {
+            libssh2_error(session, LIBSSH2_ERROR_ZLIB,
+                          "Excessive growth in compression phase", 0);
+            return -1;
+        }
+
+        session->comp_raw_bytes += src_len;
+        session->comp_compressed_bytes += out_len;
+
+        /* Incompressible data (e.g. already compressed files) only costs
+           CPU, so stop compressing for a while before trying again */
+        if (ctx->adaptive) {
+            if (ctx->backoff)
+                ctx->backoff--;
+            else if (out_len >= src_len)
+                ctx->backoff = COMP_ADAPTIVE_BACKOFF;
+        }
+
+        *dest = ctx->buf;
+        *dest_len = out_len;
+        *free_dest = 0;
+    } else {
+        out = LIBSSH2_ALLOC(session, out_len);
+        if (!out) {
+            libssh2_error(session, LIBSSH2_ERROR_ALLOC,
+                          "Unable to allocate decompression buffer", 0);
+            return -1;
+        }
+        memcpy(out, ctx->buf, out_len);
+
+        *dest = out;
+        *dest_len = out_len;
+        *free_dest = 1;
+    }
 
     return 0;
 }
@@ -296,18 +354,20 @@ static int
 comp_method_zlib_dtor(LIBSSH2_SESSION * session, int compress,
                       void **abstract)
 {
-    z_stream *strm = *abstract;
+    struct comp_zlib_ctx *ctx = *abstract;
 
-    if (strm) {
+    if (ctx) {
         if (compress) {
             /* deflate */
-            deflateEnd(strm);
+            deflateEnd(&ctx->strm);
         } else {
             /* inflate */
-            inflateEnd(strm);
+            inflateEnd(&ctx->strm);
         }
 
-        LIBSSH2_FREE(session, strm);
+        if (ctx->buf)
+            LIBSSH2_FREE(session, ctx->buf);
+        LIBSSH2_FREE(session, ctx);
     }
 
     *abstract = NULL;
@@ -317,6 +377,17 @@ comp_method_zlib_dtor(LIBSSH2_SESSION * session, int compress,
 
 static const LIBSSH2_COMP_METHOD comp_method_zlib = {
     "zlib",
+    1,
+    comp_method_zlib_init,
+    comp_method_zlib_comp,
+    comp_method_zlib_dtor,
+};
+
+/* Same stream as "zlib" but it only starts once the user is authenticated,
+   which is the only compression stock OpenSSH servers offer by default */
+static const LIBSSH2_COMP_METHOD comp_method_zlib_openssh = {
+    "zlib@openssh.com",
+    0,
     comp_method_zlib_init,
     comp_method_zlib_comp,
     comp_method_zlib_dtor,
@@ -331,6 +402,7 @@ static const LIBSSH2_COMP_METHOD *comp_methods[] = {
     &comp_method_none,
 #ifdef LIBSSH2_HAVE_ZLIB
     &comp_method_zlib,
+    &comp_method_zlib_openssh,
 #endif /* LIBSSH2_HAVE_ZLIB */
     NULL
 };
@@ -45,7 +45,7 @@
  */
 static int
 crypt_none_crypt(LIBSSH2_SESSION * session, unsigned char *buf,
-                         void **abstract)
+                 size_t blocksize, void **abstract)
 {
     /* Do nothing to the data! */
     return 0;
@@ -59,7 +59,9 @@ static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_none = {
     0,                     /* flags */
     NULL,
     crypt_none_crypt,
-    NULL
+    NULL,
+    0,                     /* algo */
+    0                      /* authentication tag length */
 };
 #endif /* LIBSSH2_CRYPT_NONE */
 
@@ -96,11 +98,12 @@ crypt_init(LIBSSH2_SESSION * session,
 
 static int
 crypt_encrypt(LIBSSH2_SESSION * session, unsigned char *block,
-                 void **abstract)
+              size_t blocksize, void **abstract)
 {
     struct crypt_ctx *cctx = *(struct crypt_ctx **) abstract;
     (void) session;
-    return _libssh2_cipher_crypt(&cctx->h, cctx->algo, cctx->encrypt, block);
+    return _libssh2_cipher_crypt(&cctx->h, cctx->algo, cctx->encrypt, block,
+                                 blocksize);
 }
 
 static int
@@ -115,6 +118,36 @@ crypt_dtor(LIBSSH2_SESSION * session, void **abstract)
     return 0;
 }
 
+#if LIBSSH2_AES_GCM
+/* RFC 5647 as implemented by OpenSSH: the packet length is authenticated
+   but not encrypted and the tag replaces the negotiated MAC */
+static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes128_gcm = {
+    "aes128-gcm@openssh.com",
+    16,                         /* blocksize */
+    12,                         /* initial value length */
+    16,                         /* secret length -- 16*8 == 128bit */
+    0,                          /* flags */
+    &crypt_init,
+    &crypt_encrypt,
+    &crypt_dtor,
+    _libssh2_cipher_aes128gcm,
+    16                          /* authentication tag length */
+};
+
+static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes256_gcm = {
+    "aes256-gcm@openssh.com",
+    16,                         /* blocksize */
+    12,                         /* initial value length */
+    32,                         /* secret length -- 32*8 == 256bit */
+    0,                          /* flags */
+    &crypt_init,
+    &crypt_encrypt,
+    &crypt_dtor,
+    _libssh2_cipher_aes256gcm,
+    16                          /* authentication tag length */
+};
+#endif /* LIBSSH2_AES_GCM */
+
 #if LIBSSH2_AES_CTR
 static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes128_ctr = {
     "aes128-ctr",
@@ -125,7 +158,8 @@ static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes128_ctr = {
     &crypt_init,
     &crypt_encrypt,
     &crypt_dtor,
-    _libssh2_cipher_aes128ctr
+    _libssh2_cipher_aes128ctr,
+    0                           /* authentication tag length */
 };
 
 static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes192_ctr = {
@@ -137,7 +171,8 @@ static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes192_ctr = {
     &crypt_init,
     &crypt_encrypt,
     &crypt_dtor,
-    _libssh2_cipher_aes192ctr
+    _libssh2_cipher_aes192ctr,
+    0                           /* authentication tag length */
 };
 
 static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes256_ctr = {
@@ -149,7 +184,8 @@ static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes256_ctr = {
     &crypt_init,
     &crypt_encrypt,
     &crypt_dtor,
-    _libssh2_cipher_aes256ctr
+    _libssh2_cipher_aes256ctr,
+    0                           /* authentication tag length */
 };
 #endif
 
@@ -163,7 +199,8 @@ static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes128_cbc = {
     &crypt_init,
     &crypt_encrypt,
     &crypt_dtor,
-    _libssh2_cipher_aes128
+    _libssh2_cipher_aes128,
+    0                           /* authentication tag length */
 };
 
 static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes192_cbc = {
@@ -175,7 +212,8 @@ static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes192_cbc = {
     &crypt_init,
     &crypt_encrypt,
     &crypt_dtor,
-    _libssh2_cipher_aes192
+    _libssh2_cipher_aes192,
+    0                           /* authentication tag length */
 };
 
 static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes256_cbc = {
@@ -187,7 +225,8 @@ static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes256_cbc = {
     &crypt_init,
     &crypt_encrypt,
     &crypt_dtor,
-    _libssh2_cipher_aes256
+    _libssh2_cipher_aes256,
+    0                           /* authentication tag length */
 };
 
 /* rijndael-cbc@lysator.liu.se == aes256-cbc */
@@ -201,7 +240,8 @@ static const LIBSSH2_CRYPT_METHOD
     &crypt_init,
     &crypt_encrypt,
     &crypt_dtor,
-    _libssh2_cipher_aes256
+    _libssh2_cipher_aes256,
+    0                           /* authentication tag length */
 };
 #endif /* LIBSSH2_AES */
 
@@ -215,7 +255,8 @@ static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_blowfish_cbc = {
     &crypt_init,
     &crypt_encrypt,
     &crypt_dtor,
-    _libssh2_cipher_blowfish
+    _libssh2_cipher_blowfish,
+    0                           /* authentication tag length */
 };
 #endif /* LIBSSH2_BLOWFISH */
 
@@ -229,7 +270,8 @@ static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_arcfour = {
     &crypt_init,
     &crypt_encrypt,
     &crypt_dtor,
-    _libssh2_cipher_arcfour
+    _libssh2_cipher_arcfour,
+    0                           /* authentication tag length */
 };
 
 static int
@@ -248,7 +290,8 @@ crypt_init_arcfour128(LIBSSH2_SESSION * session,
 	unsigned char block[8];
 	size_t discard = 1536;
 	for (; discard; discard -= 8)
-	    _libssh2_cipher_crypt(&cctx->h, cctx->algo, cctx->encrypt, block);
+	    _libssh2_cipher_crypt(&cctx->h, cctx->algo, cctx->encrypt, block,
+	                          sizeof(block));
     }
 
     return rc;
@@ -263,7 +306,8 @@ static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_arcfour128 = {
     &crypt_init_arcfour128,
     &crypt_encrypt,
     &crypt_dtor,
-    _libssh2_cipher_arcfour
+    _libssh2_cipher_arcfour,
+    0                           /* authentication tag length */
 };
 #endif /* LIBSSH2_RC4 */
 
@@ -277,7 +321,8 @@ static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_cast128_cbc = {
     &crypt_init,
     &crypt_encrypt,
     &crypt_dtor,
-    _libssh2_cipher_cast5
+    _libssh2_cipher_cast5,
+    0                           /* authentication tag length */
 };
 #endif /* LIBSSH2_CAST */
 
@@ -291,11 +336,16 @@ static const LIBSSH2_CRYPT_METHOD libssh2_crypt_method_3des_cbc = {
     &crypt_init,
     &crypt_encrypt,
     &crypt_dtor,
-    _libssh2_cipher_3des
+    _libssh2_cipher_3des,
+    0                           /* authentication tag length */
 };
 #endif
 
 static const LIBSSH2_CRYPT_METHOD *_libssh2_crypt_methods[] = {
+#if LIBSSH2_AES_GCM
+  &libssh2_crypt_method_aes128_gcm,
+  &libssh2_crypt_method_aes256_gcm,
+#endif /* LIBSSH2_AES_GCM */
 #if LIBSSH2_AES_CTR
   &libssh2_crypt_method_aes128_ctr,
   &libssh2_crypt_method_aes192_ctr,
@@ -553,21 +553,15 @@ _libssh2_cipher_init(_libssh2_cipher_ctx * h,
 int
 _libssh2_cipher_crypt(_libssh2_cipher_ctx * ctx,
                       _libssh2_cipher_type(algo),
-                      int encrypt, unsigned char *block)
+                      int encrypt, unsigned char *block, size_t blocksize)
 {
-    int cipher = _libssh2_gcry_cipher (algo);
-    size_t blklen = gcry_cipher_get_algo_blklen(cipher);
     int ret;
-
-    if (blklen == 1) {
-/* Hack for arcfour. */
-        blklen = 8;
-    }
+    (void) algo;
 
     if (encrypt) {
-        ret = gcry_cipher_encrypt(*ctx, block, blklen, block, blklen);
+        ret = gcry_cipher_encrypt(*ctx, block, blocksize, block, blocksize);
     } else {
-        ret = gcry_cipher_decrypt(*ctx, block, blklen, block, blklen);
+        ret = gcry_cipher_decrypt(*ctx, block, blocksize, block, blocksize);
     }
     return ret;
 }
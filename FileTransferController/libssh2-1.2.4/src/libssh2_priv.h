@@ -356,6 +356,21 @@ struct _LIBSSH2_CHANNEL
     /* Amount of bytes to be refunded to receive window (but not yet sent) */
     unsigned long adjust_queue;
 
+    /* SSH_MSG_CHANNEL_DATA and SSH_MSG_CHANNEL_EXTENDED_DATA packets received
+       for this channel, kept apart from the session packets */
+    struct list_head data_packets;
+
+    /* Receive window autotuning (see libssh2_channel_window_autotune()) */
+    unsigned long window_max;     /* 0 if autotuning is disabled */
+    unsigned long window_target;  /* Window to advertise */
+    unsigned long window_bytes;   /* Received in the current measurement */
+    struct timeval window_start;  /* Start of the current measurement */
+    struct timeval window_reopen; /* Last time an exhausted window was
+                                     adjusted or the channel was requested,
+                                     or 0 */
+    double window_rtt;            /* Smoothed round-trip time in seconds or
+                                     0 if not measured yet */
+
     LIBSSH2_SESSION *session;
 
     void *abstract;
@@ -400,6 +415,7 @@ struct _LIBSSH2_CHANNEL
 
     /* State variables used in libssh2_channel_read_ex() */
     libssh2_nonblocking_states read_state;
+    unsigned long read_adjustment;
 
     uint32_t read_local_id;
 
@@ -473,7 +489,8 @@ typedef struct _libssh2_endpoint_data
     char *lang_prefs;
 } libssh2_endpoint_data;
 
-#define PACKETBUFSIZE (1024*16)
+/* large enough to receive a maximum size packet with a single recv() */
+#define PACKETBUFSIZE (1024*64)
 
 struct transportpacket
 {
@@ -502,8 +519,10 @@ struct transportpacket
 
     /* ------------- for outgoing data --------------- */
     unsigned char *outbuf;      /* pointer to a LIBSSH2_ALLOC() area for the
-                                   outgoing data */
-    int ototal_num;             /* size of outbuf in number of bytes */
+                                   outgoing data, reused for every packet */
+    int osize;                  /* allocated size of outbuf */
+    int ototal_num;             /* size of the packet stored in outbuf in
+                                   number of bytes, 0 if none is pending */
     unsigned char *odata;       /* original pointer to the data we stored in
                                    outbuf */
     unsigned long olen;         /* original size of the data we stored in
@@ -541,6 +560,20 @@ struct _LIBSSH2_PUBLICKEY
 
 #define SFTP_HANDLE_MAXLEN 256 /* according to spec! */
 
+/* Number of buckets of the SFTP packet hash table: request IDs are allocated
+   sequentially so pending responses spread evenly as long as fewer requests
+   than this are in flight */
+#define SFTP_PACKET_BUCKETS 128
+
+/* A FXP_READ or FXP_WRITE request in flight on a pipelined file handle */
+struct _libssh2_sftp_request
+{
+    unsigned char type;
+    unsigned long request_id;
+    libssh2_uint64_t offset;
+    size_t length;
+};
+
 struct _LIBSSH2_SFTP_HANDLE
 {
     struct list_node node;
@@ -562,12 +595,43 @@ struct _LIBSSH2_SFTP_HANDLE
         struct _libssh2_sftp_handle_file_data
         {
             libssh2_uint64_t offset;
+
+            /* State variables used when pipelining (see
+               libssh2_sftp_pipeline()): ring buffer of the requests in flight
+               in the order they were sent */
+            struct _libssh2_sftp_request pipeline[LIBSSH2_SFTP_PIPELINE_MAX];
+            unsigned int pipeline_depth;
+            unsigned int pipeline_first;
+            unsigned int pipeline_count;
+            libssh2_uint64_t read_offset; /* Offset of the next FXP_READ */
+            int read_eof;
+            /* Request being sent (FXP_READ requests use request_packet) */
+            struct _libssh2_sftp_request send_request;
+            unsigned char *send_packet;
+            size_t send_len;
+            size_t send_sent;
+            /* FXP_DATA response not entirely returned to the caller yet */
+            unsigned char *data;
+            size_t data_pos;
+            size_t data_end;
         } file;
         struct _libssh2_sftp_handle_dir_data
         {
             unsigned long names_left;
             void *names_packet;
             char *next_name;
+
+            /* State variables used when pipelining (see
+               libssh2_sftp_pipeline()): ring buffer of the IDs of the
+               FXP_READDIR requests in flight in the order they were sent */
+            unsigned long pipeline[LIBSSH2_SFTP_PIPELINE_MAX];
+            unsigned int pipeline_depth;
+            unsigned int pipeline_first;
+            unsigned int pipeline_count;
+            int eof;
+            /* Request being sent (in request_packet) */
+            unsigned long send_request_id;
+            size_t send_sent;
         } dir;
     } u;
 
@@ -583,7 +647,8 @@ struct _LIBSSH2_SFTP
 
     unsigned long request_id, version;
 
-    struct list_head packets;
+    /* Received packets hashed by request ID (see sftp_packet_add()) */
+    struct list_head packets[SFTP_PACKET_BUCKETS];
 
     /* a list of _LIBSSH2_SFTP_HANDLE structs */
     struct list_head sftp_handles;
@@ -651,6 +716,16 @@ struct _LIBSSH2_SFTP
     unsigned char *stat_packet;
     unsigned long stat_request_id;
 
+    /* State variables used in libssh2_sftp_stat_batch(): request i has the ID
+       statbatch_first_id + i */
+    libssh2_nonblocking_states statbatch_state;
+    unsigned long statbatch_first_id;
+    unsigned int statbatch_sent;
+    unsigned int statbatch_received;
+    unsigned char *statbatch_packet;
+    size_t statbatch_packet_len;
+    size_t statbatch_packet_sent;
+
     /* State variables used in libssh2_sftp_symlink() */
     libssh2_nonblocking_states symlink_state;
     unsigned char *symlink_packet;
@@ -681,6 +756,14 @@ struct _LIBSSH2_SESSION
     int state;
     int flags;
 
+    /* zlib settings of outgoing packets (see libssh2_session_compression())
+       and how much they have been compressed so far */
+    int comp_level;
+    int comp_strategy;
+    int comp_flags;
+    libssh2_uint64_t comp_raw_bytes;
+    libssh2_uint64_t comp_compressed_bytes;
+
     /* Agreed Key Exchange Method */
     const LIBSSH2_KEX_METHOD *kex;
     int burn_optimistic_kexinit:1;
@@ -981,16 +1064,25 @@ struct _LIBSSH2_CRYPT_METHOD
                  const LIBSSH2_CRYPT_METHOD * method, unsigned char *iv,
                  int *free_iv, unsigned char *secret, int *free_secret,
                  int encrypt, void **abstract);
+    /* Encrypts or decrypts in place 'blocksize' bytes, which is a multiple
+       of the block size - For AEAD ciphers this is the whole packet except
+       the packet length field and the authentication tag follows it */
     int (*crypt) (LIBSSH2_SESSION * session, unsigned char *block,
-                  void **abstract);
+                  size_t blocksize, void **abstract);
     int (*dtor) (LIBSSH2_SESSION * session, void **abstract);
 
       _libssh2_cipher_type(algo);
+
+    /* length of the authentication tag of AEAD ciphers which replaces the
+       negotiated MAC, 0 for other ciphers */
+    int auth_len;
 };
 
 struct _LIBSSH2_COMP_METHOD
 {
     const char *name;
+    int use_in_auth; /* zero if the stream only starts once authenticated
+                        (delayed compression like "zlib@openssh.com") */
 
     int (*init) (LIBSSH2_SESSION * session, int compress, void **abstract);
     int (*comp) (LIBSSH2_SESSION * session, int compress, unsigned char **dest,
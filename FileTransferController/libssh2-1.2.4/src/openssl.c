@@ -167,12 +167,63 @@ _libssh2_dsa_sha1_verify(libssh2_dsa_ctx * dsactx,
     return (ret == 1) ? 0 : -1;
 }
 
+#if LIBSSH2_AES_GCM
+#define GCM_TAG_LEN 16
+
+/* cipher_crypt_gcm
+ * Encrypts or decrypts a whole packet as in RFC 5647: the packet length,
+ * which is also the length of the data, is the additional authenticated
+ * data, the tag follows the data and the nonce is incremented every time
+ */
+static int
+cipher_crypt_gcm(_libssh2_cipher_ctx * ctx, int encrypt,
+                 unsigned char *block, size_t blocksize)
+{
+    unsigned char aad[4];
+    unsigned char lastiv[1];
+
+    _libssh2_htonu32(aad, blocksize);
+
+    if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_IV_GEN, 1, lastiv))
+        return 1;
+    if (!encrypt &&
+        !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, GCM_TAG_LEN,
+                             block + blocksize))
+        return 1;
+
+    if ((EVP_Cipher(ctx, NULL, aad, sizeof(aad)) < 0) ||
+        (EVP_Cipher(ctx, block, block, blocksize) < 0) ||
+        (EVP_Cipher(ctx, NULL, NULL, 0) < 0))
+        return 1; /* authentication failure when decrypting */
+
+    if (encrypt &&
+        !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, GCM_TAG_LEN,
+                             block + blocksize))
+        return 1;
+
+    return 0;
+}
+#endif /* LIBSSH2_AES_GCM */
+
 int
 _libssh2_cipher_init(_libssh2_cipher_ctx * h,
                      _libssh2_cipher_type(algo),
                      unsigned char *iv, unsigned char *secret, int encrypt)
 {
     EVP_CIPHER_CTX_init(h);
+#if LIBSSH2_AES_GCM
+    if (EVP_CIPHER_mode(algo()) == EVP_CIPH_GCM_MODE) {
+        /* The whole IV is fixed, its last 8 bytes being then incremented
+           for each packet by cipher_crypt_gcm() */
+        if (!EVP_CipherInit(h, algo(), NULL, NULL, encrypt) ||
+            !EVP_CIPHER_CTX_ctrl(h, EVP_CTRL_GCM_SET_IV_FIXED, -1, iv) ||
+            !EVP_CipherInit(h, NULL, secret, NULL, -1)) {
+            EVP_CIPHER_CTX_cleanup(h);
+            return 1;
+        }
+        return 0;
+    }
+#endif
     EVP_CipherInit(h, algo(), secret, iv, encrypt);
     return 0;
 }
@@ -180,26 +231,21 @@ _libssh2_cipher_init(_libssh2_cipher_ctx * h,
 int
 _libssh2_cipher_crypt(_libssh2_cipher_ctx * ctx,
                       _libssh2_cipher_type(algo),
-                      int encrypt, unsigned char *block)
+                      int encrypt, unsigned char *block, size_t blocksize)
 {
-    int blocksize = ctx->cipher->block_size;
-    unsigned char buf[EVP_MAX_BLOCK_LENGTH];
-    int ret;
     (void) algo;
-    (void) encrypt;
 
-    if (blocksize == 1) {
-/* Hack for arcfour. */
-        blocksize = 8;
-    }
-    ret = EVP_Cipher(ctx, buf, block, blocksize);
-    if (ret == 1) {
-        memcpy(block, buf, blocksize);
-    }
-    return ret == 1 ? 0 : 1;
+#if LIBSSH2_AES_GCM
+    if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_GCM_MODE)
+        return cipher_crypt_gcm(ctx, encrypt, block, blocksize);
+#endif
+
+    /* EVP_Cipher() supports in place operation so all the blocks are
+       processed with a single call */
+    return EVP_Cipher(ctx, block, block, blocksize) == 1 ? 0 : 1;
 }
 
-#if LIBSSH2_AES_CTR
+#if LIBSSH2_AES_CTR && !LIBSSH2_AES_EVP_CTR
 #include <openssl/aes.h>
 
 typedef struct
@@ -235,7 +281,7 @@ aes_ctr_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
     unsigned char b1[AES_BLOCK_SIZE];
     size_t i;
 
-    if (inl != 16) /* libssh2 only ever encrypt one block */
+    if (inl % AES_BLOCK_SIZE) /* libssh2 only ever encrypt whole blocks */
 	return 0;
 
 /*
@@ -245,16 +291,18 @@ aes_ctr_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
   the ciphertext block C1.  The counter X is then incremented
 */
 
-    AES_encrypt(c->ctr, b1, &c->key);
+    for (; inl; inl -= AES_BLOCK_SIZE) {
+	AES_encrypt(c->ctr, b1, &c->key);
 
-    for (i = 0; i < 16; i++)
-	*out++ = *in++ ^ b1[i];
+	for (i = 0; i < AES_BLOCK_SIZE; i++)
+	    *out++ = *in++ ^ b1[i];
 
-    i = 15;
-    while (c->ctr[i]++ == 0xFF) {
-	if (i == 0)
-	    break;
-	i--;
+	i = AES_BLOCK_SIZE - 1;
+	while (c->ctr[i]++ == 0xFF) {
+	    if (i == 0)
+		break;
+	    i--;
+	}
     }
 
     return 1;
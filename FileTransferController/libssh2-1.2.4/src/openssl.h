@@ -79,6 +79,28 @@
 # define LIBSSH2_AES 0
 #endif
 
+/* OpenSSL 1.0.1 provides CTR and GCM modes through EVP, which use AES-NI
+   when the CPU supports it */
+#if OPENSSL_VERSION_NUMBER >= 0x10001000L && !defined(OPENSSL_NO_AES)
+# define LIBSSH2_AES_EVP_CTR 1
+# define LIBSSH2_AES_GCM 1
+#else
+# define LIBSSH2_AES_EVP_CTR 0
+# define LIBSSH2_AES_GCM 0
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x00908000L && !defined(OPENSSL_NO_SHA256)
+# define LIBSSH2_HMAC_SHA256 1
+#else
+# define LIBSSH2_HMAC_SHA256 0
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x00908000L && !defined(OPENSSL_NO_SHA512)
+# define LIBSSH2_HMAC_SHA512 1
+#else
+# define LIBSSH2_HMAC_SHA512 0
+#endif
+
 #ifdef OPENSSL_NO_BLOWFISH
 # define LIBSSH2_BLOWFISH 0
 #else
@@ -124,6 +146,10 @@
   HMAC_Init(ctx, key, keylen, EVP_md5())
 #define libssh2_hmac_ripemd160_init(ctx, key, keylen) \
   HMAC_Init(ctx, key, keylen, EVP_ripemd160())
+#define libssh2_hmac_sha256_init(ctx, key, keylen) \
+  HMAC_Init(ctx, key, keylen, EVP_sha256())
+#define libssh2_hmac_sha512_init(ctx, key, keylen) \
+  HMAC_Init(ctx, key, keylen, EVP_sha512())
 #define libssh2_hmac_update(ctx, data, datalen) \
   HMAC_Update(&(ctx), data, datalen)
 #define libssh2_hmac_final(ctx, data) HMAC_Final(&(ctx), data, NULL)
@@ -197,9 +223,17 @@ int _libssh2_dsa_sha1_sign(libssh2_dsa_ctx * dsactx,
 #define _libssh2_cipher_aes256 EVP_aes_256_cbc
 #define _libssh2_cipher_aes192 EVP_aes_192_cbc
 #define _libssh2_cipher_aes128 EVP_aes_128_cbc
+#if LIBSSH2_AES_EVP_CTR
+#define _libssh2_cipher_aes128ctr EVP_aes_128_ctr
+#define _libssh2_cipher_aes192ctr EVP_aes_192_ctr
+#define _libssh2_cipher_aes256ctr EVP_aes_256_ctr
+#else
 #define _libssh2_cipher_aes128ctr _libssh2_EVP_aes_128_ctr
 #define _libssh2_cipher_aes192ctr _libssh2_EVP_aes_192_ctr
 #define _libssh2_cipher_aes256ctr _libssh2_EVP_aes_256_ctr
+#endif
+#define _libssh2_cipher_aes128gcm EVP_aes_128_gcm
+#define _libssh2_cipher_aes256gcm EVP_aes_256_gcm
 #define _libssh2_cipher_blowfish EVP_bf_cbc
 #define _libssh2_cipher_arcfour EVP_rc4
 #define _libssh2_cipher_cast5 EVP_cast5_cbc
@@ -212,7 +246,8 @@ int _libssh2_cipher_init(_libssh2_cipher_ctx * h,
 
 int _libssh2_cipher_crypt(_libssh2_cipher_ctx * ctx,
                           _libssh2_cipher_type(algo),
-                          int encrypt, unsigned char *block);
+                          int encrypt, unsigned char *block,
+                          size_t blocksize);
 
 #define _libssh2_cipher_dtor(ctx) EVP_CIPHER_CTX_cleanup(ctx)
 
@@ -730,6 +730,9 @@ _libssh2_packet_add(LIBSSH2_SESSION * session, unsigned char *data,
                 /* Now that we've received it, shrink our window */
                 session->packAdd_channel->remote.window_size -=
                     datalen - session->packAdd_data_head;
+                _libssh2_channel_window_received(session->packAdd_channel,
+                                                 datalen -
+                                                 session->packAdd_data_head);
             }
 
             break;
@@ -905,7 +908,14 @@ _libssh2_packet_add(LIBSSH2_SESSION * session, unsigned char *data,
         packAdd_packet->data_head = session->packAdd_data_head;
         packAdd_packet->mac = macstate;
 
-        _libssh2_list_add(&session->packets, &packAdd_packet->node);
+        /* Queue channel data on its channel so reading a channel does not
+           walk the packets of all the others */
+        if ((data[0] == SSH_MSG_CHANNEL_DATA)
+            || (data[0] == SSH_MSG_CHANNEL_EXTENDED_DATA))
+            _libssh2_list_add(&session->packAdd_channel->data_packets,
+                              &packAdd_packet->node);
+        else
+            _libssh2_list_add(&session->packets, &packAdd_packet->node);
 
         session->packAdd_state = libssh2_NB_state_sent1;
     }
@@ -456,6 +456,7 @@ libssh2_session_init_ex(LIBSSH2_ALLOC_FUNC((*my_alloc)),
         session->realloc = local_realloc;
         session->abstract = abstract;
         session->api_block_mode = 1; /* blocking API by default */
+        session->comp_level = LIBSSH2_COMPRESSION_DEFAULT_LEVEL;
         _libssh2_debug(session, LIBSSH2_TRACE_TRANS,
                        "New session resource allocated");
         libssh2_crypto_init();
@@ -797,6 +798,11 @@ session_free(LIBSSH2_SESSION *session)
         LIBSSH2_FREE(session, session->local.banner);
     }
 
+    /* Free the outgoing packet buffer */
+    if (session->packet.outbuf) {
+        LIBSSH2_FREE(session, session->packet.outbuf);
+    }
+
     /* Free preference(s) */
     if (session->kex_prefs) {
         LIBSSH2_FREE(session, session->kex_prefs);
@@ -1196,6 +1202,50 @@ libssh2_session_flag(LIBSSH2_SESSION * session, int flag, int value)
     return session->flags;
 }
 
+/* libssh2_session_compression
+ *
+ * Set the zlib level and strategy used to compress outgoing packets if
+ * compression is negotiated, which only applies to the following key
+ * exchanges. In adaptive mode packets are no longer compressed for a while
+ * as soon as one does not shrink (e.g. when sending already compressed
+ * data).
+ */
+LIBSSH2_API int
+libssh2_session_compression(LIBSSH2_SESSION * session, int level,
+                            int strategy, int flags)
+{
+    if ((level < LIBSSH2_COMPRESSION_DEFAULT_LEVEL) || (level > 9)) {
+        libssh2_error(session, LIBSSH2_ERROR_INVAL,
+                      (char *) "Invalid compression level", 0);
+        return -1;
+    }
+
+    session->comp_level = level;
+    session->comp_strategy = strategy;
+    session->comp_flags = flags;
+
+    return 0;
+}
+
+/* libssh2_session_compression_stats
+ *
+ * Return how many bytes of outgoing payloads were passed to the compressor
+ * and how many came out of it, the ratio of which is the achieved
+ * compression
+ */
+LIBSSH2_API int
+libssh2_session_compression_stats(LIBSSH2_SESSION * session,
+                                  libssh2_uint64_t *raw,
+                                  libssh2_uint64_t *compressed)
+{
+    if (raw)
+        *raw = session->comp_raw_bytes;
+    if (compressed)
+        *compressed = session->comp_compressed_bytes;
+
+    return 0;
+}
+
 /* _libssh2_session_set_blocking
  *
  * Set a session's blocking mode on or off, return the previous status when
@@ -1243,8 +1293,7 @@ libssh2_session_get_blocking(LIBSSH2_SESSION * session)
 LIBSSH2_API int
 libssh2_poll_channel_read(LIBSSH2_CHANNEL * channel, int extended)
 {
-    LIBSSH2_SESSION *session = channel->session;
-    LIBSSH2_PACKET *packet = _libssh2_list_first(&session->packets);
+    LIBSSH2_PACKET *packet = _libssh2_list_first(&channel->data_packets);
 
     while (packet) {
         if ( channel->local.id == _libssh2_ntohu32(packet->data + 1)) {
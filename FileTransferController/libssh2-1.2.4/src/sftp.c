@@ -106,6 +106,22 @@ _libssh2_htonu64(unsigned char *buf, libssh2_uint64_t value)
     buf[7] = (unsigned char)( value        & 0xFF);
 }
 
+/*
+ * sftp_packet_bucket
+ *
+ * Returns the bucket of the packet hash table for an SFTP packet: responses
+ * are hashed by request ID while FXP_VERSION, which has none, goes to the
+ * first bucket
+ */
+static unsigned int
+sftp_packet_bucket(const unsigned char *data, unsigned long data_len)
+{
+    if ((data[0] == SSH_FXP_VERSION) || (data_len < 5))
+        return 0;
+
+    return _libssh2_ntohu32(data + 1) % SFTP_PACKET_BUCKETS;
+}
+
 /*
  * sftp_packet_add
  *
@@ -132,7 +148,8 @@ sftp_packet_add(LIBSSH2_SFTP *sftp, unsigned char *data,
     packet->data_len = data_len;
     packet->data_head = 5;
 
-    _libssh2_list_add(&sftp->packets, &packet->node);
+    _libssh2_list_add(&sftp->packets[sftp_packet_bucket(data, data_len)],
+                      &packet->node);
 
     return 0;
 }
@@ -247,7 +264,7 @@ sftp_packet_ask(LIBSSH2_SFTP *sftp, unsigned char packet_type,
                 unsigned long *data_len)
 {
     LIBSSH2_SESSION *session = sftp->channel->session;
-    LIBSSH2_PACKET *packet = _libssh2_list_first(&sftp->packets);
+    LIBSSH2_PACKET *packet;
     unsigned char match_buf[5];
     int match_len;
 
@@ -263,6 +280,9 @@ sftp_packet_ask(LIBSSH2_SFTP *sftp, unsigned char packet_type,
         _libssh2_htonu32(match_buf + 1, request_id);
     }
 
+    /* Only the packets with the same hash can match */
+    packet = _libssh2_list_first(&sftp->packets[sftp_packet_bucket(match_buf,
+                                                                   match_len)]);
     while (packet) {
         if (!memcmp((char *) packet->data, (char *) match_buf, match_len)) {
 
@@ -778,6 +798,10 @@ sftp_shutdown(LIBSSH2_SFTP *sftp)
         LIBSSH2_FREE(session, sftp->stat_packet);
         sftp->stat_packet = NULL;
     }
+    if (sftp->statbatch_packet) {
+        LIBSSH2_FREE(session, sftp->statbatch_packet);
+        sftp->statbatch_packet = NULL;
+    }
     if (sftp->symlink_packet) {
         LIBSSH2_FREE(session, sftp->symlink_packet);
         sftp->symlink_packet = NULL;
@@ -997,6 +1021,362 @@ libssh2_sftp_open_ex(LIBSSH2_SFTP *sftp, const char *filename,
     return hnd;
 }
 
+/* Amount of data asked by a single pipelined FXP_READ or carried by a single
+   pipelined FXP_WRITE: the response to a FXP_READ must fit in
+   LIBSSH2_SFTP_PACKET_MAXLEN */
+#define SFTP_PIPELINE_CHUNK 32768
+
+/* sftp_pipeline_send
+ * Sends the request pending on a pipelined file handle and adds it to the
+ * requests in flight
+ */
+static int sftp_pipeline_send(LIBSSH2_SFTP_HANDLE *handle)
+{
+    struct _libssh2_sftp_handle_file_data *file = &handle->u.file;
+    LIBSSH2_SFTP *sftp = handle->sftp;
+    LIBSSH2_SESSION *session = sftp->channel->session;
+    int rc;
+
+    while (file->send_sent < file->send_len) {
+        rc = _libssh2_channel_write(sftp->channel, 0,
+                                    (char *) file->send_packet +
+                                    file->send_sent,
+                                    file->send_len - file->send_sent);
+        if (rc == PACKET_EAGAIN) {
+            return rc;
+        } else if (rc == 0) {
+            /* The channel window is full: wait for the server to adjust it */
+            return PACKET_EAGAIN;
+        } else if (rc < 0) {
+            if (file->send_packet != handle->request_packet)
+                LIBSSH2_FREE(session, file->send_packet);
+            file->send_packet = NULL;
+            return rc;
+        }
+        file->send_sent += rc;
+    }
+
+    file->pipeline[(file->pipeline_first + file->pipeline_count) %
+                   LIBSSH2_SFTP_PIPELINE_MAX] = file->send_request;
+    file->pipeline_count++;
+    if (file->send_request.type == SSH_FXP_WRITE) {
+        LIBSSH2_FREE(session, file->send_packet);
+        file->offset += file->send_request.length;
+    }
+    file->send_packet = NULL;
+
+    return 0;
+}
+
+/* sftp_pipeline_collect
+ * Waits for the response to the oldest request in flight on a pipelined file
+ * handle. FXP_WRITE acknowledgements are checked here while FXP_READ responses
+ * are returned in "data" and must be freed by the caller.
+ */
+static int sftp_pipeline_collect(LIBSSH2_SFTP_HANDLE *handle,
+                                 struct _libssh2_sftp_request *request,
+                                 unsigned char **data,
+                                 unsigned long *data_len)
+{
+    struct _libssh2_sftp_handle_file_data *file = &handle->u.file;
+    LIBSSH2_SFTP *sftp = handle->sftp;
+    LIBSSH2_SESSION *session = sftp->channel->session;
+    struct _libssh2_sftp_request *first = &file->pipeline[file->pipeline_first];
+    static const unsigned char read_responses[2] =
+        { SSH_FXP_DATA, SSH_FXP_STATUS };
+    unsigned long retcode;
+    int rc;
+
+    /* Responses can arrive in any order: the ones to later requests wait in
+       the packet brigade until these requests are collected */
+    if (first->type == SSH_FXP_READ)
+        rc = sftp_packet_requirev(sftp, 2, read_responses, first->request_id,
+                                  data, data_len);
+    else
+        rc = sftp_packet_require(sftp, SSH_FXP_STATUS, first->request_id,
+                                 data, data_len);
+    if (rc == PACKET_EAGAIN) {
+        return rc;
+    }
+
+    *request = *first;
+    file->pipeline_first = (file->pipeline_first + 1) %
+        LIBSSH2_SFTP_PIPELINE_MAX;
+    file->pipeline_count--;
+    if (rc) {
+        libssh2_error(session, rc, "Timeout waiting for status message", 0);
+        return -1;
+    }
+
+    if (request->type == SSH_FXP_WRITE) {
+        retcode = _libssh2_ntohu32(*data + 5);
+        LIBSSH2_FREE(session, *data);
+        *data = NULL;
+        if (retcode != LIBSSH2_FX_OK) {
+            sftp->last_errno = retcode;
+            libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL,
+                          "SFTP Protocol Error", 0);
+            return LIBSSH2_ERROR_SFTP_PROTOCOL;
+        }
+    }
+
+    return 0;
+}
+
+/* sftp_pipeline_flush
+ * Waits for the responses to all the requests in flight on a pipelined file
+ * handle and returns the first error if any
+ */
+static int sftp_pipeline_flush(LIBSSH2_SFTP_HANDLE *handle)
+{
+    struct _libssh2_sftp_handle_file_data *file = &handle->u.file;
+    LIBSSH2_SESSION *session = handle->sftp->channel->session;
+    struct _libssh2_sftp_request request;
+    unsigned char *data;
+    unsigned long data_len;
+    int rc, error = 0;
+
+    if (file->send_packet) {
+        rc = sftp_pipeline_send(handle);
+        if (rc == PACKET_EAGAIN) {
+            return rc;
+        } else if (rc) {
+            error = rc;
+        }
+    }
+
+    while (file->pipeline_count) {
+        data = NULL;
+        rc = sftp_pipeline_collect(handle, &request, &data, &data_len);
+        if (rc == PACKET_EAGAIN) {
+            return rc;
+        } else if (rc && !error) {
+            error = rc;
+        }
+        if (data) {
+            LIBSSH2_FREE(session, data);
+        }
+    }
+
+    return error;
+}
+
+/* sftp_pipeline_fill
+ * Sends FXP_READ requests for the next chunks of a pipelined file handle until
+ * the pipeline is full
+ */
+static int sftp_pipeline_fill(LIBSSH2_SFTP_HANDLE *handle)
+{
+    struct _libssh2_sftp_handle_file_data *file = &handle->u.file;
+    LIBSSH2_SFTP *sftp = handle->sftp;
+    unsigned char *s;
+    int rc;
+
+    while (1) {
+        if (!file->send_packet) {
+            if (file->read_eof || (file->pipeline_count >= file->pipeline_depth))
+                return 0;
+
+            file->send_request.type = SSH_FXP_READ;
+            file->send_request.request_id = sftp->request_id++;
+            file->send_request.offset = file->read_offset;
+            file->send_request.length = SFTP_PIPELINE_CHUNK;
+            file->read_offset += SFTP_PIPELINE_CHUNK;
+
+            /* 25 = packet_len(4) + packet_type(1) + request_id(4) +
+               handle_len(4) + offset(8) + length(4) */
+            s = file->send_packet = handle->request_packet;
+            file->send_len = handle->handle_len + 25;
+            file->send_sent = 0;
+            _libssh2_htonu32(s, file->send_len - 4);
+            s += 4;
+            *(s++) = SSH_FXP_READ;
+            _libssh2_htonu32(s, file->send_request.request_id);
+            s += 4;
+            _libssh2_htonu32(s, handle->handle_len);
+            s += 4;
+            memcpy(s, handle->handle, handle->handle_len);
+            s += handle->handle_len;
+            _libssh2_htonu64(s, file->send_request.offset);
+            s += 8;
+            _libssh2_htonu32(s, file->send_request.length);
+        }
+
+        rc = sftp_pipeline_send(handle);
+        if (rc) {
+            return rc;
+        }
+    }
+}
+
+/* sftp_pipeline_read
+ * Read from a pipelined SFTP file handle
+ */
+static ssize_t sftp_pipeline_read(LIBSSH2_SFTP_HANDLE *handle, char *buffer,
+                                  size_t buffer_maxlen)
+{
+    struct _libssh2_sftp_handle_file_data *file = &handle->u.file;
+    LIBSSH2_SFTP *sftp = handle->sftp;
+    LIBSSH2_SESSION *session = sftp->channel->session;
+    struct _libssh2_sftp_request request;
+    unsigned char *data;
+    unsigned long data_len, retcode;
+    size_t bytes_read, total_read = 0;
+    int rc;
+
+    while (total_read < buffer_maxlen) {
+        if (file->data) {
+            bytes_read = file->data_end - file->data_pos;
+            if (bytes_read > buffer_maxlen - total_read)
+                bytes_read = buffer_maxlen - total_read;
+            memcpy(buffer + total_read, file->data + file->data_pos,
+                   bytes_read);
+            file->data_pos += bytes_read;
+            file->offset += bytes_read;
+            total_read += bytes_read;
+            if (file->data_pos == file->data_end) {
+                LIBSSH2_FREE(session, file->data);
+                file->data = NULL;
+            }
+            continue;
+        }
+        if (file->read_eof)
+            break;
+
+        rc = sftp_pipeline_fill(handle);
+        if ((rc == PACKET_EAGAIN) && !file->pipeline_count) {
+            return total_read ? (ssize_t) total_read : rc;
+        } else if (rc && (rc != PACKET_EAGAIN)) {
+            return rc;
+        }
+
+        data = NULL;
+        rc = sftp_pipeline_collect(handle, &request, &data, &data_len);
+        if (rc == PACKET_EAGAIN) {
+            libssh2_error(session, rc,
+                          "Would block waiting for status message", 0);
+            return total_read ? (ssize_t) total_read : rc;
+        } else if (rc) {
+            return rc;
+        }
+        if (request.type != SSH_FXP_READ)
+            continue;
+
+        /* Responses to requests sent before a short read, the end of the file
+           or a seek do not match the current offset and are dropped */
+        if (request.offset != file->offset) {
+            LIBSSH2_FREE(session, data);
+            continue;
+        }
+
+        switch (data[0]) {
+        case SSH_FXP_STATUS:
+            retcode = _libssh2_ntohu32(data + 5);
+            LIBSSH2_FREE(session, data);
+
+            if (retcode == LIBSSH2_FX_EOF) {
+                file->read_eof = 1;
+                return total_read;
+            } else {
+                sftp->last_errno = retcode;
+                libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL,
+                              "SFTP Protocol Error", 0);
+                return -1;
+            }
+
+        case SSH_FXP_DATA:
+            bytes_read = _libssh2_ntohu32(data + 5);
+            if (bytes_read > (data_len - 9)) {
+                LIBSSH2_FREE(session, data);
+                return -1;
+            }
+            /* The server returned less than asked: request the rest again */
+            if (bytes_read < request.length)
+                file->read_offset = request.offset + bytes_read;
+            if (bytes_read) {
+                file->data = data;
+                file->data_pos = 9;
+                file->data_end = 9 + bytes_read;
+            } else {
+                LIBSSH2_FREE(session, data);
+            }
+        }
+    }
+
+    return total_read;
+}
+
+/* sftp_pipeline_write
+ * Write data to a pipelined SFTP file handle. Returns the number of bytes
+ * sent, or a negative error code.
+ */
+static ssize_t sftp_pipeline_write(LIBSSH2_SFTP_HANDLE *handle,
+                                   const char *buffer, size_t count)
+{
+    struct _libssh2_sftp_handle_file_data *file = &handle->u.file;
+    LIBSSH2_SFTP *sftp = handle->sftp;
+    LIBSSH2_SESSION *session = sftp->channel->session;
+    struct _libssh2_sftp_request request;
+    unsigned char *s, *data;
+    unsigned long data_len;
+    int rc;
+
+    /* A previous call returned LIBSSH2_ERROR_EAGAIN while sending: the
+       caller is passing the same data again */
+    if (file->send_packet) {
+        request = file->send_request;
+        rc = sftp_pipeline_send(handle);
+        return rc ? rc : (ssize_t) request.length;
+    }
+
+    while (file->pipeline_count >= file->pipeline_depth) {
+        data = NULL;
+        rc = sftp_pipeline_collect(handle, &request, &data, &data_len);
+        if (data) {
+            LIBSSH2_FREE(session, data);
+        }
+        if (rc) {
+            return rc;
+        }
+    }
+
+    if (count > SFTP_PIPELINE_CHUNK)
+        count = SFTP_PIPELINE_CHUNK;
+
+    /* 25 = packet_len(4) + packet_type(1) + request_id(4) + handle_len(4) +
+       offset(8) + count(4) */
+    file->send_len = handle->handle_len + count + 25;
+    s = file->send_packet = LIBSSH2_ALLOC(session, file->send_len);
+    if (!file->send_packet) {
+        libssh2_error(session, LIBSSH2_ERROR_ALLOC,
+                      "Unable to allocate memory for FXP_WRITE", 0);
+        return LIBSSH2_ERROR_ALLOC;
+    }
+    file->send_sent = 0;
+    file->send_request.type = SSH_FXP_WRITE;
+    file->send_request.request_id = sftp->request_id++;
+    file->send_request.offset = file->offset;
+    file->send_request.length = count;
+
+    _libssh2_htonu32(s, file->send_len - 4);
+    s += 4;
+    *(s++) = SSH_FXP_WRITE;
+    _libssh2_htonu32(s, file->send_request.request_id);
+    s += 4;
+    _libssh2_htonu32(s, handle->handle_len);
+    s += 4;
+    memcpy(s, handle->handle, handle->handle_len);
+    s += handle->handle_len;
+    _libssh2_htonu64(s, file->offset);
+    s += 8;
+    _libssh2_htonu32(s, count);
+    s += 4;
+    memcpy(s, buffer, count);
+
+    rc = sftp_pipeline_send(handle);
+    return rc ? rc : (ssize_t) count;
+}
+
 /* sftp_read
  * Read from an SFTP file handle
  */
@@ -1018,6 +1398,9 @@ static ssize_t sftp_read(LIBSSH2_SFTP_HANDLE * handle, char *buffer,
     size_t total_read = 0;
     int retcode;
 
+    if (handle->u.file.pipeline_depth > 1)
+        return sftp_pipeline_read(handle, buffer, buffer_maxlen);
+
     if (sftp->read_state == libssh2_NB_state_idle) {
         _libssh2_debug(session, LIBSSH2_TRACE_SFTP,
                        "Reading %lu bytes from SFTP handle",
@@ -1186,6 +1569,110 @@ libssh2_sftp_read(LIBSSH2_SFTP_HANDLE *hnd, char *buffer,
     return rc;
 }
 
+/* sftp_readdir_fetch
+ * Keeps up to the pipeline depth FXP_READDIR requests in flight on a directory
+ * handle and returns the FXP_NAME response to the oldest one in "data". Returns
+ * 1 on success and 0 at the end of the directory, once all the requests in
+ * flight have been collected.
+ */
+static int sftp_readdir_fetch(LIBSSH2_SFTP_HANDLE *handle,
+                              unsigned char **data, unsigned long *data_len)
+{
+    struct _libssh2_sftp_handle_dir_data *dir = &handle->u.dir;
+    LIBSSH2_SFTP *sftp = handle->sftp;
+    LIBSSH2_CHANNEL *channel = sftp->channel;
+    LIBSSH2_SESSION *session = channel->session;
+    /* 13 = packet_len(4) + packet_type(1) + request_id(4) + handle_len(4) */
+    size_t packet_len = handle->handle_len + 13;
+    static const unsigned char read_responses[2] =
+        { SSH_FXP_NAME, SSH_FXP_STATUS };
+    unsigned char *s;
+    unsigned long retcode;
+    int rc;
+
+    for (;;) {
+        /* A partially sent request must be completed even after the end */
+        while (dir->send_sent ||
+               (!dir->eof && (dir->pipeline_count < dir->pipeline_depth))) {
+            if (dir->send_sent == 0) {
+                s = handle->request_packet;
+                _libssh2_htonu32(s, packet_len - 4);
+                s += 4;
+                *(s++) = SSH_FXP_READDIR;
+                dir->send_request_id = sftp->request_id++;
+                _libssh2_htonu32(s, dir->send_request_id);
+                s += 4;
+                _libssh2_htonu32(s, handle->handle_len);
+                s += 4;
+                memcpy(s, handle->handle, handle->handle_len);
+            }
+
+            rc = _libssh2_channel_write(channel, 0,
+                                        (char *) handle->request_packet +
+                                        dir->send_sent,
+                                        packet_len - dir->send_sent);
+            if ((rc == PACKET_EAGAIN) || (rc == 0)) {
+                /* Collect responses while the request cannot be sent */
+                if (dir->pipeline_count)
+                    break;
+                return PACKET_EAGAIN;
+            } else if (rc < 0) {
+                libssh2_error(session, LIBSSH2_ERROR_SOCKET_SEND,
+                              "_libssh2_channel_write() failed", 0);
+                dir->send_sent = 0;
+                dir->eof = 1;
+                return -1;
+            }
+            dir->send_sent += rc;
+            if (dir->send_sent < packet_len)
+                continue;
+
+            dir->pipeline[(dir->pipeline_first + dir->pipeline_count) %
+                          LIBSSH2_SFTP_PIPELINE_MAX] = dir->send_request_id;
+            dir->pipeline_count++;
+            dir->send_sent = 0;
+        }
+
+        if (!dir->pipeline_count) {
+            return 0;
+        }
+
+        rc = sftp_packet_requirev(sftp, 2, read_responses,
+                                  dir->pipeline[dir->pipeline_first], data,
+                                  data_len);
+        if (rc == PACKET_EAGAIN) {
+            return rc;
+        }
+        dir->pipeline_first = (dir->pipeline_first + 1) %
+            LIBSSH2_SFTP_PIPELINE_MAX;
+        dir->pipeline_count--;
+        if (rc) {
+            libssh2_error(session, LIBSSH2_ERROR_SOCKET_TIMEOUT,
+                          "Timeout waiting for status message", 0);
+            return -1;
+        }
+
+        if ((*data)[0] == SSH_FXP_NAME) {
+            return 1;
+        }
+
+        /* The server answers the requests in order so the ones sent after
+           the end of the directory or a failure get the same status: stop
+           sending and only collect them */
+        retcode = _libssh2_ntohu32(*data + 5);
+        LIBSSH2_FREE(session, *data);
+        *data = NULL;
+        if (!dir->eof && (retcode != LIBSSH2_FX_EOF)) {
+            dir->eof = 1;
+            sftp->last_errno = retcode;
+            libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL,
+                          "SFTP Protocol Error", 0);
+            return -1;
+        }
+        dir->eof = 1;
+    }
+}
+
 /* sftp_readdir
  * Read from an SFTP directory handle
  */
@@ -1263,6 +1750,14 @@ static int sftp_readdir(LIBSSH2_SFTP_HANDLE *handle, char *buffer,
             return filename_len;
         }
 
+        if (handle->u.dir.pipeline_depth > 1) {
+            retcode = sftp_readdir_fetch(handle, &data, &data_len);
+            if (retcode <= 0) {
+                return retcode;
+            }
+            goto names;
+        }
+
         /* Request another entry(entries?) */
 
         s = sftp->readdir_packet = LIBSSH2_ALLOC(session, packet_len);
@@ -1339,6 +1834,7 @@ static int sftp_readdir(LIBSSH2_SFTP_HANDLE *handle, char *buffer,
         }
     }
 
+  names:
     num_names = _libssh2_ntohu32(data + 5);
     _libssh2_debug(session, LIBSSH2_TRACE_SFTP, "%lu entries returned",
                    num_names);
@@ -1421,6 +1917,9 @@ static ssize_t sftp_write(LIBSSH2_SFTP_HANDLE *handle, const char *buffer,
     unsigned char *s, *data;
     int rc;
 
+    if (handle->u.file.pipeline_depth > 1)
+        return sftp_pipeline_write(handle, buffer, count);
+
     /* There's no point in us accepting a VERY large packet here since we
        cannot send it anyway. We just accept 4 times the big size to fill up
        the queue somewhat. */
@@ -1642,7 +2141,7 @@ libssh2_sftp_fstat_ex(LIBSSH2_SFTP_HANDLE * hnd,
 LIBSSH2_API void
 libssh2_sftp_seek(LIBSSH2_SFTP_HANDLE * handle, size_t offset)
 {
-    handle->u.file.offset = offset;
+    libssh2_sftp_seek64(handle, offset);
 }
 
 /* libssh2_sftp_seek64
@@ -1651,7 +2150,17 @@ libssh2_sftp_seek(LIBSSH2_SFTP_HANDLE * handle, size_t offset)
 LIBSSH2_API void
 libssh2_sftp_seek64(LIBSSH2_SFTP_HANDLE * handle, libssh2_uint64_t offset)
 {
-    handle->u.file.offset = offset;
+    struct _libssh2_sftp_handle_file_data *file = &handle->u.file;
+
+    file->offset = offset;
+
+    /* Pipelined reads start over from the new offset */
+    if (file->data) {
+        LIBSSH2_FREE(handle->sftp->channel->session, file->data);
+        file->data = NULL;
+    }
+    file->read_offset = offset;
+    file->read_eof = 0;
 }
 
 /* libssh2_sftp_tell
@@ -1675,6 +2184,33 @@ libssh2_sftp_tell64(LIBSSH2_SFTP_HANDLE * handle)
     return handle->u.file.offset;
 }
 
+/* libssh2_sftp_pipeline
+ * Set the maximum number of requests in flight on a file handle
+ */
+LIBSSH2_API void
+libssh2_sftp_pipeline(LIBSSH2_SFTP_HANDLE *handle, unsigned int depth)
+{
+    if (depth > LIBSSH2_SFTP_PIPELINE_MAX)
+        depth = LIBSSH2_SFTP_PIPELINE_MAX;
+    if (handle->handle_type == LIBSSH2_SFTP_HANDLE_DIR) {
+        handle->u.dir.pipeline_depth = depth;
+        return;
+    }
+    handle->u.file.pipeline_depth = depth;
+    handle->u.file.read_offset = handle->u.file.offset;
+}
+
+/* libssh2_sftp_flush
+ * Wait for all the requests in flight on a pipelined file handle
+ */
+LIBSSH2_API int
+libssh2_sftp_flush(LIBSSH2_SFTP_HANDLE *hnd)
+{
+    int rc;
+    BLOCK_ADJUST(rc, hnd->sftp->channel->session, sftp_pipeline_flush(hnd));
+    return rc;
+}
+
 /* sftp_close_handle
  *
  * Close a file or directory handle
@@ -1692,6 +2228,35 @@ sftp_close_handle(LIBSSH2_SFTP_HANDLE *handle)
     unsigned char *s, *data;
     int rc;
 
+    if ((handle->handle_type == LIBSSH2_SFTP_HANDLE_FILE)
+        && (handle->close_state == libssh2_NB_state_idle)) {
+        /* Collect the responses to the requests still in flight so they do
+           not pile up in the packet brigade - errors were already reported
+           or are reported by libssh2_sftp_flush() */
+        rc = sftp_pipeline_flush(handle);
+        if (rc == PACKET_EAGAIN) {
+            return rc;
+        }
+        if (handle->u.file.data) {
+            LIBSSH2_FREE(session, handle->u.file.data);
+            handle->u.file.data = NULL;
+        }
+    }
+    else if ((handle->handle_type == LIBSSH2_SFTP_HANDLE_DIR)
+             && (handle->close_state == libssh2_NB_state_idle)) {
+        /* Same for the FXP_READDIR requests in flight */
+        handle->u.dir.eof = 1;
+        while (handle->u.dir.pipeline_count || handle->u.dir.send_sent) {
+            rc = sftp_readdir_fetch(handle, &data, &data_len);
+            if (rc == PACKET_EAGAIN) {
+                return rc;
+            }
+            if (rc == 1) {
+                LIBSSH2_FREE(session, data);
+            }
+        }
+    }
+
     if (handle->close_state == libssh2_NB_state_idle) {
         _libssh2_debug(session, LIBSSH2_TRACE_SFTP, "Closing handle");
         s = handle->close_packet = LIBSSH2_ALLOC(session, packet_len);
@@ -2366,6 +2931,147 @@ libssh2_sftp_stat_ex(LIBSSH2_SFTP *sftp, const char *path,
     return rc;
 }
 
+/* sftp_stat_batch
+ * Stat or lstat many paths, sending the next requests while waiting for the
+ * responses
+ */
+static int sftp_stat_batch(LIBSSH2_SFTP *sftp, const char * const *paths,
+                           unsigned int count, int stat_type,
+                           LIBSSH2_SFTP_ATTRIBUTES *attrs,
+                           unsigned long *statuses)
+{
+    LIBSSH2_CHANNEL *channel = sftp->channel;
+    LIBSSH2_SESSION *session = channel->session;
+    unsigned long data_len, path_len;
+    unsigned char *s, *data;
+    static const unsigned char stat_responses[2] =
+        { SSH_FXP_ATTRS, SSH_FXP_STATUS };
+    int rc;
+
+    if (stat_type == LIBSSH2_SFTP_SETSTAT) {
+        libssh2_error(session, LIBSSH2_ERROR_INVAL,
+                      "Batches cannot set attributes", 0);
+        return -1;
+    }
+
+    if (sftp->statbatch_state == libssh2_NB_state_idle) {
+        _libssh2_debug(session, LIBSSH2_TRACE_SFTP, "%s %u paths",
+                       (stat_type == LIBSSH2_SFTP_LSTAT) ? "LStatting" :
+                       "Statting", count);
+        sftp->statbatch_first_id = sftp->request_id;
+        sftp->request_id += count;
+        sftp->statbatch_sent = 0;
+        sftp->statbatch_received = 0;
+        sftp->statbatch_state = libssh2_NB_state_sent;
+    }
+
+    while (sftp->statbatch_received < count) {
+        while ((sftp->statbatch_sent < count) &&
+               (sftp->statbatch_sent - sftp->statbatch_received <
+                LIBSSH2_SFTP_STAT_BATCH_MAX)) {
+            if (!sftp->statbatch_packet) {
+                path_len = strlen(paths[sftp->statbatch_sent]);
+                /* 13 = packet_len(4) + packet_type(1) + request_id(4) +
+                   path_len(4) */
+                sftp->statbatch_packet_len = path_len + 13;
+                s = sftp->statbatch_packet =
+                    LIBSSH2_ALLOC(session, sftp->statbatch_packet_len);
+                if (!sftp->statbatch_packet) {
+                    libssh2_error(session, LIBSSH2_ERROR_ALLOC,
+                                  "Unable to allocate memory for FXP_*STAT "
+                                  "packet", 0);
+                    sftp->statbatch_state = libssh2_NB_state_idle;
+                    return -1;
+                }
+                _libssh2_htonu32(s, sftp->statbatch_packet_len - 4);
+                s += 4;
+                *(s++) = (stat_type == LIBSSH2_SFTP_LSTAT) ? SSH_FXP_LSTAT :
+                    SSH_FXP_STAT;
+                _libssh2_htonu32(s, sftp->statbatch_first_id +
+                                 sftp->statbatch_sent);
+                s += 4;
+                _libssh2_htonu32(s, path_len);
+                s += 4;
+                memcpy(s, paths[sftp->statbatch_sent], path_len);
+                sftp->statbatch_packet_sent = 0;
+            }
+
+            rc = _libssh2_channel_write(channel, 0,
+                                        (char *) sftp->statbatch_packet +
+                                        sftp->statbatch_packet_sent,
+                                        sftp->statbatch_packet_len -
+                                        sftp->statbatch_packet_sent);
+            if ((rc == PACKET_EAGAIN) || (rc == 0)) {
+                /* Collect responses while the request cannot be sent */
+                if (sftp->statbatch_sent > sftp->statbatch_received)
+                    break;
+                return PACKET_EAGAIN;
+            } else if (rc < 0) {
+                libssh2_error(session, LIBSSH2_ERROR_SOCKET_SEND,
+                              "Unable to send STAT/LSTAT command", 0);
+                LIBSSH2_FREE(session, sftp->statbatch_packet);
+                sftp->statbatch_packet = NULL;
+                sftp->statbatch_state = libssh2_NB_state_idle;
+                return -1;
+            }
+            sftp->statbatch_packet_sent += rc;
+            if (sftp->statbatch_packet_sent == sftp->statbatch_packet_len) {
+                LIBSSH2_FREE(session, sftp->statbatch_packet);
+                sftp->statbatch_packet = NULL;
+                sftp->statbatch_sent++;
+            }
+        }
+
+        rc = sftp_packet_requirev(sftp, 2, stat_responses,
+                                  sftp->statbatch_first_id +
+                                  sftp->statbatch_received, &data,
+                                  &data_len);
+        if (rc == PACKET_EAGAIN) {
+            return rc;
+        } else if (rc) {
+            libssh2_error(session, LIBSSH2_ERROR_SOCKET_TIMEOUT,
+                          "Timeout waiting for status message", 0);
+            if (sftp->statbatch_packet) {
+                LIBSSH2_FREE(session, sftp->statbatch_packet);
+                sftp->statbatch_packet = NULL;
+            }
+            sftp->statbatch_state = libssh2_NB_state_idle;
+            return -1;
+        }
+
+        memset(&attrs[sftp->statbatch_received], 0,
+               sizeof(LIBSSH2_SFTP_ATTRIBUTES));
+        if (data[0] == SSH_FXP_STATUS) {
+            statuses[sftp->statbatch_received] = _libssh2_ntohu32(data + 5);
+        } else {
+            statuses[sftp->statbatch_received] = LIBSSH2_FX_OK;
+            sftp_bin2attr(&attrs[sftp->statbatch_received], data + 5);
+        }
+        LIBSSH2_FREE(session, data);
+        sftp->statbatch_received++;
+    }
+
+    sftp->statbatch_state = libssh2_NB_state_idle;
+
+    return 0;
+}
+
+/* libssh2_sftp_stat_batch
+ * Stat or lstat many paths at once
+ */
+LIBSSH2_API int
+libssh2_sftp_stat_batch(LIBSSH2_SFTP *sftp, const char * const *paths,
+                        unsigned int count, int stat_type,
+                        LIBSSH2_SFTP_ATTRIBUTES *attrs,
+                        unsigned long *statuses)
+{
+    int rc;
+    BLOCK_ADJUST(rc, sftp->channel->session,
+                 sftp_stat_batch(sftp, paths, count, stat_type, attrs,
+                                 statuses));
+    return rc;
+}
+
 /* sftp_symlink
  * Read or set a symlink
  */
@@ -2530,4 +3236,13 @@ libssh2_sftp_last_error(LIBSSH2_SFTP *sftp)
     return sftp->last_errno;
 }
 
+/* libssh2_sftp_get_channel
+ * Returns the channel the SFTP subsystem runs on
+ */
+LIBSSH2_API LIBSSH2_CHANNEL *
+libssh2_sftp_get_channel(LIBSSH2_SFTP *sftp)
+{
+    return sftp->channel;
+}
+
 
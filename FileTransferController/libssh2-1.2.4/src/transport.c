@@ -48,7 +48,7 @@
 #include "transport.h"
 
 #define MAX_BLOCKSIZE 32     /* MUST fit biggest crypto block size we use/get */
-#define MAX_MACSIZE 20      /* MUST fit biggest MAC length we support */
+#define MAX_MACSIZE 64      /* MUST fit biggest MAC length we support */
 
 #ifdef LIBSSH2DEBUG
 #define UNPRINTABLE_CHAR '.'
@@ -132,24 +132,17 @@ decrypt(LIBSSH2_SESSION * session, unsigned char *source,
        we risk losing those extra bytes */
     assert((len % blocksize) == 0);
 
-    while (len >= blocksize) {
-        if (session->remote.crypt->crypt(session, source,
-                                         &session->remote.crypt_abstract)) {
-            libssh2_error(session, LIBSSH2_ERROR_DECRYPT,
-                          (char *) "Error decrypting packet", 0);
-            LIBSSH2_FREE(session, p->payload);
-            return PACKET_FAIL;
-        }
+    /* all the blocks are decrypted in place with a single call */
+    if (session->remote.crypt->crypt(session, source, len,
+                                     &session->remote.crypt_abstract)) {
+        libssh2_error(session, LIBSSH2_ERROR_DECRYPT,
+                      (char *) "Error decrypting packet", 0);
+        LIBSSH2_FREE(session, p->payload);
+        return PACKET_FAIL;
+    }
 
-        /* if the crypt() function would write to a given address it
-           wouldn't have to memcpy() and we could avoid this memcpy()
-           too */
-        memcpy(dest, source, blocksize);
+    memcpy(dest, source, len);
 
-        len -= blocksize;       /* less bytes left */
-        dest += blocksize;      /* advance write pointer */
-        source += blocksize;    /* advance read pointer */
-    }
     return PACKET_NONE;         /* all is fine */
 }
 
@@ -168,7 +161,24 @@ fullpacket(LIBSSH2_SESSION * session, int encrypted /* 1 or 0 */ )
         session->fullpacket_macstate = LIBSSH2_MAC_CONFIRMED;
         session->fullpacket_payload_len = p->packet_length - 1;
 
-        if (encrypted) {
+        if (encrypted && session->remote.crypt->auth_len) {
+            /* The packet of an AEAD cipher was received as is: decrypt and
+               authenticate it at once then drop its leading padding length
+               so that the payload is laid out as for the other ciphers */
+            if (session->remote.crypt->crypt(session, p->payload,
+                                             p->packet_length,
+                                             &session->remote.crypt_abstract)) {
+                session->fullpacket_macstate = LIBSSH2_MAC_INVALID;
+            }
+
+            p->padding_length = p->payload[0];
+            if (p->padding_length > session->fullpacket_payload_len) {
+                LIBSSH2_FREE(session, p->payload);
+                return PACKET_FAIL;
+            }
+            memmove(p->payload, p->payload + 1,
+                    session->fullpacket_payload_len);
+        } else if (encrypted) {
 
             /* Calculate MAC hash */
             session->remote.mac->hash(session, macbuf,  /* store hash here */
@@ -196,7 +206,9 @@ fullpacket(LIBSSH2_SESSION * session, int encrypted /* 1 or 0 */ )
 
         /* Check for and deal with decompression */
         if (session->remote.comp &&
-            strcmp(session->remote.comp->name, "none")) {
+            strcmp(session->remote.comp->name, "none") &&
+            (session->remote.comp->use_in_auth ||
+             (session->state & LIBSSH2_STATE_AUTHENTICATED))) {
             unsigned char *data;
             unsigned long data_len;
             int free_payload = 1;
@@ -290,7 +302,9 @@ int _libssh2_transport_read(LIBSSH2_SESSION * session)
     int numdecrypt;
     unsigned char block[MAX_BLOCKSIZE];
     int blocksize;
+    int headlen;
     int encrypted = 1;
+    int auth_len = 0;
 
     /* default clear the bit */
     session->socket_block_directions &= ~LIBSSH2_SESSION_BLOCK_INBOUND;
@@ -338,6 +352,7 @@ int _libssh2_transport_read(LIBSSH2_SESSION * session)
 
         if (session->state & LIBSSH2_STATE_NEWKEYS) {
             blocksize = session->remote.crypt->blocksize;
+            auth_len = session->remote.crypt->auth_len;
         } else {
             encrypted = 0;      /* not encrypted */
             blocksize = 5;      /* not strictly true, but we can use 5 here to
@@ -425,7 +440,14 @@ int _libssh2_transport_read(LIBSSH2_SESSION * session)
                 return PACKET_EAGAIN;
             }
 
-            if (encrypted) {
+            if (auth_len) {
+                /* AEAD ciphers leave the packet length in the clear, the
+                   rest of the packet is received as is and decrypted at
+                   once by fullpacket() */
+                headlen = 4;
+                memcpy(block, &p->buf[p->readidx], headlen);
+            } else if (encrypted) {
+                headlen = blocksize;
                 rc = decrypt(session, &p->buf[p->readidx], block, blocksize);
                 if (rc != PACKET_NONE) {
                     return rc;
@@ -436,11 +458,12 @@ int _libssh2_transport_read(LIBSSH2_SESSION * session)
             } else {
                 /* the data is plain, just copy it verbatim to
                    the working block buffer */
+                headlen = blocksize;
                 memcpy(block, &p->buf[p->readidx], blocksize);
             }
 
             /* advance the read pointer */
-            p->readidx += blocksize;
+            p->readidx += headlen;
 
             /* we now have the initial blocksize bytes decrypted,
              * and we can extract packet and padding length from it
@@ -449,15 +472,23 @@ int _libssh2_transport_read(LIBSSH2_SESSION * session)
             if (p->packet_length < 1)
                 return PACKET_FAIL;
 
-            p->padding_length = block[4];
-            if (p->padding_length < 0)
-                return PACKET_FAIL;
-
-            /* total_num is the number of bytes following the initial
-               (5 bytes) packet length and padding length fields */
-            p->total_num =
-                p->packet_length - 1 +
-                (encrypted ? session->remote.mac->mac_len : 0);
+            if (auth_len) {
+                /* total_num is the number of bytes following the packet
+                   length field, the padding length being set once the
+                   packet is decrypted */
+                p->padding_length = 0;
+                p->total_num = p->packet_length + auth_len;
+            } else {
+                p->padding_length = block[4];
+                if (p->padding_length < 0)
+                    return PACKET_FAIL;
+
+                /* total_num is the number of bytes following the initial
+                   (5 bytes) packet length and padding length fields */
+                p->total_num =
+                    p->packet_length - 1 +
+                    (encrypted ? session->remote.mac->mac_len : 0);
+            }
 
             /* RFC4253 section 6.1 Maximum Packet Length says:
              *
@@ -480,12 +511,12 @@ int _libssh2_transport_read(LIBSSH2_SESSION * session)
             /* init write pointer to start of payload buffer */
             p->wptr = p->payload;
 
-            if (blocksize > 5) {
+            if (headlen > 5) {
                 /* copy the data from index 5 to the end of
                    the blocksize from the temporary buffer to
                    the start of the decrypted buffer */
-                memcpy(p->wptr, &block[5], blocksize - 5);
-                p->wptr += blocksize - 5;       /* advance write pointer */
+                memcpy(p->wptr, &block[5], headlen - 5);
+                p->wptr += headlen - 5;       /* advance write pointer */
             }
 
             /* init the data_num field to the number of bytes of
@@ -493,7 +524,7 @@ int _libssh2_transport_read(LIBSSH2_SESSION * session)
             p->data_num = p->wptr - p->payload;
 
             /* we already dealt with a blocksize worth of data */
-            numbytes -= blocksize;
+            numbytes -= headlen;
         }
 
         /* how much there is left to add to the current payload
@@ -506,7 +537,7 @@ int _libssh2_transport_read(LIBSSH2_SESSION * session)
             numbytes = remainpack;
         }
 
-        if (encrypted) {
+        if (encrypted && !auth_len) {
             /* At the end of the incoming stream, there is a MAC,
                and we don't want to decrypt that since we need it
                "raw". We MUST however decrypt the padding data
@@ -532,7 +563,8 @@ int _libssh2_transport_read(LIBSSH2_SESSION * session)
                 }
             }
         } else {
-            /* unencrypted data should not be decrypted at all */
+            /* unencrypted data should not be decrypted at all, nor should
+               AEAD packets until they are complete */
             numdecrypt = 0;
         }
 
@@ -612,7 +644,7 @@ send_existing(LIBSSH2_SESSION * session, unsigned char *data,
     ssize_t length;
     struct transportpacket *p = &session->packet;
 
-    if (!p->outbuf) {
+    if (!p->ototal_num) {
         *ret = 0;
         return PACKET_NONE;
     }
@@ -648,10 +680,11 @@ send_existing(LIBSSH2_SESSION * session, unsigned char *data,
     }
 
     if (rc == length) {
-        /* the remainder of the package was sent */
-        LIBSSH2_FREE(session, p->outbuf);
-        p->outbuf = NULL;
+        /* the remainder of the package was sent, outbuf is kept for the
+           next one - the outbound direction is cleared so that it only
+           reports a partially sent packet */
         p->ototal_num = 0;
+        session->socket_block_directions &= ~LIBSSH2_SESSION_BLOCK_OUTBOUND;
     }
     else if (rc < 0) {
         /* nothing was sent */
@@ -702,7 +735,7 @@ _libssh2_transport_write(LIBSSH2_SESSION * session, unsigned char *data,
 #endif
     struct transportpacket *p = &session->packet;
     int encrypted;
-    int i;
+    int auth_len;
     ssize_t ret;
     int rc;
     unsigned char *orgdata = data;
@@ -720,9 +753,12 @@ _libssh2_transport_write(LIBSSH2_SESSION * session, unsigned char *data,
     session->socket_block_directions &= ~LIBSSH2_SESSION_BLOCK_OUTBOUND;
 
     encrypted = (session->state & LIBSSH2_STATE_NEWKEYS) ? 1 : 0;
+    auth_len = encrypted ? session->local.crypt->auth_len : 0;
 
     /* check if we should compress */
-    if (encrypted && strcmp(session->local.comp->name, "none")) {
+    if (encrypted && strcmp(session->local.comp->name, "none") &&
+        (session->local.comp->use_in_auth ||
+         (session->state & LIBSSH2_STATE_AUTHENTICATED))) {
         if (session->local.comp->comp(session, 1, &data, &data_len,
                                       LIBSSH2_PACKET_MAXCOMP,
                                       &free_data, data, data_len,
@@ -744,8 +780,10 @@ _libssh2_transport_write(LIBSSH2_SESSION * session, unsigned char *data,
     /* at this point we have it all except the padding */
 
     /* first figure out our minimum padding amount to make it an even
-       block size */
-    padding_length = blocksize - (packet_length % blocksize);
+       block size - AEAD ciphers leave the packet_length field out as it
+       is not encrypted */
+    padding_length =
+        blocksize - ((packet_length - (auth_len ? 4 : 0)) % blocksize);
 
     /* if the padding becomes too small we add another blocksize worth
        of it (taken from the original libssh2 where it didn't have any
@@ -766,16 +804,27 @@ _libssh2_transport_write(LIBSSH2_SESSION * session, unsigned char *data,
 
     packet_length += padding_length;
 
-    /* append the MAC length to the total_length size */
-    total_length =
-        packet_length + (encrypted ? session->local.mac->mac_len : 0);
-
-    /* allocate memory to store the outgoing packet in, in case we can't
-       send the whole one and thus need to keep it after this function
-       returns. */
-    p->outbuf = LIBSSH2_ALLOC(session, total_length);
-    if (!p->outbuf) {
-        return PACKET_ENOMEM;
+    /* append the MAC or authentication tag length to the total_length
+       size */
+    if (auth_len)
+        total_length = packet_length + auth_len;
+    else
+        total_length =
+            packet_length + (encrypted ? session->local.mac->mac_len : 0);
+
+    /* the outgoing packet is stored in a buffer kept across calls, in
+       case we can't send the whole one, which is only grown when needed */
+    if (total_length > p->osize) {
+        unsigned char *outbuf = LIBSSH2_REALLOC(session, p->outbuf,
+                                                total_length);
+        if (!outbuf) {
+            if (free_data) {
+                LIBSSH2_FREE(session, data);
+            }
+            return PACKET_ENOMEM;
+        }
+        p->outbuf = outbuf;
+        p->osize = total_length;
     }
 
     /* store packet_length, which is the size of the whole packet except
@@ -791,7 +840,14 @@ _libssh2_transport_write(LIBSSH2_SESSION * session, unsigned char *data,
         LIBSSH2_FREE(session, data);
     }
 
-    if (encrypted) {
+    if (auth_len) {
+        /* Encrypt and authenticate everything but the packet_length field
+           at once, the cipher writes the tag at index packet_length. */
+        if (session->local.crypt->crypt(session, p->outbuf + 4,
+                                        packet_length - 4,
+                                        &session->local.crypt_abstract))
+            return PACKET_FAIL;     /* encryption failure */
+    } else if (encrypted) {
         /* Calculate MAC hash. Put the output at index packet_length,
            since that size includes the whole packet. The MAC is
            calculated on the entire unencrypted packet, including all
@@ -801,14 +857,11 @@ _libssh2_transport_write(LIBSSH2_SESSION * session, unsigned char *data,
                                  packet_length, NULL, 0,
                                  &session->local.mac_abstract);
 
-        /* Encrypt the whole packet data, one block size at a time.
-           The MAC field is not encrypted. */
-        for(i = 0; i < packet_length; i += session->local.crypt->blocksize) {
-            unsigned char *ptr = &p->outbuf[i];
-            if (session->local.crypt->crypt(session, ptr,
-                                            &session->local.crypt_abstract))
-                return PACKET_FAIL;     /* encryption failure */
-        }
+        /* Encrypt the whole packet data with a single call. The MAC
+           field is not encrypted. */
+        if (session->local.crypt->crypt(session, p->outbuf, packet_length,
+                                        &session->local.crypt_abstract))
+            return PACKET_FAIL;     /* encryption failure */
     }
 
     session->local.seqno++;
@@ -841,8 +894,6 @@ _libssh2_transport_write(LIBSSH2_SESSION * session, unsigned char *data,
     /* the whole thing got sent away */
     p->odata = NULL;
     p->olen = 0;
-    LIBSSH2_FREE(session, p->outbuf);
-    p->outbuf = NULL;
 
     return PACKET_NONE;         /* all is good */
 }
@@ -0,0 +1,65 @@
+/*
+	This file is part of the PolKit library.
+	Copyright (C) 2008-2009 Pierre-Olivier Latour <info@pol-online.net>
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#import <Foundation/Foundation.h>
+
+/*
+Runs a chain of stages on separate threads connected by bounded rings of recycled blocks:
+- The source stage fills blocks of "blockSize" bytes by calling its callback until it returns 0 (end of data) - Only the last block can be partially filled (possibly empty) and it is flagged as final
+- Each intermediate stage transforms a block of its input ring into a block of its output ring
+- The consumer pulls the output of the last stage with BlockPipelineRead() from its own thread
+Statistics for each stage tell where the bottleneck is: a stage that is mostly busy while the others are starved or blocked is the limiting one
+*/
+
+#define kBlockPipelineMaxStages			6 //Including the source and the consumer
+
+typedef struct {
+	unsigned char*						bytes;
+	NSUInteger							length,
+										capacity;
+	BOOL								final;
+} BlockPipelineBlock;
+
+typedef struct {
+	const char*							name;
+	double								busyTime, //Seconds spent processing
+										starvedTime, //Seconds spent waiting for input
+										blockedTime; //Seconds spent waiting for room in the output ring
+	double								occupancy; //Average fill level of the output ring in [0,1] range (0 for the consumer)
+} BlockPipelineStageStatistics;
+
+typedef NSInteger (*BlockPipelineSourceCallback)(void* info, void* bytes, NSUInteger maxLength); //Returns 0 at end of data or -1 on error
+typedef BOOL (*BlockPipelineStageCallback)(void* info, const BlockPipelineBlock* input, BlockPipelineBlock* output); //Output is empty on entry and has the same "final" flag as input
+
+typedef struct BlockPipeline BlockPipeline;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+BlockPipeline* BlockPipelineCreate(const char* sourceName, BlockPipelineSourceCallback callback, void* info, NSUInteger blockSize, NSUInteger blockCount, const char* consumerName);
+BOOL BlockPipelineAddStage(BlockPipeline* pipeline, const char* name, BlockPipelineStageCallback callback, void* info, NSUInteger outputCapacity); //Must be called before BlockPipelineStart()
+BOOL BlockPipelineStart(BlockPipeline* pipeline);
+void BlockPipelineDestroy(BlockPipeline* pipeline); //Aborts the stages if they are still running and waits for their threads to exit
+
+NSInteger BlockPipelineRead(BlockPipeline* pipeline, void* bytes, NSUInteger maxLength); //Blocks until data is available - Returns 0 at end of data or -1 on error
+NSError* BlockPipelineGetError(BlockPipeline* pipeline); //Returns the error that failed the pipeline if known (e.g. a stage overflowing its output block) or nil - Callback failures are not described
+NSUInteger BlockPipelineGetStatistics(BlockPipeline* pipeline, BlockPipelineStageStatistics* statistics, NSUInteger maxStages); //Returns the number of stages including the source and the consumer
+#ifdef __cplusplus
+}
+#endif
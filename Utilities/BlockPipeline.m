@@ -0,0 +1,396 @@
+/*
+	This file is part of the PolKit library.
+	Copyright (C) 2008-2009 Pierre-Olivier Latour <info@pol-online.net>
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#import <pthread.h>
+
+#import "BlockPipeline.h"
+
+#define kMaxBlocks						16
+
+typedef struct {
+	BlockPipelineBlock					blocks[kMaxBlocks];
+	NSUInteger							capacity,
+										head,
+										count;
+	double								occupancySum;
+	CFAbsoluteTime						changeTime;
+} Ring;
+
+typedef struct {
+	struct BlockPipeline*				pipeline;
+	NSUInteger							index;
+	const char*							name;
+	BlockPipelineStageCallback			callback;
+	void*								info;
+	pthread_t							thread;
+	BOOL								running;
+	double								busyTime,
+										starvedTime,
+										blockedTime;
+} Stage;
+
+struct BlockPipeline {
+	BlockPipelineSourceCallback			source;
+	void*								sourceInfo;
+	NSUInteger							blockSize,
+										blockCount;
+	pthread_mutex_t						mutex;
+	pthread_cond_t						condition;
+	BOOL								started,
+										failed,
+										aborted;
+	NSError*							error;
+	CFAbsoluteTime						startTime,
+										endTime;
+	NSUInteger							numStages; //Source and intermediate stages
+	Stage								stages[kBlockPipelineMaxStages - 1];
+	Ring								rings[kBlockPipelineMaxStages - 1]; //Output of each stage
+	Stage								consumer;
+	NSUInteger							readOffset;
+};
+
+/* Must be called with the mutex locked */
+static void _SetRingCount(Ring* ring, NSUInteger count)
+{
+	CFAbsoluteTime						time = CFAbsoluteTimeGetCurrent();
+	
+	ring->occupancySum += (double)ring->count * (time - ring->changeTime);
+	ring->changeTime = time;
+	ring->count = count;
+}
+
+/* Must be called with the mutex locked - Returns NULL if the pipeline failed or was aborted */
+static BlockPipelineBlock* _WaitForInput(BlockPipeline* pipeline, Stage* stage)
+{
+	Ring*								ring = &pipeline->rings[stage->index - 1];
+	CFAbsoluteTime						time = CFAbsoluteTimeGetCurrent();
+	
+	while(!pipeline->failed && !pipeline->aborted && (ring->count == 0))
+	pthread_cond_wait(&pipeline->condition, &pipeline->mutex);
+	stage->starvedTime += CFAbsoluteTimeGetCurrent() - time;
+	
+	return (pipeline->failed || pipeline->aborted ? NULL : &ring->blocks[ring->head]);
+}
+
+/* Must be called with the mutex locked - Returns NULL if the pipeline failed or was aborted */
+static BlockPipelineBlock* _WaitForOutput(BlockPipeline* pipeline, Stage* stage)
+{
+	Ring*								ring = &pipeline->rings[stage->index];
+	CFAbsoluteTime						time = CFAbsoluteTimeGetCurrent();
+	
+	while(!pipeline->failed && !pipeline->aborted && (ring->count == pipeline->blockCount))
+	pthread_cond_wait(&pipeline->condition, &pipeline->mutex);
+	stage->blockedTime += CFAbsoluteTimeGetCurrent() - time;
+	
+	return (pipeline->failed || pipeline->aborted ? NULL : &ring->blocks[(ring->head + ring->count) % pipeline->blockCount]);
+}
+
+/* Must be called with the mutex locked */
+static void _ReleaseInput(BlockPipeline* pipeline, Stage* stage)
+{
+	Ring*								ring = &pipeline->rings[stage->index - 1];
+	
+	ring->head = (ring->head + 1) % pipeline->blockCount;
+	_SetRingCount(ring, ring->count - 1);
+	pthread_cond_broadcast(&pipeline->condition);
+}
+
+/* Must be called with the mutex locked */
+static void _CommitOutput(BlockPipeline* pipeline, Stage* stage, BOOL success)
+{
+	Ring*								ring = &pipeline->rings[stage->index];
+	
+	if(success)
+	_SetRingCount(ring, ring->count + 1);
+	else
+	pipeline->failed = YES;
+	pthread_cond_broadcast(&pipeline->condition);
+}
+
+static void* _SourceEntryPoint(void* arg)
+{
+	Stage*								stage = (Stage*)arg;
+	BlockPipeline*						pipeline = stage->pipeline;
+	BlockPipelineBlock*					block;
+	CFAbsoluteTime						time;
+	NSInteger							result;
+	BOOL								success,
+										final;
+	
+	pthread_mutex_lock(&pipeline->mutex);
+	while((block = _WaitForOutput(pipeline, stage))) {
+		pthread_mutex_unlock(&pipeline->mutex);
+		time = CFAbsoluteTimeGetCurrent();
+		block->length = 0;
+		block->final = NO;
+		success = YES;
+		while(block->length < pipeline->blockSize) {
+			result = pipeline->source(pipeline->sourceInfo, block->bytes + block->length, pipeline->blockSize - block->length);
+			if(result < 0) {
+				success = NO;
+				break;
+			}
+			if(result == 0) {
+				block->final = YES;
+				break;
+			}
+			block->length += result;
+		}
+		final = block->final;
+		stage->busyTime += CFAbsoluteTimeGetCurrent() - time;
+		pthread_mutex_lock(&pipeline->mutex);
+		_CommitOutput(pipeline, stage, success);
+		if(!success || final)
+		break;
+	}
+	pthread_mutex_unlock(&pipeline->mutex);
+	
+	return NULL;
+}
+
+static void* _StageEntryPoint(void* arg)
+{
+	Stage*								stage = (Stage*)arg;
+	BlockPipeline*						pipeline = stage->pipeline;
+	BlockPipelineBlock*					input;
+	BlockPipelineBlock*					output;
+	NSError*							error = nil;
+	NSAutoreleasePool*					pool;
+	CFAbsoluteTime						time;
+	BOOL								success,
+										final;
+	
+	pthread_mutex_lock(&pipeline->mutex);
+	while((input = _WaitForInput(pipeline, stage)) && (output = _WaitForOutput(pipeline, stage))) {
+		pthread_mutex_unlock(&pipeline->mutex);
+		time = CFAbsoluteTimeGetCurrent();
+		output->length = 0;
+		output->final = final = input->final;
+		success = stage->callback(stage->info, input, output);
+		if(output->length > output->capacity) {
+			pool = [NSAutoreleasePool new]; //NOTE: Stage threads have no autorelease pool
+			error = [[NSError alloc] initWithDomain:@"BlockPipeline" code:-1 userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"Stage \"%s\" overflowed its output block (%i bytes for %i)", stage->name, output->length, output->capacity] forKey:NSLocalizedDescriptionKey]];
+			[pool drain];
+			output->length = 0;
+			success = NO;
+		}
+		stage->busyTime += CFAbsoluteTimeGetCurrent() - time;
+		pthread_mutex_lock(&pipeline->mutex);
+		if(error) {
+			if(pipeline->error == nil)
+			pipeline->error = error;
+			else
+			[error release];
+			error = nil;
+		}
+		_ReleaseInput(pipeline, stage);
+		_CommitOutput(pipeline, stage, success);
+		if(!success || final)
+		break;
+	}
+	pthread_mutex_unlock(&pipeline->mutex);
+	
+	return NULL;
+}
+
+BlockPipeline* BlockPipelineCreate(const char* sourceName, BlockPipelineSourceCallback callback, void* info, NSUInteger blockSize, NSUInteger blockCount, const char* consumerName)
+{
+	BlockPipeline*						pipeline;
+	
+	if((callback == NULL) || (blockSize == 0) || (blockCount < 2) || (blockCount > kMaxBlocks))
+	return NULL;
+	
+	pipeline = calloc(1, sizeof(BlockPipeline));
+	pipeline->source = callback;
+	pipeline->sourceInfo = info;
+	pipeline->blockSize = blockSize;
+	pipeline->blockCount = blockCount;
+	pthread_mutex_init(&pipeline->mutex, NULL);
+	pthread_cond_init(&pipeline->condition, NULL);
+	pipeline->stages[0].pipeline = pipeline;
+	pipeline->stages[0].name = sourceName;
+	pipeline->rings[0].capacity = blockSize;
+	pipeline->numStages = 1;
+	pipeline->consumer.pipeline = pipeline;
+	pipeline->consumer.name = consumerName;
+	
+	return pipeline;
+}
+
+BOOL BlockPipelineAddStage(BlockPipeline* pipeline, const char* name, BlockPipelineStageCallback callback, void* info, NSUInteger outputCapacity)
+{
+	Stage*								stage;
+	
+	if(pipeline->started || (pipeline->numStages == kBlockPipelineMaxStages - 1) || (callback == NULL) || (outputCapacity == 0))
+	return NO;
+	
+	stage = &pipeline->stages[pipeline->numStages];
+	stage->pipeline = pipeline;
+	stage->index = pipeline->numStages;
+	stage->name = name;
+	stage->callback = callback;
+	stage->info = info;
+	pipeline->rings[pipeline->numStages].capacity = outputCapacity;
+	pipeline->numStages += 1;
+	
+	return YES;
+}
+
+BOOL BlockPipelineStart(BlockPipeline* pipeline)
+{
+	NSUInteger							i,
+										j;
+	int									error;
+	
+	if(pipeline->started)
+	return NO;
+	pipeline->started = YES;
+	pipeline->startTime = CFAbsoluteTimeGetCurrent();
+	pipeline->consumer.index = pipeline->numStages;
+	
+	for(i = 0; i < pipeline->numStages; ++i) {
+		pipeline->rings[i].changeTime = pipeline->startTime;
+		for(j = 0; j < pipeline->blockCount; ++j) {
+			pipeline->rings[i].blocks[j].capacity = pipeline->rings[i].capacity;
+			pipeline->rings[i].blocks[j].bytes = malloc(pipeline->rings[i].capacity);
+			if(pipeline->rings[i].blocks[j].bytes == NULL) {
+				pipeline->failed = YES;
+				return NO;
+			}
+		}
+	}
+	
+	for(i = 0; i < pipeline->numStages; ++i) {
+		error = pthread_create(&pipeline->stages[i].thread, NULL, (i ? _StageEntryPoint : _SourceEntryPoint), &pipeline->stages[i]);
+		if(error) {
+			NSLog(@"%s: pthread_create() failed with error \"%s\"", __FUNCTION__, strerror(error));
+			pthread_mutex_lock(&pipeline->mutex);
+			pipeline->failed = YES;
+			pthread_cond_broadcast(&pipeline->condition);
+			pthread_mutex_unlock(&pipeline->mutex);
+			return NO;
+		}
+		pipeline->stages[i].running = YES;
+	}
+	
+	return YES;
+}
+
+void BlockPipelineDestroy(BlockPipeline* pipeline)
+{
+	NSUInteger							i,
+										j;
+	
+	if(pipeline == NULL)
+	return;
+	
+	pthread_mutex_lock(&pipeline->mutex);
+	pipeline->aborted = YES;
+	pthread_cond_broadcast(&pipeline->condition);
+	pthread_mutex_unlock(&pipeline->mutex);
+	for(i = 0; i < pipeline->numStages; ++i) {
+		if(pipeline->stages[i].running)
+		pthread_join(pipeline->stages[i].thread, NULL);
+	}
+	
+	for(i = 0; i < pipeline->numStages; ++i) {
+		for(j = 0; j < pipeline->blockCount; ++j)
+		free(pipeline->rings[i].blocks[j].bytes);
+	}
+	[pipeline->error release];
+	pthread_cond_destroy(&pipeline->condition);
+	pthread_mutex_destroy(&pipeline->mutex);
+	free(pipeline);
+}
+
+NSInteger BlockPipelineRead(BlockPipeline* pipeline, void* bytes, NSUInteger maxLength)
+{
+	Stage*								consumer = &pipeline->consumer;
+	BlockPipelineBlock*					block;
+	NSUInteger							length;
+	
+	if(!pipeline->started)
+	return -1;
+	
+	pthread_mutex_lock(&pipeline->mutex);
+	while(1) {
+		block = _WaitForInput(pipeline, consumer);
+		if(block == NULL) {
+			pthread_mutex_unlock(&pipeline->mutex);
+			return -1;
+		}
+		if(pipeline->readOffset < block->length)
+		break;
+		if(block->final) {
+			if(pipeline->endTime == 0.0)
+			pipeline->endTime = CFAbsoluteTimeGetCurrent();
+			pthread_mutex_unlock(&pipeline->mutex);
+			return 0;
+		}
+		pipeline->readOffset = 0;
+		_ReleaseInput(pipeline, consumer);
+	}
+	pthread_mutex_unlock(&pipeline->mutex);
+	
+	length = MIN(block->length - pipeline->readOffset, maxLength);
+	bcopy(block->bytes + pipeline->readOffset, bytes, length);
+	pipeline->readOffset += length;
+	
+	return length;
+}
+
+NSError* BlockPipelineGetError(BlockPipeline* pipeline)
+{
+	NSError*							error;
+	
+	pthread_mutex_lock(&pipeline->mutex);
+	error = [[pipeline->error retain] autorelease];
+	pthread_mutex_unlock(&pipeline->mutex);
+	
+	return error;
+}
+
+NSUInteger BlockPipelineGetStatistics(BlockPipeline* pipeline, BlockPipelineStageStatistics* statistics, NSUInteger maxStages)
+{
+	CFAbsoluteTime						time;
+	double								duration;
+	Ring*								ring;
+	Stage*								stage;
+	NSUInteger							i;
+	
+	pthread_mutex_lock(&pipeline->mutex);
+	time = (pipeline->endTime > 0.0 ? pipeline->endTime : CFAbsoluteTimeGetCurrent());
+	duration = time - pipeline->startTime;
+	for(i = 0; (i <= pipeline->numStages) && (i < maxStages); ++i) {
+		stage = (i < pipeline->numStages ? &pipeline->stages[i] : &pipeline->consumer);
+		statistics[i].name = stage->name;
+		statistics[i].busyTime = stage->busyTime;
+		statistics[i].starvedTime = stage->starvedTime;
+		statistics[i].blockedTime = stage->blockedTime;
+		statistics[i].occupancy = 0.0;
+		if(stage == &pipeline->consumer) //NOTE: The consumer is considered busy whenever it is not waiting for data
+		statistics[i].busyTime = MAX(duration - stage->starvedTime, 0.0);
+		else if(pipeline->started && (duration > 0.0)) {
+			ring = &pipeline->rings[i];
+			statistics[i].occupancy = (ring->occupancySum + (double)ring->count * MAX(time - ring->changeTime, 0.0)) / (duration * (double)pipeline->blockCount);
+		}
+	}
+	pthread_mutex_unlock(&pipeline->mutex);
+	
+	return pipeline->numStages + 1;
+}
@@ -0,0 +1,57 @@
+/*
+	This file is part of the PolKit library.
+	Copyright (C) 2008-2009 Pierre-Olivier Latour <info@pol-online.net>
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#import <Foundation/Foundation.h>
+
+/*
+Encrypted data layout:
+- 24 bytes header: "PKC1" magic, chunk size (32 bits big-endian) and 16 random bytes of salt
+- Sequence of chunks: AES-256-GCM ciphertext of "chunk size" bytes of plain data followed by its 16 bytes authentication tag
+- The last chunk always holds less than "chunk size" bytes of plain data (possibly none) and is flagged as such, so truncation is detected
+The key is derived from the password and salt with PBKDF2-HMAC-SHA256, the nonce of a chunk is its index and the header is authenticated with every chunk
+*/
+
+#define kChunkedCipherHeaderSize			24
+#define kChunkedCipherTagSize				16
+#define kChunkedCipherDefaultChunkSize		(64 * 1024)
+
+typedef struct ChunkedCipher ChunkedCipher;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+ChunkedCipher* ChunkedCipherCreateEncryptor(NSData* password, NSUInteger chunkSize, NSUInteger numThreads); //Pass 0 for default chunk size - "numThreads" includes the calling thread
+ChunkedCipher* ChunkedCipherCreateDecryptor(NSData* password, const unsigned char* header, NSUInteger numThreads); //Returns NULL if the header is invalid
+void ChunkedCipherDestroy(ChunkedCipher* cipher);
+
+const unsigned char* ChunkedCipherGetHeader(ChunkedCipher* cipher);
+NSUInteger ChunkedCipherGetChunkSize(ChunkedCipher* cipher);
+
+/* Encrypts or decrypts consecutive chunks starting at "firstIndex" in parallel:
+- Input must contain whole chunks except if "final" is YES in which case its last chunk is the last chunk of the data
+- Output must be large enough for the result (see below) and cannot overlap the input
+- Returns the number of bytes written to output or -1 on error (including authentication failures)
+*/
+long ChunkedCipherProcess(ChunkedCipher* cipher, const void* input, NSUInteger inputLength, void* output, unsigned long long firstIndex, BOOL final);
+
+unsigned long long ChunkedCipherEncryptedLength(unsigned long long length, NSUInteger chunkSize); //For the whole data including the header
+unsigned long long ChunkedCipherEncryptedRangeForRange(unsigned long long offset, unsigned long long length, NSUInteger chunkSize, unsigned long long* encryptedLength, unsigned long long* firstIndex); //Returns the offset of the whole chunks to fetch to decrypt a range of plain data (the header must also be fetched) - The offset of the range in the first chunk is "offset - firstIndex * chunkSize"
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,334 @@
+/*
+	This file is part of the PolKit library.
+	Copyright (C) 2008-2009 Pierre-Olivier Latour <info@pol-online.net>
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#import <openssl/evp.h>
+#import <openssl/rand.h>
+#import <pthread.h>
+
+#import "ChunkedCipher.h"
+
+#define kMagic							"PKC1"
+#define kKeySize						32
+#define kNonceSize						12
+#define kSaltSize						16
+#define kKeyIterations					10000
+#define kMinChunkSize					1024
+#define kMaxChunkSize					(16 * 1024 * 1024)
+#define kMaxThreads						16
+
+struct ChunkedCipher {
+	BOOL								decrypt;
+	unsigned char						header[kChunkedCipherHeaderSize];
+	unsigned char						key[kKeySize];
+	NSUInteger							chunkSize;
+	EVP_CIPHER_CTX*						context;
+	NSUInteger							numThreads;
+	pthread_t							threads[kMaxThreads];
+	pthread_mutex_t						mutex;
+	pthread_cond_t						jobCondition,
+										doneCondition;
+	BOOL								quit;
+	
+	const unsigned char*				input;
+	NSUInteger							inputLength;
+	unsigned char*						output;
+	unsigned long long					firstIndex;
+	NSUInteger							numChunks,
+										nextChunk,
+										doneChunks;
+	BOOL								final,
+										failed;
+};
+
+static EVP_CIPHER_CTX* _CreateContext(ChunkedCipher* cipher)
+{
+	EVP_CIPHER_CTX*						context = EVP_CIPHER_CTX_new();
+	
+	if(context == NULL)
+	return NULL;
+	
+	if((cipher->decrypt ? EVP_DecryptInit_ex(context, EVP_aes_256_gcm(), NULL, cipher->key, NULL) : EVP_EncryptInit_ex(context, EVP_aes_256_gcm(), NULL, cipher->key, NULL)) != 1) {
+		EVP_CIPHER_CTX_free(context);
+		return NULL;
+	}
+	
+	return context;
+}
+
+static BOOL _ProcessChunk(ChunkedCipher* cipher, EVP_CIPHER_CTX* context, NSUInteger chunk)
+{
+	NSUInteger							inSize = (cipher->decrypt ? cipher->chunkSize + kChunkedCipherTagSize : cipher->chunkSize),
+										outSize = (cipher->decrypt ? cipher->chunkSize : cipher->chunkSize + kChunkedCipherTagSize),
+										inLength = inSize;
+	BOOL								last = (cipher->final && (chunk == cipher->numChunks - 1));
+	unsigned long long					index = cipher->firstIndex + chunk;
+	unsigned char						nonce[kNonceSize] = {0};
+	unsigned char						aad[kChunkedCipherHeaderSize + 9];
+	const unsigned char*				input = cipher->input + chunk * inSize;
+	unsigned char*						output = cipher->output + chunk * outSize;
+	unsigned char						buffer[EVP_MAX_BLOCK_LENGTH];
+	int									length,
+										dataLength,
+										i;
+	
+	if(last)
+	inLength = cipher->inputLength - chunk * inSize;
+	dataLength = (cipher->decrypt ? inLength - kChunkedCipherTagSize : inLength);
+	
+	for(i = 0; i < 8; ++i)
+	nonce[kNonceSize - 1 - i] = aad[kChunkedCipherHeaderSize + 7 - i] = (index >> (i * 8)) & 0xFF;
+	bcopy(cipher->header, aad, kChunkedCipherHeaderSize);
+	aad[kChunkedCipherHeaderSize + 8] = (last ? 1 : 0);
+	
+	if(cipher->decrypt) {
+		if(EVP_DecryptInit_ex(context, NULL, NULL, NULL, nonce) != 1)
+		return NO;
+		if(EVP_DecryptUpdate(context, NULL, &length, aad, sizeof(aad)) != 1)
+		return NO;
+		if(dataLength && (EVP_DecryptUpdate(context, output, &length, input, dataLength) != 1))
+		return NO;
+		if(EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_SET_TAG, kChunkedCipherTagSize, (void*)(input + dataLength)) != 1)
+		return NO;
+		if(EVP_DecryptFinal_ex(context, buffer, &length) != 1) //NOTE: This is where authentication fails
+		return NO;
+	}
+	else {
+		if(EVP_EncryptInit_ex(context, NULL, NULL, NULL, nonce) != 1)
+		return NO;
+		if(EVP_EncryptUpdate(context, NULL, &length, aad, sizeof(aad)) != 1)
+		return NO;
+		if(dataLength && (EVP_EncryptUpdate(context, output, &length, input, dataLength) != 1))
+		return NO;
+		if(EVP_EncryptFinal_ex(context, buffer, &length) != 1)
+		return NO;
+		if(EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_GET_TAG, kChunkedCipherTagSize, output + dataLength) != 1)
+		return NO;
+	}
+	
+	return YES;
+}
+
+/* Must be called with the mutex locked */
+static void _ProcessChunks(ChunkedCipher* cipher, EVP_CIPHER_CTX* context)
+{
+	NSUInteger							chunk;
+	BOOL								success;
+	
+	while(cipher->nextChunk < cipher->numChunks) {
+		chunk = cipher->nextChunk++;
+		pthread_mutex_unlock(&cipher->mutex);
+		success = (context ? _ProcessChunk(cipher, context, chunk) : NO);
+		pthread_mutex_lock(&cipher->mutex);
+		if(!success)
+		cipher->failed = YES;
+		if(++cipher->doneChunks == cipher->numChunks)
+		pthread_cond_signal(&cipher->doneCondition);
+	}
+}
+
+static void* _ThreadEntryPoint(void* arg)
+{
+	ChunkedCipher*						cipher = (ChunkedCipher*)arg;
+	EVP_CIPHER_CTX*						context = _CreateContext(cipher);
+	
+	pthread_mutex_lock(&cipher->mutex);
+	while(1) {
+		while(!cipher->quit && (cipher->nextChunk >= cipher->numChunks))
+		pthread_cond_wait(&cipher->jobCondition, &cipher->mutex);
+		if(cipher->quit)
+		break;
+		_ProcessChunks(cipher, context);
+	}
+	pthread_mutex_unlock(&cipher->mutex);
+	
+	if(context)
+	EVP_CIPHER_CTX_free(context);
+	
+	return NULL;
+}
+
+static ChunkedCipher* _CreateCipher(NSData* password, const unsigned char* header, BOOL decrypt, NSUInteger numThreads)
+{
+	ChunkedCipher*						cipher;
+	NSUInteger							i;
+	int									error;
+	
+	if(![password length])
+	return NULL;
+	
+	cipher = calloc(1, sizeof(ChunkedCipher));
+	cipher->decrypt = decrypt;
+	bcopy(header, cipher->header, kChunkedCipherHeaderSize);
+	cipher->chunkSize = ((NSUInteger)header[4] << 24) | ((NSUInteger)header[5] << 16) | ((NSUInteger)header[6] << 8) | (NSUInteger)header[7];
+	if(PKCS5_PBKDF2_HMAC([password bytes], [password length], &header[8], kSaltSize, kKeyIterations, EVP_sha256(), kKeySize, cipher->key) != 1) {
+		free(cipher);
+		return NULL;
+	}
+	cipher->context = _CreateContext(cipher);
+	if(cipher->context == NULL) {
+		free(cipher);
+		return NULL;
+	}
+	
+	pthread_mutex_init(&cipher->mutex, NULL);
+	pthread_cond_init(&cipher->jobCondition, NULL);
+	pthread_cond_init(&cipher->doneCondition, NULL);
+	for(i = 1; i < MIN(numThreads, kMaxThreads + 1); ++i) {
+		error = pthread_create(&cipher->threads[cipher->numThreads], NULL, _ThreadEntryPoint, cipher);
+		if(error) {
+			NSLog(@"%s: pthread_create() failed with error \"%s\"", __FUNCTION__, strerror(error));
+			break;
+		}
+		cipher->numThreads += 1;
+	}
+	
+	return cipher;
+}
+
+ChunkedCipher* ChunkedCipherCreateEncryptor(NSData* password, NSUInteger chunkSize, NSUInteger numThreads)
+{
+	unsigned char						header[kChunkedCipherHeaderSize];
+	
+	if(chunkSize == 0)
+	chunkSize = kChunkedCipherDefaultChunkSize;
+	if((chunkSize < kMinChunkSize) || (chunkSize > kMaxChunkSize))
+	return NULL;
+	
+	bcopy(kMagic, header, 4);
+	header[4] = (chunkSize >> 24) & 0xFF;
+	header[5] = (chunkSize >> 16) & 0xFF;
+	header[6] = (chunkSize >> 8) & 0xFF;
+	header[7] = chunkSize & 0xFF;
+	if(RAND_bytes(&header[8], kSaltSize) != 1)
+	return NULL;
+	
+	return _CreateCipher(password, header, NO, numThreads);
+}
+
+ChunkedCipher* ChunkedCipherCreateDecryptor(NSData* password, const unsigned char* header, NSUInteger numThreads)
+{
+	NSUInteger							chunkSize;
+	
+	if(memcmp(header, kMagic, 4))
+	return NULL;
+	chunkSize = ((NSUInteger)header[4] << 24) | ((NSUInteger)header[5] << 16) | ((NSUInteger)header[6] << 8) | (NSUInteger)header[7];
+	if((chunkSize < kMinChunkSize) || (chunkSize > kMaxChunkSize))
+	return NULL;
+	
+	return _CreateCipher(password, header, YES, numThreads);
+}
+
+void ChunkedCipherDestroy(ChunkedCipher* cipher)
+{
+	NSUInteger							i;
+	
+	if(cipher == NULL)
+	return;
+	
+	pthread_mutex_lock(&cipher->mutex);
+	cipher->quit = YES;
+	pthread_cond_broadcast(&cipher->jobCondition);
+	pthread_mutex_unlock(&cipher->mutex);
+	for(i = 0; i < cipher->numThreads; ++i)
+	pthread_join(cipher->threads[i], NULL);
+	
+	pthread_cond_destroy(&cipher->doneCondition);
+	pthread_cond_destroy(&cipher->jobCondition);
+	pthread_mutex_destroy(&cipher->mutex);
+	EVP_CIPHER_CTX_free(cipher->context);
+	bzero(cipher->key, kKeySize);
+	free(cipher);
+}
+
+const unsigned char* ChunkedCipherGetHeader(ChunkedCipher* cipher)
+{
+	return cipher->header;
+}
+
+NSUInteger ChunkedCipherGetChunkSize(ChunkedCipher* cipher)
+{
+	return cipher->chunkSize;
+}
+
+long ChunkedCipherProcess(ChunkedCipher* cipher, const void* input, NSUInteger inputLength, void* output, unsigned long long firstIndex, BOOL final)
+{
+	NSUInteger							inSize = (cipher->decrypt ? cipher->chunkSize + kChunkedCipherTagSize : cipher->chunkSize),
+										numChunks = inputLength / inSize;
+	BOOL								failed;
+	
+	if(final) {
+		//NOTE: The last chunk always holds less than a full chunk of plain data
+		if(cipher->decrypt && (inputLength - numChunks * inSize < kChunkedCipherTagSize))
+		return -1;
+		numChunks += 1;
+	}
+	else if(inputLength % inSize)
+	return -1;
+	if(numChunks == 0)
+	return 0;
+	
+	pthread_mutex_lock(&cipher->mutex);
+	cipher->input = input;
+	cipher->inputLength = inputLength;
+	cipher->output = output;
+	cipher->firstIndex = firstIndex;
+	cipher->final = final;
+	cipher->failed = NO;
+	cipher->doneChunks = 0;
+	cipher->nextChunk = 0;
+	cipher->numChunks = numChunks;
+	if((numChunks > 1) && cipher->numThreads)
+	pthread_cond_broadcast(&cipher->jobCondition);
+	_ProcessChunks(cipher, cipher->context);
+	while(cipher->doneChunks < cipher->numChunks)
+	pthread_cond_wait(&cipher->doneCondition, &cipher->mutex);
+	failed = cipher->failed;
+	cipher->numChunks = 0;
+	cipher->nextChunk = 0;
+	pthread_mutex_unlock(&cipher->mutex);
+	
+	if(failed)
+	return -1;
+	
+	return (cipher->decrypt ? inputLength - numChunks * kChunkedCipherTagSize : inputLength + numChunks * kChunkedCipherTagSize);
+}
+
+unsigned long long ChunkedCipherEncryptedLength(unsigned long long length, NSUInteger chunkSize)
+{
+	if(chunkSize == 0)
+	chunkSize = kChunkedCipherDefaultChunkSize;
+	
+	return kChunkedCipherHeaderSize + length + (length / chunkSize + 1) * kChunkedCipherTagSize;
+}
+
+unsigned long long ChunkedCipherEncryptedRangeForRange(unsigned long long offset, unsigned long long length, NSUInteger chunkSize, unsigned long long* encryptedLength, unsigned long long* firstIndex)
+{
+	unsigned long long					first,
+										last;
+	
+	if(chunkSize == 0)
+	chunkSize = kChunkedCipherDefaultChunkSize;
+	first = offset / chunkSize;
+	last = (length ? (offset + length - 1) / chunkSize : first);
+	if(encryptedLength)
+	*encryptedLength = (last - first + 1) * (chunkSize + kChunkedCipherTagSize);
+	if(firstIndex)
+	*firstIndex = first;
+	
+	return kChunkedCipherHeaderSize + first * (chunkSize + kChunkedCipherTagSize);
+}
@@ -0,0 +1,55 @@
+/*
+	This file is part of the PolKit library.
+	Copyright (C) 2008-2009 Pierre-Olivier Latour <info@pol-online.net>
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#import <Foundation/Foundation.h>
+
+/*
+Computes several digests of the same data in a single pass:
+- Data is copied into a small ring of recycled blocks and each algorithm consumes the blocks on its own thread, so the caller only pays for a memcpy()
+- Threads are only started once the first block is full, so small amounts of data are digested inline without any overhead
+*/
+
+enum {
+	kDigestPipelineAlgorithm_MD5 = (1 << 0),
+	kDigestPipelineAlgorithm_SHA256 = (1 << 1),
+	kDigestPipelineAlgorithm_XXH64 = (1 << 2) //Non-cryptographic but much faster
+};
+typedef NSUInteger DigestPipelineAlgorithms;
+
+typedef struct {
+	unsigned char						md5[16];
+	unsigned char						sha256[32];
+	unsigned char						xxh64[8]; //Big-endian (canonical representation)
+} DigestPipelineResults;
+
+typedef struct DigestPipeline DigestPipeline;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+DigestPipeline* DigestPipelineCreate(DigestPipelineAlgorithms algorithms, BOOL threaded); //Returns NULL if "algorithms" is 0
+BOOL DigestPipelineUpdate(DigestPipeline* pipeline, const void* bytes, NSUInteger length); //May block if the digest threads are behind
+BOOL DigestPipelineFinalize(DigestPipeline* pipeline, DigestPipelineResults* results); //Waits for the digest threads - Results of algorithms not computed are zeroed - The pipeline must be destroyed afterwards
+void DigestPipelineDestroy(DigestPipeline* pipeline); //Can be called without finalizing
+DigestPipelineAlgorithms DigestPipelineGetAlgorithms(DigestPipeline* pipeline);
+
+unsigned long long DigestPipelineXXH64(const void* bytes, NSUInteger length, unsigned long long seed);
+#ifdef __cplusplus
+}
+#endif
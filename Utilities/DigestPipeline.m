@@ -0,0 +1,454 @@
+/*
+	This file is part of the PolKit library.
+	Copyright (C) 2008-2009 Pierre-Olivier Latour <info@pol-online.net>
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#import <openssl/evp.h>
+#import <pthread.h>
+
+#import "DigestPipeline.h"
+
+#define kBlockSize						(256 * 1024)
+#define kBlockCount						8
+#define kMaxConsumers					3
+
+#define kPrime64_1						0x9E3779B185EBCA87ULL
+#define kPrime64_2						0xC2B2AE3D27D4EB4FULL
+#define kPrime64_3						0x165667B19E3779F9ULL
+#define kPrime64_4						0x85EBCA77C2B2AE63ULL
+#define kPrime64_5						0x27D4EB2F165667C5ULL
+
+#define ROTL64(__VALUE__, __COUNT__) (((__VALUE__) << (__COUNT__)) | ((__VALUE__) >> (64 - (__COUNT__))))
+
+typedef struct {
+	unsigned long long					totalLength;
+	uint64_t							v1,
+										v2,
+										v3,
+										v4;
+	unsigned char						buffer[32];
+	NSUInteger							bufferLength;
+} XXH64State;
+
+typedef struct {
+	DigestPipeline*						pipeline;
+	DigestPipelineAlgorithms			algorithm;
+	EVP_MD_CTX*							context;
+	XXH64State							state;
+	unsigned long long					consumed;
+	pthread_t							thread;
+} Consumer;
+
+struct DigestPipeline {
+	DigestPipelineAlgorithms			algorithms;
+	BOOL								threaded,
+										running,
+										finished,
+										cancelled,
+										failed;
+	pthread_mutex_t						mutex;
+	pthread_cond_t						dataCondition,
+										spaceCondition;
+	unsigned char*						blocks[kBlockCount];
+	NSUInteger							lengths[kBlockCount];
+	NSUInteger							fillLength;
+	unsigned long long					submitted;
+	NSUInteger							numConsumers;
+	Consumer							consumers[kMaxConsumers];
+};
+
+static inline uint64_t _Read64(const unsigned char* bytes)
+{
+	return (uint64_t)bytes[0] | ((uint64_t)bytes[1] << 8) | ((uint64_t)bytes[2] << 16) | ((uint64_t)bytes[3] << 24) | ((uint64_t)bytes[4] << 32) | ((uint64_t)bytes[5] << 40) | ((uint64_t)bytes[6] << 48) | ((uint64_t)bytes[7] << 56);
+}
+
+static inline uint64_t _Read32(const unsigned char* bytes)
+{
+	return (uint64_t)bytes[0] | ((uint64_t)bytes[1] << 8) | ((uint64_t)bytes[2] << 16) | ((uint64_t)bytes[3] << 24);
+}
+
+static inline uint64_t _XXH64Round(uint64_t accumulator, uint64_t input)
+{
+	accumulator += input * kPrime64_2;
+	accumulator = ROTL64(accumulator, 31);
+	
+	return accumulator * kPrime64_1;
+}
+
+static inline uint64_t _XXH64MergeRound(uint64_t accumulator, uint64_t value)
+{
+	accumulator ^= _XXH64Round(0, value);
+	
+	return accumulator * kPrime64_1 + kPrime64_4;
+}
+
+static void _XXH64Init(XXH64State* state, uint64_t seed)
+{
+	bzero(state, sizeof(XXH64State));
+	state->v1 = seed + kPrime64_1 + kPrime64_2;
+	state->v2 = seed + kPrime64_2;
+	state->v3 = seed;
+	state->v4 = seed - kPrime64_1;
+}
+
+static void _XXH64Update(XXH64State* state, const unsigned char* bytes, NSUInteger length)
+{
+	const unsigned char*				end = bytes + length;
+	NSUInteger							count;
+	
+	state->totalLength += length;
+	
+	if(state->bufferLength) {
+		count = MIN(32 - state->bufferLength, length);
+		bcopy(bytes, state->buffer + state->bufferLength, count);
+		state->bufferLength += count;
+		bytes += count;
+		if(state->bufferLength < 32)
+		return;
+		state->v1 = _XXH64Round(state->v1, _Read64(state->buffer));
+		state->v2 = _XXH64Round(state->v2, _Read64(state->buffer + 8));
+		state->v3 = _XXH64Round(state->v3, _Read64(state->buffer + 16));
+		state->v4 = _XXH64Round(state->v4, _Read64(state->buffer + 24));
+		state->bufferLength = 0;
+	}
+	
+	while(bytes + 32 <= end) {
+		state->v1 = _XXH64Round(state->v1, _Read64(bytes));
+		state->v2 = _XXH64Round(state->v2, _Read64(bytes + 8));
+		state->v3 = _XXH64Round(state->v3, _Read64(bytes + 16));
+		state->v4 = _XXH64Round(state->v4, _Read64(bytes + 24));
+		bytes += 32;
+	}
+	
+	if(bytes < end) {
+		bcopy(bytes, state->buffer, end - bytes);
+		state->bufferLength = end - bytes;
+	}
+}
+
+static uint64_t _XXH64Final(XXH64State* state)
+{
+	const unsigned char*				bytes = state->buffer;
+	const unsigned char*				end = state->buffer + state->bufferLength;
+	uint64_t							hash;
+	
+	if(state->totalLength >= 32) {
+		hash = ROTL64(state->v1, 1) + ROTL64(state->v2, 7) + ROTL64(state->v3, 12) + ROTL64(state->v4, 18);
+		hash = _XXH64MergeRound(hash, state->v1);
+		hash = _XXH64MergeRound(hash, state->v2);
+		hash = _XXH64MergeRound(hash, state->v3);
+		hash = _XXH64MergeRound(hash, state->v4);
+	}
+	else
+	hash = state->v3 + kPrime64_5; //NOTE: "v3" is still the seed
+	hash += state->totalLength;
+	
+	while(bytes + 8 <= end) {
+		hash ^= _XXH64Round(0, _Read64(bytes));
+		hash = ROTL64(hash, 27) * kPrime64_1 + kPrime64_4;
+		bytes += 8;
+	}
+	if(bytes + 4 <= end) {
+		hash ^= _Read32(bytes) * kPrime64_1;
+		hash = ROTL64(hash, 23) * kPrime64_2 + kPrime64_3;
+		bytes += 4;
+	}
+	while(bytes < end) {
+		hash ^= (*bytes) * kPrime64_5;
+		hash = ROTL64(hash, 11) * kPrime64_1;
+		bytes += 1;
+	}
+	
+	hash ^= hash >> 33;
+	hash *= kPrime64_2;
+	hash ^= hash >> 29;
+	hash *= kPrime64_3;
+	hash ^= hash >> 32;
+	
+	return hash;
+}
+
+unsigned long long DigestPipelineXXH64(const void* bytes, NSUInteger length, unsigned long long seed)
+{
+	XXH64State							state;
+	
+	_XXH64Init(&state, seed);
+	_XXH64Update(&state, bytes, length);
+	
+	return _XXH64Final(&state);
+}
+
+static BOOL _UpdateConsumer(Consumer* consumer, const unsigned char* bytes, NSUInteger length)
+{
+	if(consumer->context)
+	return (EVP_DigestUpdate(consumer->context, bytes, length) == 1 ? YES : NO);
+	
+	_XXH64Update(&consumer->state, bytes, length);
+	return YES;
+}
+
+/* Must be called with the mutex locked */
+static unsigned long long _MinimumConsumed(DigestPipeline* pipeline)
+{
+	unsigned long long					consumed = pipeline->submitted;
+	NSUInteger							i;
+	
+	for(i = 0; i < pipeline->numConsumers; ++i)
+	consumed = MIN(consumed, pipeline->consumers[i].consumed);
+	
+	return consumed;
+}
+
+static void* _ThreadEntryPoint(void* arg)
+{
+	Consumer*							consumer = (Consumer*)arg;
+	DigestPipeline*						pipeline = consumer->pipeline;
+	NSUInteger							slot;
+	BOOL								success;
+	
+	pthread_mutex_lock(&pipeline->mutex);
+	while(1) {
+		while(!pipeline->finished && (consumer->consumed == pipeline->submitted))
+		pthread_cond_wait(&pipeline->dataCondition, &pipeline->mutex);
+		if(pipeline->cancelled || (consumer->consumed == pipeline->submitted))
+		break;
+		slot = consumer->consumed % kBlockCount;
+		pthread_mutex_unlock(&pipeline->mutex);
+		success = _UpdateConsumer(consumer, pipeline->blocks[slot], pipeline->lengths[slot]);
+		pthread_mutex_lock(&pipeline->mutex);
+		if(!success)
+		pipeline->failed = YES;
+		consumer->consumed += 1;
+		pthread_cond_broadcast(&pipeline->spaceCondition);
+	}
+	pthread_mutex_unlock(&pipeline->mutex);
+	
+	return NULL;
+}
+
+/* Returns NO if the threads could not be started in which case the pipeline stays synchronous */
+static BOOL _StartThreads(DigestPipeline* pipeline)
+{
+	NSUInteger							i,
+										count;
+	int									error = 0;
+	
+	for(count = 0; count < pipeline->numConsumers; ++count) {
+		error = pthread_create(&pipeline->consumers[count].thread, NULL, _ThreadEntryPoint, &pipeline->consumers[count]);
+		if(error) {
+			NSLog(@"%s: pthread_create() failed with error \"%s\"", __FUNCTION__, strerror(error));
+			break;
+		}
+	}
+	
+	if(error) {
+		pthread_mutex_lock(&pipeline->mutex);
+		pipeline->finished = YES;
+		pthread_cond_broadcast(&pipeline->dataCondition);
+		pthread_mutex_unlock(&pipeline->mutex);
+		for(i = 0; i < count; ++i)
+		pthread_join(pipeline->consumers[i].thread, NULL);
+		pipeline->finished = NO;
+		pipeline->threaded = NO;
+		return NO;
+	}
+	
+	pipeline->running = YES;
+	return YES;
+}
+
+static void _StopThreads(DigestPipeline* pipeline, BOOL cancel)
+{
+	NSUInteger							i;
+	
+	pthread_mutex_lock(&pipeline->mutex);
+	pipeline->finished = YES;
+	pipeline->cancelled = cancel;
+	pthread_cond_broadcast(&pipeline->dataCondition);
+	pthread_mutex_unlock(&pipeline->mutex);
+	for(i = 0; i < pipeline->numConsumers; ++i)
+	pthread_join(pipeline->consumers[i].thread, NULL);
+	pipeline->running = NO;
+}
+
+/* Hands the block being filled to the consumers and waits for the next one to be available */
+static BOOL _SubmitBlock(DigestPipeline* pipeline)
+{
+	NSUInteger							slot = pipeline->submitted % kBlockCount,
+										i;
+	BOOL								success = YES;
+	
+	pipeline->lengths[slot] = pipeline->fillLength;
+	pipeline->fillLength = 0;
+	
+	if(pipeline->threaded && !pipeline->running)
+	_StartThreads(pipeline);
+	if(!pipeline->running) {
+		for(i = 0; i < pipeline->numConsumers; ++i) {
+			if(!_UpdateConsumer(&pipeline->consumers[i], pipeline->blocks[slot], pipeline->lengths[slot]))
+			success = NO;
+		}
+		return success;
+	}
+	
+	pthread_mutex_lock(&pipeline->mutex);
+	pipeline->submitted += 1;
+	pthread_cond_broadcast(&pipeline->dataCondition);
+	while(pipeline->submitted - _MinimumConsumed(pipeline) >= kBlockCount)
+	pthread_cond_wait(&pipeline->spaceCondition, &pipeline->mutex);
+	success = !pipeline->failed;
+	pthread_mutex_unlock(&pipeline->mutex);
+	
+	return success;
+}
+
+DigestPipeline* DigestPipelineCreate(DigestPipelineAlgorithms algorithms, BOOL threaded)
+{
+	DigestPipeline*						pipeline;
+	Consumer*							consumer;
+	const EVP_MD*						type;
+	NSUInteger							i;
+	
+	algorithms &= (kDigestPipelineAlgorithm_MD5 | kDigestPipelineAlgorithm_SHA256 | kDigestPipelineAlgorithm_XXH64);
+	if(algorithms == 0)
+	return NULL;
+	
+	pipeline = calloc(1, sizeof(DigestPipeline));
+	pipeline->algorithms = algorithms;
+	pipeline->threaded = threaded;
+	pthread_mutex_init(&pipeline->mutex, NULL);
+	pthread_cond_init(&pipeline->dataCondition, NULL);
+	pthread_cond_init(&pipeline->spaceCondition, NULL);
+	for(i = 0; i < kMaxConsumers; ++i) {
+		if(!(algorithms & (1 << i)))
+		continue;
+		consumer = &pipeline->consumers[pipeline->numConsumers++];
+		consumer->pipeline = pipeline;
+		consumer->algorithm = (1 << i);
+		if(consumer->algorithm == kDigestPipelineAlgorithm_XXH64) {
+			_XXH64Init(&consumer->state, 0);
+			continue;
+		}
+		type = (consumer->algorithm == kDigestPipelineAlgorithm_MD5 ? EVP_md5() : EVP_sha256());
+		consumer->context = EVP_MD_CTX_create();
+		if((consumer->context == NULL) || (EVP_DigestInit_ex(consumer->context, type, NULL) != 1)) {
+			DigestPipelineDestroy(pipeline);
+			return NULL;
+		}
+	}
+	for(i = 0; i < (threaded ? kBlockCount : 1); ++i) {
+		pipeline->blocks[i] = malloc(kBlockSize);
+		if(pipeline->blocks[i] == NULL) {
+			DigestPipelineDestroy(pipeline);
+			return NULL;
+		}
+	}
+	
+	return pipeline;
+}
+
+BOOL DigestPipelineUpdate(DigestPipeline* pipeline, const void* bytes, NSUInteger length)
+{
+	NSUInteger							count;
+	
+	while(length) {
+		count = MIN(kBlockSize - pipeline->fillLength, length);
+		bcopy(bytes, pipeline->blocks[pipeline->submitted % kBlockCount] + pipeline->fillLength, count);
+		pipeline->fillLength += count;
+		bytes = (const unsigned char*)bytes + count;
+		length -= count;
+		
+		if(pipeline->fillLength == kBlockSize) {
+			if(!_SubmitBlock(pipeline))
+			return NO;
+		}
+	}
+	
+	return YES;
+}
+
+BOOL DigestPipelineFinalize(DigestPipeline* pipeline, DigestPipelineResults* results)
+{
+	BOOL								success = YES;
+	Consumer*							consumer;
+	unsigned int						length;
+	uint64_t							hash;
+	NSUInteger							i,
+										j;
+	
+	bzero(results, sizeof(DigestPipelineResults));
+	
+	if(pipeline->fillLength && !_SubmitBlock(pipeline))
+	success = NO;
+	if(pipeline->running) {
+		_StopThreads(pipeline, NO);
+		if(pipeline->failed)
+		success = NO;
+	}
+	if(!success)
+	return NO;
+	
+	for(i = 0; i < pipeline->numConsumers; ++i) {
+		consumer = &pipeline->consumers[i];
+		switch(consumer->algorithm) {
+			
+			case kDigestPipelineAlgorithm_MD5:
+			if(EVP_DigestFinal_ex(consumer->context, results->md5, &length) != 1)
+			success = NO;
+			break;
+			
+			case kDigestPipelineAlgorithm_SHA256:
+			if(EVP_DigestFinal_ex(consumer->context, results->sha256, &length) != 1)
+			success = NO;
+			break;
+			
+			case kDigestPipelineAlgorithm_XXH64:
+			hash = _XXH64Final(&consumer->state);
+			for(j = 0; j < 8; ++j)
+			results->xxh64[7 - j] = (hash >> (j * 8)) & 0xFF;
+			break;
+			
+		}
+	}
+	
+	return success;
+}
+
+void DigestPipelineDestroy(DigestPipeline* pipeline)
+{
+	NSUInteger							i;
+	
+	if(pipeline == NULL)
+	return;
+	
+	if(pipeline->running)
+	_StopThreads(pipeline, YES);
+	pthread_cond_destroy(&pipeline->spaceCondition);
+	pthread_cond_destroy(&pipeline->dataCondition);
+	pthread_mutex_destroy(&pipeline->mutex);
+	for(i = 0; i < kBlockCount; ++i)
+	free(pipeline->blocks[i]);
+	for(i = 0; i < pipeline->numConsumers; ++i) {
+		if(pipeline->consumers[i].context)
+		EVP_MD_CTX_destroy(pipeline->consumers[i].context);
+	}
+	free(pipeline);
+}
+
+DigestPipelineAlgorithms DigestPipelineGetAlgorithms(DigestPipeline* pipeline)
+{
+	return pipeline->algorithms;
+}
@@ -0,0 +1,283 @@
+/*
+	This file is part of the PolKit library.
+	Copyright (C) 2008-2009 Pierre-Olivier Latour <info@pol-online.net>
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#import <sys/xattr.h>
+
+#import "DirectoryScanner.h"
+
+/*
+Usage: Benchmarks [-width 4] [-depth 4] [-files 16] [-xattrDensity 0.1] [-churn 0.05] [-seed 1] [-iterations 3] [-metadata YES] [-output path]
+Results are written as an XML property list to "output" or to stdout if not defined - Progress and errors go to stderr
+*/
+
+#define kDefaultWidth				4
+#define kDefaultDepth				4
+#define kDefaultFiles				16
+#define kDefaultXAttrDensity		0.1
+#define kDefaultChurn				0.05
+#define kDefaultSeed				1
+#define kDefaultIterations			3
+
+#define kXAttrName					"net.pol-online.benchmark"
+
+static double _RandomValue()
+{
+	return (double)random() / (double)0x7FFFFFFF;
+}
+
+static BOOL _WriteFile(NSString* path, double xattrDensity)
+{
+	char						buffer[256];
+	NSData*						data;
+	
+	snprintf(buffer, sizeof(buffer), "%li", random());
+	data = [[NSData alloc] initWithBytes:buffer length:((random() % 200) + 1)];
+	if(![data writeToFile:path atomically:NO]) {
+		[data release];
+		return NO;
+	}
+	[data release];
+	
+	if(_RandomValue() < xattrDensity) {
+		if(setxattr([path UTF8String], kXAttrName, buffer, strlen(buffer), 0, 0) != 0) {
+			NSLog(@"%s: setxattr() on \"%@\" failed with error \"%s\"", __FUNCTION__, path, strerror(errno));
+			return NO;
+		}
+	}
+	
+	return YES;
+}
+
+static BOOL _GenerateTree(NSString* path, NSUInteger width, NSUInteger depth, NSUInteger files, double xattrDensity, NSMutableArray* filePaths)
+{
+	NSAutoreleasePool*			localPool = [NSAutoreleasePool new];
+	BOOL						success = YES;
+	NSString*					subPath;
+	NSUInteger					i;
+	
+	if(![[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:NO attributes:nil error:NULL])
+	success = NO;
+	
+	for(i = 0; success && (i < files); ++i) {
+		subPath = [path stringByAppendingPathComponent:[NSString stringWithFormat:@"File-%lu.data", (unsigned long)i]];
+		if(_WriteFile(subPath, xattrDensity))
+		[filePaths addObject:subPath];
+		else
+		success = NO;
+	}
+	
+	if(depth > 0) {
+		for(i = 0; success && (i < width); ++i)
+		success = _GenerateTree([path stringByAppendingPathComponent:[NSString stringWithFormat:@"Folder-%lu", (unsigned long)i]], width, depth - 1, files, xattrDensity, filePaths);
+	}
+	
+	[localPool drain];
+	
+	return success;
+}
+
+/* Modifies, moves, deletes and adds the same number of files */
+static BOOL _ApplyChurn(NSMutableArray* filePaths, double churn, double xattrDensity)
+{
+	NSUInteger					count = (NSUInteger)((double)[filePaths count] * churn / 4.0),
+								i;
+	NSString*					path;
+	NSString*					newPath;
+	
+	for(i = 0; i < count; ++i) {
+		path = [filePaths objectAtIndex:(random() % [filePaths count])];
+		if(!_WriteFile(path, 0.0))
+		return NO;
+	}
+	
+	for(i = 0; i < count; ++i) {
+		path = [[filePaths objectAtIndex:(random() % [filePaths count])] retain];
+		newPath = [[path stringByDeletingPathExtension] stringByAppendingString:@"-moved.data"];
+		if(rename([path UTF8String], [newPath UTF8String]) != 0) {
+			NSLog(@"%s: rename() on \"%@\" failed with error \"%s\"", __FUNCTION__, path, strerror(errno));
+			[path release];
+			return NO;
+		}
+		[filePaths removeObject:path];
+		[filePaths addObject:newPath];
+		[path release];
+	}
+	
+	for(i = 0; i < count; ++i) {
+		path = [filePaths objectAtIndex:(random() % [filePaths count])];
+		if(unlink([path UTF8String]) != 0) {
+			NSLog(@"%s: unlink() on \"%@\" failed with error \"%s\"", __FUNCTION__, path, strerror(errno));
+			return NO;
+		}
+		[filePaths removeObject:path];
+	}
+	
+	for(i = 0; i < count; ++i) {
+		path = [[[filePaths objectAtIndex:(random() % [filePaths count])] stringByDeletingPathExtension] stringByAppendingFormat:@"-added-%lu.data", (unsigned long)i];
+		if(!_WriteFile(path, xattrDensity))
+		return NO;
+		[filePaths addObject:path];
+	}
+	
+	return YES;
+}
+
+static NSDictionary* _MakeResult(NSArray* times)
+{
+	NSArray*					sortedTimes = [times sortedArrayUsingSelector:@selector(compare:)];
+	
+	return [NSDictionary dictionaryWithObjectsAndKeys:times, @"times", [sortedTimes objectAtIndex:0], @"min", [sortedTimes objectAtIndex:([sortedTimes count] / 2)], @"median", [sortedTimes lastObject], @"max", nil];
+}
+
+int main(int argc, const char* argv[])
+{
+	NSAutoreleasePool*			localPool = [NSAutoreleasePool new];
+	NSUserDefaults*				defaults = [NSUserDefaults standardUserDefaults];
+	NSUInteger					width = ([defaults objectForKey:@"width"] ? [defaults integerForKey:@"width"] : kDefaultWidth),
+								depth = ([defaults objectForKey:@"depth"] ? [defaults integerForKey:@"depth"] : kDefaultDepth),
+								files = ([defaults objectForKey:@"files"] ? [defaults integerForKey:@"files"] : kDefaultFiles),
+								seed = ([defaults objectForKey:@"seed"] ? [defaults integerForKey:@"seed"] : kDefaultSeed),
+								iterations = ([defaults objectForKey:@"iterations"] ? MAX([defaults integerForKey:@"iterations"], 1) : kDefaultIterations);
+	double						xattrDensity = ([defaults objectForKey:@"xattrDensity"] ? [defaults doubleForKey:@"xattrDensity"] : kDefaultXAttrDensity),
+								churn = ([defaults objectForKey:@"churn"] ? [defaults doubleForKey:@"churn"] : kDefaultChurn);
+	BOOL						scanMetadata = ([defaults objectForKey:@"metadata"] ? [defaults boolForKey:@"metadata"] : YES);
+	NSString*					outputPath = [defaults stringForKey:@"output"];
+	NSString*					rootPath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSMutableArray*				filePaths = [NSMutableArray array];
+	NSMutableDictionary*		results = [NSMutableDictionary dictionary];
+	NSMutableDictionary*		benchmarks = [NSMutableDictionary dictionary];
+	NSMutableArray*				scanTimes = [NSMutableArray array];
+	NSMutableArray*				enumerateTimes = [NSMutableArray array];
+	NSMutableArray*				serializeTimes = [NSMutableArray array];
+	NSMutableArray*				deserializeTimes = [NSMutableArray array];
+	NSMutableArray*				compareTimes = [NSMutableArray array];
+	NSMutableArray*				compareMovesTimes = [NSMutableArray array];
+	NSDictionary*				changes = nil;
+	NSDictionary*				statistics = nil;
+	DirectoryScanner*			scanner = nil;
+	DirectoryScanner*			otherScanner;
+	NSData*						serializedData = nil;
+	CFAbsoluteTime				time;
+	NSUInteger					count,
+								i;
+	DirectoryItem*				item;
+	NSData*						data;
+	NSString*					error;
+	int							result = 1;
+	
+	srandom(seed);
+	fprintf(stderr, "Generating synthetic tree at \"%s\"...\n", [rootPath UTF8String]);
+	if(!_GenerateTree(rootPath, width, depth, files, xattrDensity, filePaths)) {
+		fprintf(stderr, "FAILED: Unable to generate synthetic tree\n");
+		goto Exit;
+	}
+	
+	for(i = 0; i < iterations; ++i) {
+		[scanner release];
+		scanner = [[DirectoryScanner alloc] initWithRootDirectory:rootPath scanMetadata:scanMetadata];
+		time = CFAbsoluteTimeGetCurrent();
+		if(![scanner scanRootDirectory]) {
+			fprintf(stderr, "FAILED: Unable to scan synthetic tree\n");
+			goto Exit;
+		}
+		[scanTimes addObject:[NSNumber numberWithDouble:(CFAbsoluteTimeGetCurrent() - time)]];
+		
+		count = 0;
+		time = CFAbsoluteTimeGetCurrent();
+		for(item in scanner)
+		count += 1;
+		[enumerateTimes addObject:[NSNumber numberWithDouble:(CFAbsoluteTimeGetCurrent() - time)]];
+		
+		time = CFAbsoluteTimeGetCurrent();
+		serializedData = [scanner serializedData];
+		[serializeTimes addObject:[NSNumber numberWithDouble:(CFAbsoluteTimeGetCurrent() - time)]];
+		
+		time = CFAbsoluteTimeGetCurrent();
+		otherScanner = [[DirectoryScanner alloc] initWithSerializedData:serializedData];
+		[deserializeTimes addObject:[NSNumber numberWithDouble:(CFAbsoluteTimeGetCurrent() - time)]];
+		if(otherScanner == nil) {
+			fprintf(stderr, "FAILED: Unable to deserialize scanner\n");
+			goto Exit;
+		}
+		[otherScanner release];
+	}
+	
+	otherScanner = [[DirectoryScanner alloc] initWithRootDirectory:rootPath scanMetadata:scanMetadata]; //NOTE: Collecting statistics has a cost so it is done in an extra untimed scan
+	[otherScanner setCollectStatistics:YES];
+	if(![otherScanner scanRootDirectory]) {
+		fprintf(stderr, "FAILED: Unable to scan synthetic tree\n");
+		[otherScanner release];
+		goto Exit;
+	}
+	statistics = [[[otherScanner lastStatistics] retain] autorelease];
+	[otherScanner release];
+	[results setObject:[NSNumber numberWithUnsignedInteger:[scanner numberOfDirectoryItems]] forKey:@"items"];
+	[results setObject:[NSNumber numberWithUnsignedInteger:[serializedData length]] forKey:@"serializedSize"];
+	
+	if(!_ApplyChurn(filePaths, churn, xattrDensity)) {
+		fprintf(stderr, "FAILED: Unable to apply churn to synthetic tree\n");
+		goto Exit;
+	}
+	
+	for(i = 0; i < 2 * iterations; ++i) {
+		otherScanner = [[DirectoryScanner alloc] initWithSerializedData:serializedData];
+		[otherScanner setRootDirectory:rootPath];
+		time = CFAbsoluteTimeGetCurrent();
+		changes = [otherScanner scanAndCompareRootDirectory:(i % 2 ? kDirectoryScannerOption_DetectMovedItems : 0)];
+		[(i % 2 ? compareMovesTimes : compareTimes) addObject:[NSNumber numberWithDouble:(CFAbsoluteTimeGetCurrent() - time)]];
+		[otherScanner release];
+		if(changes == nil) {
+			fprintf(stderr, "FAILED: Unable to compare synthetic tree\n");
+			goto Exit;
+		}
+	}
+	[results setObject:[NSNumber numberWithUnsignedInteger:[[changes objectForKey:kDirectoryScannerResultKey_MovedItems] count]] forKey:@"movedItems"];
+	
+	[benchmarks setObject:_MakeResult(scanTimes) forKey:@"scanRootDirectory"];
+	[benchmarks setObject:_MakeResult(enumerateTimes) forKey:@"enumeration"];
+	[benchmarks setObject:_MakeResult(serializeTimes) forKey:@"serializedData"];
+	[benchmarks setObject:_MakeResult(deserializeTimes) forKey:@"initWithSerializedData"];
+	[benchmarks setObject:_MakeResult(compareTimes) forKey:@"scanAndCompareRootDirectory"];
+	[benchmarks setObject:_MakeResult(compareMovesTimes) forKey:@"scanAndCompareRootDirectory.detectMovedItems"];
+	[results setObject:benchmarks forKey:@"benchmarks"];
+	if(statistics)
+	[results setObject:statistics forKey:@"scanStatistics"];
+	[results setObject:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithUnsignedInteger:width], @"width", [NSNumber numberWithUnsignedInteger:depth], @"depth", [NSNumber numberWithUnsignedInteger:files], @"files", [NSNumber numberWithDouble:xattrDensity], @"xattrDensity", [NSNumber numberWithDouble:churn], @"churn", [NSNumber numberWithUnsignedInteger:seed], @"seed", [NSNumber numberWithUnsignedInteger:iterations], @"iterations", [NSNumber numberWithBool:scanMetadata], @"metadata", nil] forKey:@"parameters"];
+	
+	data = [NSPropertyListSerialization dataFromPropertyList:results format:NSPropertyListXMLFormat_v1_0 errorDescription:&error];
+	if(data == nil) {
+		fprintf(stderr, "FAILED: Unable to serialize results (%s)\n", [error UTF8String]);
+		[error release];
+		goto Exit;
+	}
+	if(outputPath) {
+		if(![data writeToFile:outputPath atomically:YES]) {
+			fprintf(stderr, "FAILED: Unable to write results to \"%s\"\n", [outputPath UTF8String]);
+			goto Exit;
+		}
+	}
+	else
+	fwrite([data bytes], 1, [data length], stdout);
+	result = 0;
+	
+Exit:
+	[scanner release];
+	[[NSFileManager defaultManager] removeItemAtPath:rootPath error:NULL];
+	[localPool drain];
+	return result;
+}
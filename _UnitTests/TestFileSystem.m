@@ -32,6 +32,7 @@
 @interface UnitTests_FileSystem : UnitTest <DirectoryWatcherDelegate, DiskWatcherDelegate>
 {
 	BOOL					_didUpdate;
+	NSUInteger				_batchCount;
 }
 @end
 
@@ -52,6 +53,12 @@ static NSComparisonResult _SortFunction(NSString* path1, NSString* path2, void*
 	_didUpdate = YES;
 }
 
+- (void) directoryWatcher:(DirectoryWatcher*)watcher didUpdatePaths:(NSDictionary*)paths eventID:(FSEventStreamEventId)eventID
+{
+	AssertTrue([paths count], nil);
+	_batchCount += 1;
+}
+
 - (void) _update:(NSTimer*)timer
 {
 	NSString*				path = (NSString*)[timer userInfo];
@@ -87,6 +94,45 @@ static NSComparisonResult _SortFunction(NSString* path1, NSString* path2, void*
 	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:path error:&error], [error localizedDescription]);
 }
 
+- (void) _updateMultiple:(NSTimer*)timer
+{
+	NSString*				path = (NSString*)[timer userInfo];
+	NSUInteger				i;
+	
+	for(i = 0; i < 10; ++i)
+	AssertTrue([[NSData data] writeToFile:[path stringByAppendingPathComponent:[NSString stringWithFormat:@"File-%i", i]] atomically:NO], nil);
+}
+
+- (void) testDirectoryWatcher2
+{
+	NSString*				path = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	DirectoryWatcher*		watcher;
+	NSError*				error;
+	
+	AssertTrue([[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:NO attributes:nil error:&error], [error localizedDescription]);
+	
+	watcher = [[DirectoryWatcher alloc] initWithRootDirectory:path latency:0.0 lastEventID:0];
+	AssertNotNil(watcher, nil);
+	[watcher setDelegate:self];
+	[watcher setCoalescingInterval:1.0];
+	AssertEquals([watcher coalescingInterval], 1.0, nil);
+	
+	_didUpdate = NO;
+	_batchCount = 0;
+	[watcher startWatching];
+	AssertTrue([watcher isWatching], nil);
+	[NSTimer scheduledTimerWithTimeInterval:0.5 target:self selector:@selector(_updateMultiple:) userInfo:path repeats:NO];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:3.0]];
+	[watcher stopWatching];
+	AssertFalse(_didUpdate, nil);
+	AssertEquals(_batchCount, (NSUInteger)1, nil);
+	
+	[watcher setDelegate:nil];
+	[watcher release];
+	
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:path error:&error], [error localizedDescription]);
+}
+
 - (void) _testScanner:(BOOL)flag
 {
 	NSString*				path = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
@@ -337,6 +383,40 @@ static NSComparisonResult _SortFunction(NSString* path1, NSString* path2, void*
 	[self _testScanner:YES];
 }
 
+- (void) testScanner6
+{
+	DirectoryScanner*		scanner;
+	NSDictionary*			statistics;
+	
+	scanner = [[DirectoryScanner alloc] initWithRootDirectory:kDirectoryPath scanMetadata:YES];
+	AssertNotNil(scanner, nil);
+	AssertFalse([scanner collectStatistics], nil);
+	AssertNotNil([scanner scanRootDirectory], nil);
+	AssertNil([scanner lastStatistics], nil);
+	
+	[scanner setCollectStatistics:YES];
+	[scanner setSortPaths:YES];
+	AssertNotNil([scanner scanAndCompareRootDirectory:kDirectoryScannerOption_DetectMovedItems], nil);
+	statistics = [scanner lastStatistics];
+	AssertNotNil(statistics, nil);
+	AssertEquals([[statistics objectForKey:kDirectoryScannerStatisticsKey_Entries] unsignedIntegerValue], [scanner numberOfDirectoryItems], nil);
+	AssertTrue([[statistics objectForKey:kDirectoryScannerStatisticsKey_Directories] unsignedIntegerValue] > 0, nil);
+	AssertEquals([[[statistics objectForKey:kDirectoryScannerStatisticsKey_SystemCalls] objectForKey:@"lstat"] unsignedIntegerValue], [scanner numberOfDirectoryItems], nil);
+	AssertTrue([[[statistics objectForKey:kDirectoryScannerStatisticsKey_WallTimes] objectForKey:kDirectoryScannerPhase_Total] doubleValue] > 0.0, nil);
+	AssertTrue([[[statistics objectForKey:kDirectoryScannerStatisticsKey_WallTimes] objectForKey:kDirectoryScannerPhase_Compare] doubleValue] > 0.0, nil);
+	AssertTrue([[statistics objectForKey:kDirectoryScannerStatisticsKey_SlowestDirectories] count] > 0, nil);
+	
+	AssertNotNil([scanner compare:scanner options:0], nil);
+	AssertNotNil([scanner lastStatistics], nil);
+	AssertEquals([[[scanner lastStatistics] objectForKey:kDirectoryScannerStatisticsKey_Entries] unsignedIntegerValue], (NSUInteger)0, nil);
+	
+	[scanner setCollectStatistics:NO];
+	AssertNotNil([scanner scanRootDirectory], nil);
+	AssertNil([scanner lastStatistics], nil);
+	
+	[scanner release];
+}
+
 - (void) diskWatcherDidUpdateAvailability:(DiskWatcher*)watcher
 {
 	_didUpdate = YES;
@@ -18,11 +18,19 @@
 
 #import "UnitTesting.h"
 #import "FileTransferController.h"
+#import "FileTransferQueue.h"
+#import "ChunkedCipher.h"
+#import "DigestPipeline.h"
 #import "NSURL+Parameters.h"
 
 #define kTimeOut				30.0
 
-@interface UnitTests_FileTransferController : UnitTest <FileTransferControllerDelegate>
+@interface UnitTests_FileTransferController : UnitTest <FileTransferControllerDelegate, FileTransferQueueDelegate>
+{
+@private
+	NSUInteger					_completedItems;
+	NSUInteger					_abortLength;
+}
 @end
 
 @implementation UnitTests_FileTransferController
@@ -45,6 +53,18 @@
 	[self logMessage:@"[Error %i] %@\n%@", [error code], [error localizedDescription], [error userInfo]];
 }
 
+- (BOOL) fileTransferControllerShouldAbort:(FileTransferController*)controller
+{
+	return (_abortLength && ([controller currentLength] >= _abortLength));
+}
+
+- (void) fileTransferQueue:(FileTransferQueue*)queue didCompleteItem:(FileTransferItem*)item
+{
+	if([item state] != kFileTransferItemState_Succeeded)
+	[self logMessage:@"%@ failed: %@", item, [[item error] localizedDescription]];
+	_completedItems += 1;
+}
+
 - (void) _testURL:(NSURL*)url flag:(BOOL)flag
 {
 	NSAutoreleasePool*			pool = [NSAutoreleasePool new];
@@ -54,6 +74,7 @@
 	NSError*					error;
 	NSData*						sourceData;
 	NSData*						destinationData;
+	NSDictionary*				statistics;
 	
 	if(!url)
 	goto Exit;
@@ -188,6 +209,32 @@
 		}
 	}
 	
+	if([controller isKindOfClass:[HTTPTransferController class]]) {
+		[(HTTPTransferController*)controller setMaximumDownloadConnections:4];
+		[(HTTPTransferController*)controller setDownloadSegmentSize:(16 * 1024)];
+		AssertTrue([controller uploadFileFromPath:imagePath toPath:@"Test.jpg"], nil);
+		AssertTrue([controller downloadFileFromPath:@"Test.jpg" toPath:filePath], nil);
+		sourceData = [NSData dataWithContentsOfFile:imagePath];
+		destinationData = [NSData dataWithContentsOfFile:filePath];
+		AssertEquals([destinationData length], [sourceData length], nil);
+		if([destinationData length] == [sourceData length])
+		AssertTrue([destinationData isEqualToData:sourceData], nil);
+		AssertTrue([[NSFileManager defaultManager] removeItemAtPath:filePath error:&error], [error localizedDescription]);
+		[(HTTPTransferController*)controller setMaximumDownloadConnections:1];
+		
+		[HTTPTransferController resetHostLimiter];
+		[(HTTPTransferController*)controller setLimitsConcurrentRequestsPerHost:YES];
+		AssertTrue([controller downloadFileFromPathToNull:@"Test.jpg"], nil);
+		AssertTrue([controller downloadFileFromPathToNull:@"Test.jpg"], nil);
+		statistics = [HTTPTransferController hostLimiterStatistics];
+		AssertEquals([[statistics objectForKey:kHTTPHostLimiterStatisticsKey_Requests] unsignedIntegerValue], (NSUInteger)2, nil);
+		AssertEquals([[statistics objectForKey:kHTTPHostLimiterStatisticsKey_Failures] unsignedIntegerValue], (NSUInteger)0, nil);
+		[(HTTPTransferController*)controller setLimitsConcurrentRequestsPerHost:NO];
+		
+		if([controller respondsToSelector:@selector(deleteFileAtPath:)])
+		AssertTrue([controller deleteFileAtPath:@"Test.jpg"], nil);
+	}
+	
 	[controller setEncryptionPassword:@"info@pol-online.net"];
 	AssertTrue([controller uploadFileFromPath:imagePath toPath:@"Test.data"], nil);
 	AssertTrue([controller downloadFileFromPath:@"Test.data" toPath:filePath], nil);
@@ -256,6 +303,246 @@ Exit:
 	[self _testDigest:YES];
 }
 
+- (void) testMultipleDigests
+{
+	NSString*					fileName = [[NSProcessInfo processInfo] globallyUniqueString];
+	NSMutableData*				data = [NSMutableData dataWithLength:(3 * 1024 * 1024 + 1234)];
+	unsigned char*				bytes = [data mutableBytes];
+	FileTransferController*		controller;
+	NSDictionary*				digests;
+	unsigned long long			hash;
+	unsigned char				buffer[8];
+	NSUInteger					i;
+	const unsigned char			md5Abc[] = {0x90, 0x01, 0x50, 0x98, 0x3c, 0xd2, 0x4f, 0xb0, 0xd6, 0x96, 0x3f, 0x7d, 0x28, 0xe1, 0x7f, 0x72},
+								sha256Abc[] = {0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23, 0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad},
+								xxh64Abc[] = {0x44, 0xbc, 0x2c, 0xf5, 0xad, 0x77, 0x09, 0x99};
+	
+	for(i = 0; i < [data length]; ++i)
+	bytes[i] = (i * 7919) ^ (i >> 9);
+	hash = DigestPipelineXXH64(bytes, [data length], 0);
+	for(i = 0; i < 8; ++i)
+	buffer[7 - i] = (hash >> (i * 8)) & 0xFF;
+	
+	controller = [FileTransferController fileTransferControllerWithURL:[NSURL fileURLWithPath:@"/tmp"]];
+	AssertNotNil(controller, nil);
+	[controller setDigestComputation:YES];
+	[controller setDigestAlgorithms:(kFileTransferDigestAlgorithm_MD5 | kFileTransferDigestAlgorithm_SHA256 | kFileTransferDigestAlgorithm_XXH64)];
+	
+	AssertTrue([controller uploadFileFromData:data toPath:fileName], nil);
+	digests = [controller lastTransferDigests];
+	AssertEquals([digests count], (NSUInteger)3, nil);
+	AssertEqualObjects([controller lastTransferDigestData], [digests objectForKey:kFileTransferDigestKey_MD5], nil);
+	AssertEquals([[digests objectForKey:kFileTransferDigestKey_SHA256] length], (NSUInteger)32, nil);
+	AssertEqualObjects([digests objectForKey:kFileTransferDigestKey_XXH64], [NSData dataWithBytes:buffer length:8], nil);
+	
+	AssertEqualObjects([controller downloadFileFromPathToData:fileName], data, nil);
+	AssertEqualObjects([controller lastTransferDigests], digests, nil);
+	
+	[controller setDigestAlgorithms:kFileTransferDigestAlgorithm_XXH64];
+	AssertNotNil([controller downloadFileFromPathToData:fileName], nil);
+	AssertNil([controller lastTransferDigestData], nil);
+	AssertEqualObjects([[controller lastTransferDigests] objectForKey:kFileTransferDigestKey_XXH64], [NSData dataWithBytes:buffer length:8], nil);
+	
+	[controller setDigestComputation:NO];
+	AssertNotNil([controller downloadFileFromPathToData:fileName], nil);
+	AssertNil([controller lastTransferDigests], nil);
+	
+	AssertTrue([controller deleteFileAtPath:fileName], nil);
+	
+	AssertEquals(DigestPipelineXXH64("", 0, 0), 0xEF46DB3751D8E999ULL, nil);
+	AssertEquals(DigestPipelineXXH64("abc", 3, 0), 0x44BC2CF5AD770999ULL, nil);
+	
+	[controller setDigestComputation:YES];
+	[controller setDigestAlgorithms:(kFileTransferDigestAlgorithm_MD5 | kFileTransferDigestAlgorithm_SHA256 | kFileTransferDigestAlgorithm_XXH64)];
+	AssertTrue([controller uploadFileFromData:[NSData dataWithBytes:"abc" length:3] toPath:fileName], nil);
+	digests = [controller lastTransferDigests];
+	AssertEqualObjects([digests objectForKey:kFileTransferDigestKey_MD5], [NSData dataWithBytes:md5Abc length:sizeof(md5Abc)], nil);
+	AssertEqualObjects([digests objectForKey:kFileTransferDigestKey_SHA256], [NSData dataWithBytes:sha256Abc length:sizeof(sha256Abc)], nil);
+	AssertEqualObjects([digests objectForKey:kFileTransferDigestKey_XXH64], [NSData dataWithBytes:xxh64Abc length:sizeof(xxh64Abc)], nil);
+	AssertTrue([controller deleteFileAtPath:fileName], nil);
+}
+
+- (void) testPipelinedUpload
+{
+	NSString*					fileName = [[NSProcessInfo processInfo] globallyUniqueString];
+	NSMutableData*				data = [NSMutableData dataWithLength:(5 * 1024 * 1024 + 4321)];
+	unsigned char*				bytes = [data mutableBytes];
+	FileTransferController*		controller;
+	NSData*						digest;
+	NSArray*					statistics;
+	NSUInteger					i;
+	
+	for(i = 0; i < [data length]; ++i)
+	bytes[i] = (i * 7919) ^ (i >> 9);
+	
+	controller = [FileTransferController fileTransferControllerWithURL:[NSURL fileURLWithPath:@"/tmp"]];
+	AssertNotNil(controller, nil);
+	[controller setDigestComputation:YES];
+	
+	AssertTrue([controller uploadFileFromData:data toPath:fileName], nil);
+	AssertNil([controller lastUploadPipelineStatistics], nil);
+	digest = [controller lastTransferDigestData];
+	AssertNotNil(digest, nil);
+	
+	[controller setPipelinedUploads:YES];
+	for(i = 0; i < 3; ++i) {
+		[controller setEncryptionPassword:(i ? @"info@pol-online.net" : nil)];
+		[controller setEncryptionFormat:(i == 2 ? kFileTransferEncryptionFormat_Chunked : kFileTransferEncryptionFormat_CBC)];
+		
+		AssertTrue([controller uploadFileFromData:data toPath:fileName], nil);
+		AssertEqualObjects([controller lastTransferDigestData], digest, nil);
+		statistics = [controller lastUploadPipelineStatistics];
+		AssertEquals([statistics count], (NSUInteger)(i ? 3 : 2), nil);
+		AssertEqualObjects([[statistics objectAtIndex:0] objectForKey:kFileTransferPipelineStatisticsKey_Stage], @"read", nil);
+		AssertEqualObjects([[statistics lastObject] objectForKey:kFileTransferPipelineStatisticsKey_Stage], @"send", nil);
+		if(i)
+		AssertEqualObjects([[statistics objectAtIndex:1] objectForKey:kFileTransferPipelineStatisticsKey_Stage], @"encrypt", nil);
+		if(i)
+		AssertEquals([controller lastTransferSize], (NSUInteger)[FileTransferController encryptedLengthForLength:[data length] encryptionFormat:[controller encryptionFormat]], nil);
+		else
+		AssertEquals([controller lastTransferSize], [data length], nil);
+		
+		AssertEqualObjects([controller downloadFileFromPathToData:fileName], data, nil);
+		AssertEqualObjects([controller lastTransferDigestData], digest, nil);
+	}
+	[controller setEncryptionPassword:nil];
+	
+	AssertTrue([controller deleteFileAtPath:fileName], nil);
+}
+
+- (void) _testResumableTransfersWithURL:(NSURL*)url
+{
+	NSString*					fileName = [[NSProcessInfo processInfo] globallyUniqueString];
+	NSString*					localPath = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSString*					checkpointPath = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSMutableData*				data = [NSMutableData dataWithLength:(3 * 1024 * 1024 + 1234)];
+	unsigned char*				bytes = [data mutableBytes];
+	FileTransferController*		controller;
+	NSData*						digest;
+	NSUInteger					i;
+	
+	for(i = 0; i < [data length]; ++i)
+	bytes[i] = (i * 7919) ^ (i >> 9);
+	AssertTrue([[NSFileManager defaultManager] createDirectoryAtPath:checkpointPath withIntermediateDirectories:NO attributes:nil error:NULL], nil);
+	
+	controller = [FileTransferController fileTransferControllerWithURL:url];
+	AssertNotNil(controller, nil);
+	[controller setDelegate:self];
+	[controller setDigestComputation:YES];
+	[controller setCheckpointDirectory:checkpointPath];
+	
+	AssertTrue([controller uploadFileFromData:data toPath:fileName], nil);
+	digest = [controller lastTransferDigestData];
+	AssertNotNil(digest, nil);
+	
+	_abortLength = 1024 * 1024;
+	AssertFalse([controller downloadFileFromPath:fileName toPath:localPath], nil);
+	AssertEquals([[[NSFileManager defaultManager] contentsOfDirectoryAtPath:checkpointPath error:NULL] count], (NSUInteger)1, nil);
+	_abortLength = 0;
+	AssertTrue([controller downloadFileFromPath:fileName toPath:localPath], nil);
+	AssertTrue([controller lastTransferResumeOffset] > 0, nil);
+	AssertEquals([controller lastTransferSize], (NSUInteger)([data length] - [controller lastTransferResumeOffset]), nil);
+	AssertEqualObjects([controller lastTransferDigestData], digest, nil);
+	AssertEqualObjects([NSData dataWithContentsOfFile:localPath], data, nil);
+	AssertEquals([[[NSFileManager defaultManager] contentsOfDirectoryAtPath:checkpointPath error:NULL] count], (NSUInteger)0, nil);
+	AssertTrue([controller deleteFileAtPath:fileName], nil);
+	
+	_abortLength = 1024 * 1024;
+	AssertFalse([controller uploadFileFromPath:localPath toPath:fileName], nil);
+	AssertEquals([[[NSFileManager defaultManager] contentsOfDirectoryAtPath:checkpointPath error:NULL] count], (NSUInteger)1, nil);
+	_abortLength = 0;
+	AssertTrue([controller uploadFileFromPath:localPath toPath:fileName], nil);
+	AssertTrue([controller lastTransferResumeOffset] > 0, nil);
+	AssertEqualObjects([controller lastTransferDigestData], digest, nil);
+	AssertEqualObjects([controller downloadFileFromPathToData:fileName], data, nil);
+	AssertEquals([[[NSFileManager defaultManager] contentsOfDirectoryAtPath:checkpointPath error:NULL] count], (NSUInteger)0, nil);
+	
+	_abortLength = 1024 * 1024;
+	AssertFalse([controller downloadFileFromPath:fileName toPath:localPath], nil);
+	_abortLength = 0;
+	AssertTrue([controller uploadFileFromData:[data subdataWithRange:NSMakeRange(0, 2 * 1024 * 1024)] toPath:fileName], nil); //NOTE: Changes the size so the checkpoint is invalidated
+	AssertTrue([controller downloadFileFromPath:fileName toPath:localPath], nil);
+	AssertEquals([controller lastTransferResumeOffset], (unsigned long long)0, nil);
+	AssertEqualObjects([NSData dataWithContentsOfFile:localPath], [data subdataWithRange:NSMakeRange(0, 2 * 1024 * 1024)], nil);
+	AssertEquals([[[NSFileManager defaultManager] contentsOfDirectoryAtPath:checkpointPath error:NULL] count], (NSUInteger)0, nil);
+	
+	AssertTrue([data writeToFile:localPath atomically:NO], nil);
+	_abortLength = 1024 * 1024;
+	AssertFalse([controller uploadFileFromPath:localPath toPath:fileName], nil);
+	_abortLength = 0;
+	AssertTrue([controller uploadFileFromData:[NSMutableData dataWithLength:(1024 * 1024)] toPath:fileName], nil); //NOTE: Replaces the partial remote file with a different one
+	AssertTrue([controller uploadFileFromPath:localPath toPath:fileName], nil);
+	AssertEquals([controller lastTransferResumeOffset], (unsigned long long)0, nil);
+	AssertEqualObjects([controller downloadFileFromPathToData:fileName], data, nil);
+	AssertEquals([[[NSFileManager defaultManager] contentsOfDirectoryAtPath:checkpointPath error:NULL] count], (NSUInteger)0, nil);
+	
+	[controller setDelegate:nil];
+	AssertTrue([controller deleteFileAtPath:fileName], nil);
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:localPath error:NULL], nil);
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:checkpointPath error:NULL], nil);
+}
+
+- (void) testResumableTransfers
+{
+	[self _testResumableTransfersWithURL:[NSURL fileURLWithPath:@"/tmp"]];
+}
+
+- (void) testFTPResumableTransfers
+{
+	NSURL*						url;
+	
+	if((url = [self _testURLForProtocol:@"FTP"]))
+	[self _testResumableTransfersWithURL:url];
+}
+
+- (void) testSFTPResumableTransfers
+{
+	NSURL*						url;
+	
+	if((url = [self _testURLForProtocol:@"SFTP"]))
+	[self _testResumableTransfersWithURL:url];
+}
+
+- (void) testCompression
+{
+	NSString*					fileName = [[NSProcessInfo processInfo] globallyUniqueString];
+	NSMutableData*				data = [NSMutableData dataWithLength:(3 * 1024 * 1024 + 1234)];
+	unsigned char*				bytes = [data mutableBytes];
+	FileTransferController*		controller;
+	NSData*						digest;
+	NSUInteger					i;
+	
+	for(i = 0; i < [data length]; ++i)
+	bytes[i] = "PolKit"[(i / 64) % 6];
+	
+	controller = [FileTransferController fileTransferControllerWithURL:[NSURL fileURLWithPath:@"/tmp"]];
+	AssertNotNil(controller, nil);
+	[controller setDigestComputation:YES];
+	
+	AssertTrue([controller uploadFileFromData:data toPath:fileName], nil);
+	digest = [controller lastTransferDigestData];
+	AssertNotNil(digest, nil);
+	
+	for(i = 0; i < 8; ++i) {
+		[controller setCompressionFormat:(i % 2 ? kFileTransferCompressionFormat_Fast : kFileTransferCompressionFormat_GZip)];
+		[controller setEncryptionPassword:((i / 2) % 2 ? @"info@pol-online.net" : nil)];
+		[controller setEncryptionFormat:kFileTransferEncryptionFormat_Chunked];
+		[controller setPipelinedUploads:(i >= 4)];
+	
+		AssertTrue([controller uploadFileFromData:data toPath:fileName], nil);
+		AssertEqualObjects([controller lastTransferDigestData], digest, nil);
+		AssertTrue([controller lastTransferSize] < [data length] / 10, nil);
+	
+		AssertEqualObjects([controller downloadFileFromPathToData:fileName], data, nil);
+		AssertEqualObjects([controller lastTransferDigestData], digest, nil);
+	}
+	[controller setCompressionFormat:kFileTransferCompressionFormat_None];
+	[controller setEncryptionPassword:nil];
+	[controller setPipelinedUploads:NO];
+	
+	AssertTrue([controller deleteFileAtPath:fileName], nil);
+}
+
 - (void) testEncryption
 {
 	NSString*					imagePath = @"Resources/Image.jpg";
@@ -289,6 +576,74 @@ Exit:
 	[controller setDelegate:nil];
 }
 
+- (void) testChunkedEncryption
+{
+	NSString*					imagePath = @"Resources/Image.jpg";
+	NSString*					fileName = [[[NSProcessInfo processInfo] globallyUniqueString] stringByAppendingPathExtension:@"data"];
+	NSString*					tmpPath = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSData*						password = [@"info@pol-online.net" dataUsingEncoding:NSUTF8StringEncoding];
+	NSMutableData*				source = [NSMutableData dataWithContentsOfFile:imagePath];
+	FileTransferController*		controller;
+	NSMutableData*				data;
+	NSData*						digest;
+	ChunkedCipher*				cipher;
+	NSRange						range;
+	unsigned long long			index,
+								encryptedOffset,
+								encryptedLength;
+	NSMutableData*				buffer;
+	long						length;
+	
+	//Make sure the data spans several chunks and ends in the middle of one
+	while([source length] < 5 * kChunkedCipherDefaultChunkSize)
+	[source appendData:source];
+	[source setLength:([source length] - 1000)];
+	AssertTrue([source writeToFile:tmpPath atomically:YES], nil);
+	
+	controller = [FileTransferController fileTransferControllerWithURL:[NSURL fileURLWithPath:@"/tmp"]];
+	AssertNotNil(controller, nil);
+	[controller setDelegate:self];
+	[controller setDigestComputation:YES];
+	[controller setEncryptionPassword:@"info@pol-online.net"];
+	[controller setEncryptionFormat:kFileTransferEncryptionFormat_Chunked];
+	
+	AssertTrue([controller uploadFileFromPath:tmpPath toPath:fileName], nil);
+	digest = [controller lastTransferDigestData];
+	data = [NSMutableData dataWithContentsOfFile:[@"/tmp" stringByAppendingPathComponent:fileName]];
+	AssertEquals((unsigned long long)[data length], [FileTransferController encryptedLengthForLength:[source length] encryptionFormat:kFileTransferEncryptionFormat_Chunked], nil);
+	
+	AssertEqualObjects([controller downloadFileFromPathToData:fileName], source, nil);
+	AssertEqualObjects([controller lastTransferDigestData], digest, nil);
+	
+	//Decrypt a range in the middle of the data without the previous chunks
+	range = NSMakeRange(2 * kChunkedCipherDefaultChunkSize + 100, kChunkedCipherDefaultChunkSize);
+	encryptedOffset = ChunkedCipherEncryptedRangeForRange(range.location, range.length, kChunkedCipherDefaultChunkSize, &encryptedLength, &index);
+	AssertEquals(index, (unsigned long long)2, nil);
+	cipher = ChunkedCipherCreateDecryptor(password, [data bytes], 2);
+	AssertTrue(cipher != NULL, nil);
+	buffer = [NSMutableData dataWithLength:encryptedLength];
+	length = ChunkedCipherProcess(cipher, (const char*)[data bytes] + encryptedOffset, encryptedLength, [buffer mutableBytes], index, NO);
+	AssertEquals(length, (long)(2 * kChunkedCipherDefaultChunkSize), nil);
+	AssertEqualObjects([buffer subdataWithRange:NSMakeRange(range.location - index * kChunkedCipherDefaultChunkSize, range.length)], [source subdataWithRange:range], nil);
+	ChunkedCipherDestroy(cipher);
+	
+	//Tampered or truncated data must fail to decrypt
+	((char*)[data mutableBytes])[encryptedOffset + 10] ^= 0xFF;
+	AssertTrue([data writeToFile:[@"/tmp" stringByAppendingPathComponent:fileName] atomically:YES], nil);
+	AssertNil([controller downloadFileFromPathToData:fileName], nil);
+	((char*)[data mutableBytes])[encryptedOffset + 10] ^= 0xFF;
+	[data setLength:([data length] - 1000 - kChunkedCipherTagSize)];
+	AssertTrue([data writeToFile:[@"/tmp" stringByAppendingPathComponent:fileName] atomically:YES], nil);
+	AssertNil([controller downloadFileFromPathToData:fileName], nil);
+	
+	AssertTrue([controller deleteFileAtPath:fileName], nil);
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:tmpPath error:NULL], nil);
+	
+	[controller setEncryptionPassword:nil];
+	[controller setDigestComputation:NO];
+	[controller setDelegate:nil];
+}
+
 - (void) testLocal
 {
 	NSString*					path = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
@@ -299,6 +654,139 @@ Exit:
 	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:path error:&error], [error localizedDescription]);
 }
 
+- (void) testLocalCopyPermissions
+{
+	NSString*					path = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSData*						data = [NSData dataWithContentsOfFile:@"Resources/Image.jpg"];
+	FileTransferController*		controller;
+	NSDictionary*				attributes;
+	NSError*					error;
+	
+	AssertTrue([[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:NO attributes:nil error:&error], [error localizedDescription]);
+	controller = [FileTransferController fileTransferControllerWithURL:[NSURL fileURLWithPath:path]];
+	AssertNotNil(controller, nil);
+	AssertTrue([controller uploadFileFromData:data toPath:@"Test.jpg"], nil);
+	attributes = [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedShort:0741] forKey:NSFilePosixPermissions];
+	AssertTrue([[NSFileManager defaultManager] setAttributes:attributes ofItemAtPath:[path stringByAppendingPathComponent:@"Test.jpg"] error:&error], [error localizedDescription]);
+	
+	AssertTrue([controller copyPath:@"Test.jpg" toPath:@"Test-copy.jpg"], nil);
+	attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:[path stringByAppendingPathComponent:@"Test-copy.jpg"] error:&error];
+	AssertNotNil(attributes, [error localizedDescription]);
+	AssertEquals([[attributes objectForKey:NSFilePosixPermissions] unsignedShortValue], (unsigned short)0741, nil);
+	AssertEqualObjects([controller downloadFileFromPathToData:@"Test-copy.jpg"], data, nil);
+	
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:path error:&error], [error localizedDescription]);
+}
+
+- (void) testBandwidthClasses
+{
+	NSDictionary*				statistics;
+	
+	AssertEquals([FileTransferController weightForBandwidthClass:kFileTransferBandwidthClass_Interactive], (NSUInteger)16, nil);
+	AssertEquals([FileTransferController weightForBandwidthClass:kFileTransferBandwidthClass_Default], (NSUInteger)4, nil);
+	AssertEquals([FileTransferController weightForBandwidthClass:kFileTransferBandwidthClass_Background], (NSUInteger)1, nil);
+	[FileTransferController setWeight:0 forBandwidthClass:kFileTransferBandwidthClass_Background];
+	AssertEquals([FileTransferController weightForBandwidthClass:kFileTransferBandwidthClass_Background], (NSUInteger)1, nil);
+	
+	[FileTransferController setGlobalBandwidthBurstInterval:0.5];
+	AssertEquals([FileTransferController globalBandwidthBurstInterval], 0.5, nil);
+	[FileTransferController setGlobalBandwidthBurstInterval:0.25];
+	
+	statistics = [FileTransferController downloadBandwidthStatisticsForClass:kFileTransferBandwidthClass_Default];
+	AssertNotNil([statistics objectForKey:kFileTransferBandwidthStatisticsKey_Bytes], nil);
+	AssertNotNil([statistics objectForKey:kFileTransferBandwidthStatisticsKey_Rate], nil);
+	AssertEquals([[statistics objectForKey:kFileTransferBandwidthStatisticsKey_Transfers] intValue], 0, nil);
+	AssertNil([FileTransferController uploadBandwidthStatisticsForClass:3], nil);
+}
+
+- (void) testQueue
+{
+	NSString*					imagePath = @"Resources/Image.jpg";
+	NSString*					path = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSString*					tmpPath = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSURL*						url = [NSURL fileURLWithPath:path];
+	NSData*						data = [NSData dataWithContentsOfFile:imagePath];
+	FileTransferQueue*			queue;
+	FileTransferItem*			directory;
+	FileTransferItem*			item;
+	NSError*					error;
+	NSUInteger					i;
+	
+	AssertTrue([[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:NO attributes:nil error:&error], [error localizedDescription]);
+	AssertTrue([[NSFileManager defaultManager] createDirectoryAtPath:tmpPath withIntermediateDirectories:NO attributes:nil error:&error], [error localizedDescription]);
+	
+	queue = [[FileTransferQueue alloc] initWithMaximumConcurrentTransfers:4];
+	AssertNotNil(queue, nil);
+	[queue setDelegate:self];
+	_completedItems = 0;
+	directory = [queue addCreationOfDirectoryAtPath:@"Folder" baseURL:url];
+	AssertNotNil(directory, nil);
+	for(i = 0; i < 16; ++i) {
+		item = [queue addUploadFromPath:imagePath toPath:[NSString stringWithFormat:@"Folder/Image-%i.jpg", i] baseURL:url];
+		AssertNotNil(item, nil);
+		AssertTrue([[item dependencies] containsObject:directory], nil);
+	}
+	[queue start];
+	AssertTrue([queue waitUntilDone], nil);
+	AssertEquals(_completedItems, (NSUInteger)17, nil);
+	AssertEquals([queue numberOfFailedItems], (NSUInteger)0, nil);
+	AssertEquals([queue progress], (float)1.0, nil);
+	[queue release];
+	
+	queue = [[FileTransferQueue alloc] initWithMaximumConcurrentTransfers:4];
+	[queue setDelegate:self];
+	_completedItems = 0;
+	for(i = 0; i < 16; ++i)
+	[queue addDownloadFromPath:[NSString stringWithFormat:@"Folder/Image-%i.jpg", i] toPath:[tmpPath stringByAppendingPathComponent:[NSString stringWithFormat:@"Image-%i.jpg", i]] baseURL:url];
+	[queue addDeletionOfFileAtPath:@"Missing.jpg" baseURL:url];
+	[queue start];
+	AssertTrue([queue waitUntilDone], nil);
+	AssertEquals(_completedItems, (NSUInteger)17, nil);
+	[queue release];
+	for(i = 0; i < 16; ++i)
+	AssertEqualObjects([NSData dataWithContentsOfFile:[tmpPath stringByAppendingPathComponent:[NSString stringWithFormat:@"Image-%i.jpg", i]]], data, nil);
+	
+	queue = [[FileTransferQueue alloc] initWithMaximumConcurrentTransfers:2];
+	[queue setDelegate:self];
+	[queue setMaximumRetries:0];
+	directory = [queue addCreationOfDirectoryAtPath:@"Missing/Folder" baseURL:url];
+	item = [queue addUploadFromPath:imagePath toPath:@"Missing/Folder/Image.jpg" baseURL:url];
+	[queue start];
+	AssertFalse([queue waitUntilDone], nil);
+	AssertEquals([directory state], (FileTransferItemState)kFileTransferItemState_Failed, nil);
+	AssertEquals([item state], (FileTransferItemState)kFileTransferItemState_Failed, nil);
+	[queue release];
+	
+	queue = [[FileTransferQueue alloc] initWithMaximumConcurrentTransfers:2];
+	[queue setDelegate:self];
+	item = [queue addUploadFromPath:imagePath toPath:@"Missing/Image.jpg" baseURL:url];
+	[queue start];
+	AssertFalse([queue waitUntilDone], nil);
+	AssertEquals([item state], (FileTransferItemState)kFileTransferItemState_Failed, nil);
+	AssertEquals([item attempts], (NSUInteger)1, nil);
+	item = [queue addUploadFromPath:imagePath toPath:@"Image-Again.jpg" baseURL:url];
+	[queue start];
+	AssertTrue([queue waitUntilDone], nil);
+	AssertEquals([item state], (FileTransferItemState)kFileTransferItemState_Succeeded, nil);
+	AssertEquals([queue numberOfCompletedItems], (NSUInteger)1, nil);
+	[queue release];
+	
+	queue = [[FileTransferQueue alloc] initWithMaximumConcurrentTransfers:2];
+	[queue setDelegate:self];
+	AssertEquals([queue retryDelay], 1.0, nil);
+	directory = [[[FileTransferQueue new] autorelease] addCreationOfDirectoryAtPath:@"Other" baseURL:url];
+	item = [queue addUploadFromPath:imagePath toPath:@"Image.jpg" baseURL:url];
+	[item addDependency:directory];
+	[queue start];
+	AssertFalse([queue waitUntilDone], nil);
+	AssertEquals([item state], (FileTransferItemState)kFileTransferItemState_Failed, nil);
+	AssertTrue([[[item error] localizedDescription] rangeOfString:@"not in the queue"].location != NSNotFound, nil);
+	[queue release];
+	
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:tmpPath error:&error], [error localizedDescription]);
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:path error:&error], [error localizedDescription]);
+}
+
 - (void) testAFP
 {
 	NSURL*						url;
@@ -323,6 +811,302 @@ Exit:
 	[self _testURL:url flag:NO];
 }
 
+- (void) testSFTPPipelining
+{
+	NSString*					fileName = [[NSProcessInfo processInfo] globallyUniqueString];
+	NSMutableData*				data = [NSMutableData dataWithLength:(3 * 1024 * 1024 + 1234)];
+	unsigned char*				bytes = [data mutableBytes];
+	SFTPTransferController*		controller;
+	NSURL*						url;
+	NSUInteger					i;
+	
+	if(!(url = [self _testURLForProtocol:@"SFTP"]))
+	return;
+	
+	for(i = 0; i < [data length]; ++i)
+	bytes[i] = (i * 7919) ^ (i >> 9);
+	
+	controller = [[SFTPTransferController alloc] initWithBaseURL:url];
+	AssertNotNil(controller, nil);
+	AssertEquals([controller maximumPipelinedRequests], (NSUInteger)16, nil);
+	for(i = 0; i < 3; ++i) {
+		[controller setMaximumPipelinedRequests:(i == 0 ? 1 : (i == 1 ? 16 : 64))];
+		AssertTrue([controller uploadFileFromData:data toPath:fileName], nil);
+		AssertEquals([controller lastTransferSize], [data length], nil);
+		AssertEqualObjects([controller downloadFileFromPathToData:fileName], data, nil);
+	}
+	
+	AssertEquals([controller maximumReceiveWindow], (NSUInteger)(128 * 1024 * 1024), nil);
+	AssertTrue([controller receiveWindow] >= 600 * 65536, nil); //NOTE: Starts from the stock window
+	[controller setMaximumReceiveWindow:(256 * 1024)];
+	AssertEqualObjects([controller downloadFileFromPathToData:fileName], data, nil);
+	AssertTrue([controller receiveWindow] <= 256 * 1024, nil);
+	[controller setMaximumReceiveWindow:0];
+	AssertEqualObjects([controller downloadFileFromPathToData:fileName], data, nil);
+	AssertEquals([controller receiveWindow], (NSUInteger)0, nil);
+	[controller setInitialReceiveWindow:(64 * 1024)];
+	[controller setMaximumReceiveWindow:(16 * 1024 * 1024)];
+	AssertEqualObjects([controller downloadFileFromPathToData:fileName], data, nil);
+	AssertTrue([controller receiveWindow] > 64 * 1024, nil); //NOTE: A 64 KB window limits even a local link so it must grow
+	[controller setInitialReceiveWindow:0];
+	[controller setMaximumReceiveWindow:(128 * 1024 * 1024)];
+	
+	AssertTrue([controller deleteFileAtPath:fileName], nil);
+	[controller release];
+}
+
+- (void) testSFTPCompression
+{
+	NSString*					fileName = [[NSProcessInfo processInfo] globallyUniqueString];
+	NSMutableData*				data = [NSMutableData dataWithLength:(2 * 1024 * 1024)];
+	unsigned char*				bytes = [data mutableBytes];
+	SFTPTransferController*		controller;
+	NSURL*						url;
+	NSUInteger					i;
+	
+	if(!(url = [self _testURLForProtocol:@"SFTP"]))
+	return;
+	
+	for(i = 0; i < [data length]; ++i)
+	bytes[i] = "PolKit "[i % 7];
+	
+	controller = [[SFTPTransferController alloc] initWithBaseURL:url];
+	AssertNotNil(controller, nil);
+	AssertEquals([controller connectionCompressionLevel], (NSInteger)0, nil);
+	[controller setConnectionCompressionLevel:6];
+	AssertTrue([controller uploadFileFromData:data toPath:fileName], nil);
+	AssertTrue([controller connectionCompressionRatio] < 0.5, nil);
+	AssertEqualObjects([controller downloadFileFromPathToData:fileName], data, nil);
+	
+	for(i = 0; i < [data length]; ++i)
+	bytes[i] = random();
+	AssertTrue([controller uploadFileFromData:data toPath:fileName], nil);
+	AssertEqualObjects([controller downloadFileFromPathToData:fileName], data, nil);
+	
+	AssertTrue([controller deleteFileAtPath:fileName], nil);
+	[controller release];
+}
+
+- (void) testSFTPBatchTransfers
+{
+	NSString*					tmpPath = NSTemporaryDirectory();
+	NSMutableArray*				localPaths = [NSMutableArray array];
+	NSMutableArray*				remotePaths = [NSMutableArray array];
+	NSMutableArray*				downloadPaths = [NSMutableArray array];
+	NSMutableArray*				contents = [NSMutableArray array];
+	SFTPTransferController*		controller;
+	NSMutableData*				data;
+	NSString*					fileName;
+	NSURL*						url;
+	NSUInteger					i,
+								j;
+	
+	if(!(url = [self _testURLForProtocol:@"SFTP"]))
+	return;
+	
+	for(i = 0; i < 10; ++i) {
+		data = [NSMutableData dataWithLength:(i * 100 * 1024 + i)];
+		if([data length])
+		memset([data mutableBytes], 'A' + i, [data length]);
+		fileName = [[NSProcessInfo processInfo] globallyUniqueString];
+		AssertTrue([data writeToFile:[tmpPath stringByAppendingPathComponent:fileName] atomically:YES], nil);
+		[localPaths addObject:[tmpPath stringByAppendingPathComponent:fileName]];
+		[remotePaths addObject:fileName];
+		[downloadPaths addObject:[tmpPath stringByAppendingPathComponent:[fileName stringByAppendingPathExtension:@"download"]]];
+		[contents addObject:data];
+	}
+	
+	controller = [[SFTPTransferController alloc] initWithBaseURL:url];
+	AssertNotNil(controller, nil);
+	AssertEquals([controller maximumChannels], (NSUInteger)4, nil);
+	for(i = 0; i < 2; ++i) {
+		[controller setMaximumChannels:(i == 0 ? 1 : 4)];
+		AssertTrue([controller uploadFilesFromPaths:localPaths toPaths:remotePaths], nil);
+		AssertTrue([controller downloadFilesFromPaths:remotePaths toPaths:downloadPaths], nil);
+		for(j = 0; j < [downloadPaths count]; ++j)
+		AssertEqualObjects([NSData dataWithContentsOfFile:[downloadPaths objectAtIndex:j]], [contents objectAtIndex:j], nil);
+	}
+	
+	[controller setCompressionFormat:kFileTransferCompressionFormat_GZip];
+	AssertFalse([controller uploadFilesFromPaths:localPaths toPaths:remotePaths], nil);
+	[controller setCompressionFormat:kFileTransferCompressionFormat_None];
+	
+	for(i = 0; i < [remotePaths count]; ++i) {
+		AssertTrue([controller deleteFileAtPath:[remotePaths objectAtIndex:i]], nil);
+		AssertTrue([[NSFileManager defaultManager] removeItemAtPath:[localPaths objectAtIndex:i] error:NULL], nil);
+		AssertTrue([[NSFileManager defaultManager] removeItemAtPath:[downloadPaths objectAtIndex:i] error:NULL], nil);
+	}
+	[controller release];
+}
+
+- (void) testSFTPConnectionPool
+{
+	NSString*					fileName = [[NSProcessInfo processInfo] globallyUniqueString];
+	NSData*						data = [@"PolKit" dataUsingEncoding:NSUTF8StringEncoding];
+	SFTPTransferController*		controller;
+	NSDictionary*				statistics;
+	NSUInteger					leases,
+								returns;
+	NSURL*						url;
+	NSUInteger					i;
+	
+	if(!(url = [self _testURLForProtocol:@"SFTP"]))
+	return;
+	
+	[SFTPTransferController closePooledConnections];
+	statistics = [SFTPTransferController connectionPoolStatistics];
+	AssertEquals([[statistics objectForKey:kSFTPConnectionPoolStatisticsKey_Idle] unsignedIntegerValue], (NSUInteger)0, nil);
+	leases = [[statistics objectForKey:kSFTPConnectionPoolStatisticsKey_Leases] unsignedIntegerValue];
+	returns = [[statistics objectForKey:kSFTPConnectionPoolStatisticsKey_Returns] unsignedIntegerValue];
+	for(i = 0; i < 4; ++i) {
+		controller = [[SFTPTransferController alloc] initWithBaseURL:url];
+		AssertNotNil(controller, nil);
+		AssertTrue([controller reusesConnections], nil);
+		[controller setReusesConnections:(i < 3)];
+		if(i == 0)
+		AssertTrue([controller uploadFileFromData:data toPath:fileName], nil);
+		else
+		AssertEqualObjects([controller downloadFileFromPathToData:fileName], data, nil);
+		if(i == 3)
+		AssertTrue([controller deleteFileAtPath:fileName], nil);
+		[controller release];
+		AssertEquals([[[SFTPTransferController connectionPoolStatistics] objectForKey:kSFTPConnectionPoolStatisticsKey_Idle] unsignedIntegerValue], (NSUInteger)1, nil); //NOTE: The last controller does not reuse connections so it leaves the pooled one alone
+	}
+	statistics = [SFTPTransferController connectionPoolStatistics];
+	AssertEquals([[statistics objectForKey:kSFTPConnectionPoolStatisticsKey_Leases] unsignedIntegerValue], leases + 2, nil); //NOTE: The second and third controllers reuse the connection of the first one
+	AssertEquals([[statistics objectForKey:kSFTPConnectionPoolStatisticsKey_Returns] unsignedIntegerValue], returns + 3, nil);
+	[SFTPTransferController closePooledConnections];
+}
+
+- (void) testSFTPBatchAttributes
+{
+	NSString*					directoryName = [[NSProcessInfo processInfo] globallyUniqueString];
+	NSData*						data = [@"PolKit" dataUsingEncoding:NSUTF8StringEncoding];
+	NSMutableArray*				paths = [NSMutableArray array];
+	SFTPTransferController*		controller;
+	NSDictionary*				dictionary;
+	NSURL*						url;
+	NSUInteger					i;
+	
+	if(!(url = [self _testURLForProtocol:@"SFTP"]))
+	return;
+	
+	controller = [[SFTPTransferController alloc] initWithBaseURL:url];
+	AssertNotNil(controller, nil);
+	AssertTrue([controller createDirectoryAtPath:directoryName], nil);
+	for(i = 0; i < 200; ++i) {
+		[paths addObject:[directoryName stringByAppendingPathComponent:[NSString stringWithFormat:@"File %i", i]]];
+		AssertTrue([controller uploadFileFromData:data toPath:[paths lastObject]], nil);
+	}
+	
+	dictionary = [controller contentsOfDirectoryAtPath:directoryName];
+	AssertEquals([dictionary count], [paths count], nil);
+	AssertEqualObjects([[dictionary objectForKey:@"File 199"] objectForKey:NSFileSize], [NSNumber numberWithUnsignedInteger:[data length]], nil);
+	
+	[paths addObject:[directoryName stringByAppendingPathComponent:@"Missing"]];
+	[paths addObject:directoryName];
+	dictionary = [controller attributesOfItemsAtPaths:paths];
+	AssertEquals([dictionary count], [paths count] - 1, nil);
+	AssertNil([dictionary objectForKey:[directoryName stringByAppendingPathComponent:@"Missing"]], nil);
+	AssertEqualObjects([[dictionary objectForKey:directoryName] objectForKey:NSFileType], NSFileTypeDirectory, nil);
+	AssertEqualObjects([[dictionary objectForKey:[paths objectAtIndex:0]] objectForKey:NSFileSize], [NSNumber numberWithUnsignedInteger:[data length]], nil);
+	
+	for(i = 0; i < 200; ++i)
+	AssertTrue([controller deleteFileAtPath:[paths objectAtIndex:i]], nil);
+	AssertTrue([controller deleteDirectoryAtPath:directoryName], nil);
+	[controller release];
+}
+
+- (void) testSFTPTransferLoop
+{
+	NSString*					tmpPath = NSTemporaryDirectory();
+	NSData*						data = [NSMutableData dataWithLength:(512 * 1024)];
+	NSMutableArray*				controllers = [NSMutableArray array];
+	NSMutableArray*				remotePaths = [NSMutableArray array];
+	NSString*					localPath = [tmpPath stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	SFTPTransferController*		controller;
+	SFTPTransferLoop*			loop;
+	NSURL*						url;
+	NSUInteger					i;
+	
+	if(!(url = [self _testURLForProtocol:@"SFTP"]))
+	return;
+	
+	AssertTrue([data writeToFile:localPath atomically:YES], nil);
+	for(i = 0; i < 3; ++i) {
+		controller = [[SFTPTransferController alloc] initWithBaseURL:url];
+		AssertNotNil(controller, nil);
+		[controllers addObject:controller];
+		[controller release];
+	}
+	
+	loop = [SFTPTransferLoop new];
+	AssertFalse([loop addUploadFromPath:localPath toPath:@"" controller:[controllers objectAtIndex:0]], nil);
+	for(i = 0; i < 12; ++i) {
+		[remotePaths addObject:[[NSProcessInfo processInfo] globallyUniqueString]];
+		AssertTrue([loop addUploadFromPath:localPath toPath:[remotePaths lastObject] controller:[controllers objectAtIndex:(i % 3)]], nil);
+	}
+	AssertTrue([loop run], nil);
+	AssertNil([loop error], nil);
+	
+	for(i = 0; i < 12; ++i)
+	AssertTrue([loop addDownloadFromPath:[remotePaths objectAtIndex:i] toPath:[localPath stringByAppendingFormat:@"-%i", i] controller:[controllers objectAtIndex:(i % 3)]], nil);
+	AssertTrue([loop addDownloadFromPath:@"Missing" toPath:[localPath stringByAppendingString:@"-missing"] controller:[controllers objectAtIndex:0]], nil);
+	AssertFalse([loop run], nil);
+	AssertNotNil([loop error], nil);
+	[loop release];
+	
+	for(i = 0; i < 12; ++i) {
+		AssertEqualObjects([NSData dataWithContentsOfFile:[localPath stringByAppendingFormat:@"-%i", i]], data, nil);
+		AssertTrue([[controllers objectAtIndex:(i % 3)] deleteFileAtPath:[remotePaths objectAtIndex:i]], nil);
+		AssertTrue([[NSFileManager defaultManager] removeItemAtPath:[localPath stringByAppendingFormat:@"-%i", i] error:NULL], nil);
+	}
+	AssertFalse([[NSFileManager defaultManager] fileExistsAtPath:[localPath stringByAppendingString:@"-missing"]], nil);
+	
+	[[controllers objectAtIndex:0] setEncryptionPassword:@"info@pol-online.net"];
+	loop = [SFTPTransferLoop new];
+	AssertFalse([loop addUploadFromPath:localPath toPath:[remotePaths objectAtIndex:0] controller:[controllers objectAtIndex:0]], nil);
+	[loop release];
+	AssertTrue([[NSFileManager defaultManager] removeItemAtPath:localPath error:NULL], nil);
+}
+
+- (void) testSFTPOverSCP
+{
+	NSString*					fileName = [[NSProcessInfo processInfo] globallyUniqueString];
+	NSMutableData*				data = [NSMutableData dataWithLength:(2 * 1024 * 1024 + 1234)];
+	unsigned char*				bytes = [data mutableBytes];
+	SFTPTransferController*		controller;
+	NSURL*						url;
+	NSUInteger					i;
+	
+	if(!(url = [self _testURLForProtocol:@"SFTP"]))
+	return;
+	
+	for(i = 0; i < [data length]; ++i)
+	bytes[i] = (i * 7919) ^ (i >> 9);
+	
+	controller = [[SFTPTransferController alloc] initWithBaseURL:url];
+	AssertNotNil(controller, nil);
+	AssertEquals([controller transferProtocol], (SFTPTransferProtocol)kSFTPTransferProtocol_SFTP, nil);
+	AssertEquals([controller scpThreshold], (unsigned long long)(16 * 1024 * 1024), nil);
+	
+	[controller setTransferProtocol:kSFTPTransferProtocol_SCP];
+	AssertTrue([controller uploadFileFromData:data toPath:fileName], nil);
+	AssertEqualObjects([controller downloadFileFromPathToData:fileName], data, nil);
+	
+	[controller setTransferProtocol:kSFTPTransferProtocol_Automatic];
+	[controller setScpThreshold:(1024 * 1024)];
+	[controller setDigestComputation:YES];
+	AssertTrue([controller uploadFileFromData:data toPath:fileName], nil);
+	AssertNotNil([controller lastTransferDigestData], nil);
+	AssertEqualObjects([controller downloadFileFromPathToData:fileName], data, nil);
+	[controller setScpThreshold:([data length] + 1)];
+	AssertEqualObjects([controller downloadFileFromPathToData:fileName], data, nil);
+	
+	AssertTrue([controller deleteFileAtPath:fileName], nil);
+	[controller release];
+}
+
 - (void) testFTP
 {
 	NSURL*						url;
@@ -370,9 +1154,14 @@ Exit:
 - (void) _testAmazonS3:(BOOL)secure
 {
 	NSString*					imagePath = @"Resources/Image.jpg";
+	NSString*					filePath = [@"/tmp" stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
 	AmazonS3TransferController*	controller;
 	NSURL*						url;
 	NSString*					name;
+	NSMutableData*				data;
+	NSData*						digestData;
+	NSError*					error;
+	NSUInteger					i;
 	
 	if((url = [self _testURLForProtocol:(secure ? @"SecureAmazonS3" : @"AmazonS3")])) {
 		controller = [[(secure ? [SecureAmazonS3TransferController class] : [AmazonS3TransferController class]) alloc] initWithAccessKeyID:[url user] secretAccessKey:[url passwordByReplacingPercentEscapes] bucket:nil];
@@ -415,6 +1204,28 @@ Exit:
 		AssertTrue([controller copyPath:@"Test.jpg" toPath:@"Test-copy.jpg"], nil);
 		AssertTrue([controller deleteFileAtPath:@"Test-copy.jpg"], nil);
 		AssertTrue([controller deleteFileAtPath:@"Test.jpg"], nil);
+		[controller setCompressionFormat:kFileTransferCompressionFormat_GZip];
+		AssertFalse([controller uploadFileFromPath:imagePath toPath:@"Test.jpg.gz"], nil);
+		[controller setCompressionFormat:kFileTransferCompressionFormat_None];
+		
+		data = [NSMutableData dataWithLength:(12 * 1024 * 1024)];
+		for(i = 0; i < [data length] / sizeof(long); ++i)
+		((long*)[data mutableBytes])[i] = random();
+		AssertTrue([data writeToFile:filePath atomically:NO], nil);
+		[controller setDigestComputation:YES];
+		[controller setMaximumUploadConnections:3];
+		[controller setMultipartUploadPartSize:(5 * 1024 * 1024)];
+		AssertTrue([controller uploadFileFromPath:filePath toPath:@"Test.data"], nil);
+		AssertEquals([controller lastTransferSize], [data length], nil);
+		digestData = [controller lastTransferDigestData];
+		AssertNotNil(digestData, nil);
+		AssertTrue([[NSFileManager defaultManager] removeItemAtPath:filePath error:&error], [error localizedDescription]);
+		AssertTrue([controller downloadFileFromPath:@"Test.data" toPath:filePath], nil);
+		AssertEqualObjects([controller lastTransferDigestData], digestData, nil);
+		AssertEqualObjects([NSData dataWithContentsOfFile:filePath], data, nil);
+		AssertTrue([[NSFileManager defaultManager] removeItemAtPath:filePath error:&error], [error localizedDescription]);
+		AssertTrue([controller deleteFileAtPath:@"Test.data"], nil);
+		[controller setDigestComputation:NO];
 		[controller release];
 	}
 }